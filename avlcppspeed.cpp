@@ -0,0 +1,176 @@
+
+#include <cstdio>
+#include <cassert>
+#include <cstdlib>
+#include <cinttypes>
+#include <ctime>
+#include <set>
+#include <vector>
+
+#include <boost/intrusive/avltree.hpp>
+
+#include "inline_avl.hpp"
+
+/*
+ * avl::tree against boost::intrusive::avltree, both intrusive, and against
+ * std::set<int>, which allocates a node per key. Each adds, finds and
+ * removes the same distinct keys in its own random order.
+ */
+
+static inline unsigned
+xorshift32(unsigned *const p_rng)
+{
+    unsigned x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return x;
+}
+
+static inline uint64_t
+elapsed_ns(struct timespec const *const start, struct timespec const *const end)
+{
+    return (end->tv_sec - start->tv_sec)*UINT64_C(1000000000) + (end->tv_nsec - start->tv_nsec);
+}
+
+struct by_key {
+    using is_transparent = void;
+
+    template <class L, class R>
+    bool operator()(L const &l, R const &r) const { return key(l) < key(r); }
+
+    template <class O>
+    static int key(O const &o) { return o.key; }
+    static int key(int const k) { return k; }
+};
+
+struct item {
+    int key;
+    e_avl_node link;
+};
+
+namespace bi = boost::intrusive;
+
+struct bitem {
+    int key;
+    bi::avl_set_member_hook<bi::link_mode<bi::normal_link>> link;
+};
+
+using btree_t = bi::avltree<bitem,
+      bi::member_hook<bitem, decltype(bitem::link), &bitem::link>,
+      bi::compare<by_key>>;
+
+#define N_PHASES 3
+
+static void
+shuffle(std::vector<int> &order, unsigned *const p_rng)
+{
+    for (size_t i = order.size() - 1; i > 0; --i) {
+        size_t const j = xorshift32(p_rng) % (i + 1);
+        int const tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+}
+
+// Times `step(phase, i)` over every index, once per phase
+template <class Step>
+static void
+run(std::vector<int> &order, unsigned *const p_rng, uint64_t ns[N_PHASES], Step const step)
+{
+    struct timespec start, end;
+    for (int phase = 0; phase < N_PHASES; ++phase) {
+        shuffle(order, p_rng);
+        clock_gettime(CLOCK_REALTIME, &start);
+        for (int const i : order) {
+            step(phase, i);
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        ns[phase] = elapsed_ns(&start, &end);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t const n_objs = (argc > 1) ? strtoull(argv[1], NULL, 0) : (1u << 20);
+    if (n_objs == 0 || n_objs > (1u << 31)) {
+        fprintf(stderr, "avlcppspeed: between 1 and 2^31 nodes\n");
+        return 1;
+    }
+    printf("NUM_OBJS %zu\n", n_objs);
+    printf("Object size: %zu bytes, boost %zu bytes\n", sizeof(item), sizeof(bitem));
+
+    unsigned rng = time(NULL);
+    std::vector<int> order(n_objs);
+    std::vector<int> keys(n_objs);
+    for (size_t i = 0; i < n_objs; ++i) {
+        order[i] = (int)i;
+        keys[i] = (int)((i * 0x9e3779b1u) & 0x7fffffffu);
+    }
+
+    uint64_t ns[3][N_PHASES];
+
+    {
+        std::vector<item> objs(n_objs);
+        for (size_t i = 0; i < n_objs; ++i) {
+            objs[i].key = keys[i];
+        }
+        avl::tree<item, &item::link, by_key> tree;
+        run(order, &rng, ns[0], [&](int const phase, int const i) {
+            if (phase == 0) {
+                (void)tree.insert(objs[i]);
+            } else if (phase == 1) {
+                assert(&*tree.find(keys[i]) == &objs[i]);
+                (void)tree.find(keys[i]);
+            } else {
+                (void)tree.erase(keys[i]);
+            }
+        });
+        assert(tree.empty());
+    }
+
+    {
+        std::vector<bitem> objs(n_objs);
+        for (size_t i = 0; i < n_objs; ++i) {
+            objs[i].key = keys[i];
+        }
+        btree_t tree;
+        run(order, &rng, ns[1], [&](int const phase, int const i) {
+            if (phase == 0) {
+                (void)tree.insert_unique(objs[i]);
+            } else if (phase == 1) {
+                assert(&*tree.find(keys[i], by_key()) == &objs[i]);
+                (void)tree.find(keys[i], by_key());
+            } else {
+                (void)tree.erase(keys[i], by_key());
+            }
+        });
+        assert(tree.empty());
+    }
+
+    {
+        std::set<int> tree;
+        run(order, &rng, ns[2], [&](int const phase, int const i) {
+            if (phase == 0) {
+                (void)tree.insert(keys[i]);
+            } else if (phase == 1) {
+                assert(*tree.find(keys[i]) == keys[i]);
+                (void)tree.find(keys[i]);
+            } else {
+                (void)tree.erase(keys[i]);
+            }
+        });
+        assert(tree.empty());
+    }
+
+    char const *const names[N_PHASES] = { "add", "find", "remove" };
+    for (int phase = 0; phase < N_PHASES; ++phase) {
+        printf("Average time to %s a node: %f nanoseconds, boost %f nanoseconds, std::set %f nanoseconds\n",
+                names[phase], 1.0 * ns[0][phase] / n_objs, 1.0 * ns[1][phase] / n_objs,
+                1.0 * ns[2][phase] / n_objs);
+    }
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 
 #include "avlhelper.h"
+#include "inline_avl_setops.h"
 
 __attribute__((pure))
 static inline int
@@ -40,6 +41,23 @@ avl_my_add(avl_tree_t *const tree, my_t *const t)
     return (void *)((unsigned char *)o - offsetof(my_t, ok));
 }
 
+__attribute__((flatten))
+size_t
+avl_my_add_sorted_batch(avl_tree_t *const tree, my_t *const objs[], size_t const n)
+{
+    void *stack[90];
+    e_avl_node *nodes[256];
+    size_t added = 0;
+    for (size_t i = 0; i < n; i += 256) {
+        size_t const chunk = (n - i < 256) ? n - i : 256;
+        for (size_t j = 0; j < chunk; ++j) {
+            nodes[j] = &objs[i + j]->ok;
+        }
+        added += avl_base_add_sorted_batch(tree, nodes, chunk, mycmp, stack);
+    }
+    return added;
+}
+
 __attribute__((flatten))
 my_t *
 avl_my_get(avl_tree_t const*const tree, int const key)
@@ -55,6 +73,25 @@ avl_my_get(avl_tree_t const*const tree, int const key)
     }
 }
 
+__attribute__((flatten))
+void
+avl_my_get_batch(avl_tree_t const*const tree, int const keys[], size_t const n, my_t *out[])
+{
+    // An array of `int` has the same layout as an array of `myk_t`
+    e_avl_node *nodes[256];
+    for (size_t i = 0; i < n; i += 256) {
+        size_t const chunk = (n - i < 256) ? n - i : 256;
+        avl_base_get_batch(tree, &keys[i], sizeof(*keys), chunk, nodes, mykeycmp);
+        for (size_t j = 0; j < chunk; ++j) {
+            if (nodes[j] == NULL) {
+                out[i + j] = NULL;
+            } else {
+                out[i + j] = (void *)((unsigned char *)nodes[j] - offsetof(my_t, ok));
+            }
+        }
+    }
+}
+
 __attribute__((flatten))
 my_t *
 avl_my_rem(avl_tree_t *const tree, int const key)
@@ -71,3 +108,322 @@ avl_my_rem(avl_tree_t *const tree, int const key)
     }
 }
 
+
+__attribute__((flatten))
+my_t *
+avl_my_seek(avl_iter_t *const iter, int const key)
+{
+    myk_t const k = {
+        .my_key = key,
+    };
+    e_avl_node *const o = avl_iter_seek(iter, &k, mykeycmp);
+    if (o == NULL) {
+        return NULL;
+    } else {
+        return (void *)((unsigned char *)o - offsetof(my_t, ok));
+    }
+}
+
+__attribute__((flatten))
+my_t *
+avl_my_seek_near(avl_iter_t *const iter, int const key)
+{
+    myk_t const k = {
+        .my_key = key,
+    };
+    e_avl_node *const o = avl_iter_seek_near(iter, &k, mykeycmp);
+    if (o == NULL) {
+        return NULL;
+    } else {
+        return (void *)((unsigned char *)o - offsetof(my_t, ok));
+    }
+}
+
+__attribute__((flatten))
+my_t *
+avl_my_add_near(avl_tree_t *const tree, avl_iter_t *const finger, my_t *const t)
+{
+    e_avl_node *const o = avl_base_add_near(tree, finger, &t->ok, mycmp);
+    return (void *)((unsigned char *)o - offsetof(my_t, ok));
+}
+
+__attribute__((flatten))
+my_t *
+avl_my_lower_bound(avl_tree_t const*const tree, int const key)
+{
+    myk_t const k = {
+        .my_key = key,
+    };
+    e_avl_node *const o = avl_base_lower_bound(tree, &k, mykeycmp);
+    if (o == NULL) {
+        return NULL;
+    } else {
+        return (void *)((unsigned char *)o - offsetof(my_t, ok));
+    }
+}
+
+__attribute__((flatten))
+my_t *
+avl_my_upper_bound(avl_tree_t const*const tree, int const key)
+{
+    myk_t const k = {
+        .my_key = key,
+    };
+    e_avl_node *const o = avl_base_upper_bound(tree, &k, mykeycmp);
+    if (o == NULL) {
+        return NULL;
+    } else {
+        return (void *)((unsigned char *)o - offsetof(my_t, ok));
+    }
+}
+
+__attribute__((flatten))
+my_t *
+avl_my_floor(avl_tree_t const*const tree, int const key)
+{
+    myk_t const k = {
+        .my_key = key,
+    };
+    e_avl_node *const o = avl_base_floor(tree, &k, mykeycmp);
+    if (o == NULL) {
+        return NULL;
+    } else {
+        return (void *)((unsigned char *)o - offsetof(my_t, ok));
+    }
+}
+
+__attribute__((flatten))
+my_t *
+avl_my_ceil(avl_tree_t const*const tree, int const key)
+{
+    myk_t const k = {
+        .my_key = key,
+    };
+    e_avl_node *const o = avl_base_ceil(tree, &k, mykeycmp);
+    if (o == NULL) {
+        return NULL;
+    } else {
+        return (void *)((unsigned char *)o - offsetof(my_t, ok));
+    }
+}
+
+__attribute__((flatten))
+size_t
+avl_my_range_count(avl_tree_t const*const tree, int const lo, int const hi)
+{
+    myk_t const klo = {
+        .my_key = lo,
+    };
+    myk_t const khi = {
+        .my_key = hi,
+    };
+    void *stack[45];
+    return avl_base_range_count(tree, &klo, &khi, mykeycmp, stack);
+}
+
+__attribute__((flatten))
+void
+avl_my_split(avl_tree_t *const tree, int const key, avl_tree_t *const right)
+{
+    myk_t const k = {
+        .my_key = key,
+    };
+    void *stack[46];
+    avl_base_split(tree, &k, mykeycmp, stack, right);
+}
+
+// Subproblems shorter than this aren't worth a thread. The set operations
+// recurse, so they aren't flattened like the wrappers above.
+#define MY_FORK_HEIGHT 10
+
+void
+avl_my_union(avl_tree_t *const dst, avl_tree_t *const src, unsigned const threads)
+{
+    avl_setop_t const op = {
+        .cmpfunc = mycmp,
+        .threads = threads,
+        .fork_height = MY_FORK_HEIGHT,
+    };
+    avl_base_union(dst, src, &op);
+}
+
+void
+avl_my_intersection(avl_tree_t *const dst, avl_tree_t const*const src, unsigned const threads)
+{
+    avl_setop_t const op = {
+        .cmpfunc = mycmp,
+        .threads = threads,
+        .fork_height = MY_FORK_HEIGHT,
+    };
+    avl_base_intersection(dst, src, &op);
+}
+
+void
+avl_my_difference(avl_tree_t *const dst, avl_tree_t const*const src, unsigned const threads)
+{
+    avl_setop_t const op = {
+        .cmpfunc = mycmp,
+        .threads = threads,
+        .fork_height = MY_FORK_HEIGHT,
+    };
+    avl_base_difference(dst, src, &op);
+}
+
+#ifdef AVL_SUBTREE_COUNT
+__attribute__((flatten))
+my_t *
+avl_my_select(avl_tree_t const*const tree, size_t const k)
+{
+    e_avl_node *const o = avl_base_select(tree, k);
+    if (o == NULL) {
+        return NULL;
+    } else {
+        return (void *)((unsigned char *)o - offsetof(my_t, ok));
+    }
+}
+
+__attribute__((flatten))
+size_t
+avl_my_rank(avl_tree_t const*const tree, int const key)
+{
+    myk_t const k = {
+        .my_key = key,
+    };
+    return avl_base_rank(tree, &k, mykeycmp);
+}
+#endif
+
+__attribute__((pure))
+static inline int
+myccmp(e_avl_cnode const*const ln, e_avl_cnode const*const rn)
+{
+    myc_t const*const l = (void *)((unsigned char *)ln - offsetof(myc_t, ok));
+    myc_t const*const r = (void *)((unsigned char *)rn - offsetof(myc_t, ok));
+    if (l->my_key < r->my_key) {
+        return -1;
+    } else if (l->my_key > r->my_key) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+__attribute__((pure))
+static inline int
+myckeycmp(void const*const key, e_avl_cnode const*const rn)
+{
+    myk_t const*const l = key;
+    myc_t const*const r = (void *)((unsigned char *)rn - offsetof(myc_t, ok));
+    if (l->my_key < r->my_key) {
+        return -1;
+    } else if (l->my_key > r->my_key) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+__attribute__((flatten))
+myc_t *
+avl_myc_add(avl_ctree_t *const tree, myc_t *const t)
+{
+    void *stack[45];
+    e_avl_cnode *const o = avl_compact_add(tree, &t->ok, myccmp, stack);
+    return (void *)((unsigned char *)o - offsetof(myc_t, ok));
+}
+
+__attribute__((flatten))
+myc_t *
+avl_myc_get(avl_ctree_t const*const tree, int const key)
+{
+    myk_t const k = {
+        .my_key = key,
+    };
+    e_avl_cnode *const o = avl_compact_get(tree, &k, myckeycmp);
+    if (o == NULL) {
+        return NULL;
+    } else {
+        return (void *)((unsigned char *)o - offsetof(myc_t, ok));
+    }
+}
+
+__attribute__((flatten))
+myc_t *
+avl_myc_rem(avl_ctree_t *const tree, int const key)
+{
+    myk_t const k = {
+        .my_key = key,
+    };
+    void *stack[45];
+    e_avl_cnode *const o = avl_compact_rem(tree, &k, myckeycmp, stack);
+    if (o == NULL) {
+        return NULL;
+    } else {
+        return (void *)((unsigned char *)o - offsetof(myc_t, ok));
+    }
+}
+
+__attribute__((pure))
+static inline int
+myxcmp(e_avl_xnode const*const ln, e_avl_xnode const*const rn)
+{
+    myx_t const*const l = (void *)((unsigned char *)ln - offsetof(myx_t, ok));
+    myx_t const*const r = (void *)((unsigned char *)rn - offsetof(myx_t, ok));
+    if (l->my_key < r->my_key) {
+        return -1;
+    } else if (l->my_key > r->my_key) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+__attribute__((pure))
+static inline int
+myxkeycmp(void const*const key, e_avl_xnode const*const rn)
+{
+    myk_t const*const l = key;
+    myx_t const*const r = (void *)((unsigned char *)rn - offsetof(myx_t, ok));
+    if (l->my_key < r->my_key) {
+        return -1;
+    } else if (l->my_key > r->my_key) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+avl_xtree_t
+avl_myx_init(myx_t *const pool)
+{
+    return avl_xtree_init(pool, sizeof(*pool), offsetof(myx_t, ok));
+}
+
+__attribute__((flatten))
+uint32_t
+avl_myx_add(avl_xtree_t *const tree, uint32_t const i)
+{
+    uint32_t path[48];
+    return avl_index_add(tree, i, myxcmp, path);
+}
+
+__attribute__((flatten))
+uint32_t
+avl_myx_get(avl_xtree_t const*const tree, int const key)
+{
+    myk_t const k = {
+        .my_key = key,
+    };
+    return avl_index_get(tree, &k, myxkeycmp);
+}
+
+__attribute__((flatten))
+uint32_t
+avl_myx_rem(avl_xtree_t *const tree, int const key)
+{
+    myk_t const k = {
+        .my_key = key,
+    };
+    uint32_t path[48];
+    return avl_index_rem(tree, &k, myxkeycmp, path);
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "inline_avl.h"
+#include "inline_avl_compact.h"
+#include "inline_avl_index.h"
 
 typedef struct my_type my_t;
 struct my_type {
@@ -8,12 +10,50 @@ struct my_type {
     int my_key;
 };
 
+typedef struct myc_type myc_t;
+struct myc_type {
+    e_avl_cnode ok;
+    int my_key;
+};
+
+typedef struct myx_type myx_t;
+struct myx_type {
+    e_avl_xnode ok;
+    int my_key;
+};
+
 typedef struct my_key_type myk_t;
 struct my_key_type {
     int my_key;
 };
 
 my_t *avl_my_add(avl_tree_t *tree, my_t *t);
+size_t avl_my_add_sorted_batch(avl_tree_t *tree, my_t *const objs[], size_t n);
 my_t *avl_my_get(avl_tree_t const*tree, int key);
 my_t *avl_my_rem(avl_tree_t *tree, int key);
+void avl_my_get_batch(avl_tree_t const*tree, int const keys[], size_t n, my_t *out[]);
+my_t *avl_my_seek(avl_iter_t *iter, int key);
+my_t *avl_my_seek_near(avl_iter_t *iter, int key);
+my_t *avl_my_add_near(avl_tree_t *tree, avl_iter_t *finger, my_t *t);
+my_t *avl_my_lower_bound(avl_tree_t const*tree, int key);
+my_t *avl_my_upper_bound(avl_tree_t const*tree, int key);
+my_t *avl_my_floor(avl_tree_t const*tree, int key);
+my_t *avl_my_ceil(avl_tree_t const*tree, int key);
+size_t avl_my_range_count(avl_tree_t const*tree, int lo, int hi);
+void avl_my_split(avl_tree_t *tree, int key, avl_tree_t *right);
+void avl_my_union(avl_tree_t *dst, avl_tree_t *src, unsigned threads);
+void avl_my_intersection(avl_tree_t *dst, avl_tree_t const*src, unsigned threads);
+void avl_my_difference(avl_tree_t *dst, avl_tree_t const*src, unsigned threads);
+#ifdef AVL_SUBTREE_COUNT
+my_t *avl_my_select(avl_tree_t const*tree, size_t k);
+size_t avl_my_rank(avl_tree_t const*tree, int key);
+#endif
+
+myc_t *avl_myc_add(avl_ctree_t *tree, myc_t *t);
+myc_t *avl_myc_get(avl_ctree_t const*tree, int key);
+myc_t *avl_myc_rem(avl_ctree_t *tree, int key);
 
+avl_xtree_t avl_myx_init(myx_t *pool);
+uint32_t avl_myx_add(avl_xtree_t *tree, uint32_t i);
+uint32_t avl_myx_get(avl_xtree_t const*tree, int key);
+uint32_t avl_myx_rem(avl_xtree_t *tree, int key);
@@ -0,0 +1,104 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "inline_avl_interval.h"
+
+static inline unsigned
+xorshift32(unsigned *const p_rng)
+{
+    unsigned x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return x;
+}
+
+static inline uint64_t
+elapsed_ns(struct timespec const*const start, struct timespec const*const end)
+{
+    return (end->tv_sec - start->tv_sec)*UINT64_C(1000000000) + (end->tv_nsec - start->tv_nsec);
+}
+
+static bool
+count_visit(e_avl_inode *const in, void *const arg)
+{
+    (void)in;
+    ++*(size_t *)arg;
+    return true;
+}
+
+#define NUM_OBJS (1<<20)
+#define KEY_SPACE (1u<<30)
+#define NUM_QUERIES 10000
+#define NUM_SCAN_QUERIES 100
+
+int
+main(void)
+{
+    printf("NUM_OBJS %d\n", NUM_OBJS);
+    unsigned rng = time(NULL);
+
+    // Leased ranges: mostly short, a few long
+    e_avl_inode *objs = malloc(sizeof(*objs) * NUM_OBJS);
+    avl_tree_t tree = avl_tree_init();
+    void *stack[45];
+    for (int i = 0; i < NUM_OBJS; ++i) {
+        objs[i].start = xorshift32(&rng) % KEY_SPACE;
+        objs[i].end = objs[i].start + 1 + ((i % 100 == 0) ? xorshift32(&rng) % (1<<20) : xorshift32(&rng) % 4096);
+        (void)avl_interval_add(&tree, &objs[i], stack);
+    }
+
+    uint64_t *qs = malloc(sizeof(*qs) * NUM_QUERIES);
+    for (int i = 0; i < NUM_QUERIES; ++i) {
+        qs[i] = xorshift32(&rng) % KEY_SPACE;
+    }
+
+    struct timespec start, end;
+    size_t tree_hits = 0;
+    size_t scan_hits = 0;
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (int i = 0; i < NUM_QUERIES; ++i) {
+        (void)avl_interval_overlap(&tree, qs[i], qs[i] + 1024, count_visit, &tree_hits, stack);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const tree_ns = elapsed_ns(&start, &end);
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (int i = 0; i < NUM_QUERIES; ++i) {
+        (void)avl_interval_stab(&tree, qs[i], count_visit, &tree_hits, stack);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const stab_ns = elapsed_ns(&start, &end);
+
+    // What it costs without the tree: check every entry
+    size_t check_hits = 0;
+    for (int i = 0; i < NUM_SCAN_QUERIES; ++i) {
+        (void)avl_interval_overlap(&tree, qs[i], qs[i] + 1024, count_visit, &check_hits, stack);
+    }
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (int i = 0; i < NUM_SCAN_QUERIES; ++i) {
+        for (int j = 0; j < NUM_OBJS; ++j) {
+            scan_hits += objs[j].start < qs[i] + 1024 && objs[j].end > qs[i];
+        }
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const scan_ns = elapsed_ns(&start, &end);
+    assert(scan_hits == check_hits);
+
+    printf("Ran test with %d intervals\n", NUM_OBJS);
+    printf("Average intervals per overlap query: %f\n", 1.0 * check_hits / NUM_SCAN_QUERIES);
+    printf("Average time for an overlap query: %f nanoseconds\n", 1.0 * tree_ns / NUM_QUERIES);
+    printf("Average time for a stabbing query: %f nanoseconds\n", 1.0 * stab_ns / NUM_QUERIES);
+    printf("Average time for an overlap query by scanning: %f nanoseconds\n", 1.0 * scan_ns / NUM_SCAN_QUERIES);
+
+    free(qs);
+    free(objs);
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "avlhelper.h"
+
+static inline unsigned
+xorshift32(unsigned *const p_rng)
+{
+    unsigned x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return x;
+}
+
+static inline uint64_t
+elapsed_ns(struct timespec const*const start, struct timespec const*const end)
+{
+    return (end->tv_sec - start->tv_sec)*UINT64_C(1000000000) + (end->tv_nsec - start->tv_nsec);
+}
+
+static int
+intcmp(void const*const lhs, void const*const rhs)
+{
+    int const l = *(int const*)lhs;
+    int const r = *(int const*)rhs;
+    return (l > r) - (l < r);
+}
+
+#define NUM_BASE (1<<20)
+#define NUM_DELTA (1<<16)
+#define NUM_TRIALS 10
+
+static my_t *base_objs;
+static my_t *delta_objs;
+static e_avl_node **nodes;
+
+// Relink `tree` from `objs`, which are already in key order
+static void
+rebuild(avl_tree_t *const tree, my_t *const objs, int const n)
+{
+    for (int i = 0; i < n; ++i) {
+        nodes[i] = &objs[i].ok;
+    }
+    *tree = avl_tree_init();
+    avl_base_build_sorted(tree, nodes, n);
+}
+
+int
+main(void)
+{
+    unsigned rng = time(NULL);
+
+    long const nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned const threads = (nproc > 1) ? (unsigned)nproc - 1 : 0;
+
+    printf("NUM_BASE %d\n", NUM_BASE);
+    printf("NUM_DELTA %d\n", NUM_DELTA);
+    printf("Extra threads %u\n", threads);
+
+    // The base holds every multiple of three, and the delta holds random
+    // keys from the same range, so about a third of them collide.
+    base_objs = malloc(sizeof(*base_objs) * NUM_BASE);
+    delta_objs = malloc(sizeof(*delta_objs) * NUM_DELTA);
+    nodes = malloc(sizeof(*nodes) * NUM_BASE);
+
+    for (int i = 0; i < NUM_BASE; ++i) {
+        base_objs[i].my_key = i * 3;
+    }
+
+    int *keys = malloc(sizeof(*keys) * NUM_DELTA);
+    for (int i = 0; i < NUM_DELTA; ++i) {
+        keys[i] = (int)(xorshift32(&rng) % (NUM_BASE * 3u));
+    }
+    qsort(keys, NUM_DELTA, sizeof(*keys), intcmp);
+    int n_delta = 0;
+    for (int i = 0; i < NUM_DELTA; ++i) {
+        if (n_delta == 0 || keys[i] != delta_objs[n_delta - 1].my_key) {
+            delta_objs[n_delta++].my_key = keys[i];
+        }
+    }
+    free(keys);
+
+    struct timespec start, end;
+    uint64_t add_ns = 0;
+    uint64_t union_ns[2] = { 0, 0 };
+    uint64_t inter_ns[2] = { 0, 0 };
+    uint64_t diff_ns[2] = { 0, 0 };
+    unsigned const thread_counts[2] = { 0, threads };
+
+    avl_tree_t base, delta;
+
+    for (int i = 0; i < NUM_TRIALS; ++i) {
+        // The old way: move the delta over one node at a time
+        rebuild(&base, base_objs, NUM_BASE);
+        rebuild(&delta, delta_objs, n_delta);
+        clock_gettime(CLOCK_REALTIME, &start);
+        for (int j = 0; j < n_delta; ++j) {
+            my_t *const e = avl_my_rem(&delta, delta_objs[j].my_key);
+            (void)avl_my_add(&base, e);
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        add_ns += elapsed_ns(&start, &end);
+        size_t const union_size = avl_size(&base);
+
+        for (int t = 0; t < 2; ++t) {
+            rebuild(&base, base_objs, NUM_BASE);
+            rebuild(&delta, delta_objs, n_delta);
+            clock_gettime(CLOCK_REALTIME, &start);
+            avl_my_union(&base, &delta, thread_counts[t]);
+            clock_gettime(CLOCK_REALTIME, &end);
+            union_ns[t] += elapsed_ns(&start, &end);
+            assert(avl_size(&base) == union_size);
+
+            rebuild(&base, base_objs, NUM_BASE);
+            rebuild(&delta, delta_objs, n_delta);
+            clock_gettime(CLOCK_REALTIME, &start);
+            avl_my_intersection(&base, &delta, thread_counts[t]);
+            clock_gettime(CLOCK_REALTIME, &end);
+            inter_ns[t] += elapsed_ns(&start, &end);
+            assert(avl_size(&base) == NUM_BASE + n_delta - union_size);
+
+            rebuild(&base, base_objs, NUM_BASE);
+            rebuild(&delta, delta_objs, n_delta);
+            clock_gettime(CLOCK_REALTIME, &start);
+            avl_my_difference(&base, &delta, thread_counts[t]);
+            clock_gettime(CLOCK_REALTIME, &end);
+            diff_ns[t] += elapsed_ns(&start, &end);
+            assert(avl_size(&base) == union_size - n_delta);
+        }
+    }
+
+    printf("Merged a delta of %d into a base of %d\n", n_delta, NUM_BASE);
+    printf("Average time to merge node by node: %f milliseconds\n", add_ns / 1e6 / NUM_TRIALS);
+    for (int t = 0; t < 2; ++t) {
+        printf("With %u extra threads:\n", thread_counts[t]);
+        printf("  Average time for a union: %f milliseconds\n", union_ns[t] / 1e6 / NUM_TRIALS);
+        printf("  Average time for an intersection: %f milliseconds\n", inter_ns[t] / 1e6 / NUM_TRIALS);
+        printf("  Average time for a difference: %f milliseconds\n", diff_ns[t] / 1e6 / NUM_TRIALS);
+    }
+
+    free(nodes);
+    free(delta_objs);
+    free(base_objs);
+
+    return 0;
+}
@@ -4,8 +4,21 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include "avlhelper.h"
+#include "inline_avl_pool.h"
+#include "inline_avl_int.h"
+#include "inline_avl_frozen.h"
+#include "inline_avl_concurrent.h"
+#include "inline_avl_sharded.h"
+#include "inline_avl_clone.h"
+#include "inline_avl_file.h"
 
 static inline unsigned
 xorshift32(unsigned *const p_rng)
@@ -18,13 +31,1349 @@ xorshift32(unsigned *const p_rng)
     return x;
 }
 
+static int
+objcmp(void const*const lhs, void const*const rhs)
+{
+    my_t const*const l = *(my_t *const*)lhs;
+    my_t const*const r = *(my_t *const*)rhs;
+    return (l->my_key > r->my_key) - (l->my_key < r->my_key);
+}
+
 #define NUM_LOOPS 100000
 #define NUM_OBJS (1<<17)
 #define NUM_INNER_LOOP 100
+#define NUM_SCANS 100
+
+static inline uint64_t
+elapsed_ns(struct timespec const*const start, struct timespec const*const end)
+{
+    return (end->tv_sec - start->tv_sec)*UINT64_C(1000000000) + (end->tv_nsec - start->tv_nsec);
+}
+
+// Link `n` objects with distinct keys into `tree`, placing them in memory in
+// an order unrelated to the tree's.
+static void
+build_scattered(avl_tree_t *const tree, my_t *const objs, size_t const n)
+{
+    // Multiplying by an odd constant modulo 2^31 never maps two indices
+    // below 2^31 to the same key
+    for (size_t i = 0; i < n; ++i) {
+        objs[i].my_key = (int)((i * 0x9e3779b1u) & 0x7fffffffu);
+    }
+
+    my_t **sorted = malloc(sizeof(*sorted) * n);
+    for (size_t i = 0; i < n; ++i) {
+        sorted[i] = &objs[i];
+    }
+    qsort(sorted, n, sizeof(*sorted), objcmp);
+
+    e_avl_node **nodes = (void *)sorted;
+    for (size_t i = 0; i < n; ++i) {
+        nodes[i] = &sorted[i]->ok;
+    }
+
+    *tree = avl_tree_init();
+    avl_base_build_sorted(tree, nodes, n);
+    free(sorted);
+}
+
+#define NUM_BATCH_KEYS (1<<22)
+
+// Scalar gets against batched gets, on a tree big enough to miss the
+// last-level cache on most levels.
+static int
+batch_speed(int const log2_objs)
+{
+    size_t const n_objs = (size_t)1 << log2_objs;
+    printf("NUM_OBJS %zu\n", n_objs);
+    printf("Tree nodes occupy %zu MiB\n", (n_objs * sizeof(my_t)) >> 20);
+
+    unsigned rng = time(NULL);
+    avl_tree_t tree;
+    my_t *objs = malloc(sizeof(*objs) * n_objs);
+    build_scattered(&tree, objs, n_objs);
+
+    int *keys = malloc(sizeof(*keys) * NUM_BATCH_KEYS);
+    my_t **out = malloc(sizeof(*out) * NUM_BATCH_KEYS);
+    for (size_t i = 0; i < NUM_BATCH_KEYS; ++i) {
+        keys[i] = objs[(((size_t)xorshift32(&rng) << 32) | xorshift32(&rng)) % n_objs].my_key;
+    }
+
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (size_t i = 0; i < NUM_BATCH_KEYS; ++i) {
+        out[i] = avl_my_get(&tree, keys[i]);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const scalar_ns = elapsed_ns(&start, &end);
+
+    for (size_t i = 0; i < NUM_BATCH_KEYS; ++i) {
+        assert(out[i] != NULL && out[i]->my_key == keys[i]);
+        out[i] = NULL;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    avl_my_get_batch(&tree, keys, NUM_BATCH_KEYS, out);
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const batch_ns = elapsed_ns(&start, &end);
+
+    for (size_t i = 0; i < NUM_BATCH_KEYS; ++i) {
+        assert(out[i] != NULL && out[i]->my_key == keys[i]);
+    }
+
+    printf("Average time to get a node: %f nanoseconds\n", 1.0 * scalar_ns / NUM_BATCH_KEYS);
+    printf("Average time to get a node in a batch: %f nanoseconds\n", 1.0 * batch_ns / NUM_BATCH_KEYS);
+
+    free(out);
+    free(keys);
+    free(objs);
+
+    return 0;
+}
+
+#define NUM_INGEST_BASE (1<<20)
+#define NUM_INGEST_RUNS 64
+#define INGEST_RUN_LEN 4096
+
+// Node by node inserts against sorted batches, for runs of nearby keys
+// landing in a big tree.
+static int
+ingest_speed(void)
+{
+    size_t const n_runs = NUM_INGEST_RUNS;
+    size_t const n_new = n_runs * INGEST_RUN_LEN;
+    printf("NUM_INGEST_BASE %d\n", NUM_INGEST_BASE);
+    printf("Ingesting %zu runs of %d keys\n", n_runs, INGEST_RUN_LEN);
+
+    unsigned rng = time(NULL);
+    avl_tree_t tree;
+    my_t *base = malloc(sizeof(*base) * NUM_INGEST_BASE);
+    my_t *objs = malloc(sizeof(*objs) * n_new);
+    my_t **runs = malloc(sizeof(*runs) * n_new);
+
+    for (size_t r = 0; r < n_runs; ++r) {
+        int const start = (int)(xorshift32(&rng) & 0x7ff00000u);
+        for (size_t j = 0; j < INGEST_RUN_LEN; ++j) {
+            size_t const i = r * INGEST_RUN_LEN + j;
+            objs[i].my_key = start + (int)j * 7;
+            runs[i] = &objs[i];
+        }
+    }
+
+    struct timespec start, end;
+
+    build_scattered(&tree, base, NUM_INGEST_BASE);
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (size_t i = 0; i < n_new; ++i) {
+        (void)avl_my_add(&tree, runs[i]);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const add_ns = elapsed_ns(&start, &end);
+    size_t const size = avl_size(&tree);
+
+    build_scattered(&tree, base, NUM_INGEST_BASE);
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (size_t r = 0; r < n_runs; ++r) {
+        (void)avl_my_add_sorted_batch(&tree, runs + r * INGEST_RUN_LEN, INGEST_RUN_LEN);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const batch_ns = elapsed_ns(&start, &end);
+    assert(avl_size(&tree) == size);
+
+    printf("Average time to add a node: %f nanoseconds\n", 1.0 * add_ns / n_new);
+    printf("Average time to add a node in a sorted batch: %f nanoseconds\n", 1.0 * batch_ns / n_new);
+
+    free(runs);
+    free(objs);
+    free(base);
+
+    return 0;
+}
+
+#define NUM_NEARLY_OBJS (1<<20)
+
+// Plain adds against adds from a finger, for keys that arrive nearly sorted:
+// ascending, with one in eight landing a short way back.
+static int
+nearly_sorted_speed(void)
+{
+    printf("NUM_NEARLY_OBJS %d\n", NUM_NEARLY_OBJS);
+
+    unsigned rng = time(NULL);
+    my_t *objs = malloc(sizeof(*objs) * NUM_NEARLY_OBJS);
+    for (int i = 0; i < NUM_NEARLY_OBJS; ++i) {
+        objs[i].my_key = i * 16;
+        if ((xorshift32(&rng) & 7) == 0) {
+            objs[i].my_key -= 1 + (int)(xorshift32(&rng) % 1024);
+        }
+    }
+
+    struct timespec start, end;
+    avl_tree_t tree = avl_tree_init();
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (int i = 0; i < NUM_NEARLY_OBJS; ++i) {
+        (void)avl_my_add(&tree, &objs[i]);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const add_ns = elapsed_ns(&start, &end);
+    size_t const size = avl_size(&tree);
+
+    tree = avl_tree_init();
+    void *stack[45];
+    avl_iter_t finger = avl_iter_init(&tree, stack);
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (int i = 0; i < NUM_NEARLY_OBJS; ++i) {
+        (void)avl_my_add_near(&tree, &finger, &objs[i]);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const near_ns = elapsed_ns(&start, &end);
+    assert(avl_size(&tree) == size);
+
+    printf("Average time to add a node: %f nanoseconds\n", 1.0 * add_ns / NUM_NEARLY_OBJS);
+    printf("Average time to add a node from a finger: %f nanoseconds\n", 1.0 * near_ns / NUM_NEARLY_OBJS);
+
+    free(objs);
+
+    return 0;
+}
+
+#define NUM_COMPACT_OBJS (1<<20)
+
+// The height-based node against the compact one, on the same random keys.
+static int
+compact_speed(void)
+{
+    printf("NUM_COMPACT_OBJS %d\n", NUM_COMPACT_OBJS);
+    printf("Node size: %zu bytes, compact %zu bytes\n", sizeof(e_avl_node), sizeof(e_avl_cnode));
+    printf("Object size: %zu bytes, compact %zu bytes\n", sizeof(my_t), sizeof(myc_t));
+
+    unsigned rng = time(NULL);
+    my_t *objs = malloc(sizeof(*objs) * NUM_COMPACT_OBJS);
+    myc_t *cobjs = malloc(sizeof(*cobjs) * NUM_COMPACT_OBJS);
+    int *order = malloc(sizeof(*order) * NUM_COMPACT_OBJS);
+
+    // Distinct keys, visited in a different random order for each phase
+    for (int i = 0; i < NUM_COMPACT_OBJS; ++i) {
+        objs[i].my_key = (int)(((unsigned)i * 0x9e3779b1u) & 0x7fffffffu);
+        cobjs[i].my_key = objs[i].my_key;
+        order[i] = i;
+    }
+
+    struct timespec start, end;
+    uint64_t ns[2][3];
+    avl_tree_t tree = avl_tree_init();
+    avl_ctree_t ctree = avl_ctree_init();
+
+    for (int phase = 0; phase < 3; ++phase) {
+        for (int i = NUM_COMPACT_OBJS - 1; i > 0; --i) {
+            int const j = xorshift32(&rng) % (i + 1);
+            int const tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &start);
+        for (int i = 0; i < NUM_COMPACT_OBJS; ++i) {
+            my_t *const o = &objs[order[i]];
+            if (phase == 0) {
+                (void)avl_my_add(&tree, o);
+            } else if (phase == 1) {
+                assert(avl_my_get(&tree, o->my_key) == o);
+            } else {
+                (void)avl_my_rem(&tree, o->my_key);
+            }
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        ns[0][phase] = elapsed_ns(&start, &end);
+
+        clock_gettime(CLOCK_REALTIME, &start);
+        for (int i = 0; i < NUM_COMPACT_OBJS; ++i) {
+            myc_t *const o = &cobjs[order[i]];
+            if (phase == 0) {
+                (void)avl_myc_add(&ctree, o);
+            } else if (phase == 1) {
+                assert(avl_myc_get(&ctree, o->my_key) == o);
+            } else {
+                (void)avl_myc_rem(&ctree, o->my_key);
+            }
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        ns[1][phase] = elapsed_ns(&start, &end);
+    }
+    assert(avl_size(&tree) == 0 && avl_csize(&ctree) == 0);
+
+    char const*const names[3] = { "adds", "gets", "removes" };
+    for (int phase = 0; phase < 3; ++phase) {
+        printf("%s per second: %f million, compact %f million\n", names[phase],
+                1e3 * NUM_COMPACT_OBJS / ns[0][phase], 1e3 * NUM_COMPACT_OBJS / ns[1][phase]);
+    }
+
+    free(order);
+    free(cobjs);
+    free(objs);
+
+    return 0;
+}
+
+// Shuffle `order[0..n)` in place
+static void
+shuffle(uint32_t *const order, size_t const n, unsigned *const p_rng)
+{
+    for (size_t i = n - 1; i > 0; --i) {
+        size_t const j = ((((size_t)xorshift32(p_rng) << 32) | xorshift32(p_rng)) % (i + 1));
+        uint32_t const tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+}
+
+// The pointer-based tree against the index-based one, on `n_objs` random
+// keys. Each is run and freed before the other, so that big trees fit.
+static int
+index_speed(size_t const n_objs)
+{
+    if (n_objs == 0 || n_objs > (1u << 31)) {
+        fprintf(stderr, "avlspeed index: between 1 and 2^31 nodes\n");
+        return 1;
+    }
+    printf("NUM_OBJS %zu\n", n_objs);
+    printf("Object size: %zu bytes, indexed %zu bytes\n", sizeof(my_t), sizeof(myx_t));
+
+    unsigned rng = time(NULL);
+    uint32_t *order = malloc(sizeof(*order) * n_objs);
+    for (size_t i = 0; i < n_objs; ++i) {
+        order[i] = (uint32_t)i;
+    }
+
+    struct timespec start, end;
+    uint64_t ns[2][3];
+
+    {
+        my_t *objs = malloc(sizeof(*objs) * n_objs);
+        for (size_t i = 0; i < n_objs; ++i) {
+            objs[i].my_key = (int)((i * 0x9e3779b1u) & 0x7fffffffu);
+        }
+        avl_tree_t tree = avl_tree_init();
+
+        for (int phase = 0; phase < 3; ++phase) {
+            shuffle(order, n_objs, &rng);
+            clock_gettime(CLOCK_REALTIME, &start);
+            for (size_t i = 0; i < n_objs; ++i) {
+                my_t *const o = &objs[order[i]];
+                if (phase == 0) {
+                    (void)avl_my_add(&tree, o);
+                } else if (phase == 1) {
+                    assert(avl_my_get(&tree, o->my_key) == o);
+                } else {
+                    (void)avl_my_rem(&tree, o->my_key);
+                }
+            }
+            clock_gettime(CLOCK_REALTIME, &end);
+            ns[0][phase] = elapsed_ns(&start, &end);
+        }
+        assert(avl_size(&tree) == 0);
+        free(objs);
+    }
+
+    {
+        myx_t *pool = malloc(sizeof(*pool) * n_objs);
+        for (size_t i = 0; i < n_objs; ++i) {
+            pool[i].my_key = (int)((i * 0x9e3779b1u) & 0x7fffffffu);
+        }
+        avl_xtree_t tree = avl_myx_init(pool);
+
+        for (int phase = 0; phase < 3; ++phase) {
+            shuffle(order, n_objs, &rng);
+            clock_gettime(CLOCK_REALTIME, &start);
+            for (size_t i = 0; i < n_objs; ++i) {
+                uint32_t const o = order[i];
+                if (phase == 0) {
+                    (void)avl_myx_add(&tree, o);
+                } else if (phase == 1) {
+                    assert(avl_myx_get(&tree, pool[o].my_key) == o);
+                } else {
+                    (void)avl_myx_rem(&tree, pool[o].my_key);
+                }
+            }
+            clock_gettime(CLOCK_REALTIME, &end);
+            ns[1][phase] = elapsed_ns(&start, &end);
+        }
+        assert(avl_xsize(&tree) == 0);
+        free(pool);
+    }
+
+    char const*const names[3] = { "add", "get", "remove" };
+    for (int phase = 0; phase < 3; ++phase) {
+        printf("Average time to %s a node: %f nanoseconds, indexed %f nanoseconds\n", names[phase],
+                1.0 * ns[0][phase] / n_objs, 1.0 * ns[1][phase] / n_objs);
+    }
+
+    free(order);
+
+    return 0;
+}
+
+// A counter of this thread's mispredicted branches in user space, or -1 if
+// the machine doesn't offer one (as in many VMs).
+static int
+branch_miss_counter(void)
+{
+    struct perf_event_attr attr = {
+        .size = sizeof(attr),
+        .type = PERF_TYPE_HARDWARE,
+        .config = PERF_COUNT_HW_BRANCH_MISSES,
+        .disabled = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void
+counter_start(int const fd)
+{
+    if (fd >= 0) {
+        (void)ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        (void)ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static uint64_t
+counter_stop(int const fd)
+{
+    uint64_t count = 0;
+    if (fd >= 0) {
+        (void)ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+            count = 0;
+        }
+    }
+    return count;
+}
+
+// Lookups through `avl_my_get` against the same `n_objs` keys kept in knodes
+static int
+intkey_speed(size_t const n_objs)
+{
+    if (n_objs == 0 || n_objs > (1u << 31)) {
+        fprintf(stderr, "avlspeed intkey: between 1 and 2^31 nodes\n");
+        return 1;
+    }
+    printf("NUM_OBJS %zu\n", n_objs);
+
+    unsigned rng = time(NULL);
+    my_t *objs = malloc(sizeof(*objs) * n_objs);
+    e_avl_knode *knodes = malloc(sizeof(*knodes) * n_objs);
+    uint32_t *order = malloc(sizeof(*order) * n_objs);
+
+    avl_tree_t tree = avl_tree_init();
+    avl_tree_t ktree = avl_tree_init();
+    void *stack[46];
+    for (size_t i = 0; i < n_objs; ++i) {
+        objs[i].my_key = (int)((i * 0x9e3779b1u) & 0x7fffffffu);
+        knodes[i].key = (uint64_t)objs[i].my_key;
+        order[i] = (uint32_t)i;
+    }
+    shuffle(order, n_objs, &rng);
+    for (size_t i = 0; i < n_objs; ++i) {
+        (void)avl_my_add(&tree, &objs[order[i]]);
+        (void)avl_int_add(&ktree, &knodes[order[i]], stack);
+    }
+
+    int const fd = branch_miss_counter();
+    struct timespec start, end;
+    uint64_t ns[2];
+    uint64_t misses[2];
+
+    shuffle(order, n_objs, &rng);
+    counter_start(fd);
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (size_t i = 0; i < n_objs; ++i) {
+        my_t *const o = avl_my_get(&tree, objs[order[i]].my_key);
+        assert(o == &objs[order[i]]);
+        (void)o;
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    misses[0] = counter_stop(fd);
+    ns[0] = elapsed_ns(&start, &end);
+
+    shuffle(order, n_objs, &rng);
+    counter_start(fd);
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (size_t i = 0; i < n_objs; ++i) {
+        e_avl_knode *const o = avl_int_get(&ktree, knodes[order[i]].key);
+        assert(o == &knodes[order[i]]);
+        (void)o;
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    misses[1] = counter_stop(fd);
+    ns[1] = elapsed_ns(&start, &end);
+
+    printf("Average time to get a node: %f nanoseconds, integer key %f nanoseconds\n",
+            1.0 * ns[0] / n_objs, 1.0 * ns[1] / n_objs);
+    if (fd >= 0) {
+        printf("Branch misses per get: %f, integer key %f\n",
+                1.0 * misses[0] / n_objs, 1.0 * misses[1] / n_objs);
+        close(fd);
+    } else {
+        printf("Branch misses per get: no hardware counter available\n");
+    }
+
+    free(order);
+    free(knodes);
+    free(objs);
+
+    return 0;
+}
+
+// Random lookups over `n_objs` objects scattered in memory, then again after
+// moving them into breadth first order in slices of `budget` objects.
+static int
+relayout_speed(size_t const n_objs, size_t const budget)
+{
+    if (n_objs == 0 || n_objs > (1u << 31) || budget == 0) {
+        fprintf(stderr, "avlspeed relayout: between 1 and 2^31 nodes, in slices of at least 1\n");
+        return 1;
+    }
+    printf("NUM_OBJS %zu\n", n_objs);
+
+    unsigned rng = time(NULL);
+    my_t *objs = malloc(sizeof(*objs) * n_objs);
+    my_t *region = malloc(sizeof(*region) * n_objs);
+    uint32_t *order = malloc(sizeof(*order) * n_objs);
+    for (size_t i = 0; i < n_objs; ++i) {
+        order[i] = (uint32_t)i;
+    }
+
+    avl_tree_t tree;
+    build_scattered(&tree, objs, n_objs);
+
+    struct timespec start, end;
+    uint64_t get_ns[2];
+
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            avl_relayout_t rl = avl_relayout_init(&tree, region, sizeof(my_t), offsetof(my_t, ok), NULL, NULL);
+            size_t slices = 0;
+            clock_gettime(CLOCK_REALTIME, &start);
+            while (avl_base_relayout(&rl, budget) == AVL_RELAYOUT_MORE) {
+                ++slices;
+            }
+            clock_gettime(CLOCK_REALTIME, &end);
+            uint64_t const ns = elapsed_ns(&start, &end);
+            printf("Relayout: %f nanoseconds per node, %zu slices of %zu nodes, %f microseconds per slice\n",
+                    1.0 * ns / n_objs, slices + 1, budget, 1e-3 * ns / (slices + 1));
+        }
+
+        shuffle(order, n_objs, &rng);
+        my_t const*const from = (pass == 0) ? objs : region;
+        (void)from;
+        clock_gettime(CLOCK_REALTIME, &start);
+        for (size_t i = 0; i < n_objs; ++i) {
+            int const key = (int)((order[i] * 0x9e3779b1u) & 0x7fffffffu);
+            my_t *const o = avl_my_get(&tree, key);
+            assert(o != NULL && o->my_key == key && o >= from && o < from + n_objs);
+            (void)o;
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        get_ns[pass] = elapsed_ns(&start, &end);
+    }
+
+    printf("Average time to get a node: %f nanoseconds, after relayout %f nanoseconds\n",
+            1.0 * get_ns[0] / n_objs, 1.0 * get_ns[1] / n_objs);
+
+    free(order);
+    free(region);
+    free(objs);
+
+    return 0;
+}
+
+static uint64_t
+knode_keyof(e_avl_node const*const nd)
+{
+    return nd2knode(nd)->key;
+}
+
+#define FROZEN_BATCH 256
+
+// Lookups of `n_objs` integer keys in the tree, in a frozen snapshot of it,
+// and in the snapshot a batch at a time
+static int
+frozen_speed(size_t const n_objs)
+{
+    if (n_objs == 0 || n_objs > (1u << 31)) {
+        fprintf(stderr, "avlspeed frozen: between 1 and 2^31 nodes\n");
+        return 1;
+    }
+    printf("NUM_OBJS %zu\n", n_objs);
+
+    unsigned rng = time(NULL);
+    e_avl_knode *knodes = malloc(sizeof(*knodes) * n_objs);
+    uint32_t *order = malloc(sizeof(*order) * n_objs);
+    uint64_t *keys = malloc(sizeof(*keys) * n_objs);
+
+    avl_tree_t tree = avl_tree_init();
+    void *stack[46];
+    for (size_t i = 0; i < n_objs; ++i) {
+        knodes[i].key = (uint64_t)i * UINT64_C(0x9e3779b97f4a7c15);
+        order[i] = (uint32_t)i;
+    }
+    shuffle(order, n_objs, &rng);
+    for (size_t i = 0; i < n_objs; ++i) {
+        (void)avl_int_add(&tree, &knodes[order[i]], stack);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_REALTIME, &start);
+    avl_frozen_t frozen;
+    if (!avl_freeze(&tree, knode_keyof, stack, &frozen)) {
+        fprintf(stderr, "avlspeed frozen: out of memory\n");
+        return 1;
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    printf("Freeze: %f nanoseconds per node\n", 1.0 * elapsed_ns(&start, &end) / n_objs);
+
+    shuffle(order, n_objs, &rng);
+    for (size_t i = 0; i < n_objs; ++i) {
+        keys[i] = knodes[order[i]].key;
+    }
+
+    uint64_t ns[3];
+    for (int mode = 0; mode < 3; ++mode) {
+        clock_gettime(CLOCK_REALTIME, &start);
+        if (mode == 0) {
+            for (size_t i = 0; i < n_objs; ++i) {
+                e_avl_knode *const o = avl_int_get(&tree, keys[i]);
+                assert(o == &knodes[order[i]]);
+                (void)o;
+            }
+        } else if (mode == 1) {
+            for (size_t i = 0; i < n_objs; ++i) {
+                e_avl_node *const o = avl_frozen_get(&frozen, keys[i]);
+                assert(o == &knodes[order[i]].node);
+                (void)o;
+            }
+        } else {
+            e_avl_node *out[FROZEN_BATCH];
+            for (size_t i = 0; i < n_objs; i += FROZEN_BATCH) {
+                size_t const len = (n_objs - i < FROZEN_BATCH) ? n_objs - i : FROZEN_BATCH;
+                avl_frozen_get_batch(&frozen, &keys[i], len, out);
+                for (size_t j = 0; j < len; ++j) {
+                    assert(out[j] == &knodes[order[i + j]].node);
+                }
+            }
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        ns[mode] = elapsed_ns(&start, &end);
+    }
+    assert(avl_frozen_valid(&frozen));
+
+    printf("Average time to get a node: %f nanoseconds, frozen %f nanoseconds, frozen in batches %f nanoseconds\n",
+            1.0 * ns[0] / n_objs, 1.0 * ns[1] / n_objs, 1.0 * ns[2] / n_objs);
+
+    avl_frozen_free(&frozen);
+    free(keys);
+    free(order);
+    free(knodes);
+
+    return 0;
+}
+
+#define NUM_SEQ_OBJS (1<<20)
+#define SEQ_RUN_NS UINT64_C(1000000000)
+#define SEQ_MAX_READERS 64
+
+struct seq_shared {
+    avl_tree_t tree;
+    pthread_rwlock_t lock;
+    int optimistic;   /* readers use the seqlock rather than the rwlock */
+    int done;
+};
+
+struct seq_reader {
+    struct seq_shared *sh;
+    pthread_t thread;
+    unsigned rng;
+    uint64_t gets;
+};
+
+static void *
+seq_reader(void *const arg)
+{
+    struct seq_reader *const r = arg;
+    struct seq_shared *const sh = r->sh;
+
+    while (!__atomic_load_n(&sh->done, __ATOMIC_ACQUIRE)) {
+        /* The even keys are always there */
+        uint64_t const key = 2 * (xorshift32(&r->rng) % (NUM_SEQ_OBJS / 2));
+        e_avl_node *nd;
+        if (sh->optimistic) {
+            nd = avl_seq_get(&sh->tree, &key, avl_knode_keycmp);
+        } else {
+            pthread_rwlock_rdlock(&sh->lock);
+            nd = avl_base_get(&sh->tree, &key, avl_knode_keycmp);
+            pthread_rwlock_unlock(&sh->lock);
+        }
+        assert(nd != NULL && nd2knode(nd)->key == key);
+        (void)nd;
+        ++r->gets;
+    }
+    return NULL;
+}
+
+// One writer adding and removing the odd keys of a tree of NUM_SEQ_OBJS while
+// `n_readers` threads look up the even ones, first under a rwlock, then
+// optimistically under the tree's sequence count.
+static int
+seqlock_speed(int const n_readers)
+{
+    if (n_readers < 1 || n_readers > SEQ_MAX_READERS) {
+        fprintf(stderr, "avlspeed seqlock: between 1 and %d readers\n", SEQ_MAX_READERS);
+        return 1;
+    }
+    printf("NUM_OBJS %d, %d readers, %ld online cpus\n", NUM_SEQ_OBJS, n_readers,
+            sysconf(_SC_NPROCESSORS_ONLN));
+
+    avl_pool_t pool;
+    if (!avl_pool_init(&pool, (size_t)NUM_SEQ_OBJS * 2 * sizeof(e_avl_knode), 0)) {
+        fprintf(stderr, "avlspeed seqlock: can't reserve the pool\n");
+        return 1;
+    }
+    avl_pool_cache_t cache = avl_pool_cache(&pool);
+    void *stack[46];
+
+    struct seq_shared sh = { .tree = avl_tree_init() };
+    /* The default lets a stream of readers starve the writer for good */
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&sh.lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    for (uint64_t k = 0; k < NUM_SEQ_OBJS; k += 2) {
+        e_avl_knode *const kn = avl_pool_alloc(&cache, sizeof(*kn));
+        kn->key = k;
+        (void)avl_int_add(&sh.tree, kn, stack);
+    }
+
+    struct seq_reader readers[SEQ_MAX_READERS];
+    unsigned rng = time(NULL);
+    uint64_t gets[2];
+    uint64_t writes[2];
+
+    for (int optimistic = 0; optimistic < 2; ++optimistic) {
+        sh.optimistic = optimistic;
+        sh.done = 0;
+        for (int i = 0; i < n_readers; ++i) {
+            readers[i] = (struct seq_reader) { .sh = &sh, .rng = rng + i + 1 };
+            pthread_create(&readers[i].thread, NULL, seq_reader, &readers[i]);
+        }
+
+        struct timespec start, now;
+        uint64_t n_writes = 0;
+        clock_gettime(CLOCK_REALTIME, &start);
+        do {
+            uint64_t const key = 2 * (xorshift32(&rng) % (NUM_SEQ_OBJS / 2)) + 1;
+            e_avl_knode *const kn = avl_pool_alloc(&cache, sizeof(*kn));
+            kn->key = key;
+
+            if (optimistic) {
+                avl_seq_write_begin(&sh.tree);
+            } else {
+                pthread_rwlock_wrlock(&sh.lock);
+            }
+            e_avl_knode *const got = avl_int_add(&sh.tree, kn, stack);
+            e_avl_knode *const gone = (got == kn) ? NULL : avl_int_rem(&sh.tree, key, stack);
+            if (optimistic) {
+                avl_seq_write_end(&sh.tree);
+            } else {
+                pthread_rwlock_unlock(&sh.lock);
+            }
+
+            /* Pool memory stays readable, so it can be recycled at once */
+            if (gone != NULL) {
+                avl_pool_free(&cache, gone, sizeof(*gone));
+                avl_pool_free(&cache, kn, sizeof(*kn));
+            }
+            ++n_writes;
+            clock_gettime(CLOCK_REALTIME, &now);
+        } while (elapsed_ns(&start, &now) < SEQ_RUN_NS);
+
+        __atomic_store_n(&sh.done, 1, __ATOMIC_RELEASE);
+        gets[optimistic] = 0;
+        for (int i = 0; i < n_readers; ++i) {
+            pthread_join(readers[i].thread, NULL);
+            gets[optimistic] += readers[i].gets;
+        }
+        writes[optimistic] = n_writes;
+    }
+
+    printf("Gets per second: rwlock %" PRIu64 ", seqlock %" PRIu64 "\n", gets[0], gets[1]);
+    printf("Writes per second: rwlock %" PRIu64 ", seqlock %" PRIu64 "\n", writes[0], writes[1]);
+
+    pthread_rwlock_destroy(&sh.lock);
+    avl_pool_release(&pool);
+
+    return 0;
+}
+
+#define NUM_CONC_OPS (1<<20)
+#define NUM_CONC_RANGE (1<<18)
+#define CONC_MAX_THREADS 64
+
+static avl_conc_tree_t conc_tree;
+
+struct conc_worker {
+    pthread_t thread;
+    int id;
+    int locked;              /* one tree under a mutex instead */
+    avl_tree_t *tree;
+    pthread_mutex_t *lock;
+};
+
+/* Half lookups, a quarter adds and a quarter removes, in a range of keys of
+ * the thread's own */
+static void *
+conc_worker(void *const arg)
+{
+    struct conc_worker *const w = arg;
+    avl_conc_thread_t *const th = w->locked ? NULL : avl_conc_thread_enter(&conc_tree);
+    unsigned rng = 0x9e3779b9u * (w->id + 1);
+    uint64_t const base = (uint64_t)w->id * NUM_CONC_RANGE;
+    void *stack[46];
+
+    for (int i = 0; i < NUM_CONC_OPS; ++i) {
+        unsigned const r = xorshift32(&rng);
+        uint64_t const key = base + r % NUM_CONC_RANGE;
+        unsigned const op = (r >> 24) & 3;
+
+        if (!w->locked) {
+            if (op < 2) {
+                (void)avl_conc_get(th, key);
+            } else if (op == 2) {
+                (void)avl_conc_add(th, key, (void *)(uintptr_t)(key + 1));
+            } else {
+                (void)avl_conc_rem(th, key);
+            }
+            continue;
+        }
+
+        if (op < 2) {
+            pthread_mutex_lock(w->lock);
+            (void)avl_int_get(w->tree, key);
+            pthread_mutex_unlock(w->lock);
+        } else if (op == 2) {
+            e_avl_knode *const kn = malloc(sizeof(*kn));
+            kn->key = key;
+            pthread_mutex_lock(w->lock);
+            e_avl_knode *const got = avl_int_add(w->tree, kn, stack);
+            pthread_mutex_unlock(w->lock);
+            if (got != kn) {
+                free(kn);
+            }
+        } else {
+            pthread_mutex_lock(w->lock);
+            e_avl_knode *const gone = avl_int_rem(w->tree, key, stack);
+            pthread_mutex_unlock(w->lock);
+            free(gone);
+        }
+    }
+
+    if (th != NULL) {
+        avl_conc_thread_leave(th);
+    }
+    return NULL;
+}
+
+static void
+conc_free_knodes(e_avl_node *const nd)
+{
+    if (nd != NULL) {
+        conc_free_knodes(nd->lc);
+        conc_free_knodes(nd->rc);
+        free(nd2knode(nd));
+    }
+}
+
+// The concurrent tree against one tree under a mutex, with 1 to `max_threads`
+// threads each doing NUM_CONC_OPS mixed operations on its own keys.
+static int
+concurrent_speed(int const max_threads)
+{
+    if (max_threads < 1 || max_threads > CONC_MAX_THREADS) {
+        fprintf(stderr, "avlspeed concurrent: between 1 and %d threads\n", CONC_MAX_THREADS);
+        return 1;
+    }
+    printf("NUM_OPS %d per thread, %ld online cpus\n", NUM_CONC_OPS, sysconf(_SC_NPROCESSORS_ONLN));
+
+    struct conc_worker workers[CONC_MAX_THREADS];
+    for (int n_threads = 1; n_threads <= max_threads; ++n_threads) {
+        double mops[2];
+
+        for (int locked = 0; locked < 2; ++locked) {
+            avl_tree_t tree = avl_tree_init();
+            pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+            avl_conc_init(&conc_tree);
+
+            struct timespec start, end;
+            clock_gettime(CLOCK_REALTIME, &start);
+            for (int i = 0; i < n_threads; ++i) {
+                workers[i] = (struct conc_worker) {
+                    .id = i, .locked = locked, .tree = &tree, .lock = &lock,
+                };
+                pthread_create(&workers[i].thread, NULL, conc_worker, &workers[i]);
+            }
+            for (int i = 0; i < n_threads; ++i) {
+                pthread_join(workers[i].thread, NULL);
+            }
+            clock_gettime(CLOCK_REALTIME, &end);
+            mops[locked] = 1e3 * n_threads * NUM_CONC_OPS / elapsed_ns(&start, &end);
+
+            avl_conc_destroy(&conc_tree);
+            conc_free_knodes(tree.m_top);
+        }
+
+        printf("%2d threads: %f million operations per second, under a mutex %f\n",
+                n_threads, mops[0], mops[1]);
+    }
+
+    return 0;
+}
+
+#define NUM_SHARD_OPS (1<<20)
+#define NUM_SHARD_RANGE (1<<20)
+
+struct shard_worker {
+    pthread_t thread;
+    int id;
+    int skewed;              /* most operations on one sixteenth of the keys */
+    avl_sharded_t *sh;       /* NULL for the tree under a mutex */
+    avl_tree_t *tree;
+    pthread_mutex_t *lock;
+};
+
+/* Half lookups, a quarter adds and a quarter removes, over keys shared by
+ * every thread */
+static void *
+shard_worker(void *const arg)
+{
+    struct shard_worker *const w = arg;
+    unsigned rng = 0x85ebca6bu * (w->id + 1);
+    void *stack[46];
+
+    for (int i = 0; i < NUM_SHARD_OPS; ++i) {
+        unsigned const r = xorshift32(&rng);
+        unsigned const range = (w->skewed && (r & 7) != 0) ? NUM_SHARD_RANGE / 16 : NUM_SHARD_RANGE;
+        uint64_t const key = xorshift32(&rng) % range;
+        unsigned const op = (r >> 24) & 3;
+
+        if (op < 2) {
+            if (w->sh != NULL) {
+                (void)avl_sharded_get(w->sh, key);
+            } else {
+                pthread_mutex_lock(w->lock);
+                (void)avl_int_get(w->tree, key);
+                pthread_mutex_unlock(w->lock);
+            }
+        } else if (op == 2) {
+            e_avl_knode *const kn = malloc(sizeof(*kn));
+            kn->key = key;
+            e_avl_knode *got;
+            if (w->sh != NULL) {
+                got = avl_sharded_add(w->sh, kn);
+            } else {
+                pthread_mutex_lock(w->lock);
+                got = avl_int_add(w->tree, kn, stack);
+                pthread_mutex_unlock(w->lock);
+            }
+            if (got != kn) {
+                free(kn);
+            }
+        } else {
+            e_avl_knode *gone;
+            if (w->sh != NULL) {
+                gone = avl_sharded_rem(w->sh, key);
+            } else {
+                pthread_mutex_lock(w->lock);
+                gone = avl_int_rem(w->tree, key, stack);
+                pthread_mutex_unlock(w->lock);
+            }
+            free(gone);
+        }
+    }
+    return NULL;
+}
+
+// `n_shards` range shards against one tree under a mutex, with `n_threads`
+// threads doing NUM_SHARD_OPS mixed operations each over shared keys, spread
+// evenly and then mostly on a sixteenth of them.
+static int
+sharded_speed(int const n_threads, unsigned const n_shards)
+{
+    if (n_threads < 1 || n_threads > CONC_MAX_THREADS || n_shards < 1 || n_shards > 4096) {
+        fprintf(stderr, "avlspeed sharded: 1 to %d threads, 1 to 4096 shards\n", CONC_MAX_THREADS);
+        return 1;
+    }
+    printf("NUM_OPS %d per thread, %d threads, %u shards, %ld online cpus\n", NUM_SHARD_OPS,
+            n_threads, n_shards, sysconf(_SC_NPROCESSORS_ONLN));
+
+    struct shard_worker workers[CONC_MAX_THREADS];
+    char const *const names[2] = { "even", "skewed" };
+
+    for (int skewed = 0; skewed < 2; ++skewed) {
+        double mops[2];
+        uint64_t moves = 0;
+
+        for (int locked = 0; locked < 2; ++locked) {
+            avl_sharded_t sh;
+            avl_tree_t tree = avl_tree_init();
+            pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+            if (!locked && !avl_sharded_init(&sh, n_shards, 0, NUM_SHARD_RANGE - 1)) {
+                fprintf(stderr, "avlspeed sharded: can't allocate the shards\n");
+                return 1;
+            }
+
+            struct timespec start, end;
+            clock_gettime(CLOCK_REALTIME, &start);
+            for (int i = 0; i < n_threads; ++i) {
+                workers[i] = (struct shard_worker) {
+                    .id = i, .skewed = skewed, .sh = locked ? NULL : &sh,
+                    .tree = &tree, .lock = &lock,
+                };
+                pthread_create(&workers[i].thread, NULL, shard_worker, &workers[i]);
+            }
+            for (int i = 0; i < n_threads; ++i) {
+                pthread_join(workers[i].thread, NULL);
+            }
+            clock_gettime(CLOCK_REALTIME, &end);
+            mops[locked] = 1e3 * n_threads * NUM_SHARD_OPS / elapsed_ns(&start, &end);
+
+            if (!locked) {
+                moves = sh.m_moves;
+                for (unsigned i = 0; i < n_shards; ++i) {
+                    conc_free_knodes(sh.m_shards[i].tree.m_top);
+                }
+                avl_sharded_destroy(&sh);
+            }
+            conc_free_knodes(tree.m_top);
+        }
+
+        printf("Keys %s: %f million operations per second sharded (%" PRIu64 " boundary moves), "
+                "under one mutex %f\n", names[skewed], mops[0], moves, mops[1]);
+    }
+
+    return 0;
+}
+
+struct clone_arena {
+    my_t *objs;
+    size_t n;
+};
+
+static bool
+clone_arena_alloc(size_t const n, void *const arg)
+{
+    struct clone_arena *const a = arg;
+    a->objs = malloc(sizeof(*a->objs) * n);
+    a->n = n;
+    return a->objs != NULL;
+}
+
+static e_avl_node *
+clone_arena_copy(e_avl_node const*const src, size_t const i, void *const arg)
+{
+    struct clone_arena *const a = arg;
+    a->objs[i].my_key = ((my_t const*)src)->my_key;
+    return &a->objs[i].ok;
+}
+
+// Copying a tree of 2^n objects by adding each object's copy to a new tree,
+// against `avl_base_clone` on one thread and on `threads` more.
+static int
+clone_speed(int const log2_objs, unsigned const threads)
+{
+    size_t const n_objs = (size_t)1 << log2_objs;
+    printf("NUM_OBJS %zu, %u extra threads, %ld online cpus\n", n_objs, threads,
+            sysconf(_SC_NPROCESSORS_ONLN));
+    printf("Tree nodes occupy %zu MiB\n", (n_objs * sizeof(my_t)) >> 20);
+
+    avl_tree_t tree;
+    my_t *objs = malloc(sizeof(*objs) * n_objs);
+    build_scattered(&tree, objs, n_objs);
+
+    struct timespec start, end;
+    void *stack[64];
+
+    my_t *copies = malloc(sizeof(*copies) * n_objs);
+    avl_tree_t readd = avl_tree_init();
+    clock_gettime(CLOCK_REALTIME, &start);
+    avl_iter_t iter = avl_iter_init(&tree, stack);
+    size_t i = 0;
+    for (e_avl_node *nd = avl_iter_first(&iter); nd != NULL; nd = avl_iter_next(&iter), ++i) {
+        copies[i].my_key = ((my_t *)nd)->my_key;
+        (void)avl_my_add(&readd, &copies[i]);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const readd_ns = elapsed_ns(&start, &end);
+    assert(avl_size(&readd) == n_objs);
+    free(copies);
+
+    uint64_t clone_ns[2];
+    unsigned const n_threads[2] = { 0, threads };
+    for (int run = 0; run < 2; ++run) {
+        struct clone_arena a = { NULL, 0 };
+        avl_tree_t clone = avl_tree_init();
+        clock_gettime(CLOCK_REALTIME, &start);
+        bool const ok = avl_base_clone(&clone, &tree, clone_arena_alloc, clone_arena_copy, &a, n_threads[run]);
+        clock_gettime(CLOCK_REALTIME, &end);
+        clone_ns[run] = elapsed_ns(&start, &end);
+        assert(ok && avl_size(&clone) == n_objs && avl_height(&clone) == avl_height(&tree));
+        (void)ok;
+        free(a.objs);
+    }
+
+    printf("Average time to copy a node by adding it: %f nanoseconds\n", 1.0 * readd_ns / n_objs);
+    printf("Average time to clone a node: %f nanoseconds\n", 1.0 * clone_ns[0] / n_objs);
+    printf("Average time to clone a node with %u extra threads: %f nanoseconds\n", threads,
+            1.0 * clone_ns[1] / n_objs);
+
+    free(objs);
+    return 0;
+}
+
+static void
+file_encode(e_avl_node const*const nd, void *const record, void *const arg)
+{
+    (void)arg;
+    int32_t const key = ((my_t const*)nd)->my_key;
+    memcpy(record, &key, sizeof(key));
+}
+
+static e_avl_node *
+file_decode(void const*const record, size_t const i, void *const arg)
+{
+    struct clone_arena *const a = arg;
+    int32_t key;
+    memcpy(&key, record, sizeof(key));
+    a->objs[i].my_key = key;
+    return &a->objs[i].ok;
+}
+
+// Saving a tree of 2^n objects, then loading it back by adding every record
+// to a tree, against `avl_file_load`, against just reading the records. The
+// file is in the page cache throughout.
+static int
+file_speed(int const log2_objs)
+{
+    size_t const n_objs = (size_t)1 << log2_objs;
+    printf("NUM_OBJS %zu\n", n_objs);
+
+    avl_tree_t tree;
+    my_t *objs = malloc(sizeof(*objs) * n_objs);
+    build_scattered(&tree, objs, n_objs);
+
+    char path[] = "/tmp/avlspeed.XXXXXX";
+    int const fd = mkstemp(path);
+    if (fd < 0) {
+        perror("avlspeed file: mkstemp");
+        return 1;
+    }
+    (void)unlink(path);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_REALTIME, &start);
+    bool const written = avl_file_write_tree(fd, &tree, sizeof(int32_t), file_encode, NULL);
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const write_ns = elapsed_ns(&start, &end);
+    avl_file_t f;
+    if (!written || !avl_file_map(&f, fd, sizeof(int32_t))) {
+        fprintf(stderr, "avlspeed file: can't write the file\n");
+        return 1;
+    }
+    printf("File occupies %zu MiB\n", f.m_len >> 20);
+
+    // Just reading every record, as the floor for any way of loading them
+    clock_gettime(CLOCK_REALTIME, &start);
+    int64_t sum = 0;
+    for (size_t i = 0; i < n_objs; ++i) {
+        int32_t key;
+        memcpy(&key, avl_file_record(&f, i), sizeof(key));
+        sum += key;
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const read_ns = elapsed_ns(&start, &end);
+
+    my_t *copies = malloc(sizeof(*copies) * n_objs);
+    avl_tree_t readd = avl_tree_init();
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (size_t i = 0; i < n_objs; ++i) {
+        int32_t key;
+        memcpy(&key, avl_file_record(&f, i), sizeof(key));
+        copies[i].my_key = key;
+        (void)avl_my_add(&readd, &copies[i]);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const readd_ns = elapsed_ns(&start, &end);
+    assert(avl_size(&readd) == n_objs);
+    free(copies);
+
+    struct clone_arena a = { NULL, 0 };
+    avl_tree_t loaded = avl_tree_init();
+    clock_gettime(CLOCK_REALTIME, &start);
+    bool const ok = avl_file_load(&loaded, &f, clone_arena_alloc, file_decode, &a);
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const load_ns = elapsed_ns(&start, &end);
+    assert(ok && avl_size(&loaded) == n_objs);
+    (void)ok;
+
+    printf("Average time to write a record: %f nanoseconds\n", 1.0 * write_ns / n_objs);
+    printf("Average time to read a record: %f nanoseconds (sum %" PRId64 ")\n", 1.0 * read_ns / n_objs, sum);
+    printf("Average time to load a record by adding it: %f nanoseconds\n", 1.0 * readd_ns / n_objs);
+    printf("Average time to load a record: %f nanoseconds\n", 1.0 * load_ns / n_objs);
+
+    free(a.objs);
+    avl_file_unmap(&f);
+    close(fd);
+    free(objs);
+    return 0;
+}
+
+#define NUM_ALLOC_OBJS (1<<20)
+
+#define ALLOC_MALLOC 0
+#define ALLOC_POOL   1
+#define ALLOC_HUGE   2
+
+// Objects allocated one at a time, as real callers do, from malloc or from
+// a pool (optionally on huge pages): fill a tree, look every key up, then
+// drop it all.
+static int
+alloc_speed(int const mode)
+{
+    char const*const names[3] = { "malloc", "pool", "pool with huge pages" };
+    printf("Allocating %d objects with %s\n", NUM_ALLOC_OBJS, names[mode]);
+
+    unsigned rng = time(NULL);
+    uint32_t *order = malloc(sizeof(*order) * NUM_ALLOC_OBJS);
+    my_t **objs = malloc(sizeof(*objs) * NUM_ALLOC_OBJS);
+    for (uint32_t i = 0; i < NUM_ALLOC_OBJS; ++i) {
+        order[i] = i;
+    }
+    shuffle(order, NUM_ALLOC_OBJS, &rng);
+
+    avl_pool_t pool;
+    avl_pool_cache_t cache;
+    if (mode != ALLOC_MALLOC) {
+        if (!avl_pool_init(&pool, (size_t)NUM_ALLOC_OBJS * 2 * sizeof(my_t), (mode == ALLOC_HUGE) ? AVL_POOL_HUGE : 0)) {
+            fprintf(stderr, "avlspeed alloc: couldn't reserve the pool\n");
+            return 1;
+        }
+        cache = avl_pool_cache(&pool);
+    }
+
+    struct timespec start, end;
+    avl_tree_t tree = avl_tree_init();
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (uint32_t i = 0; i < NUM_ALLOC_OBJS; ++i) {
+        my_t *const o = (mode == ALLOC_MALLOC) ? malloc(sizeof(*o)) : avl_pool_alloc(&cache, sizeof(*o));
+        o->my_key = (int)((order[i] * 0x9e3779b1u) & 0x7fffffffu);
+        objs[order[i]] = o;
+        (void)avl_my_add(&tree, o);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const add_ns = elapsed_ns(&start, &end);
+
+    shuffle(order, NUM_ALLOC_OBJS, &rng);
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (uint32_t i = 0; i < NUM_ALLOC_OBJS; ++i) {
+        my_t *const o = objs[order[i]];
+        assert(avl_my_get(&tree, o->my_key) == o);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const get_ns = elapsed_ns(&start, &end);
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    if (mode == ALLOC_MALLOC) {
+        for (uint32_t i = 0; i < NUM_ALLOC_OBJS; ++i) {
+            free(objs[i]);
+        }
+    } else {
+        avl_pool_release(&pool);
+    }
+    tree = avl_tree_init();
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const drop_ns = elapsed_ns(&start, &end);
+
+    printf("Average time to allocate and add a node: %f nanoseconds\n", 1.0 * add_ns / NUM_ALLOC_OBJS);
+    printf("Average time to get a node: %f nanoseconds\n", 1.0 * get_ns / NUM_ALLOC_OBJS);
+    printf("Time to drop the tree: %f milliseconds\n", drop_ns / 1e6);
+
+    free(objs);
+    free(order);
+
+    return 0;
+}
 
 int
-main(void)
+main(int argc, char **argv)
 {
+    if (argc > 1 && strcmp(argv[1], "batch") == 0) {
+        return batch_speed((argc > 2) ? atoi(argv[2]) : 24);
+    }
+    if (argc > 1 && strcmp(argv[1], "ingest") == 0) {
+        return ingest_speed();
+    }
+    if (argc > 1 && strcmp(argv[1], "nearly") == 0) {
+        return nearly_sorted_speed();
+    }
+    if (argc > 1 && strcmp(argv[1], "compact") == 0) {
+        return compact_speed();
+    }
+    if (argc > 1 && strcmp(argv[1], "alloc") == 0) {
+        if (argc > 2 && strcmp(argv[2], "malloc") == 0) {
+            return alloc_speed(ALLOC_MALLOC);
+        } else if (argc > 2 && strcmp(argv[2], "pool") == 0) {
+            return alloc_speed(ALLOC_POOL);
+        } else if (argc > 2 && strcmp(argv[2], "huge") == 0) {
+            return alloc_speed(ALLOC_HUGE);
+        }
+        return alloc_speed(ALLOC_MALLOC) || alloc_speed(ALLOC_POOL) || alloc_speed(ALLOC_HUGE);
+    }
+    if (argc > 1 && strcmp(argv[1], "intkey") == 0) {
+        return intkey_speed((argc > 2) ? strtoull(argv[2], NULL, 0) : (1 << 20));
+    }
+    if (argc > 1 && strcmp(argv[1], "relayout") == 0) {
+        return relayout_speed((argc > 2) ? strtoull(argv[2], NULL, 0) : (1 << 20),
+                (argc > 3) ? strtoull(argv[3], NULL, 0) : 4096);
+    }
+    if (argc > 1 && strcmp(argv[1], "frozen") == 0) {
+        return frozen_speed((argc > 2) ? strtoull(argv[2], NULL, 0) : (1 << 22));
+    }
+    if (argc > 1 && strcmp(argv[1], "seqlock") == 0) {
+        return seqlock_speed((argc > 2) ? atoi(argv[2]) : 4);
+    }
+    if (argc > 1 && strcmp(argv[1], "concurrent") == 0) {
+        return concurrent_speed((argc > 2) ? atoi(argv[2]) : 4);
+    }
+    if (argc > 1 && strcmp(argv[1], "sharded") == 0) {
+        return sharded_speed((argc > 2) ? atoi(argv[2]) : 4,
+                (argc > 3) ? strtoul(argv[3], NULL, 0) : 16);
+    }
+    if (argc > 1 && strcmp(argv[1], "clone") == 0) {
+        return clone_speed((argc > 2) ? atoi(argv[2]) : 22,
+                (argc > 3) ? strtoul(argv[3], NULL, 0) : 3);
+    }
+    if (argc > 1 && strcmp(argv[1], "file") == 0) {
+        return file_speed((argc > 2) ? atoi(argv[2]) : 22);
+    }
+    if (argc > 1 && strcmp(argv[1], "index") == 0) {
+        return index_speed((argc > 2) ? strtoull(argv[2], NULL, 0) : 1000000);
+    }
+
     printf("NUM_OBJS %d\n", NUM_OBJS);
     printf("NUM_INNER_LOOP %d\n", NUM_INNER_LOOP);
     unsigned rng = time(NULL);
@@ -40,19 +1389,47 @@ main(void)
 
     struct timespec start, end;
     uint64_t get_ns = 0;
+    uint64_t bound_ns = 0;
     uint64_t add_ns = 0;
     uint64_t rem_ns = 0;
 
 
+    // Make the keys distinct, and collect the objects in key order
+    my_t **sorted = malloc(sizeof(*sorted) * NUM_OBJS);
     for (int i = 0; i < NUM_OBJS; ++i) {
-        // Put all the objects into the tree
-        my_t *a = avl_my_add(&tree, &objs[i]);
-        while (a != &objs[i]) {
-            objs[i].my_key = (int)(xorshift32(&rng) & 0xefffffffu);
-            a = avl_my_add(&tree, &objs[i]);
+        sorted[i] = &objs[i];
+    }
+    qsort(sorted, NUM_OBJS, sizeof(*sorted), objcmp);
+    for (int i = 1; i < NUM_OBJS; ++i) {
+        if (sorted[i]->my_key <= sorted[i - 1]->my_key) {
+            sorted[i]->my_key = sorted[i - 1]->my_key + 1;
         }
     }
 
+    // Time putting all the objects into the tree one at a time, against
+    // linking them all at once from key order.
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (int i = 0; i < NUM_OBJS; ++i) {
+        my_t *const a = avl_my_add(&tree, &objs[i]);
+        assert(a == &objs[i]);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const fill_ns = (end.tv_sec - start.tv_sec)*UINT64_C(1000000000) + (end.tv_nsec - start.tv_nsec);
+
+    e_avl_node **nodes = malloc(sizeof(*nodes) * NUM_OBJS);
+    for (int i = 0; i < NUM_OBJS; ++i) {
+        nodes[i] = &sorted[i]->ok;
+    }
+
+    tree = avl_tree_init();
+    clock_gettime(CLOCK_REALTIME, &start);
+    avl_base_build_sorted(&tree, nodes, NUM_OBJS);
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t const build_ns = (end.tv_sec - start.tv_sec)*UINT64_C(1000000000) + (end.tv_nsec - start.tv_nsec);
+
+    free(nodes);
+    free(sorted);
+
     my_t **ptrs = malloc(sizeof(*ptrs) * NUM_INNER_LOOP);
 
     for (int i = 0; i < NUM_LOOPS; ++i) {
@@ -66,6 +1443,16 @@ main(void)
 
         get_ns += (end.tv_sec - start.tv_sec)*UINT64_C(1000000000) + (end.tv_nsec - start.tv_nsec);
 
+        clock_gettime(CLOCK_REALTIME, &start);
+        for (int j = 0; j < NUM_INNER_LOOP; ++j) {
+            int const key = (int)(xorshift32(&rng) & 0xefffffffu);
+            my_t *b = avl_my_lower_bound(&tree, key);
+            assert(b == NULL || b->my_key >= key);
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+
+        bound_ns += (end.tv_sec - start.tv_sec)*UINT64_C(1000000000) + (end.tv_nsec - start.tv_nsec);
+
         clock_gettime(CLOCK_REALTIME, &start);
         unsigned const start_idx = xorshift32(&rng) % NUM_OBJS;
         for (int j = 0; j < NUM_INNER_LOOP; ++j) {
@@ -88,11 +1475,30 @@ main(void)
         add_ns += (end.tv_sec - start.tv_sec)*UINT64_C(1000000000) + (end.tv_nsec - start.tv_nsec);
     }
 
+    // Full in-order scans, to measure the per-step cost of the iterator
+    void *stack[45];
+    avl_iter_t iter = avl_iter_init(&tree, stack);
+    uint64_t scan_ns = 0;
+    size_t scanned = 0;
+    for (int i = 0; i < NUM_SCANS; ++i) {
+        clock_gettime(CLOCK_REALTIME, &start);
+        for (e_avl_node *n = avl_iter_first(&iter); n != NULL; n = avl_iter_next(&iter)) {
+            ++scanned;
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        scan_ns += (end.tv_sec - start.tv_sec)*UINT64_C(1000000000) + (end.tv_nsec - start.tv_nsec);
+    }
+    assert(scanned == (size_t)NUM_SCANS * NUM_OBJS);
+
     double const divisor = 1.0 * NUM_LOOPS * NUM_INNER_LOOP;
     printf("Ran test with a tree of size %d\n", NUM_OBJS);
+    printf("Time to fill the tree by adding: %f milliseconds\n", fill_ns / 1e6);
+    printf("Time to fill the tree by building from sorted: %f milliseconds\n", build_ns / 1e6);
     printf("Average time to get a node: %f nanoseconds\n", 1.0 * get_ns / divisor);
+    printf("Average time to find a lower bound: %f nanoseconds\n", 1.0 * bound_ns / divisor);
     printf("Average time to add a node: %f nanoseconds\n", 1.0 * add_ns / divisor);
     printf("Average time to remove a node: %f nanoseconds\n", 1.0 * rem_ns / divisor);
+    printf("Average time to step a scan: %f nanoseconds\n", 1.0 * scan_ns / scanned);
 
     free(objs);
     free(ptrs);
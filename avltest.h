@@ -43,5 +43,24 @@ TOP(avl_tree_t *const tree)
     return nd2t(tree->m_top);
 }
 
+// Recursively verify the stored heights and balance factors below `m`,
+// returning the height of the subtree.
+static inline int
+CHECK(my_t *const m)
+{
+    if (m == NULL) return 0;
+
+    int const lh = CHECK(leftc(m));
+    int const rh = CHECK(rightc(m));
+    assert(m->ok.height == 1 + ((lh > rh) ? lh : rh));
+    assert(rh - lh >= -1 && rh - lh <= 1);
+#ifdef AVL_SUBTREE_COUNT
+    assert(m->ok.count == 1 + avl_node_count(m->ok.lc) + avl_node_count(m->ok.rc));
+#endif
+    if (leftc(m) != NULL) assert(KEY(leftc(m)) < KEY(m));
+    if (rightc(m) != NULL) assert(KEY(rightc(m)) > KEY(m));
+    return m->ok.height;
+}
+
 #endif
 
@@ -0,0 +1,104 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "avlhelper.h"
+#include "avltest.h"
+
+int
+main(void)
+{
+    avl_tree_t t = avl_tree_init();
+    avl_tree_t *const tree = &t;
+
+    void *stack[45];
+    avl_iter_t it = avl_iter_init(tree, stack);
+    avl_iter_t *const iter = &it;
+
+    // Iterating an empty tree yields nothing
+    assert(avl_iter_first(iter) == NULL);
+    assert(avl_iter_last(iter) == NULL);
+    assert(avl_my_seek(iter, 0) == NULL);
+
+    // Insert the even numbers 0..2*(n-1) in a scrambled order
+    int const n_objs = 1000;
+    my_t *objs = malloc(sizeof(*objs) * n_objs);
+    for (int i = 0; i < n_objs; ++i) {
+        objs[i].my_key = ((i * 7919) % n_objs) * 2;
+        avl_my_add(tree, &objs[i]);
+    }
+    assert(avl_size(tree) == n_objs);
+
+    {
+        // Forward scan visits every key in order
+        int expect = 0;
+        for (my_t *m = nd2t(avl_iter_first(iter)); m != NULL; m = nd2t(avl_iter_next(iter))) {
+            assert(KEY(m) == expect);
+            assert(nd2t(avl_iter_cur(iter)) == m);
+            expect += 2;
+        }
+        assert(expect == n_objs * 2);
+        assert(avl_iter_cur(iter) == NULL);
+        assert(avl_iter_next(iter) == NULL);
+    }
+
+    {
+        // Backward scan visits every key in reverse order
+        int expect = (n_objs - 1) * 2;
+        for (my_t *m = nd2t(avl_iter_last(iter)); m != NULL; m = nd2t(avl_iter_prev(iter))) {
+            assert(KEY(m) == expect);
+            expect -= 2;
+        }
+        assert(expect == -2);
+    }
+
+    {
+        // Stepping back and forth returns to the same node
+        my_t *m = avl_my_seek(iter, 500);
+        assert(KEY(m) == 500);
+        assert(KEY(nd2t(avl_iter_next(iter))) == 502);
+        assert(KEY(nd2t(avl_iter_prev(iter))) == 500);
+        assert(KEY(nd2t(avl_iter_prev(iter))) == 498);
+    }
+
+    {
+        // Seeking positions at the first key not less than the target
+        assert(KEY(avl_my_seek(iter, -5)) == 0);
+        assert(KEY(avl_my_seek(iter, 0)) == 0);
+        assert(KEY(avl_my_seek(iter, 1)) == 2);
+        assert(KEY(avl_my_seek(iter, 777)) == 778);
+        assert(KEY(nd2t(avl_iter_next(iter))) == 780);
+        assert(KEY(avl_my_seek(iter, (n_objs - 1) * 2)) == (n_objs - 1) * 2);
+        assert(avl_iter_next(iter) == NULL);
+        assert(avl_my_seek(iter, (n_objs - 1) * 2 + 1) == NULL);
+    }
+
+    {
+        // Mutating the tree invalidates the iterator
+        my_t *m = avl_my_seek(iter, 100);
+        assert(KEY(m) == 100);
+        assert(avl_iter_valid(iter));
+
+        my_t *const e = avl_my_rem(tree, 102);
+        assert(KEY(e) == 102);
+        assert(!avl_iter_valid(iter));
+        assert(avl_iter_cur(iter) == NULL);
+        assert(avl_iter_next(iter) == NULL);
+        assert(avl_iter_prev(iter) == NULL);
+
+        // Repositioning makes it usable again
+        assert(KEY(avl_my_seek(iter, 100)) == 100);
+        assert(KEY(nd2t(avl_iter_next(iter))) == 104);
+
+        avl_my_add(tree, e);
+        assert(avl_iter_next(iter) == NULL);
+        assert(KEY(avl_my_seek(iter, 101)) == 102);
+    }
+
+    free(objs);
+
+    return 0;
+}
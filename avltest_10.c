@@ -0,0 +1,79 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "avlhelper.h"
+#include "avltest.h"
+
+int
+main(void)
+{
+    int const max_objs = 300;
+    my_t *objs = malloc(sizeof(*objs) * max_objs);
+    e_avl_node **nodes = malloc(sizeof(*nodes) * max_objs);
+    for (int i = 0; i < max_objs; ++i) {
+        objs[i].my_key = i * 3;
+        nodes[i] = &objs[i].ok;
+    }
+
+    void *stack[45];
+
+    // Every size builds a valid, minimal height tree holding every node
+    for (int n = 0; n <= max_objs; ++n) {
+        avl_tree_t t = avl_tree_init();
+        avl_tree_t *const tree = &t;
+
+        avl_base_build_sorted(tree, nodes, n);
+        assert(avl_size(tree) == n);
+
+        int const h = CHECK(TOP(tree));
+        int min_h = 0;
+        while ((1 << min_h) <= n) ++min_h;
+        assert(h == min_h);
+
+        avl_iter_t iter = avl_iter_init(tree, stack);
+        int i = 0;
+        for (my_t *m = nd2t(avl_iter_first(&iter)); m != NULL; m = nd2t(avl_iter_next(&iter))) {
+            assert(m == &objs[i]);
+            ++i;
+        }
+        assert(i == n);
+
+        // A built tree behaves like any other
+        for (int j = 0; j < n; ++j) {
+            assert(avl_my_get(tree, j * 3) == &objs[j]);
+            assert(avl_my_get(tree, j * 3 + 1) == NULL);
+        }
+        for (int j = 0; j < n; j += 2) {
+            assert(avl_my_rem(tree, j * 3) == &objs[j]);
+        }
+        CHECK(TOP(tree));
+        for (int j = 0; j < n; j += 2) {
+            assert(avl_my_add(tree, &objs[j]) == &objs[j]);
+        }
+        CHECK(TOP(tree));
+        assert(avl_size(tree) == n);
+    }
+
+    {
+        // Building over a populated tree replaces its contents
+        avl_tree_t t = avl_tree_init();
+        avl_tree_t *const tree = &t;
+        for (int i = 0; i < 10; ++i) {
+            avl_my_add(tree, &objs[i]);
+        }
+        avl_base_build_sorted(tree, nodes + 100, 7);
+        assert(avl_size(tree) == 7);
+        assert(avl_my_get(tree, 0) == NULL);
+        assert(avl_my_get(tree, 300) == &objs[100]);
+        CHECK(TOP(tree));
+    }
+
+    free(nodes);
+    free(objs);
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "avlhelper.h"
+#include "avltest.h"
+
+// Check that `tree` holds exactly the keys lo, lo+2, ... below hi, in order
+static void
+check_range(avl_tree_t *const tree, int const lo, int const hi)
+{
+    void *stack[45];
+    avl_iter_t iter = avl_iter_init(tree, stack);
+
+    CHECK(TOP(tree));
+    int expect = lo;
+    for (my_t *m = nd2t(avl_iter_first(&iter)); m != NULL; m = nd2t(avl_iter_next(&iter))) {
+        assert(KEY(m) == expect);
+        expect += 2;
+    }
+    assert(expect >= hi);
+    assert(avl_size(tree) == (size_t)(expect - lo) / 2);
+}
+
+int
+main(void)
+{
+    int const n_objs = 200;
+    my_t *objs = malloc(sizeof(*objs) * n_objs);
+
+    void *stack[46];
+
+    // Split a tree at every key and between every pair of keys, then glue it
+    // back together.
+    for (int cut = -1; cut <= n_objs * 2 + 1; ++cut) {
+        avl_tree_t l = avl_tree_init();
+        avl_tree_t r = avl_tree_init();
+
+        for (int i = 0; i < n_objs; ++i) {
+            objs[i].my_key = ((i * 37) % n_objs) * 2;
+            avl_my_add(&l, &objs[i]);
+        }
+
+        avl_my_split(&l, cut, &r);
+
+        int first_right = (cut <= 0) ? 0 : ((cut + 1) / 2) * 2;
+        if (first_right > n_objs * 2) first_right = n_objs * 2;
+        check_range(&l, 0, first_right);
+        check_range(&r, first_right, n_objs * 2);
+        assert(avl_size(&l) + avl_size(&r) == n_objs);
+
+        avl_base_join(&l, &r, stack);
+        assert(avl_size(&r) == 0 && TOP(&r) == NULL);
+        check_range(&l, 0, n_objs * 2);
+    }
+
+    // Join trees of very different heights
+    for (int n_left = 0; n_left <= 64; ++n_left) {
+        for (int n_right = 0; n_right <= 64; n_right += 7) {
+            avl_tree_t l = avl_tree_init();
+            avl_tree_t r = avl_tree_init();
+
+            for (int i = 0; i < n_left; ++i) {
+                objs[i].my_key = i * 2;
+                avl_my_add(&l, &objs[i]);
+            }
+            for (int i = 0; i < n_right; ++i) {
+                objs[n_left + i].my_key = (n_left + i) * 2;
+                avl_my_add(&r, &objs[n_left + i]);
+            }
+
+            unsigned const gen = l.m_gen;
+            avl_base_join(&l, &r, stack);
+            assert(n_right == 0 || l.m_gen != gen);
+            check_range(&l, 0, (n_left + n_right) * 2);
+
+            // The joined tree is still usable
+            if (n_left + n_right > 0) {
+                assert(avl_my_rem(&l, 0) == &objs[0]);
+                assert(avl_my_add(&l, &objs[0]) == &objs[0]);
+                check_range(&l, 0, (n_left + n_right) * 2);
+            }
+        }
+    }
+
+    // Halves whose sizes the split left unknown stay countable through adds,
+    // removes and joins, and are known again once emptied
+    {
+        avl_tree_t l = avl_tree_init();
+        avl_tree_t r = avl_tree_init();
+        for (int i = 0; i < n_objs; ++i) {
+            objs[i].my_key = i * 2;
+            avl_my_add(&l, &objs[i]);
+        }
+
+        avl_my_split(&l, n_objs, &r);
+#ifndef AVL_SUBTREE_COUNT
+        assert(l.m_size == AVL_SIZE_UNKNOWN && r.m_size == AVL_SIZE_UNKNOWN);
+#endif
+        assert(avl_size(&l) == (size_t)n_objs / 2 && avl_size(&r) == (size_t)n_objs / 2);
+
+        assert(avl_my_rem(&l, 0) == &objs[0]);
+        assert(avl_size(&l) == (size_t)n_objs / 2 - 1);
+        assert(avl_my_add(&l, &objs[0]) == &objs[0]);
+        assert(avl_size(&l) == (size_t)n_objs / 2);
+
+        avl_base_join(&l, &r, stack);
+        check_range(&l, 0, n_objs * 2);
+
+        // Splitting off nothing leaves the size as it was
+        avl_my_split(&l, n_objs * 2, &r);
+        assert(avl_size(&r) == 0 && r.m_size == 0);
+        check_range(&l, 0, n_objs * 2);
+
+        for (int i = 0; i < n_objs; ++i) {
+            assert(avl_my_rem(&l, i * 2) == &objs[i]);
+        }
+        assert(l.m_size == 0 && TOP(&l) == NULL);
+        assert(avl_my_add(&l, &objs[0]) == &objs[0]);
+        assert(l.m_size == 1);
+    }
+
+    // Splitting an empty tree produces two empty trees
+    {
+        avl_tree_t l = avl_tree_init();
+        avl_tree_t r = avl_tree_init();
+        avl_my_split(&l, 5, &r);
+        assert(avl_size(&l) == 0 && avl_size(&r) == 0);
+        assert(TOP(&l) == NULL && TOP(&r) == NULL);
+    }
+
+    free(objs);
+
+    return 0;
+}
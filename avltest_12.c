@@ -0,0 +1,135 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "avlhelper.h"
+#include "avltest.h"
+
+#define KEY_RANGE 6000
+
+static unsigned
+xorshift32(unsigned *const p_rng)
+{
+    unsigned x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return x;
+}
+
+// Fill `tree` with the keys for which `in` is set, using objects from `objs`
+static void
+fill(avl_tree_t *const tree, my_t *const objs, bool const*const in)
+{
+    *tree = avl_tree_init();
+    for (int k = 0; k < KEY_RANGE; ++k) {
+        if (in[k]) {
+            objs[k].my_key = k;
+            avl_my_add(tree, &objs[k]);
+        }
+    }
+}
+
+// Check that `tree` holds exactly the keys for which `in` is set
+static void
+check_set(avl_tree_t *const tree, my_t *const objs, bool const*const in)
+{
+    void *stack[45];
+    avl_iter_t iter = avl_iter_init(tree, stack);
+
+    CHECK(TOP(tree));
+    size_t count = 0;
+    int k = -1;
+    for (my_t *m = nd2t(avl_iter_first(&iter)); m != NULL; m = nd2t(avl_iter_next(&iter))) {
+        assert(KEY(m) > k);
+        for (++k; k < KEY(m); ++k) {
+            assert(!in[k]);
+        }
+        assert(in[k]);
+        assert(m == &objs[k]);
+        ++count;
+    }
+    for (++k; k < KEY_RANGE; ++k) {
+        assert(!in[k]);
+    }
+    assert(avl_size(tree) == count);
+}
+
+int
+main(void)
+{
+    unsigned rng = 0xdeadbeefu;
+
+    my_t *a_objs = malloc(sizeof(*a_objs) * KEY_RANGE);
+    my_t *b_objs = malloc(sizeof(*b_objs) * KEY_RANGE);
+    bool a_in[KEY_RANGE];
+    bool b_in[KEY_RANGE];
+    bool expect[KEY_RANGE];
+
+    // Densities chosen to cover tiny, lopsided and similar sized inputs, run
+    // both serially and with enough threads that halves get forked.
+    unsigned const densities[] = { 0, 1, 10, 50, 90, 100 };
+    int const n_densities = sizeof(densities)/sizeof(*densities);
+
+    for (unsigned threads = 0; threads <= 4; threads += 4) {
+        for (int da = 0; da < n_densities; ++da) {
+            for (int db = 0; db < n_densities; ++db) {
+                for (int k = 0; k < KEY_RANGE; ++k) {
+                    a_in[k] = xorshift32(&rng) % 100 < densities[da];
+                    b_in[k] = xorshift32(&rng) % 100 < densities[db];
+                }
+
+                avl_tree_t a, b;
+
+                // Union keeps the node from the destination on a collision
+                fill(&a, a_objs, a_in);
+                fill(&b, b_objs, b_in);
+                avl_my_union(&a, &b, threads);
+                assert(avl_size(&b) == 0 && TOP(&b) == NULL);
+                {
+                    void *stack[45];
+                    avl_iter_t iter = avl_iter_init(&a, stack);
+                    size_t count = 0;
+                    for (my_t *m = nd2t(avl_iter_first(&iter)); m != NULL; m = nd2t(avl_iter_next(&iter))) {
+                        int const k = KEY(m);
+                        assert(a_in[k] || b_in[k]);
+                        assert(m == (a_in[k] ? &a_objs[k] : &b_objs[k]));
+                        ++count;
+                    }
+                    for (int k = 0; k < KEY_RANGE; ++k) {
+                        count -= (a_in[k] || b_in[k]);
+                    }
+                    assert(count == 0);
+                    assert(CHECK(TOP(&a)) == avl_height(&a));
+                }
+
+                fill(&a, a_objs, a_in);
+                fill(&b, b_objs, b_in);
+                avl_my_intersection(&a, &b, threads);
+                for (int k = 0; k < KEY_RANGE; ++k) {
+                    expect[k] = a_in[k] && b_in[k];
+                }
+                check_set(&a, a_objs, expect);
+                check_set(&b, b_objs, b_in);
+
+                fill(&a, a_objs, a_in);
+                fill(&b, b_objs, b_in);
+                avl_my_difference(&a, &b, threads);
+                for (int k = 0; k < KEY_RANGE; ++k) {
+                    expect[k] = a_in[k] && !b_in[k];
+                }
+                check_set(&a, a_objs, expect);
+                check_set(&b, b_objs, b_in);
+            }
+        }
+    }
+
+    free(a_objs);
+    free(b_objs);
+
+    return 0;
+}
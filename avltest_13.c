@@ -0,0 +1,174 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "avlhelper.h"
+#include "avltest.h"
+
+// Built with AVL_SUBTREE_COUNT
+
+static unsigned
+xorshift32(unsigned *const p_rng)
+{
+    unsigned x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return x;
+}
+
+// Check that select and rank agree with an in-order walk
+static void
+check_order(avl_tree_t *const tree)
+{
+    void *stack[45];
+    avl_iter_t iter = avl_iter_init(tree, stack);
+
+    CHECK(TOP(tree));
+    assert(avl_node_count(tree->m_top) == avl_size(tree));
+
+    size_t i = 0;
+    for (my_t *m = nd2t(avl_iter_first(&iter)); m != NULL; m = nd2t(avl_iter_next(&iter))) {
+        assert(avl_my_select(tree, i) == m);
+        assert(avl_my_rank(tree, KEY(m)) == i);
+        assert(avl_my_rank(tree, KEY(m) + 1) == i + 1);
+        ++i;
+    }
+    assert(i == avl_size(tree));
+    assert(avl_my_select(tree, i) == NULL);
+
+    // Range counts are differences of ranks
+    for (size_t a = 0; a < i; a += 17) {
+        for (size_t b = a; b < i; b += 29) {
+            int const lo = KEY(avl_my_select(tree, a));
+            int const hi = KEY(avl_my_select(tree, b));
+            assert(avl_my_range_count(tree, lo, hi) == b - a);
+            assert(avl_my_range_count(tree, lo + 1, hi + 1) == b - a);
+            assert(avl_my_range_count(tree, hi, lo) == 0);
+        }
+    }
+}
+
+int
+main(void)
+{
+    unsigned rng = 0xdeadbeefu;
+
+    avl_tree_t t = avl_tree_init();
+    avl_tree_t *const tree = &t;
+
+    // An empty tree
+    assert(avl_my_select(tree, 0) == NULL);
+    assert(avl_my_rank(tree, 5) == 0);
+
+    // Keys are multiples of 4 so there's always room for a key in between
+    int const n_objs = 500;
+    my_t *objs = malloc(sizeof(*objs) * n_objs);
+    for (int i = 0; i < n_objs; ++i) {
+        objs[i].my_key = (int)(xorshift32(&rng) % 10000) * 4;
+        avl_my_add(tree, &objs[i]);
+    }
+    check_order(tree);
+
+    // Counts survive removal, including of nodes with two children
+    for (int i = 0; i < n_objs; i += 3) {
+        avl_my_rem(tree, objs[i].my_key);
+    }
+    check_order(tree);
+    for (int i = 0; i < n_objs; i += 3) {
+        avl_my_add(tree, &objs[i]);
+    }
+    check_order(tree);
+
+    // Rank of keys below and above everything
+    assert(avl_my_rank(tree, -1) == 0);
+    assert(avl_my_rank(tree, 1 << 30) == avl_size(tree));
+
+    // Split sizes come from the counts, and both halves stay consistent
+    {
+        avl_tree_t r = avl_tree_init();
+        my_t *const mid = avl_my_select(tree, avl_size(tree) / 3);
+        size_t const total = avl_size(tree);
+
+        avl_my_split(tree, KEY(mid), &r);
+        assert(avl_size(tree) == total / 3);
+        assert(avl_my_select(&r, 0) == mid);
+        check_order(tree);
+        check_order(&r);
+
+        void *stack[46];
+        avl_base_join(tree, &r, stack);
+        assert(avl_size(tree) == total);
+        check_order(tree);
+    }
+
+    // A built tree has counts too
+    {
+        e_avl_node **nodes = malloc(sizeof(*nodes) * avl_size(tree));
+        void *stack[45];
+        avl_iter_t iter = avl_iter_init(tree, stack);
+        size_t n = 0;
+        for (e_avl_node *nd = avl_iter_first(&iter); nd != NULL; nd = avl_iter_next(&iter)) {
+            nodes[n++] = nd;
+        }
+
+        avl_tree_t b = avl_tree_init();
+        avl_base_build_sorted(&b, nodes, n);
+        check_order(&b);
+        free(nodes);
+    }
+
+    // Sorted batches keep the counts up to date, including the runs that
+    // stop short of the top of the tree
+    {
+        int const n = 3000;
+        my_t *bobjs = malloc(sizeof(*bobjs) * n * 2);
+        my_t **batch = malloc(sizeof(*batch) * n);
+        avl_tree_t b = avl_tree_init();
+
+        for (int i = 0; i < n; ++i) {
+            bobjs[i].my_key = i * 4;
+            batch[i] = &bobjs[i];
+        }
+        assert(avl_my_add_sorted_batch(&b, batch, n / 3) == (size_t)n / 3);
+        check_order(&b);
+        assert(avl_my_add_sorted_batch(&b, batch + n / 2, n - n / 2) == (size_t)(n - n / 2));
+        check_order(&b);
+
+        for (int i = 0; i < n; ++i) {
+            bobjs[n + i].my_key = i * 2 + (i % 7 == 0);
+            batch[i] = &bobjs[n + i];
+        }
+        size_t const before = avl_size(&b);
+        size_t const added = avl_my_add_sorted_batch(&b, batch, n);
+        assert(avl_size(&b) == before + added);
+        check_order(&b);
+
+        free(batch);
+        free(bobjs);
+    }
+
+    // So do inserts from a finger
+    {
+        int const n = 2000;
+        my_t *fobjs = malloc(sizeof(*fobjs) * n);
+        avl_tree_t b = avl_tree_init();
+        void *stack[45];
+        avl_iter_t finger = avl_iter_init(&b, stack);
+
+        for (int i = 0; i < n; ++i) {
+            fobjs[i].my_key = (i % 10 == 9) ? i - 5 : i * 3;
+            (void)avl_my_add_near(&b, &finger, &fobjs[i]);
+        }
+        check_order(&b);
+        free(fobjs);
+    }
+
+    free(objs);
+
+    return 0;
+}
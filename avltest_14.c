@@ -0,0 +1,163 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+// Keep the sum of `val` and the maximum `val` over every subtree.
+struct avl_node;
+static inline void sum_augment(struct avl_node *node);
+#define AVL_AUGMENT(node) sum_augment(node)
+
+#include "inline_avl.h"
+
+typedef struct sum_type sum_t;
+struct sum_type {
+    e_avl_node ok;
+    int key;
+    long val;
+    long sum;
+    long max;
+};
+
+static inline sum_t *
+nd2s(e_avl_node const*const nd)
+{
+    if (nd == NULL) return NULL;
+
+    return (void *)((unsigned char *)nd - offsetof(sum_t, ok));
+}
+
+static inline void
+sum_augment(struct avl_node *const node)
+{
+    sum_t *const s = nd2s(node);
+    s->sum = s->val;
+    s->max = s->val;
+    if (node->lc != NULL) {
+        s->sum += nd2s(node->lc)->sum;
+        if (nd2s(node->lc)->max > s->max) s->max = nd2s(node->lc)->max;
+    }
+    if (node->rc != NULL) {
+        s->sum += nd2s(node->rc)->sum;
+        if (nd2s(node->rc)->max > s->max) s->max = nd2s(node->rc)->max;
+    }
+}
+
+static int
+scmp(e_avl_node const*const ln, e_avl_node const*const rn)
+{
+    return (nd2s(ln)->key > nd2s(rn)->key) - (nd2s(ln)->key < nd2s(rn)->key);
+}
+
+static int
+skeycmp(void const*const key, e_avl_node const*const rn)
+{
+    int const k = *(int const*)key;
+    return (k > nd2s(rn)->key) - (k < nd2s(rn)->key);
+}
+
+// Verify the aggregate of every node below `nd`, returning the subtree sum
+static long
+check_sums(e_avl_node *const nd)
+{
+    if (nd == NULL) return 0;
+
+    sum_t *const s = nd2s(nd);
+    long const sum = s->val + check_sums(nd->lc) + check_sums(nd->rc);
+    assert(s->sum == sum);
+    long max = s->val;
+    if (nd->lc != NULL && nd2s(nd->lc)->max > max) max = nd2s(nd->lc)->max;
+    if (nd->rc != NULL && nd2s(nd->rc)->max > max) max = nd2s(nd->rc)->max;
+    assert(s->max == max);
+    return sum;
+}
+
+struct range_result {
+    long sum;
+    long max;
+    int pieces;
+};
+
+static void
+range_sum(e_avl_node *const node, bool const whole, void *const arg)
+{
+    struct range_result *const r = arg;
+    sum_t const*const s = nd2s(node);
+    long const sum = whole ? s->sum : s->val;
+    long const max = whole ? s->max : s->val;
+    r->sum += sum;
+    if (max > r->max) r->max = max;
+    ++r->pieces;
+}
+
+#define N_OBJS 400
+
+int
+main(void)
+{
+    avl_tree_t t = avl_tree_init();
+    avl_tree_t *const tree = &t;
+    void *stack[46];
+
+    sum_t *objs = malloc(sizeof(*objs) * N_OBJS);
+    for (int i = 0; i < N_OBJS; ++i) {
+        objs[i].key = (i * 151) % N_OBJS;
+        objs[i].val = (objs[i].key * 7919) % 1000;
+        e_avl_node *const o = avl_base_add(tree, &objs[i].ok, scmp, stack);
+        assert(o == &objs[i].ok);
+    }
+    check_sums(tree->m_top);
+
+    // Remove every third key, which exercises every removal case
+    for (int k = 0; k < N_OBJS; k += 3) {
+        e_avl_node *const o = avl_base_rem(tree, &k, skeycmp, stack);
+        assert(nd2s(o)->key == k);
+    }
+    check_sums(tree->m_top);
+
+    // Compare range queries against a direct sum
+    for (int lo = -1; lo <= N_OBJS; lo += 7) {
+        for (int hi = lo; hi <= N_OBJS + 1; hi += 5) {
+            struct range_result r = { .sum = 0, .max = -1, .pieces = 0 };
+            avl_base_range_visit(tree, &lo, &hi, skeycmp, range_sum, &r);
+
+            long sum = 0;
+            long max = -1;
+            for (int i = 0; i < N_OBJS; ++i) {
+                int const k = objs[i].key;
+                if (k % 3 != 0 && k >= lo && k < hi) {
+                    sum += objs[i].val;
+                    if (objs[i].val > max) max = objs[i].val;
+                }
+            }
+            assert(r.sum == sum);
+            assert(r.max == max);
+            assert(r.pieces <= 1 + 4 * avl_height(tree));
+        }
+    }
+
+    // Aggregates survive split, join and bulk building
+    {
+        avl_tree_t r = avl_tree_init();
+        int const cut = N_OBJS / 2;
+        avl_base_split(tree, &cut, skeycmp, stack, &r);
+        check_sums(tree->m_top);
+        check_sums(r.m_top);
+        avl_base_join(tree, &r, stack);
+        check_sums(tree->m_top);
+
+        e_avl_node **nodes = malloc(sizeof(*nodes) * N_OBJS);
+        for (int i = 0; i < N_OBJS; ++i) {
+            nodes[objs[i].key] = &objs[i].ok;
+        }
+        avl_base_build_sorted(tree, nodes, N_OBJS);
+        check_sums(tree->m_top);
+        free(nodes);
+    }
+
+    free(objs);
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "inline_avl_interval.h"
+
+static unsigned
+xorshift32(unsigned *const p_rng)
+{
+    unsigned x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return x;
+}
+
+#define N_OBJS 2000
+
+static e_avl_inode objs[N_OBJS];
+static bool in_tree[N_OBJS];
+static bool seen[N_OBJS];
+
+struct collect {
+    uint64_t last_start;
+    size_t limit;
+};
+
+static bool
+collect(e_avl_inode *const in, void *const arg)
+{
+    struct collect *const c = arg;
+    assert(in->start >= c->last_start);
+    c->last_start = in->start;
+
+    size_t const i = in - objs;
+    assert(i < N_OBJS && in_tree[i] && !seen[i]);
+    seen[i] = true;
+    return --c->limit != 0;
+}
+
+// Verify max_end below `nd`, returning the subtree's greatest end
+static uint64_t
+check_max(e_avl_node *const nd)
+{
+    if (nd == NULL) return 0;
+
+    e_avl_inode *const in = nd2inode(nd);
+    uint64_t max = in->end;
+    uint64_t const l = check_max(nd->lc);
+    uint64_t const r = check_max(nd->rc);
+    if (l > max) max = l;
+    if (r > max) max = r;
+    assert(in->max_end == max);
+    return max;
+}
+
+static void
+check_query(avl_tree_t const*const tree, uint64_t const lo, uint64_t const hi)
+{
+    void *stack[45];
+    struct collect c = { .last_start = 0, .limit = 0 };
+
+    for (int i = 0; i < N_OBJS; ++i) seen[i] = false;
+    size_t const n = avl_interval_overlap(tree, lo, hi, collect, &c, stack);
+
+    size_t expect = 0;
+    for (int i = 0; i < N_OBJS; ++i) {
+        bool const overlaps = in_tree[i] && objs[i].start < hi && objs[i].end > lo && lo < hi;
+        assert(seen[i] == overlaps);
+        expect += overlaps;
+    }
+    assert(n == expect);
+}
+
+int
+main(void)
+{
+    unsigned rng = 0xdeadbeefu;
+    void *stack[45];
+
+    avl_tree_t t = avl_tree_init();
+    avl_tree_t *const tree = &t;
+
+    // Short and long intervals over [0, 100000), including some that share
+    // a start.
+    for (int i = 0; i < N_OBJS; ++i) {
+        objs[i].start = xorshift32(&rng) % 100000;
+        objs[i].end = objs[i].start + 1 + ((i % 10 == 0) ? xorshift32(&rng) % 20000 : xorshift32(&rng) % 200);
+        if (i > 0 && i % 50 == 0) objs[i].start = objs[i - 1].start;
+        e_avl_inode *const o = avl_interval_add(tree, &objs[i], stack);
+        in_tree[i] = (o == &objs[i]);
+    }
+    check_max(tree->m_top);
+
+    for (int q = 0; q < 300; ++q) {
+        uint64_t const lo = xorshift32(&rng) % 110000;
+        check_query(tree, lo, lo + xorshift32(&rng) % 3000);
+    }
+    check_query(tree, 0, UINT64_MAX);
+    check_query(tree, 500, 500);
+
+    // Stabbing is a query of one point
+    for (int q = 0; q < 100; ++q) {
+        uint64_t const p = xorshift32(&rng) % 110000;
+        check_query(tree, p, p + 1);
+
+        struct collect c = { .last_start = 0, .limit = 0 };
+        for (int i = 0; i < N_OBJS; ++i) seen[i] = false;
+        size_t n = avl_interval_stab(tree, p, collect, &c, stack);
+        size_t expect = 0;
+        for (int i = 0; i < N_OBJS; ++i) {
+            expect += in_tree[i] && objs[i].start <= p && objs[i].end > p;
+        }
+        assert(n == expect);
+    }
+
+    // Removing intervals keeps max_end right
+    for (int i = 0; i < N_OBJS; i += 3) {
+        if (in_tree[i]) {
+            e_avl_inode *const o = avl_interval_rem(tree, objs[i].start, objs[i].end, stack);
+            assert(o == &objs[i]);
+            in_tree[i] = false;
+        }
+    }
+    assert(avl_interval_rem(tree, 7, 3, stack) == NULL);
+    check_max(tree->m_top);
+    for (int q = 0; q < 300; ++q) {
+        uint64_t const lo = xorshift32(&rng) % 110000;
+        check_query(tree, lo, lo + xorshift32(&rng) % 3000);
+    }
+
+    // The visitor can stop a query early
+    {
+        struct collect c = { .last_start = 0, .limit = 5 };
+        for (int i = 0; i < N_OBJS; ++i) seen[i] = false;
+        assert(avl_interval_overlap(tree, 0, UINT64_MAX, collect, &c, stack) == 5);
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "avlhelper.h"
+#include "avltest.h"
+
+int
+main(void)
+{
+    avl_tree_t t = avl_tree_init();
+    avl_tree_t *const tree = &t;
+
+    // Empty tree
+    assert(avl_my_lower_bound(tree, 0) == NULL);
+    assert(avl_my_upper_bound(tree, 0) == NULL);
+    assert(avl_my_floor(tree, 0) == NULL);
+    assert(avl_my_ceil(tree, 0) == NULL);
+    assert(avl_my_range_count(tree, 0, 10) == 0);
+
+    // Keys 10, 20, ..., 1000 inserted out of order
+    int const n_objs = 100;
+    my_t *objs = malloc(sizeof(*objs) * n_objs);
+    for (int i = 0; i < n_objs; ++i) {
+        objs[i].my_key = (((i * 37) % n_objs) + 1) * 10;
+        avl_my_add(tree, &objs[i]);
+    }
+
+    for (int k = 0; k <= 1010; ++k) {
+        my_t *const lb = avl_my_lower_bound(tree, k);
+        my_t *const ub = avl_my_upper_bound(tree, k);
+        my_t *const fl = avl_my_floor(tree, k);
+        my_t *const ce = avl_my_ceil(tree, k);
+
+        int const up = ((k + 9) / 10) * 10;
+        int const down = (k / 10) * 10;
+
+        if (up < 10) {
+            assert(KEY(lb) == 10);
+        } else if (up > 1000) {
+            assert(lb == NULL);
+        } else {
+            assert(KEY(lb) == up);
+        }
+        assert(ce == lb);
+
+        int const next = (k / 10 + 1) * 10;
+        if (next > 1000) {
+            assert(ub == NULL);
+        } else {
+            assert(KEY(ub) == ((next < 10) ? 10 : next));
+        }
+
+        if (down < 10) {
+            assert(fl == NULL);
+        } else if (down > 1000) {
+            assert(KEY(fl) == 1000);
+        } else {
+            assert(KEY(fl) == down);
+        }
+    }
+
+    // Range counts of [lo, hi)
+    for (int lo = -5; lo <= 1010; lo += 7) {
+        for (int hi = lo - 20; hi <= 1020; hi += 13) {
+            size_t expect = 0;
+            for (int k = 10; k <= 1000; k += 10) {
+                expect += (k >= lo && k < hi);
+            }
+            assert(avl_my_range_count(tree, lo, hi) == expect);
+        }
+    }
+
+    free(objs);
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "avlhelper.h"
+#include "avltest.h"
+
+int
+main(void)
+{
+    avl_tree_t t = avl_tree_init();
+    avl_tree_t *const tree = &t;
+
+    int const n_keys = 3000;
+    int *keys = malloc(sizeof(*keys) * n_keys);
+    my_t **out = malloc(sizeof(*out) * n_keys);
+
+    // Half the keys exist, half fall between existing keys
+    for (int i = 0; i < n_keys; ++i) {
+        keys[i] = (i * 7) % n_keys;
+    }
+
+    // Nothing is found in an empty tree
+    avl_my_get_batch(tree, keys, n_keys, out);
+    for (int i = 0; i < n_keys; ++i) {
+        assert(out[i] == NULL);
+    }
+
+    int const n_objs = n_keys / 2;
+    my_t *objs = malloc(sizeof(*objs) * n_objs);
+    for (int i = 0; i < n_objs; ++i) {
+        objs[i].my_key = ((i * 31) % n_objs) * 2;
+        avl_my_add(tree, &objs[i]);
+    }
+
+    // Every batch size agrees with looking the keys up one at a time,
+    // including batches smaller than the number of lanes
+    for (int n = 0; n <= n_keys; n += (n < 40) ? 1 : 997) {
+        for (int i = 0; i < n_keys; ++i) {
+            out[i] = (void *)&out[i];
+        }
+        avl_my_get_batch(tree, keys, n, out);
+        for (int i = 0; i < n; ++i) {
+            my_t *const g = avl_my_get(tree, keys[i]);
+            assert(out[i] == g);
+            assert((g != NULL) == (keys[i] % 2 == 0));
+        }
+        for (int i = n; i < n_keys; ++i) {
+            assert(out[i] == (void *)&out[i]);
+        }
+    }
+
+    free(objs);
+    free(out);
+    free(keys);
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "avlhelper.h"
+#include "avltest.h"
+
+static inline unsigned
+xorshift32(unsigned *const p_rng)
+{
+    unsigned x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return x;
+}
+
+#define KEY_RANGE 20000
+
+// Check that an in-order walk of `tree` gives exactly the keys in `present`
+static void
+check_contents(avl_tree_t *const tree, bool const present[])
+{
+    void *stack[45];
+    avl_iter_t it = avl_iter_init(tree, stack);
+    size_t n = 0;
+    int k = 0;
+    for (my_t *m = nd2t(avl_iter_first(&it)); m != NULL; m = nd2t(avl_iter_next(&it))) {
+        while (!present[k]) ++k;
+        assert(KEY(m) == k);
+        ++k;
+        ++n;
+    }
+    while (k < KEY_RANGE) assert(!present[k++]);
+    assert(n == avl_size(tree));
+    CHECK(TOP(tree));
+}
+
+int
+main(void)
+{
+    avl_tree_t t = avl_tree_init();
+    avl_tree_t *const tree = &t;
+    unsigned rng = 12345;
+
+    my_t *objs = malloc(sizeof(*objs) * KEY_RANGE * 2);
+    my_t **batch = malloc(sizeof(*batch) * KEY_RANGE);
+    bool *present = calloc(KEY_RANGE, sizeof(*present));
+    my_t **owner = calloc(KEY_RANGE, sizeof(*owner));
+    int used = 0;
+
+    // A batch into an empty tree is just a build
+    for (int k = 0; k < 100; ++k) {
+        objs[used].my_key = k * 50;
+        owner[k * 50] = &objs[used];
+        batch[k] = &objs[used++];
+        present[k * 50] = true;
+    }
+    assert(avl_my_add_sorted_batch(tree, batch, 100) == 100);
+    check_contents(tree, present);
+    assert(avl_my_add_sorted_batch(tree, batch, 0) == 0);
+
+    // Batches of varying density, some runs filling a single gap and some
+    // scattered across the tree, with keys already present skipped
+    int const strides[] = { 1, 2, 3, 7, 50, 97, 1000 };
+    for (int s = 0; s < (int)(sizeof(strides) / sizeof(*strides)); ++s) {
+        for (int round = 0; round < 3; ++round) {
+            int const start = xorshift32(&rng) % KEY_RANGE;
+            int const len = 1 + xorshift32(&rng) % 3000;
+            int n = 0;
+            size_t expect = 0;
+            for (int k = start; k < KEY_RANGE && n < len; k += strides[s]) {
+                objs[used].my_key = k;
+                batch[n++] = &objs[used++];
+                if (!present[k]) {
+                    present[k] = true;
+                    owner[k] = batch[n - 1];
+                    ++expect;
+                }
+            }
+            size_t const before = avl_size(tree);
+            assert(avl_my_add_sorted_batch(tree, batch, n) == expect);
+            assert(avl_size(tree) == before + expect);
+            check_contents(tree, present);
+
+            // Where a key was already present the old node is kept
+            for (int i = 0; i < n; ++i) {
+                assert(avl_my_get(tree, KEY(batch[i])) == owner[KEY(batch[i])]);
+            }
+        }
+    }
+
+    // The tree still works with single adds and removes afterwards
+    for (int k = 1; k < KEY_RANGE; k += 11) {
+        my_t *const e = avl_my_rem(tree, k);
+        assert(e == (present[k] ? owner[k] : NULL));
+        present[k] = false;
+    }
+    check_contents(tree, present);
+
+    free(owner);
+    free(present);
+    free(batch);
+    free(objs);
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "avlhelper.h"
+#include "avltest.h"
+
+static inline unsigned
+xorshift32(unsigned *const p_rng)
+{
+    unsigned x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return x;
+}
+
+#define N_OBJS 5000
+
+// The finger's path must lead from the top of the tree to `m`
+static void
+check_finger(avl_tree_t *const tree, avl_iter_t *const finger, my_t *const m)
+{
+    assert(avl_iter_valid(finger));
+    assert(nd2t(avl_iter_cur(finger)) == m);
+    astack_t const*const stack = &finger->stack;
+    assert(stack->data[0] == tree->m_top);
+    for (size_t i = 1; i < stack->sz; ++i) {
+        e_avl_node *const parent = stack->data[i - 1];
+        assert(parent->lc == stack->data[i] || parent->rc == stack->data[i]);
+    }
+}
+
+int
+main(void)
+{
+    avl_tree_t t = avl_tree_init();
+    avl_tree_t *const tree = &t;
+    unsigned rng = 4242;
+
+    void *stack[45];
+    avl_iter_t f = avl_iter_init(tree, stack);
+    avl_iter_t *const finger = &f;
+
+    my_t *objs = malloc(sizeof(*objs) * N_OBJS * 2);
+
+    // Appending at the tail, the finger follows the last node
+    for (int i = 0; i < N_OBJS; ++i) {
+        objs[i].my_key = i * 4;
+        my_t *const m = avl_my_add_near(tree, finger, &objs[i]);
+        assert(m == &objs[i]);
+        check_finger(tree, finger, m);
+        if ((i & 127) == 0) CHECK(TOP(tree));
+    }
+    CHECK(TOP(tree));
+    assert(avl_size(tree) == N_OBJS);
+
+    // A duplicate leaves the tree alone and moves the finger to the original
+    {
+        objs[N_OBJS].my_key = 400;
+        my_t *const m = avl_my_add_near(tree, finger, &objs[N_OBJS]);
+        assert(m == &objs[100]);
+        check_finger(tree, finger, m);
+        assert(avl_size(tree) == N_OBJS);
+    }
+
+    // Inserts that wander around near the last one, and some far jumps
+    int pos = 0;
+    for (int i = 0; i < N_OBJS; ++i) {
+        if (i % 100 == 0) {
+            pos = xorshift32(&rng) % N_OBJS;
+        } else {
+            pos += (int)(xorshift32(&rng) % 9) - 3;
+            if (pos < 0) pos = 0;
+            if (pos >= N_OBJS) pos = N_OBJS - 1;
+        }
+        my_t *const e = &objs[N_OBJS + i];
+        e->my_key = pos * 4 + 1 + (int)(xorshift32(&rng) % 3);
+        my_t *const m = avl_my_add_near(tree, finger, e);
+        assert(KEY(m) == KEY(e));
+        check_finger(tree, finger, m);
+    }
+    CHECK(TOP(tree));
+
+    // Everything is in order, and nothing was lost
+    {
+        void *wstack[45];
+        avl_iter_t it = avl_iter_init(tree, wstack);
+        size_t n = 0;
+        int prev = -1;
+        for (my_t *m = nd2t(avl_iter_first(&it)); m != NULL; m = nd2t(avl_iter_next(&it))) {
+            assert(KEY(m) > prev);
+            assert(avl_my_get(tree, KEY(m)) == m);
+            prev = KEY(m);
+            ++n;
+        }
+        assert(n == avl_size(tree));
+    }
+
+    // Seeking from the finger agrees with seeking from the top
+    {
+        void *sstack[45];
+        avl_iter_t s = avl_iter_init(tree, sstack);
+        for (int i = 0; i < 20000; ++i) {
+            my_t *const cur = nd2t(avl_iter_cur(finger));
+            int key;
+            if (i % 50 == 0 || cur == NULL) {
+                key = (int)(xorshift32(&rng) % (N_OBJS * 4 + 10)) - 5;
+            } else {
+                key = KEY(cur) + (int)(xorshift32(&rng) % 41) - 20;
+            }
+            my_t *const near = avl_my_seek_near(finger, key);
+            my_t *const far = avl_my_seek(&s, key);
+            assert(near == far);
+            assert(near == avl_my_lower_bound(tree, key));
+            if (near != NULL) {
+                check_finger(tree, finger, near);
+                assert(nd2t(avl_iter_next(finger)) == nd2t(avl_iter_next(&s)));
+                assert(nd2t(avl_iter_prev(finger)) == near);
+            }
+        }
+    }
+
+    // A mutation through anything else invalidates the finger, which then
+    // starts from the top again
+    {
+        my_t *const m = avl_my_seek_near(finger, 40);
+        assert(KEY(m) == 40);
+        my_t *const e = avl_my_rem(tree, 40);
+        assert(e == m);
+        assert(!avl_iter_valid(finger));
+        assert(KEY(avl_my_seek_near(finger, 40)) > 40);
+        assert(avl_my_add_near(tree, finger, e) == e);
+        check_finger(tree, finger, e);
+        CHECK(TOP(tree));
+    }
+
+    free(objs);
+
+    return 0;
+}
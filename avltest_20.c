@@ -0,0 +1,123 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "avlhelper.h"
+
+static inline unsigned
+xorshift32(unsigned *const p_rng)
+{
+    unsigned x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return x;
+}
+
+static inline myc_t *
+nd2c(e_avl_cnode *const nd)
+{
+    if (nd == NULL) return NULL;
+
+    return (void *)((unsigned char *)nd - offsetof(myc_t, ok));
+}
+
+// Recursively verify the balance factors and ordering below `nd`, returning
+// the height of the subtree and counting its nodes into `*p_count`
+static int
+check(e_avl_cnode *const nd, size_t *const p_count)
+{
+    if (nd == NULL) return 0;
+
+    e_avl_cnode *const l = avl_cnode_lc(nd);
+    e_avl_cnode *const r = avl_cnode_rc(nd);
+    int const lh = check(l, p_count);
+    int const rh = check(r, p_count);
+    assert(avl_cnode_balance(nd) == rh - lh);
+    if (l != NULL) assert(nd2c(l)->my_key < nd2c(nd)->my_key);
+    if (r != NULL) assert(nd2c(r)->my_key > nd2c(nd)->my_key);
+    ++*p_count;
+    return 1 + ((lh > rh) ? lh : rh);
+}
+
+static void
+check_tree(avl_ctree_t *const tree)
+{
+    size_t count = 0;
+    (void)check(tree->m_top, &count);
+    assert(count == avl_csize(tree));
+}
+
+#define N_OBJS 4000
+
+int
+main(void)
+{
+    avl_ctree_t t = avl_ctree_init();
+    avl_ctree_t *const tree = &t;
+    unsigned rng = 777;
+
+    // The balance factor lives in the pointers, not in the node
+    assert(sizeof(e_avl_cnode) == 2 * sizeof(void *));
+
+    myc_t *objs = malloc(sizeof(*objs) * N_OBJS);
+    bool *present = calloc(N_OBJS, sizeof(*present));
+
+    assert(avl_myc_get(tree, 0) == NULL);
+    assert(avl_myc_rem(tree, 0) == NULL);
+
+    // Ascending and descending runs force every kind of rotation
+    for (int i = 0; i < N_OBJS / 4; ++i) {
+        objs[i].my_key = i;
+        assert(avl_myc_add(tree, &objs[i]) == &objs[i]);
+        present[i] = true;
+    }
+    for (int i = N_OBJS / 2 - 1; i >= N_OBJS / 4; --i) {
+        objs[i].my_key = i;
+        assert(avl_myc_add(tree, &objs[i]) == &objs[i]);
+        present[i] = true;
+    }
+    check_tree(tree);
+
+    // Adding a duplicate returns the node already there
+    {
+        myc_t dup = { .my_key = 10 };
+        assert(avl_myc_add(tree, &dup) == &objs[10]);
+        assert(avl_csize(tree) == N_OBJS / 2);
+    }
+
+    // Random adds and removes, checked against a bitmap
+    for (int i = 0; i < 100000; ++i) {
+        int const k = xorshift32(&rng) % N_OBJS;
+        if (present[k]) {
+            assert(avl_myc_rem(tree, k) == &objs[k]);
+            present[k] = false;
+        } else {
+            objs[k].my_key = k;
+            assert(avl_myc_add(tree, &objs[k]) == &objs[k]);
+            present[k] = true;
+        }
+        if (i % 1000 == 0) check_tree(tree);
+    }
+    check_tree(tree);
+
+    for (int k = 0; k < N_OBJS; ++k) {
+        assert(avl_myc_get(tree, k) == (present[k] ? &objs[k] : NULL));
+    }
+
+    // Emptying the tree
+    for (int k = 0; k < N_OBJS; ++k) {
+        assert(avl_myc_rem(tree, k) == (present[k] ? &objs[k] : NULL));
+    }
+    assert(avl_csize(tree) == 0);
+    assert(tree->m_top == NULL);
+
+    free(present);
+    free(objs);
+
+    return 0;
+}
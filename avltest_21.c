@@ -0,0 +1,140 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include <string.h>
+
+#include "avlhelper.h"
+
+static inline unsigned
+xorshift32(unsigned *const p_rng)
+{
+    unsigned x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return x;
+}
+
+// Recursively verify the heights, balance and ordering below element `i`,
+// returning the height and counting the elements into `*p_count`
+static int
+check(avl_xtree_t const*const tree, uint32_t const i, size_t *const p_count)
+{
+    if (i == AVL_INDEX_NONE) return 0;
+
+    e_avl_xnode const*const node = avl_xnode(tree, i);
+    myx_t const*const pool = (myx_t const*)tree->m_pool;
+    int const lh = check(tree, node->lc, p_count);
+    int const rh = check(tree, node->rc, p_count);
+    assert(node->height == 1 + ((lh > rh) ? lh : rh));
+    assert(rh - lh >= -1 && rh - lh <= 1);
+    if (node->lc != AVL_INDEX_NONE) assert(pool[node->lc].my_key < pool[i].my_key);
+    if (node->rc != AVL_INDEX_NONE) assert(pool[node->rc].my_key > pool[i].my_key);
+    ++*p_count;
+    return node->height;
+}
+
+static void
+check_tree(avl_xtree_t const*const tree)
+{
+    size_t count = 0;
+    (void)check(tree, tree->m_top, &count);
+    assert(count == avl_xsize(tree));
+}
+
+#define N_OBJS 4000
+
+int
+main(void)
+{
+    unsigned rng = 99;
+
+    // Children are indices, so a node is three 32-bit words
+    assert(sizeof(e_avl_xnode) == 12);
+
+    myx_t *pool = malloc(sizeof(*pool) * N_OBJS);
+    bool *present = calloc(N_OBJS, sizeof(*present));
+    avl_xtree_t t = avl_myx_init(pool);
+    avl_xtree_t *const tree = &t;
+
+    assert(avl_myx_get(tree, 0) == AVL_INDEX_NONE);
+    assert(avl_myx_rem(tree, 0) == AVL_INDEX_NONE);
+
+    for (uint32_t i = 0; i < N_OBJS; ++i) {
+        pool[i].my_key = (int)i * 2;
+    }
+
+    // Ascending then descending halves
+    for (uint32_t i = 0; i < N_OBJS / 2; ++i) {
+        assert(avl_myx_add(tree, i) == i);
+        present[i] = true;
+    }
+    for (uint32_t i = N_OBJS; i-- > N_OBJS / 2;) {
+        assert(avl_myx_add(tree, i) == i);
+        present[i] = true;
+    }
+    check_tree(tree);
+    assert(avl_xsize(tree) == N_OBJS);
+    assert(avl_xheight(tree) <= 13);
+
+    // Random removes and re-adds
+    for (int n = 0; n < 100000; ++n) {
+        uint32_t const i = xorshift32(&rng) % N_OBJS;
+        if (present[i]) {
+            assert(avl_myx_rem(tree, pool[i].my_key) == i);
+            present[i] = false;
+        } else {
+            assert(avl_myx_add(tree, i) == i);
+            present[i] = true;
+        }
+        if (n % 1000 == 0) check_tree(tree);
+    }
+    check_tree(tree);
+
+    for (uint32_t i = 0; i < N_OBJS; ++i) {
+        assert(avl_myx_get(tree, (int)i * 2) == (present[i] ? i : AVL_INDEX_NONE));
+        assert(avl_myx_get(tree, (int)i * 2 + 1) == AVL_INDEX_NONE);
+    }
+
+    // A copy of the pool is a copy of the tree
+    {
+        myx_t *copy = malloc(sizeof(*copy) * N_OBJS);
+        memcpy(copy, pool, sizeof(*copy) * N_OBJS);
+        avl_xtree_t c = *tree;
+        avl_index_relocate(&c, copy);
+        check_tree(&c);
+        for (uint32_t i = 0; i < N_OBJS; ++i) {
+            assert(avl_myx_get(&c, (int)i * 2) == (present[i] ? i : AVL_INDEX_NONE));
+        }
+
+        // and the two are independent
+        uint32_t const removed = avl_myx_rem(&c, pool[c.m_top].my_key);
+        assert(removed != AVL_INDEX_NONE);
+        assert(avl_myx_get(&c, pool[removed].my_key) == AVL_INDEX_NONE);
+        assert(avl_myx_get(tree, pool[removed].my_key) == removed);
+        check_tree(tree);
+        free(copy);
+    }
+
+    // Duplicates return the element already in the tree
+    {
+        uint32_t j = 0;
+        while (present[j]) ++j;
+        int const key = pool[j].my_key;
+        size_t const size = avl_xsize(tree);
+        pool[j].my_key = pool[tree->m_top].my_key;
+        assert(avl_myx_add(tree, j) == tree->m_top);
+        assert(avl_xsize(tree) == size);
+        pool[j].my_key = key;
+        check_tree(tree);
+    }
+
+    free(present);
+    free(pool);
+
+    return 0;
+}
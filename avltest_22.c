@@ -0,0 +1,139 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include <string.h>
+
+#include "avlhelper.h"
+#include "avltest.h"
+#include "inline_avl_pool.h"
+
+#define N_OBJS 10000
+#define N_THREADS 4
+
+struct worker {
+    avl_pool_t *pool;
+    unsigned char **objs;
+    int n;
+};
+
+// Allocate, write, check and free a mix of sizes through a private cache
+static void *
+worker(void *const arg)
+{
+    struct worker *const w = arg;
+    avl_pool_cache_t cache = avl_pool_cache(w->pool);
+
+    for (int round = 0; round < 4; ++round) {
+        for (int i = 0; i < w->n; ++i) {
+            size_t const size = 1 + (size_t)i % AVL_POOL_MAX_SIZE;
+            w->objs[i] = avl_pool_alloc(&cache, size);
+            assert(w->objs[i] != NULL);
+            memset(w->objs[i], i & 0xff, size);
+        }
+        for (int i = 0; i < w->n; ++i) {
+            size_t const size = 1 + (size_t)i % AVL_POOL_MAX_SIZE;
+            assert(w->objs[i][size - 1] == (unsigned char)(i & 0xff));
+            avl_pool_free(&cache, w->objs[i], size);
+        }
+    }
+    avl_pool_cache_flush(&cache);
+    return NULL;
+}
+
+int
+main(void)
+{
+    avl_pool_t pool;
+    assert(avl_pool_init(&pool, (size_t)64 << 20, 0));
+    avl_pool_cache_t cache = avl_pool_cache(&pool);
+
+    assert(avl_pool_alloc(&cache, 0) == NULL);
+    assert(avl_pool_alloc(&cache, AVL_POOL_MAX_SIZE + 1) == NULL);
+
+    // Objects allocated in a row are laid out in a row
+    avl_tree_t t = avl_tree_init();
+    avl_tree_t *const tree = &t;
+    my_t **objs = malloc(sizeof(*objs) * N_OBJS);
+    size_t const step = (sizeof(my_t) + AVL_POOL_GRAIN - 1) / AVL_POOL_GRAIN * AVL_POOL_GRAIN;
+    int in_row = 0;
+    for (int i = 0; i < N_OBJS; ++i) {
+        objs[i] = avl_pool_alloc(&cache, sizeof(my_t));
+        assert(objs[i] != NULL);
+        assert((uintptr_t)objs[i] % AVL_POOL_GRAIN == 0);
+        if (i > 0 && (unsigned char *)objs[i] == (unsigned char *)objs[i - 1] + step) {
+            ++in_row;
+        }
+        objs[i]->my_key = (i * 7919) % N_OBJS;
+        assert(avl_my_add(tree, objs[i]) == objs[i]);
+    }
+    // Only the switch to a new slab breaks the run
+    assert(in_row >= N_OBJS - 1 - (int)(N_OBJS * step / AVL_POOL_SLAB) - 1);
+    CHECK(TOP(tree));
+
+    // Freed objects are handed out again before new memory
+    for (int k = 0; k < N_OBJS; k += 2) {
+        my_t *const e = avl_my_rem(tree, k);
+        assert(e != NULL);
+        avl_pool_free(&cache, e, sizeof(*e));
+    }
+    for (int k = 0; k < N_OBJS; k += 2) {
+        my_t *const e = avl_pool_alloc(&cache, sizeof(*e));
+        assert(e != NULL);
+        // It must be one of the objects from before
+        assert((unsigned char *)e >= (unsigned char *)pool.m_base);
+        assert((unsigned char *)e < (unsigned char *)pool.m_base + pool.m_used);
+        e->my_key = k;
+        assert(avl_my_add(tree, e) == e);
+    }
+    CHECK(TOP(tree));
+    assert(avl_size(tree) == N_OBJS);
+    avl_pool_cache_flush(&cache);
+
+    // Threads allocating and freeing at once, each through its own cache
+    {
+        pthread_t threads[N_THREADS];
+        struct worker workers[N_THREADS];
+        for (int i = 0; i < N_THREADS; ++i) {
+            workers[i].pool = &pool;
+            workers[i].n = 3000;
+            workers[i].objs = malloc(sizeof(*workers[i].objs) * workers[i].n);
+            assert(pthread_create(&threads[i], NULL, worker, &workers[i]) == 0);
+        }
+        for (int i = 0; i < N_THREADS; ++i) {
+            pthread_join(threads[i], NULL);
+            free(workers[i].objs);
+        }
+    }
+
+    // The tree didn't notice any of that
+    for (int k = 0; k < N_OBJS; ++k) {
+        assert(KEY(avl_my_get(tree, k)) == k);
+    }
+
+    // Dropping the whole tree is a single release
+    avl_pool_release(&pool);
+    *tree = avl_tree_init();
+
+    // A small pool runs out cleanly, and huge pages are only a hint
+    {
+        avl_pool_t small;
+        assert(avl_pool_init(&small, AVL_POOL_SLAB, AVL_POOL_HUGE));
+        assert((uintptr_t)small.m_base % AVL_POOL_HUGE_PAGE == 0);
+        avl_pool_cache_t c = avl_pool_cache(&small);
+        size_t n = 0;
+        while (avl_pool_alloc(&c, 64) != NULL) {
+            ++n;
+        }
+        assert(n == AVL_POOL_SLAB / 64);
+        assert(avl_pool_alloc(&c, 16) == NULL);
+        assert(small.m_used == AVL_POOL_SLAB);
+        avl_pool_release(&small);
+    }
+
+    free(objs);
+
+    return 0;
+}
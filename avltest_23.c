@@ -0,0 +1,162 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "inline_avl_define.h"
+
+// A scalar key
+typedef struct event event_t;
+struct event {
+    uint64_t when;
+    e_avl_node link;
+    int id;
+};
+
+static inline int
+u64cmp(uint64_t const*const l, uint64_t const*const r)
+{
+    return (*l > *r) - (*l < *r);
+}
+
+AVL_DEFINE(ev, event_t, link, when, u64cmp)
+
+// A struct key, and a comparator that is a macro
+typedef struct point point_t;
+struct point {
+    int x;
+    int y;
+};
+
+typedef struct cell cell_t;
+struct cell {
+    point_t at;
+    long val;
+    e_avl_node link;
+};
+
+#define PTCMP(l, r) \
+    (((l)->x != (r)->x) ? ((l)->x > (r)->x) - ((l)->x < (r)->x) \
+                        : ((l)->y > (r)->y) - ((l)->y < (r)->y))
+
+AVL_DEFINE_CAP(grid, cell_t, link, at, PTCMP, 4096)
+
+_Static_assert(AVL_MAX_HEIGHT(0) == 0, "empty tree");
+_Static_assert(AVL_MAX_HEIGHT(1) == 1, "one node");
+_Static_assert(AVL_MAX_HEIGHT(3) == 2, "three nodes");
+_Static_assert(AVL_MAX_HEIGHT(4) == 3, "four nodes");
+_Static_assert(AVL_MAX_HEIGHT(4095) == 16, "4095 nodes");
+_Static_assert(AVL_MAX_HEIGHT(INT32_MAX) == 44, "2^31 - 1 nodes");
+_Static_assert(AVL_MAX_HEIGHT(UINT32_MAX) == 45, "2^32 - 1 nodes");
+_Static_assert(grid_STACK == AVL_MAX_HEIGHT(4096) + 1, "stack size");
+
+#define N_EVENTS 1000
+
+int
+main(void)
+{
+    {
+        avl_tree_t t = avl_tree_init();
+        avl_tree_t *const tree = &t;
+        event_t *evs = malloc(sizeof(*evs) * N_EVENTS);
+
+        for (int i = 0; i < N_EVENTS; ++i) {
+            evs[i].when = (uint64_t)((i * 617) % N_EVENTS) * 10;
+            evs[i].id = i;
+            assert(ev_add(tree, &evs[i]) == &evs[i]);
+        }
+        assert(avl_size(tree) == N_EVENTS);
+
+        // Duplicates hand back the object already there
+        event_t dup = { .when = evs[5].when };
+        assert(ev_add(tree, &dup) == &evs[5]);
+
+        for (int i = 0; i < N_EVENTS; ++i) {
+            assert(ev_get(tree, evs[i].when) == &evs[i]);
+            assert(ev_get(tree, evs[i].when + 1) == NULL);
+        }
+
+        // Iteration in both directions, and seeking between keys
+        ev_iter_t it;
+        ev_iter_init(&it, tree);
+        uint64_t want = 0;
+        for (event_t *e = ev_first(&it); e != NULL; e = ev_next(&it)) {
+            assert(e->when == want);
+            want += 10;
+        }
+        assert(want == N_EVENTS * 10);
+        for (event_t *e = ev_last(&it); e != NULL; e = ev_prev(&it)) {
+            want -= 10;
+            assert(e->when == want);
+        }
+        assert(want == 0);
+
+        event_t *const e = ev_seek(&it, 555);
+        assert(e != NULL && e->when == 560);
+        assert(ev_next(&it)->when == 570);
+        assert(ev_seek(&it, N_EVENTS * 10) == NULL);
+
+        // Remove the odd tens
+        for (uint64_t w = 10; w < N_EVENTS * 10; w += 20) {
+            event_t *const o = ev_rem(tree, w);
+            assert(o != NULL && o->when == w);
+            assert(ev_rem(tree, w) == NULL);
+        }
+        assert(avl_size(tree) == N_EVENTS / 2);
+
+        want = 0;
+        ev_iter_init(&it, tree);
+        for (event_t *e = ev_first(&it); e != NULL; e = ev_next(&it)) {
+            assert(e->when == want);
+            want += 20;
+        }
+
+        free(evs);
+    }
+
+    {
+        avl_tree_t t = avl_tree_init();
+        avl_tree_t *const tree = &t;
+        cell_t *cells = malloc(sizeof(*cells) * 64 * 64);
+
+        // Fill a full tree to the declared capacity, in an unhelpful order
+        for (int i = 0; i < 64 * 64; ++i) {
+            int const j = (i * 1031) % (64 * 64);
+            cells[i] = (cell_t) { .at = { j % 64, j / 64 }, .val = j };
+            assert(grid_add(tree, &cells[i]) == &cells[i]);
+        }
+        assert(avl_height(tree) <= AVL_MAX_HEIGHT(64 * 64));
+
+        for (int x = 0; x < 64; ++x) {
+            for (int y = 0; y < 64; ++y) {
+                cell_t *const c = grid_get(tree, (point_t) { x, y });
+                assert(c != NULL && c->val == y * 64 + x);
+            }
+        }
+
+        grid_iter_t it;
+        grid_iter_init(&it, tree);
+        point_t prev = { -1, -1 };
+        size_t n = 0;
+        for (cell_t *c = grid_first(&it); c != NULL; c = grid_next(&it)) {
+            assert(PTCMP(&prev, &c->at) < 0);
+            prev = c->at;
+            ++n;
+        }
+        assert(n == 64 * 64);
+
+        cell_t *const c = grid_seek(&it, (point_t) { 7, 64 });
+        assert(c != NULL && c->at.x == 8 && c->at.y == 0);
+
+        for (int y = 0; y < 64; ++y) {
+            assert(grid_rem(tree, (point_t) { 3, y })->val == y * 64 + 3);
+        }
+        assert(grid_get(tree, (point_t) { 3, 10 }) == NULL);
+        assert(avl_size(tree) == 63 * 64);
+
+        free(cells);
+    }
+
+    return 0;
+}
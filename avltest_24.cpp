@@ -0,0 +1,181 @@
+
+#include <cstdio>
+#include <cassert>
+#include <cstdlib>
+#include <iterator>
+#include <vector>
+
+#include "inline_avl.hpp"
+
+struct item {
+    int key;
+    e_avl_node link;
+    int payload;
+};
+
+static bool
+operator<(item const &l, item const &r)
+{
+    return l.key < r.key;
+}
+
+// Compares items with each other and with plain keys
+struct by_key {
+    using is_transparent = void;
+
+    bool operator()(item const &l, item const &r) const { return l.key < r.key; }
+    bool operator()(int const l, item const &r) const { return l < r.key; }
+    bool operator()(item const &l, int const r) const { return l.key < r; }
+};
+
+// Checks every node is balanced and returns the height below `nd`
+static int
+check_balance(e_avl_node const *const nd)
+{
+    if (nd == nullptr) {
+        return 0;
+    }
+    int const lh = check_balance(nd->lc);
+    int const rh = check_balance(nd->rc);
+    assert(lh - rh <= 1 && rh - lh <= 1);
+    assert(nd->height == 1 + (lh > rh ? lh : rh));
+    return nd->height;
+}
+
+#define N_ITEMS 2000
+
+int
+main()
+{
+    std::vector<item> items(N_ITEMS);
+    for (int i = 0; i < N_ITEMS; ++i) {
+        items[i].key = ((i * 739) % N_ITEMS) * 2;
+        items[i].payload = i;
+    }
+
+    {
+        avl::tree<item, &item::link, by_key> t;
+        static_assert(sizeof(t) == sizeof(avl_tree_t), "empty comparators take no space");
+        assert(t.empty() && t.begin() == t.end());
+
+        for (item &it : items) {
+            auto const r = t.insert(it);
+            assert(r.second && &*r.first == &it);
+
+            // The returned iterator is valid and positioned at the new item
+            auto next = r.first;
+            ++next;
+            assert(next == t.end() || next->key > it.key);
+        }
+        assert(t.size() == N_ITEMS);
+        check_balance(t.c_tree()->m_top);
+        assert(t.height() <= avl::max_height(N_ITEMS));
+
+        item dup = { items[7].key, {}, -1 };
+        auto const r = t.insert(dup);
+        assert(!r.second && &*r.first == &items[7]);
+
+        // In order both ways
+        int want = 0;
+        for (item const &it : t) {
+            assert(it.key == want);
+            want += 2;
+        }
+        assert(want == 2 * N_ITEMS);
+        for (auto it = t.rbegin(); it != t.rend(); ++it) {
+            want -= 2;
+            assert(it->key == want);
+        }
+        assert(want == 0);
+        assert(std::distance(t.begin(), t.end()) == N_ITEMS);
+        assert(std::prev(t.end())->key == 2 * (N_ITEMS - 1));
+
+        // Lookups by key and by item
+        for (int k = -1; k <= 2 * N_ITEMS; ++k) {
+            auto const f = t.find(k);
+            auto const lb = t.lower_bound(k);
+            auto const ub = t.upper_bound(k);
+            if (k >= 0 && k % 2 == 0 && k < 2 * N_ITEMS) {
+                assert(f != t.end() && f->key == k);
+                assert(t.contains(k) && t.count(k) == 1);
+                assert(lb == f);
+                assert(ub == std::next(f));
+            } else {
+                assert(f == t.end() && !t.contains(k));
+                assert(lb == ub);
+                int const above = (k < 0) ? 0 : k + 1;
+                assert(lb == t.end() ? above >= 2 * N_ITEMS : lb->key == above);
+            }
+        }
+        item const probe = { 10, {}, 0 };
+        assert(t.find(probe)->key == 10);
+        auto const range = t.equal_range(10);
+        assert(std::distance(range.first, range.second) == 1);
+
+        // Adding invalidates other iterators, which then step to end()
+        auto stale = t.find(100);
+        assert(stale != t.end());
+        item extra = { 2 * N_ITEMS + 1, {}, 0 };
+        assert(t.insert(extra).second);
+        ++stale;
+        assert(stale == t.end());
+        assert(t.erase(extra.key) == 1);
+        assert(t.erase(extra.key) == 0);
+
+        // Erase every other item through iterators
+        auto it = t.begin();
+        while (it != t.end()) {
+            it = t.erase(it);
+            if (it != t.end()) {
+                ++it;
+            }
+        }
+        assert(t.size() == N_ITEMS / 2);
+        check_balance(t.c_tree()->m_top);
+        want = 2;
+        for (item const &i : t) {
+            assert(i.key == want);
+            want += 4;
+        }
+
+        // A half-open range, then the rest by key
+        t.erase(t.lower_bound(1000), t.lower_bound(2000));
+        assert(!t.contains(1002) && t.contains(998) && t.contains(2002));
+        for (item &i : items) {
+            (void)t.erase(i.key);
+        }
+        assert(t.empty() && t.height() == 0);
+
+        avl::tree<item, &item::link, by_key> moved(std::move(t));
+        assert(moved.empty());
+    }
+
+    {
+        // Ordering by operator<, with a small declared capacity
+        avl::tree<item, &item::link, std::less<item>, 4096> t;
+        static_assert(decltype(t)::stack_size == avl::max_height(4096) + 1, "");
+
+        for (item &it : items) {
+            assert(t.insert(it).second);
+        }
+        item const probe = { 42, {}, 0 };
+        assert(t.find(probe)->payload == items[t.find(probe)->payload].payload);
+        assert(t.erase(probe) == 1);
+        assert(t.find(probe) == t.end());
+
+        decltype(t)::const_iterator ci = t.begin();
+        assert(ci->key == 0);
+        --ci;
+        assert(ci == t.end());
+        --ci;
+        assert(ci->key == 2 * (N_ITEMS - 1));
+
+        avl::tree<item, &item::link, std::less<item>, 4096> other;
+        other.swap(t);
+        assert(t.empty() && other.size() == N_ITEMS - 1);
+        other.clear();
+        assert(other.empty() && other.begin() == other.end());
+    }
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "inline_avl_int.h"
+
+#define N_KNODES 3000
+
+static uint64_t
+key_of(size_t const i)
+{
+    // Spread over the whole range, both ends included
+    if (i == 0) return 0;
+    if (i == 1) return UINT64_MAX;
+    return (uint64_t)i * UINT64_C(0x9e3779b97f4a7c15);
+}
+
+int
+main(void)
+{
+    avl_tree_t t = avl_tree_init();
+    avl_tree_t *const tree = &t;
+    void *stack[46];
+
+    e_avl_knode *kn = malloc(sizeof(*kn) * N_KNODES);
+    for (size_t i = 0; i < N_KNODES; ++i) {
+        kn[i].key = key_of(i);
+        assert(avl_int_add(tree, &kn[i], stack) == &kn[i]);
+    }
+    assert(avl_size(tree) == N_KNODES);
+
+    e_avl_knode dup = { .key = key_of(17) };
+    assert(avl_int_add(tree, &dup, stack) == &kn[17]);
+
+    for (size_t i = 0; i < N_KNODES; ++i) {
+        assert(avl_int_get(tree, kn[i].key) == &kn[i]);
+        if (kn[i].key != UINT64_MAX) {
+            assert(avl_int_get(tree, kn[i].key + 1) == NULL);
+        }
+    }
+
+    // Lower bounds against a scan
+    for (size_t i = 0; i < N_KNODES; ++i) {
+        uint64_t const probes[3] = { kn[i].key, kn[i].key - 1, kn[i].key + 1 };
+        for (int p = 0; p < 3; ++p) {
+            e_avl_knode *best = NULL;
+            for (size_t j = 0; j < N_KNODES; ++j) {
+                if (kn[j].key >= probes[p] && (best == NULL || kn[j].key < best->key)) {
+                    best = &kn[j];
+                }
+            }
+            assert(avl_int_lower_bound(tree, probes[p]) == best);
+        }
+    }
+
+    // The generic functions work with the knode comparators
+    avl_iter_t iter = avl_iter_init(tree, stack);
+    uint64_t prev = 0;
+    size_t n = 0;
+    for (e_avl_node *nd = avl_iter_first(&iter); nd != NULL; nd = avl_iter_next(&iter)) {
+        assert(n == 0 || nd2knode(nd)->key > prev);
+        prev = nd2knode(nd)->key;
+        ++n;
+    }
+    assert(n == N_KNODES);
+
+    for (size_t i = 0; i < N_KNODES; i += 2) {
+        assert(avl_int_rem(tree, kn[i].key, stack) == &kn[i]);
+        assert(avl_int_rem(tree, kn[i].key, stack) == NULL);
+    }
+    for (size_t i = 0; i < N_KNODES; ++i) {
+        assert(avl_int_get(tree, kn[i].key) == ((i % 2 == 0) ? NULL : &kn[i]));
+    }
+    assert(avl_size(tree) == N_KNODES / 2);
+
+    // Signed keys keep their order with the sign bit flipped
+    {
+        avl_tree_t s = avl_tree_init();
+        e_avl_knode sk[5];
+        int64_t const vals[5] = { 3, -1, INT64_MIN, 0, INT64_MAX };
+        for (int i = 0; i < 5; ++i) {
+            sk[i].key = (uint64_t)vals[i] ^ (UINT64_C(1) << 63);
+            (void)avl_int_add(&s, &sk[i], stack);
+        }
+        uint64_t const zero = (uint64_t)0 ^ (UINT64_C(1) << 63);
+        assert(avl_int_lower_bound(&s, zero) == &sk[3]);
+        assert(avl_int_lower_bound(&s, zero + 1) == &sk[0]);
+        assert(avl_int_lower_bound(&s, 0) == &sk[2]);
+    }
+
+    free(kn);
+
+    return 0;
+}
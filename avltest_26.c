@@ -0,0 +1,147 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avlhelper.h"
+
+#define N_OBJS 1000
+
+// Where each object is, by key, as kept by the owner of the objects
+static my_t *where[N_OBJS];
+static size_t n_moves;
+
+static void
+move_obj(void *const dst, void *const src, void *const arg)
+{
+    assert(arg == where);
+    my_t *const o = src;
+    assert(where[o->my_key] == o);
+    memcpy(dst, src, sizeof(my_t));
+    where[o->my_key] = dst;
+    memset(src, 0xa5, sizeof(my_t));
+    ++n_moves;
+}
+
+static void
+check_tree(avl_tree_t const*const tree)
+{
+    for (int k = 0; k < N_OBJS; ++k) {
+        assert(avl_my_get(tree, k) == where[k]);
+    }
+    assert(avl_my_get(tree, N_OBJS) == NULL);
+}
+
+static void
+fill(avl_tree_t *const tree, my_t **const objs)
+{
+    *tree = avl_tree_init();
+    for (int i = 0; i < N_OBJS; ++i) {
+        int const k = (i * 389) % N_OBJS;
+        objs[i] = malloc(sizeof(my_t));
+        objs[i]->my_key = k;
+        where[k] = objs[i];
+        assert(avl_my_add(tree, objs[i]) == objs[i]);
+    }
+}
+
+int
+main(void)
+{
+    my_t *objs[N_OBJS];
+    avl_tree_t t;
+    avl_tree_t *const tree = &t;
+
+    // In slices of every size, checking the tree in between
+    for (size_t budget = 0; budget <= 9; ++budget) {
+        fill(tree, objs);
+        int const height = avl_height(tree);
+        my_t *region = malloc(sizeof(my_t) * N_OBJS);
+        avl_relayout_t rl = avl_relayout_init(tree, region, sizeof(my_t), offsetof(my_t, ok), move_obj, where);
+
+        n_moves = 0;
+        size_t slices = 0;
+        int rc;
+        while ((rc = avl_base_relayout(&rl, (budget == 0) ? SIZE_MAX : budget)) == AVL_RELAYOUT_MORE) {
+            assert(n_moves == slices * budget + budget);
+            check_tree(tree);
+            ++slices;
+        }
+        assert(rc == AVL_RELAYOUT_DONE);
+        assert(n_moves == N_OBJS);
+        assert(avl_base_relayout(&rl, 1) == AVL_RELAYOUT_DONE);
+        assert(avl_height(tree) == height);
+        check_tree(tree);
+
+        // Breadth first: each slot's children are the next unclaimed slots
+        assert(tree->m_top == &region[0].ok);
+        size_t next = 1;
+        for (size_t i = 0; i < N_OBJS; ++i) {
+            if (region[i].ok.lc != NULL) {
+                assert(region[i].ok.lc == &region[next++].ok);
+            }
+            if (region[i].ok.rc != NULL) {
+                assert(region[i].ok.rc == &region[next++].ok);
+            }
+        }
+        assert(next == N_OBJS);
+
+        // The tree works as usual afterwards
+        my_t *const o = avl_my_rem(tree, 17);
+        assert(o == &region[o - region] && o->my_key == 17);
+        assert(avl_my_add(tree, o) == o);
+
+        for (int i = 0; i < N_OBJS; ++i) {
+            free(objs[i]);
+        }
+        free(region);
+    }
+
+    // Changing the tree between slices stops the relayout
+    {
+        fill(tree, objs);
+        my_t *region = malloc(sizeof(my_t) * N_OBJS);
+        avl_relayout_t rl = avl_relayout_init(tree, region, sizeof(my_t), offsetof(my_t, ok), move_obj, where);
+        assert(avl_base_relayout(&rl, 100) == AVL_RELAYOUT_MORE);
+
+        my_t *const o = avl_my_rem(tree, where[500]->my_key);
+        assert(o != NULL);
+        assert(avl_base_relayout(&rl, 100) == AVL_RELAYOUT_STALE);
+        where[500] = NULL;
+        for (int k = 0; k < N_OBJS; ++k) {
+            assert(avl_my_get(tree, k) == where[k]);
+        }
+
+        for (int i = 0; i < N_OBJS; ++i) {
+            free(objs[i]);
+        }
+        free(region);
+    }
+
+    // Without a callback the objects are copied as they are
+    {
+        fill(tree, objs);
+        my_t *region = malloc(sizeof(my_t) * N_OBJS);
+        avl_relayout_t rl = avl_relayout_init(tree, region, sizeof(my_t), offsetof(my_t, ok), NULL, NULL);
+        assert(avl_base_relayout(&rl, SIZE_MAX) == AVL_RELAYOUT_DONE);
+        for (int k = 0; k < N_OBJS; ++k) {
+            my_t *const o = avl_my_get(tree, k);
+            assert(o >= region && o < region + N_OBJS && o->my_key == k);
+        }
+
+        for (int i = 0; i < N_OBJS; ++i) {
+            free(objs[i]);
+        }
+        free(region);
+    }
+
+    // An empty tree has nothing to move
+    {
+        avl_tree_t e = avl_tree_init();
+        avl_relayout_t rl = avl_relayout_init(&e, NULL, sizeof(my_t), offsetof(my_t, ok), NULL, NULL);
+        assert(avl_base_relayout(&rl, 0) == AVL_RELAYOUT_DONE);
+    }
+
+    return 0;
+}
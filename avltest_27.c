@@ -0,0 +1,108 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "inline_avl_int.h"
+#include "inline_avl_frozen.h"
+
+static uint64_t
+keyof(e_avl_node const*const nd)
+{
+    return nd2knode(nd)->key;
+}
+
+// Check every kind of lookup on a snapshot of `tree` against the tree
+static void
+check_snapshot(avl_tree_t const*const tree, e_avl_knode const*const kn, size_t const n)
+{
+    void *stack[46];
+    avl_frozen_t f;
+    assert(avl_freeze(tree, keyof, stack, &f));
+    assert(avl_frozen_valid(&f));
+    assert(f.m >= avl_size(tree) && f.m < 2 * avl_size(tree) + 1);
+
+    // Every key, its neighbours, and both ends of the range
+    size_t const n_probes = 3 * n + 2;
+    uint64_t *probes = malloc(sizeof(*probes) * (n_probes + 1));
+    e_avl_node **out = malloc(sizeof(*out) * (n_probes + 1));
+    for (size_t i = 0; i < n; ++i) {
+        probes[3 * i] = kn[i].key;
+        probes[3 * i + 1] = kn[i].key - 1;
+        probes[3 * i + 2] = kn[i].key + 1;
+    }
+    probes[3 * n] = 0;
+    probes[3 * n + 1] = UINT64_MAX;
+
+    for (size_t i = 0; i < n_probes; ++i) {
+        e_avl_knode *const want = avl_int_get(tree, probes[i]);
+        assert(avl_frozen_get(&f, probes[i]) == (want ? &want->node : NULL));
+        e_avl_knode *const lb = avl_int_lower_bound(tree, probes[i]);
+        assert(avl_frozen_lower_bound(&f, probes[i]) == (lb ? &lb->node : NULL));
+    }
+
+    // Batches of every length up to past a vector's worth
+    for (size_t len = 0; len <= 17 && len <= n_probes; ++len) {
+        avl_frozen_get_batch(&f, probes, len, out);
+        for (size_t i = 0; i < len; ++i) {
+            assert(out[i] == avl_frozen_get(&f, probes[i]));
+        }
+    }
+    avl_frozen_get_batch(&f, probes, n_probes, out);
+    for (size_t i = 0; i < n_probes; ++i) {
+        assert(out[i] == avl_frozen_get(&f, probes[i]));
+    }
+
+    free(out);
+    free(probes);
+    avl_frozen_free(&f);
+}
+
+#define N_KNODES 700
+
+int
+main(void)
+{
+    void *stack[46];
+    e_avl_knode *kn = malloc(sizeof(*kn) * N_KNODES);
+    for (size_t i = 0; i < N_KNODES; ++i) {
+        kn[i].key = (i == 1) ? UINT64_MAX : (uint64_t)i * UINT64_C(0x9e3779b97f4a7c15);
+    }
+
+    // Every size up to 70, to cover full, nearly full and barely used levels
+    for (size_t n = 0; n <= 70; ++n) {
+        avl_tree_t t = avl_tree_init();
+        for (size_t i = 0; i < n; ++i) {
+            (void)avl_int_add(&t, &kn[i], stack);
+        }
+        check_snapshot(&t, kn, n);
+    }
+
+    avl_tree_t t = avl_tree_init();
+    for (size_t i = 0; i < N_KNODES; ++i) {
+        (void)avl_int_add(&t, &kn[i], stack);
+    }
+    check_snapshot(&t, kn, N_KNODES);
+
+    // Changing the tree makes the snapshot stale
+    avl_frozen_t f;
+    assert(avl_freeze(&t, keyof, stack, &f));
+    assert(avl_int_rem(&t, kn[5].key, stack) == &kn[5]);
+    assert(!avl_frozen_valid(&f));
+    avl_frozen_free(&f);
+
+    // An empty snapshot finds nothing
+    avl_tree_t e = avl_tree_init();
+    assert(avl_freeze(&e, keyof, stack, &f));
+    assert(avl_frozen_get(&f, 0) == NULL && avl_frozen_lower_bound(&f, 0) == NULL);
+    e_avl_node *out[1] = { &kn[0].node };
+    uint64_t const key = 0;
+    avl_frozen_get_batch(&f, &key, 1, out);
+    assert(out[0] == NULL);
+    avl_frozen_free(&f);
+
+    free(kn);
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "inline_avl_int.h"
+#include "inline_avl_pool.h"
+
+#define N_KEYS 4096
+#define N_READERS 3
+#define N_ROUNDS 200
+
+/*
+ * One writer keeps adding and removing the odd keys, recycling their objects
+ * through a pool, while readers look keys up optimistically. The even keys
+ * are never removed, so every reader must always find them.
+ */
+
+struct shared {
+    avl_tree_t tree;
+    int done;
+};
+
+struct reader {
+    struct shared *sh;
+    unsigned rng;
+    unsigned long hits;
+};
+
+static void *
+reader(void *const arg)
+{
+    struct reader *const r = arg;
+    avl_tree_t const*const tree = &r->sh->tree;
+
+    while (!__atomic_load_n(&r->sh->done, __ATOMIC_ACQUIRE)) {
+        r->rng = r->rng * 1103515245u + 12345u;
+        uint64_t const key = (r->rng >> 8) % N_KEYS;
+
+        e_avl_knode *const kn = nd2knode(avl_seq_get(tree, &key, avl_knode_keycmp));
+        if (key % 2 == 0) {
+            assert(kn != NULL);
+        }
+        if (kn != NULL) {
+            assert(kn->key == key);
+            ++r->hits;
+        }
+    }
+    return NULL;
+}
+
+static e_avl_knode *
+add_key(avl_tree_t *const tree, avl_pool_cache_t *const cache, uint64_t const key)
+{
+    void *stack[64];
+    e_avl_knode *const kn = avl_pool_alloc(cache, sizeof(*kn));
+    assert(kn != NULL);
+    kn->key = key;
+
+    avl_seq_write_begin(tree);
+    e_avl_knode *const got = avl_int_add(tree, kn, stack);
+    avl_seq_write_end(tree);
+    assert(got == kn);
+    return kn;
+}
+
+int
+main(void)
+{
+    avl_pool_t pool;
+    assert(avl_pool_init(&pool, (size_t)16 << 20, 0));
+    avl_pool_cache_t cache = avl_pool_cache(&pool);
+    void *stack[64];
+
+    struct shared sh = { .tree = avl_tree_init(), .done = 0 };
+    avl_tree_t *const tree = &sh.tree;
+
+    // The generation is even at rest and odd inside a change
+    for (uint64_t k = 0; k < N_KEYS; k += 2) {
+        unsigned const seq = avl_seq_read_begin(tree);
+        assert(seq % 2 == 0);
+        (void)add_key(tree, &cache, k);
+        assert(avl_seq_read_retry(tree, seq));
+    }
+    {
+        unsigned const seq = avl_seq_read_begin(tree);
+        avl_seq_write_begin(tree);
+        assert(tree->m_gen % 2 == 1);
+        assert(avl_seq_read_retry(tree, seq));
+        avl_seq_write_end(tree);
+        assert(tree->m_gen % 2 == 0 && tree->m_gen == seq + 2);
+
+        uint64_t const key = 10;
+        e_avl_node *found = NULL;
+        assert(avl_seq_try_get(tree, &key, avl_knode_keycmp, &found));
+        assert(nd2knode(found)->key == 10);
+        uint64_t const missing = 11;
+        assert(avl_seq_get(tree, &missing, avl_knode_keycmp) == NULL);
+    }
+
+    struct reader readers[N_READERS];
+    pthread_t threads[N_READERS];
+    for (int i = 0; i < N_READERS; ++i) {
+        readers[i] = (struct reader) { .sh = &sh, .rng = 1 + i, .hits = 0 };
+        assert(pthread_create(&threads[i], NULL, reader, &readers[i]) == 0);
+    }
+
+    // Churn the odd keys, freeing each object as soon as it is out
+    unsigned rng = 7;
+    for (int round = 0; round < N_ROUNDS; ++round) {
+        for (uint64_t k = 1; k < N_KEYS; k += 2) {
+            (void)add_key(tree, &cache, k);
+        }
+        for (int i = 0; i < N_KEYS / 2; ++i) {
+            rng = rng * 1103515245u + 12345u;
+            uint64_t const k = 2 * ((rng >> 8) % (N_KEYS / 2)) + 1;
+
+            avl_seq_write_begin(tree);
+            e_avl_knode *const kn = avl_int_rem(tree, k, stack);
+            avl_seq_write_end(tree);
+            if (kn != NULL) {
+                avl_pool_free(&cache, kn, sizeof(*kn));
+            }
+        }
+        for (uint64_t k = 1; k < N_KEYS; k += 2) {
+            avl_seq_write_begin(tree);
+            e_avl_knode *const kn = avl_int_rem(tree, k, stack);
+            avl_seq_write_end(tree);
+            if (kn != NULL) {
+                avl_pool_free(&cache, kn, sizeof(*kn));
+            }
+        }
+        assert(avl_size(tree) == N_KEYS / 2);
+    }
+
+    __atomic_store_n(&sh.done, 1, __ATOMIC_RELEASE);
+    unsigned long hits = 0;
+    for (int i = 0; i < N_READERS; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+        hits += readers[i].hits;
+    }
+    assert(tree->m_gen % 2 == 0);
+    printf("%lu optimistic hits\n", hits);
+
+    avl_pool_release(&pool);
+    return 0;
+}
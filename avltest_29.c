@@ -0,0 +1,216 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "inline_avl_concurrent.h"
+
+#define N_KEYS 20000
+#define N_THREADS 4
+#define N_RANGE 4096
+#define N_STEPS 200000
+
+static avl_conc_tree_t tree;
+
+// Checks links, order and heights below `nd`; returns the height. With
+// `balanced` set, every node must also be in AVL balance.
+static int
+check(avl_conc_node_t const*const nd, avl_conc_node_t const*const parent,
+        uint64_t const lo, uint64_t const hi, bool const balanced, size_t *const n_values)
+{
+    if (nd == NULL) {
+        return 0;
+    }
+    assert(nd->parent == parent);
+    assert(nd->key >= lo && nd->key <= hi);
+    assert(!(nd->version & (CONC_UNLINKED | CONC_SHRINKING)));
+    if (nd->value != NULL) {
+        assert((uintptr_t)nd->value == nd->key + 1);
+        ++*n_values;
+    }
+    int const lh = check(nd->child[0], nd, lo, nd->key - 1, balanced, n_values);
+    int const rh = check(nd->child[1], nd, nd->key + 1, hi, balanced, n_values);
+    if (balanced) {
+        assert(lh - rh <= 1 && rh - lh <= 1);
+        assert(nd->height == 1 + (lh > rh ? lh : rh));
+    }
+    return 1 + (lh > rh ? lh : rh);
+}
+
+static size_t
+check_tree(bool const balanced)
+{
+    size_t n_values = 0;
+    (void)check(tree.m_holder.child[1], &tree.m_holder, 0, UINT64_MAX - 1, balanced, &n_values);
+    return n_values;
+}
+
+static void *
+val(uint64_t const key)
+{
+    return (void *)(uintptr_t)(key + 1);
+}
+
+struct worker {
+    int id;
+    bool shared;        /* every thread on the same keys */
+    unsigned char present[N_RANGE];
+};
+
+static void *
+worker(void *const arg)
+{
+    struct worker *const w = arg;
+    avl_conc_thread_t *const th = avl_conc_thread_enter(&tree);
+    assert(th != NULL);
+
+    unsigned rng = 17 + w->id;
+    uint64_t const base = w->shared ? 0 : (uint64_t)w->id * N_RANGE;
+
+    for (int i = 0; i < N_STEPS; ++i) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        uint64_t const k = base + rng % N_RANGE;
+        void *v;
+
+        switch ((rng >> 16) % 3) {
+        case 0:
+            v = avl_conc_add(th, k, val(k));
+            assert(v == val(k));
+            w->present[k - base] = 1;
+            break;
+        case 1:
+            v = avl_conc_rem(th, k);
+            assert(v == NULL || v == val(k));
+            if (!w->shared) {
+                assert((v != NULL) == w->present[k - base]);
+            }
+            w->present[k - base] = 0;
+            break;
+        default:
+            v = avl_conc_get(th, k);
+            assert(v == NULL || v == val(k));
+            if (!w->shared) {
+                assert((v != NULL) == w->present[k - base]);
+            }
+            break;
+        }
+    }
+
+    avl_conc_thread_leave(th);
+    return NULL;
+}
+
+static void
+run(bool const shared)
+{
+    static struct worker workers[N_THREADS];
+    pthread_t threads[N_THREADS];
+
+    for (int i = 0; i < N_THREADS; ++i) {
+        memset(&workers[i], 0, sizeof(workers[i]));
+        workers[i].id = i;
+        workers[i].shared = shared;
+        assert(pthread_create(&threads[i], NULL, worker, &workers[i]) == 0);
+    }
+    for (int i = 0; i < N_THREADS; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+
+    avl_conc_thread_t *const th = avl_conc_thread_enter(&tree);
+    size_t const n_values = check_tree(false);
+    if (shared) {
+        // Whatever is left, every key is there once with its own value
+        size_t n = 0;
+        for (uint64_t k = 0; k < N_RANGE; ++k) {
+            n += avl_conc_get(th, k) != NULL;
+        }
+        assert(n == n_values);
+    } else {
+        // Each thread's range holds exactly what it thinks it does
+        size_t n = 0;
+        for (int i = 0; i < N_THREADS; ++i) {
+            for (uint64_t k = 0; k < N_RANGE; ++k) {
+                uint64_t const key = (uint64_t)i * N_RANGE + k;
+                assert((avl_conc_get(th, key) != NULL) == workers[i].present[k]);
+                n += workers[i].present[k];
+            }
+        }
+        assert(n == n_values);
+    }
+
+    // Emptied from one thread, the tree is left with no nodes at all
+    for (uint64_t k = 0; k < N_THREADS * N_RANGE; ++k) {
+        (void)avl_conc_rem(th, k);
+    }
+    assert(tree.m_holder.child[1] == NULL);
+    avl_conc_thread_leave(th);
+}
+
+int
+main(void)
+{
+    avl_conc_init(&tree);
+    avl_conc_thread_t *const th = avl_conc_thread_enter(&tree);
+    assert(th != NULL);
+
+    // One thread: a plain AVL tree, apart from routing nodes
+    assert(avl_conc_get(th, 5) == NULL);
+    assert(avl_conc_rem(th, 5) == NULL);
+    for (uint64_t i = 0; i < N_KEYS; ++i) {
+        uint64_t const k = (i * 7919) % N_KEYS;
+        assert(avl_conc_add(th, k, val(k)) == val(k));
+    }
+    assert(avl_conc_add(th, 3, val(4)) == val(3));
+    assert(check_tree(true) == N_KEYS);
+    assert(tree.m_holder.child[1]->height <= 20);
+
+    for (uint64_t k = 0; k < N_KEYS; ++k) {
+        assert(avl_conc_get(th, k) == val(k));
+    }
+    assert(avl_conc_get(th, N_KEYS) == NULL);
+
+    // Removing nodes with two children leaves routing nodes, which come back
+    // to life on an add and go once they have a child to spare
+    for (uint64_t k = 0; k < N_KEYS; k += 2) {
+        assert(avl_conc_rem(th, k) == val(k));
+    }
+    assert(avl_conc_rem(th, 0) == NULL);
+    assert(check_tree(false) == N_KEYS / 2);
+    for (uint64_t k = 0; k < N_KEYS; ++k) {
+        assert(avl_conc_get(th, k) == ((k % 2) ? val(k) : NULL));
+    }
+    for (uint64_t k = 0; k < N_KEYS; k += 4) {
+        assert(avl_conc_add(th, k, val(k)) == val(k));
+    }
+    for (uint64_t k = 1; k < N_KEYS; k += 2) {
+        assert(avl_conc_rem(th, k) == val(k));
+    }
+    assert(check_tree(false) == N_KEYS / 4);
+    for (uint64_t k = 0; k < N_KEYS; k += 4) {
+        assert(avl_conc_rem(th, k) == val(k));
+    }
+    assert(tree.m_holder.child[1] == NULL);
+    avl_conc_thread_leave(th);
+
+    run(false);
+    run(true);
+
+    // Every slot can be taken, and no more
+    avl_conc_thread_t *slots[AVL_CONC_MAX_THREADS];
+    for (int i = 0; i < AVL_CONC_MAX_THREADS; ++i) {
+        slots[i] = avl_conc_thread_enter(&tree);
+        assert(slots[i] != NULL);
+    }
+    assert(avl_conc_thread_enter(&tree) == NULL);
+    for (int i = 0; i < AVL_CONC_MAX_THREADS; ++i) {
+        avl_conc_thread_leave(slots[i]);
+    }
+
+    avl_conc_destroy(&tree);
+    return 0;
+}
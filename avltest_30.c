@@ -0,0 +1,236 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "inline_avl_sharded.h"
+
+// Built with AVL_SUBTREE_COUNT, without which boundaries don't move
+
+#define N_SHARDS 8
+#define N_KEYS 50000
+#define N_THREADS 4
+#define N_STEPS 200000
+
+// Every shard holds only keys in its range, and the fences agree
+static size_t
+check_shards(avl_sharded_t *const sh)
+{
+    void *stack[AVL_SHARDED_STACK];
+    size_t n = 0;
+
+    assert(sh->m_fences[0] == 0 && sh->m_shards[0].lo == 0);
+    for (unsigned i = 0; i < sh->m_n; ++i) {
+        avl_shard_t *const s = &sh->m_shards[i];
+        assert(sh->m_fences[i] == s->lo);
+        if (i + 1 < sh->m_n) {
+            assert(s->hi == sh->m_shards[i + 1].lo);
+            assert(s->lo < s->hi);
+        }
+
+        avl_iter_t iter = avl_iter_init(&s->tree, stack);
+        for (e_avl_node *nd = avl_iter_first(&iter); nd != NULL; nd = avl_iter_next(&iter)) {
+            assert(shard_has(sh, i, nd2knode(nd)->key));
+            ++n;
+        }
+    }
+    return n;
+}
+
+struct scan_state {
+    uint64_t prev;
+    size_t n;
+    size_t stop_after;
+};
+
+static bool
+scan_cb(e_avl_knode *const kn, void *const arg)
+{
+    struct scan_state *const st = arg;
+    assert(st->n == 0 || kn->key > st->prev);
+    st->prev = kn->key;
+    return ++st->n != st->stop_after;
+}
+
+struct worker {
+    avl_sharded_t *sh;
+    e_avl_knode *kn;
+    int id;
+    unsigned char present[N_KEYS];
+};
+
+// Adds and removes the keys congruent to its id, mostly in one narrow range
+static void *
+worker(void *const arg)
+{
+    struct worker *const w = arg;
+    unsigned rng = 99 + w->id;
+
+    for (int i = 0; i < N_STEPS; ++i) {
+        rng = rng * 1103515245u + 12345u;
+        size_t const slot = ((rng >> 8) % 8 == 0) ? (rng >> 4) % N_KEYS : (rng >> 4) % (N_KEYS / 16);
+        size_t const j = slot - slot % N_THREADS + w->id;
+        if (j >= N_KEYS) {
+            continue;
+        }
+        e_avl_knode *const kn = &w->kn[j];
+
+        // Only this thread touches this key, so it knows what's there
+        if (rng & 1) {
+            if (w->present[j]) {
+                assert(avl_sharded_get(w->sh, kn->key) == kn);
+            } else {
+                assert(avl_sharded_add(w->sh, kn) == kn);
+                w->present[j] = 1;
+            }
+        } else {
+            e_avl_knode *const got = avl_sharded_rem(w->sh, kn->key);
+            assert(got == (w->present[j] ? kn : NULL));
+            w->present[j] = 0;
+            assert(avl_sharded_get(w->sh, kn->key) == NULL);
+        }
+    }
+    return NULL;
+}
+
+static void *
+scanner(void *const arg)
+{
+    avl_sharded_t *const sh = arg;
+    for (int i = 0; i < 200; ++i) {
+        struct scan_state st = { 0, 0, 0 };
+        avl_sharded_scan(sh, 0, UINT64_MAX, scan_cb, &st);
+    }
+    return NULL;
+}
+
+int
+main(void)
+{
+    e_avl_knode *const kn = calloc(N_KEYS, sizeof(*kn));
+    for (size_t i = 0; i < N_KEYS; ++i) {
+        kn[i].key = 10 * i + 5;
+    }
+
+    avl_sharded_t sh;
+    assert(!avl_sharded_init(&sh, 0, 0, 1));
+    assert(avl_sharded_init(&sh, N_SHARDS, 0, 10 * N_KEYS));
+
+    // Empty shards come through their balance checks with nothing to move
+    for (int i = 0; i < 2 * AVL_SHARDED_CHECK; ++i) {
+        assert(avl_sharded_get(&sh, kn[0].key) == NULL);
+    }
+    assert(sh.m_moves == 0 && check_shards(&sh) == 0);
+
+    // Keys in order pile into the first shards, and move on as they grow
+    for (size_t i = 0; i < N_KEYS; ++i) {
+        assert(avl_sharded_add(&sh, &kn[i]) == &kn[i]);
+    }
+    assert(avl_sharded_add(&sh, &(e_avl_knode){ .key = kn[7].key }) == &kn[7]);
+    assert(check_shards(&sh) == N_KEYS && avl_sharded_size(&sh) == N_KEYS);
+    for (size_t i = 0; i < N_KEYS; ++i) {
+        assert(avl_sharded_get(&sh, kn[i].key) == &kn[i]);
+        assert(avl_sharded_get(&sh, kn[i].key + 1) == NULL);
+    }
+
+    // Hammering a few keys makes their shard hand keys to its neighbour
+    uint64_t const moves = sh.m_moves;
+    size_t const first = avl_size(&sh.m_shards[0].tree);
+    for (int round = 0; round < 200; ++round) {
+        for (size_t i = 0; i < 1000; ++i) {
+            assert(avl_sharded_get(&sh, kn[i].key) == &kn[i]);
+        }
+    }
+#ifdef AVL_SUBTREE_COUNT
+    assert(sh.m_moves > moves);
+    assert(avl_size(&sh.m_shards[0].tree) < first);
+#else
+    assert(sh.m_moves == moves && avl_size(&sh.m_shards[0].tree) == first);
+#endif
+    assert(check_shards(&sh) == N_KEYS);
+
+    // Scans see every key once, in order, across shards
+    struct scan_state st = { 0, 0, 0 };
+    avl_sharded_scan(&sh, 0, UINT64_MAX, scan_cb, &st);
+    assert(st.n == N_KEYS);
+    st = (struct scan_state) { 0, 0, 0 };
+    avl_sharded_scan(&sh, kn[100].key, kn[30000].key, scan_cb, &st);
+    assert(st.n == 29901 && st.prev == kn[30000].key);
+    st = (struct scan_state) { 0, 0, 0 };
+    avl_sharded_scan(&sh, kn[100].key + 1, kn[100].key + 9, scan_cb, &st);
+    assert(st.n == 0);
+    st = (struct scan_state) { 0, 0, 10 };
+    avl_sharded_scan(&sh, 0, UINT64_MAX, scan_cb, &st);
+    assert(st.n == 10 && st.prev == kn[9].key);
+
+    for (size_t i = 0; i < N_KEYS; i += 2) {
+        assert(avl_sharded_rem(&sh, kn[i].key) == &kn[i]);
+    }
+    assert(avl_sharded_rem(&sh, kn[0].key) == NULL);
+    assert(check_shards(&sh) == N_KEYS / 2);
+    for (size_t i = 1; i < N_KEYS; i += 2) {
+        assert(avl_sharded_rem(&sh, kn[i].key) == &kn[i]);
+    }
+    assert(avl_sharded_size(&sh) == 0);
+
+    // And so do shards emptied by removes, next to one that still has keys
+    assert(avl_sharded_add(&sh, &kn[N_KEYS - 1]) == &kn[N_KEYS - 1]);
+    for (int i = 0; i < 2 * AVL_SHARDED_CHECK; ++i) {
+        assert(avl_sharded_get(&sh, kn[0].key) == NULL);
+        assert(avl_sharded_get(&sh, kn[N_KEYS / 2].key) == NULL);
+    }
+    assert(check_shards(&sh) == 1);
+    assert(avl_sharded_rem(&sh, kn[N_KEYS - 1].key) == &kn[N_KEYS - 1]);
+
+    // Threads on their own keys, with boundaries moving under them
+    static struct worker workers[N_THREADS];
+    pthread_t threads[N_THREADS + 1];
+    for (int i = 0; i < N_THREADS; ++i) {
+        workers[i] = (struct worker) { .sh = &sh, .kn = kn, .id = i };
+        assert(pthread_create(&threads[i], NULL, worker, &workers[i]) == 0);
+    }
+    assert(pthread_create(&threads[N_THREADS], NULL, scanner, &sh) == 0);
+    for (int i = 0; i <= N_THREADS; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+
+    size_t const n = check_shards(&sh);
+    size_t present = 0;
+    for (size_t i = 0; i < N_KEYS; ++i) {
+        e_avl_knode *const got = avl_sharded_get(&sh, kn[i].key);
+        assert(got == (workers[i % N_THREADS].present[i] ? &kn[i] : NULL));
+        present += (got != NULL);
+    }
+    assert(present == n);
+
+    avl_sharded_destroy(&sh);
+
+    // Fences stay in order however close the range is to the largest key,
+    // and however few keys it holds
+    uint64_t const ranges[][2] = {
+        { UINT64_MAX - 10, UINT64_MAX },
+        { 0, UINT64_MAX },
+        { UINT64_MAX, UINT64_MAX },
+        { 5, 5 },
+    };
+    for (size_t j = 0; j < sizeof(ranges) / sizeof(ranges[0]); ++j) {
+        assert(avl_sharded_init(&sh, N_SHARDS, ranges[j][0], ranges[j][1]));
+        for (uint64_t i = 0; i < 20; ++i) {
+            kn[i].key = UINT64_MAX - i;
+            kn[20 + i].key = i;
+            assert(avl_sharded_add(&sh, &kn[i]) == &kn[i]);
+            assert(avl_sharded_add(&sh, &kn[20 + i]) == &kn[20 + i]);
+        }
+        assert(check_shards(&sh) == 40);
+        for (size_t i = 0; i < 40; ++i) {
+            assert(avl_sharded_get(&sh, kn[i].key) == &kn[i]);
+        }
+        avl_sharded_destroy(&sh);
+    }
+
+    free(kn);
+    return 0;
+}
@@ -0,0 +1,246 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "inline_avl_persist.h"
+#include "inline_avl_int.h"
+
+#define N_KEYS 4000
+#define N_SNAPSHOTS 12
+#define N_STEPS 3000
+
+struct item {
+    e_avl_knode kn;
+    uint64_t payload;
+};
+
+static long live;
+
+static e_avl_node *
+copy_item(e_avl_node const*const nd, void *const arg)
+{
+    (void)arg;
+    struct item const*const src = (struct item const*)nd;
+    struct item *const it = malloc(sizeof(*it));
+    it->kn.key = src->kn.key;
+    it->payload = src->payload;
+    __atomic_add_fetch(&live, 1, __ATOMIC_RELAXED);
+    return &it->kn.node;
+}
+
+static void
+drop_item(e_avl_node *const nd, void *const arg)
+{
+    (void)arg;
+    __atomic_sub_fetch(&live, 1, __ATOMIC_RELAXED);
+    free(nd);
+}
+
+static struct item *
+new_item(uint64_t const key)
+{
+    struct item *const it = malloc(sizeof(*it));
+    it->kn.key = key;
+    it->payload = key * 3;
+    __atomic_add_fetch(&live, 1, __ATOMIC_RELAXED);
+    return it;
+}
+
+// Checks order, heights, balance and payloads below `nd`; returns the height
+static int
+check(e_avl_node const*const nd, uint64_t const lo, uint64_t const hi, size_t *const n)
+{
+    if (nd == NULL) {
+        return 0;
+    }
+    struct item const*const it = (struct item const*)nd;
+    assert(it->kn.key >= lo && it->kn.key <= hi);
+    assert(it->payload == it->kn.key * 3);
+    assert(__atomic_load_n(&nd->refs, __ATOMIC_RELAXED) >= 1);
+    ++*n;
+    int const lh = check(nd->lc, lo, it->kn.key - 1, n);
+    int const rh = check(nd->rc, it->kn.key + 1, hi, n);
+    assert(lh - rh <= 1 && rh - lh <= 1);
+    assert(nd->height == 1 + (lh > rh ? lh : rh));
+    return nd->height;
+}
+
+// The version holds exactly the keys marked in `model`
+static void
+check_version(avl_tree_t const*const tree, unsigned char const*const model)
+{
+    size_t n = 0, want = 0;
+    (void)check(tree->m_top, 0, UINT64_MAX, &n);
+    assert(n == avl_size(tree));
+    for (uint64_t k = 0; k < 2 * N_KEYS; ++k) {
+        assert((avl_int_get(tree, k) != NULL) == model[k]);
+        want += model[k];
+    }
+    assert(n == want);
+}
+
+struct reader {
+    avl_persist_t const *p;
+    avl_tree_t snap;
+    uint64_t sum;
+    int rounds;
+};
+
+// Walks its snapshot over and over while the writer changes the tree, then
+// releases it
+static void *
+reader(void *const arg)
+{
+    struct reader *const r = arg;
+    void *stack[46];
+
+    for (int i = 0; i < r->rounds; ++i) {
+        uint64_t sum = 0;
+        avl_iter_t iter = avl_iter_init(&r->snap, stack);
+        for (e_avl_node *nd = avl_iter_first(&iter); nd != NULL; nd = avl_iter_next(&iter)) {
+            sum += nd2knode(nd)->key;
+        }
+        assert(sum == r->sum);
+    }
+    avl_persist_release(r->p, &r->snap);
+    return NULL;
+}
+
+int
+main(void)
+{
+    void *stack[46];
+    avl_persist_t p = avl_persist_init(copy_item, drop_item, NULL);
+    static unsigned char model[N_SNAPSHOTS + 1][2 * N_KEYS];
+    unsigned char *const cur = model[N_SNAPSHOTS];
+
+    // With no snapshots, changes are made in place
+    for (uint64_t i = 0; i < N_KEYS; ++i) {
+        uint64_t const k = (i * 7919) % N_KEYS;
+        struct item *const it = new_item(k);
+        assert(avl_persist_add(&p, &it->kn.node, avl_knode_cmp, stack) == &it->kn.node);
+        cur[k] = 1;
+    }
+    {
+        struct item *const dup = new_item(5);
+        assert(avl_persist_add(&p, &dup->kn.node, avl_knode_cmp, stack) != &dup->kn.node);
+        drop_item(&dup->kn.node, NULL);
+    }
+    assert(p.m_copies == 0);
+    check_version(&p.m_tree, cur);
+
+    // A snapshot stays as it was while its tree changes, and every change
+    // copies no more than a few nodes per level
+    avl_tree_t first = avl_persist_snapshot(&p);
+    memcpy(model[0], cur, sizeof(model[0]));
+    int const height = avl_height(&p.m_tree);
+    for (uint64_t k = 0; k < N_KEYS; k += 2) {
+        size_t const copies = p.m_copies;
+        assert(avl_persist_rem(&p, &k, avl_knode_keycmp, stack));
+        assert((int)(p.m_copies - copies) <= 2 * height + 2);
+        cur[k] = 0;
+    }
+    for (uint64_t k = N_KEYS; k < N_KEYS + N_KEYS / 4; ++k) {
+        size_t const copies = p.m_copies;
+        struct item *const it = new_item(k);
+        assert(avl_persist_add(&p, &it->kn.node, avl_knode_cmp, stack) == &it->kn.node);
+        assert((int)(p.m_copies - copies) <= height + 2);
+        cur[k] = 1;
+    }
+    {
+        uint64_t const k = 0;
+        assert(!avl_persist_rem(&p, &k, avl_knode_keycmp, stack));
+    }
+    check_version(&first, model[0]);
+    check_version(&p.m_tree, cur);
+
+    // Releasing it drops what only it held, and the tree goes back to
+    // changing in place
+    avl_persist_release(&p, &first);
+    assert(first.m_top == NULL);
+    assert(live == (long)avl_size(&p.m_tree));
+    {
+        size_t const copies = p.m_copies;
+        uint64_t const k = 1;
+        assert(avl_persist_rem(&p, &k, avl_knode_keycmp, stack));
+        struct item *const it = new_item(k);
+        assert(avl_persist_add(&p, &it->kn.node, avl_knode_cmp, stack) == &it->kn.node);
+        assert(p.m_copies == copies);
+    }
+
+    // Many versions at once, released in a different order from their making
+    avl_tree_t snaps[N_SNAPSHOTS];
+    unsigned rng = 12345;
+    for (int s = 0; s < N_SNAPSHOTS; ++s) {
+        for (int i = 0; i < N_STEPS / N_SNAPSHOTS; ++i) {
+            rng = rng * 1103515245u + 12345u;
+            uint64_t const k = (rng >> 8) % (2 * N_KEYS);
+            if (rng & 1) {
+                if (!cur[k]) {
+                    struct item *const it = new_item(k);
+                    assert(avl_persist_add(&p, &it->kn.node, avl_knode_cmp, stack) == &it->kn.node);
+                    cur[k] = 1;
+                }
+            } else {
+                assert(avl_persist_rem(&p, &k, avl_knode_keycmp, stack) == cur[k]);
+                cur[k] = 0;
+            }
+        }
+        snaps[s] = avl_persist_snapshot(&p);
+        memcpy(model[s], cur, sizeof(model[s]));
+    }
+    check_version(&p.m_tree, cur);
+    for (int s = 0; s < N_SNAPSHOTS; ++s) {
+        check_version(&snaps[s], model[s]);
+    }
+    for (int s = 1; s < N_SNAPSHOTS; s += 2) {
+        avl_persist_release(&p, &snaps[s]);
+    }
+    for (int s = 0; s < N_SNAPSHOTS; s += 2) {
+        check_version(&snaps[s], model[s]);
+        avl_persist_release(&p, &snaps[s]);
+    }
+    check_version(&p.m_tree, cur);
+    assert(live == (long)avl_size(&p.m_tree));
+
+    // Readers on other threads, releasing their snapshots while the writer
+    // goes on
+    struct reader readers[2];
+    pthread_t threads[2];
+    for (int i = 0; i < 2; ++i) {
+        uint64_t sum = 0;
+        for (uint64_t k = 0; k < 2 * N_KEYS; ++k) {
+            sum += cur[k] ? k : 0;
+        }
+        readers[i] = (struct reader) {
+            .p = &p, .snap = avl_persist_snapshot(&p), .sum = sum, .rounds = 20 + 20 * i,
+        };
+        assert(pthread_create(&threads[i], NULL, reader, &readers[i]) == 0);
+
+        for (int j = 0; j < N_STEPS; ++j) {
+            rng = rng * 1103515245u + 12345u;
+            uint64_t const k = (rng >> 8) % (2 * N_KEYS);
+            if (cur[k]) {
+                assert(avl_persist_rem(&p, &k, avl_knode_keycmp, stack));
+            } else {
+                struct item *const it = new_item(k);
+                assert(avl_persist_add(&p, &it->kn.node, avl_knode_cmp, stack) == &it->kn.node);
+            }
+            cur[k] ^= 1;
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    check_version(&p.m_tree, cur);
+    assert(live == (long)avl_size(&p.m_tree));
+
+    avl_persist_destroy(&p);
+    assert(live == 0);
+    printf("%zu nodes copied\n", p.m_copies);
+    return 0;
+}
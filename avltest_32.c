@@ -0,0 +1,141 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "inline_avl_int.h"
+#include "inline_avl_clone.h"
+
+struct item {
+    e_avl_knode kn;
+    uint64_t payload;
+};
+
+struct arena {
+    struct item *items;
+    size_t n;
+    bool fail;
+};
+
+static bool
+arena_alloc(size_t const n, void *const arg)
+{
+    struct arena *const a = arg;
+    if (a->fail) {
+        return false;
+    }
+    a->items = malloc(n * sizeof(*a->items));
+    a->n = n;
+    return a->items != NULL;
+}
+
+static e_avl_node *
+arena_copy(e_avl_node const*const src, size_t const i, void *const arg)
+{
+    struct arena *const a = arg;
+    struct item const*const from = (struct item const*)src;
+    assert(i < a->n);
+    a->items[i].kn.key = from->kn.key;
+    a->items[i].payload = from->payload;
+    return &a->items[i].kn.node;
+}
+
+// The copy has the shape, heights and contents of the original, and sits in
+// the arena in pre-order
+static void
+check_same(e_avl_node const*const src, e_avl_node const*const dst, struct arena const*const a,
+        size_t *const slot)
+{
+    if (src == NULL) {
+        assert(dst == NULL);
+        return;
+    }
+    assert(dst == &a->items[(*slot)++].kn.node);
+    assert(dst->height == src->height);
+    assert(nd2knode(dst)->key == nd2knode(src)->key);
+    assert(((struct item const*)dst)->payload == ((struct item const*)src)->payload);
+    check_same(src->lc, dst->lc, a, slot);
+    check_same(src->rc, dst->rc, a, slot);
+}
+
+static void
+check_clone(avl_tree_t const*const src, unsigned const threads)
+{
+    struct arena a = { 0 };
+    avl_tree_t dst = avl_tree_init();
+    assert(avl_base_clone(&dst, src, arena_alloc, arena_copy, &a, threads));
+    assert(avl_size(&dst) == avl_size(src));
+
+    size_t slot = 0;
+    check_same(src->m_top, dst.m_top, &a, &slot);
+    assert(slot == avl_size(src));
+    free(a.items);
+}
+
+int
+main(void)
+{
+    void *stack[46];
+    size_t const sizes[] = { 0, 1, 2, 3, 7, 100, 1000, 30000 };
+    unsigned const threads[] = { 0, 1, 3, 8, 100 };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        size_t const n = sizes[s];
+        struct item *const items = calloc(2 * n + 1, sizeof(*items));
+        avl_tree_t tree = avl_tree_init();
+
+        // Insert twice as many and remove half, for an uneven shape
+        unsigned rng = 1 + s;
+        for (size_t i = 0; i < 2 * n; ++i) {
+            rng = rng * 1103515245u + 12345u;
+            items[i].kn.key = ((uint64_t)rng << 20) | i;
+            items[i].payload = i * 7;
+            assert(avl_int_add(&tree, &items[i].kn, stack) == &items[i].kn);
+        }
+        for (size_t i = 0; i < 2 * n; i += 2) {
+            assert(avl_int_rem(&tree, items[i].kn.key, stack) == &items[i].kn);
+        }
+        assert(avl_size(&tree) == n);
+
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t) {
+            check_clone(&tree, threads[t]);
+        }
+        free(items);
+    }
+
+    // A clone is a tree like any other
+    {
+        size_t const n = 5000;
+        struct item *const items = calloc(n, sizeof(*items));
+        avl_tree_t tree = avl_tree_init();
+        for (size_t i = 0; i < n; ++i) {
+            items[i].kn.key = (i * 7919) % n;
+            items[i].payload = i;
+            assert(avl_int_add(&tree, &items[i].kn, stack) == &items[i].kn);
+        }
+
+        struct arena a = { 0 };
+        avl_tree_t dst = avl_tree_init();
+        assert(avl_base_clone(&dst, &tree, arena_alloc, arena_copy, &a, 3));
+        for (uint64_t k = 0; k < n; ++k) {
+            e_avl_knode *const kn = avl_int_get(&dst, k);
+            assert(kn != NULL && kn->key == k && kn != avl_int_get(&tree, k));
+        }
+        for (uint64_t k = 0; k < n; k += 2) {
+            assert(avl_int_rem(&dst, k, stack) != NULL);
+        }
+        assert(avl_size(&dst) == n / 2 && avl_size(&tree) == n);
+        check_clone(&dst, 2);
+
+        // When there's no room, nothing is copied
+        struct arena none = { .fail = true };
+        assert(!avl_base_clone(&dst, &tree, arena_alloc, arena_copy, &none, 2));
+        assert(avl_size(&dst) == n / 2);
+
+        free(a.items);
+        free(items);
+    }
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "inline_avl_int.h"
+#include "inline_avl_file.h"
+
+struct item {
+    e_avl_knode kn;
+    uint64_t payload;
+};
+
+struct record {
+    uint64_t key;
+    uint64_t payload;
+};
+
+struct arena {
+    struct item *items;
+    size_t n;
+};
+
+static void
+encode_item(e_avl_node const*const nd, void *const record, void *const arg)
+{
+    (void)arg;
+    struct item const*const it = (struct item const*)nd;
+    struct record const r = { it->kn.key, it->payload };
+    memcpy(record, &r, sizeof(r));
+}
+
+static bool
+arena_alloc(size_t const n, void *const arg)
+{
+    struct arena *const a = arg;
+    a->items = malloc(n * sizeof(*a->items));
+    a->n = n;
+    return a->items != NULL;
+}
+
+static e_avl_node *
+decode_item(void const*const record, size_t const i, void *const arg)
+{
+    struct arena *const a = arg;
+    struct record r;
+    memcpy(&r, record, sizeof(r));
+    assert(i < a->n);
+    a->items[i].kn.key = r.key;
+    a->items[i].payload = r.payload;
+    return &a->items[i].kn.node;
+}
+
+// Checks order and balance below `nd`; returns the height
+static int
+check(e_avl_node const*const nd, uint64_t const lo, uint64_t const hi)
+{
+    if (nd == NULL) {
+        return 0;
+    }
+    uint64_t const key = nd2knode(nd)->key;
+    assert(key >= lo && key <= hi);
+    int const lh = check(nd->lc, lo, key - 1);
+    int const rh = check(nd->rc, key + 1, hi);
+    assert(lh - rh <= 1 && rh - lh <= 1);
+    assert(nd->height == 1 + (lh > rh ? lh : rh));
+    return nd->height;
+}
+
+// Saves `tree`, loads it back, and compares the two
+static void
+round_trip(avl_tree_t const*const tree)
+{
+    FILE *const fp = tmpfile();
+    assert(fp != NULL);
+    int const fd = fileno(fp);
+    assert(avl_file_write_tree(fd, tree, sizeof(struct record), encode_item, NULL));
+
+    avl_file_t f;
+    assert(avl_file_map(&f, fd, sizeof(struct record)));
+    assert(avl_file_size(&f) == avl_size(tree));
+
+    struct arena a = { NULL, 0 };
+    avl_tree_t loaded = avl_tree_init();
+    assert(avl_file_load(&loaded, &f, arena_alloc, decode_item, &a));
+    assert(avl_size(&loaded) == avl_size(tree));
+    (void)check(loaded.m_top, 0, UINT64_MAX);
+
+    // Same objects in the same order, in the records and in the new tree
+    void *stack[64], *lstack[64];
+    avl_iter_t iter = avl_iter_init(tree, stack);
+    avl_iter_t liter = avl_iter_init(&loaded, lstack);
+    e_avl_node *nd = avl_iter_first(&iter);
+    e_avl_node *lnd = avl_iter_first(&liter);
+    for (size_t i = 0; nd != NULL; ++i) {
+        struct item const*const it = (struct item const*)nd;
+        struct item const*const lit = (struct item const*)lnd;
+        assert(lnd == &a.items[i].kn.node);
+        assert(lit->kn.key == it->kn.key && lit->payload == it->payload);
+
+        struct record r;
+        memcpy(&r, avl_file_record(&f, i), sizeof(r));
+        assert(r.key == it->kn.key && r.payload == it->payload);
+
+        nd = avl_iter_next(&iter);
+        lnd = avl_iter_next(&liter);
+    }
+    assert(lnd == NULL);
+
+    avl_file_unmap(&f);
+    free(a.items);
+    fclose(fp);
+}
+
+int
+main(void)
+{
+    void *stack[64];
+    size_t const sizes[] = { 0, 1, 2, 1000, 100000 };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        size_t const n = sizes[s];
+        struct item *const items = calloc(n + 1, sizeof(*items));
+        avl_tree_t tree = avl_tree_init();
+        unsigned rng = 7 + s;
+        for (size_t i = 0; i < n; ++i) {
+            rng = rng * 1103515245u + 12345u;
+            items[i].kn.key = ((uint64_t)rng << 24) | i;
+            items[i].payload = ~items[i].kn.key;
+            assert(avl_int_add(&tree, &items[i].kn, stack) == &items[i].kn);
+        }
+        round_trip(&tree);
+        free(items);
+    }
+
+    // Records streamed straight to the writer, more than fit in its buffer,
+    // and of a size that doesn't divide it
+    FILE *const fp = tmpfile();
+    int const fd = fileno(fp);
+    size_t const n = 3 * AVL_FILE_BUFFER / 12 + 5;
+    avl_file_writer_t w;
+    assert(avl_file_write_begin(&w, fd, 12));
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t const r[3] = { i, 2 * i, 3 * i };
+        memcpy(avl_file_write_next(&w), r, sizeof(r));
+    }
+
+    // Until the writer is done, the file isn't one
+    avl_file_t f;
+    assert(!avl_file_map(&f, fd, 12));
+    assert(avl_file_write_end(&w));
+    assert(avl_file_map(&f, fd, 12));
+    assert(avl_file_size(&f) == n);
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t r[3];
+        memcpy(r, avl_file_record(&f, i), sizeof(r));
+        assert(r[0] == i && r[1] == 2 * i && r[2] == 3 * i);
+    }
+    avl_file_unmap(&f);
+
+    // Files of another record size, version or length are turned away
+    assert(!avl_file_map(&f, fd, 16));
+    assert(!avl_file_map(&f, fd, 0));
+    avl_file_header_t header;
+    assert(pread(fd, &header, sizeof(header), 0) == sizeof(header));
+    header.version = AVL_FILE_VERSION + 1;
+    assert(pwrite(fd, &header, sizeof(header), 0) == sizeof(header));
+    assert(!avl_file_map(&f, fd, 12));
+    header.version = AVL_FILE_VERSION;
+    assert(pwrite(fd, &header, sizeof(header), 0) == sizeof(header));
+    assert(avl_file_map(&f, fd, 12));
+    avl_file_unmap(&f);
+    assert(ftruncate(fd, sizeof(header) + 12 * (n - 1)) == 0);
+    assert(!avl_file_map(&f, fd, 12));
+    assert(ftruncate(fd, 10) == 0);
+    assert(!avl_file_map(&f, fd, 12));
+    fclose(fp);
+
+    return 0;
+}
@@ -6,6 +6,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <sched.h>
 
 #ifndef assert
 #define assert(x)
@@ -29,7 +31,7 @@ static inline astack_t
 stack_init(void *const buffer)
 {
     return (astack_t) {
-        .data = buffer,
+        .data = (void **)buffer,
         .sz = 0,
     };
 }
@@ -70,26 +72,56 @@ struct avl_node {
     e_avl_node *lc;
     e_avl_node *rc;
     int height;
-#if UINTPTR_MAX == 0xffffffffffffffffull
+#if defined(AVL_SUBTREE_COUNT)
+    // Opt-in: the number of nodes in the subtree rooted here, kept up to date
+    // wherever `height` is. On 64-bit this takes the place of `reserved`, so
+    // the node stays the same size.
+    unsigned count;
+#elif !defined(AVL_PERSISTENT) && UINTPTR_MAX == 0xffffffffffffffffull
     // It's sort of pointless to include this but it's good to be explicit that
     // this field will be present. The implementation doesn't touch it so it
     // could be used to store extra information (maybe typing information or
     // something, on 64-bit)
     int reserved;
 #endif
+#if defined(AVL_PERSISTENT)
+    // Opt-in: how many parents and versions hold this node, see
+    // inline_avl_persist.h. Without counts it takes the place of `reserved`.
+    unsigned refs;
+#endif
 };
 
 typedef struct avl_tree avl_tree_t;
 
 struct avl_tree {
     e_avl_node *m_top; /* top of the tree */
-    size_t m_size;
-    unsigned m_gen; /* generation is used for iterators */
+    size_t m_size; /* or AVL_SIZE_UNKNOWN, see avl_size */
+    unsigned m_gen; /* generation, even at rest, see "Optimistic readers" */
 };
 
+/* Every change steps the generation by two, so that it stays even between
+ * changes and odd values are left to mark a change in progress */
+#define AVL_GEN_STEP 2u
+
+static inline unsigned
+gen_bump(avl_tree_t *const tree)
+{
+    /* Atomic only so that optimistic readers may load it at any time */
+    unsigned const gen = tree->m_gen + AVL_GEN_STEP;
+    __atomic_store_n(&tree->m_gen, gen, __ATOMIC_RELAXED);
+    return gen;
+}
+
 typedef int (*avlcmp_t)(e_avl_node const*, e_avl_node const*);
 typedef int (*avlkeycmp_t)(void const*, e_avl_node const*);
 
+/* Room for `n` objects in one block, for functions that make a tree's worth
+ * of them at once to fill in order. False if there isn't any. */
+typedef bool (*avlalloc_t)(size_t n, void *arg);
+
+/* Take back a node that no tree holds any more */
+typedef void (*avldrop_t)(e_avl_node *, void *);
+
 static inline avl_tree_t
 avl_tree_init(void)
 {
@@ -111,6 +143,19 @@ avl_node_height(e_avl_node const*const p_n)
     return p_n->height;
 }
 
+#ifdef AVL_SUBTREE_COUNT
+__attribute__((pure))
+static inline size_t
+avl_node_count(e_avl_node const*const p_n)
+{
+    if (p_n == NULL) {
+        return 0;
+    }
+
+    return p_n->count;
+}
+#endif
+
 __attribute__((pure))
 static inline int
 avl_height(avl_tree_t const*const tree)
@@ -118,13 +163,54 @@ avl_height(avl_tree_t const*const tree)
     return avl_node_height(tree->m_top);
 }
 
+/* `m_size` of a tree whose size isn't known. Without AVL_SUBTREE_COUNT a
+ * split can't size its halves short of walking one of them, so it leaves
+ * them unknown rather than spend O(n). Adds and removes keep it unknown
+ * until the tree is emptied. */
+#define AVL_SIZE_UNKNOWN SIZE_MAX
+
+__attribute__((pure))
+static inline size_t
+walk_count(e_avl_node const*const node)
+{
+    if (node == NULL) {
+        return 0;
+    }
+    return 1 + walk_count(node->lc) + walk_count(node->rc);
+}
+
+// Returns the number of nodes in the tree. O(1), unless its size was left
+// unknown by a split, in which case the nodes are counted in O(n).
 __attribute__((pure))
 static inline size_t
 avl_size(avl_tree_t const*const p_tree)
 {
+    if (p_tree->m_size == AVL_SIZE_UNKNOWN) {
+        return walk_count(p_tree->m_top);
+    }
     return p_tree->m_size;
 }
 
+static inline void
+size_grow(avl_tree_t *const tree, size_t const n)
+{
+    if (tree->m_size != AVL_SIZE_UNKNOWN) {
+        tree->m_size += n;
+    }
+}
+
+/* Called after the nodes are unlinked, so that an unknown size becomes known
+ * again once the tree is empty */
+static inline void
+size_shrink(avl_tree_t *const tree, size_t const n)
+{
+    if (tree->m_top == NULL) {
+        tree->m_size = 0;
+    } else if (tree->m_size != AVL_SIZE_UNKNOWN) {
+        tree->m_size -= n;
+    }
+}
+
 
 #define DFOUND  0
 #define DLEFT   1
@@ -202,6 +288,25 @@ divek(
 }
 
 
+/* Unless nodes keep counts or an augmentation, a node's height is all it
+ * records about its subtree, so a retrace can stop at the first node whose
+ * height comes out unchanged: nothing above it can tell the difference. */
+#if !defined(AVL_SUBTREE_COUNT) && !defined(AVL_AUGMENT)
+#define AVL_HEIGHT_ONLY
+#endif
+
+/*
+ * Augmentation.
+ *
+ * To keep a per-subtree aggregate (a maximum, a sum, ...) in the objects
+ * containing the nodes, define AVL_AUGMENT(node) before including this file.
+ * It's invoked with a `struct avl_node *` every time that node's height is
+ * recomputed, which is after any change to its children, and always after
+ * the children's own aggregates are final. That covers insertion,
+ * rotations, every step of `rebalance`, and the bulk operations.
+ *
+ * It is a compile time hook, so every tree in a translation unit shares it.
+ */
 static inline void
 update_height(struct avl_node *const node)
 {
@@ -209,6 +314,12 @@ update_height(struct avl_node *const node)
     int const height_rc = avl_node_height(node->rc);
     int const maxheight = (height_rc > height_lc) ? height_rc : height_lc;
     node->height = 1 + maxheight;
+#ifdef AVL_SUBTREE_COUNT
+    node->count = 1 + avl_node_count(node->lc) + avl_node_count(node->rc);
+#endif
+#ifdef AVL_AUGMENT
+    AVL_AUGMENT(node);
+#endif
 }
 
 /*
@@ -316,14 +427,17 @@ find_case(e_avl_node const*const node)
 static inline void
 rebalance(avl_tree_t *const tree, struct astack *const p_stack)
 {
-    e_avl_node *node = stack_pop(p_stack);
+    e_avl_node *node = (e_avl_node *)stack_pop(p_stack);
 
     /* Traverse back up the tree, rebalancing and adjusting height */
     while (node != NULL) {
 
+#ifdef AVL_HEIGHT_ONLY
+        int const old_height = node->height;
+#endif
         update_height(node);
         unsigned const rot = find_case(node);
-        e_avl_node *const parent = stack_peek(p_stack);
+        e_avl_node *const parent = (e_avl_node *)stack_peek(p_stack);
 
         /* branch is the pivot point to rotate through:
          *
@@ -365,10 +479,31 @@ rebalance(avl_tree_t *const tree, struct astack *const p_stack)
             }
         }
 
-        node = stack_pop(p_stack);
+#ifdef AVL_HEIGHT_ONLY
+        if ((*branch)->height == old_height) {
+            break;
+        }
+#endif
+
+        node = (e_avl_node *)stack_pop(p_stack);
     }
 }
 
+/* Make `node` a tree of one */
+static inline void
+leaf_init(e_avl_node *const node)
+{
+    node->lc = NULL;
+    node->rc = NULL;
+    node->height = 1;
+#ifdef AVL_SUBTREE_COUNT
+    node->count = 1;
+#endif
+#ifdef AVL_AUGMENT
+    AVL_AUGMENT(node);
+#endif
+}
+
 // Mutate functions
 static inline e_avl_node *
 avl_base_add(
@@ -377,11 +512,9 @@ avl_base_add(
     avlcmp_t const cmpfunc,
     void *const stack_buffer)
 {
-    node->lc = NULL;
-    node->rc = NULL;
-    node->height = 1;
+    leaf_init(node);
 
-    if (tree->m_size == 0) {
+    if (tree->m_top == NULL) {
         tree->m_top = node;
     } else {
 
@@ -391,7 +524,7 @@ avl_base_add(
         // Find the point of insertion into the tree
         int const rc = dive(tree->m_top, node, cmpfunc, stack);
 
-        e_avl_node *const parent = stack_peek(stack);
+        e_avl_node *const parent = (e_avl_node *)stack_peek(stack);
         if (rc == DLEFT) {
             parent->lc = node;
         } else if (rc == DRIGHT) {
@@ -404,13 +537,76 @@ avl_base_add(
         rebalance(tree, stack);
     }
 
-    ++tree->m_size;
-    ++tree->m_gen;
+    size_grow(tree, 1);
+    gen_bump(tree);
 
     return node;
 
 }
 
+/*
+ * Link `n` nodes, already sorted in ascending order, into a perfectly balanced
+ * subtree and return its top. No comparisons or rotations are performed.
+ *
+ * The middle node of every range becomes the parent of the middles of its two
+ * halves. Ranges are visited twice, once to link them and again once both
+ * halves are finished so `update_height` sees complete children.
+ */
+static inline e_avl_node *
+build_balanced(e_avl_node *const nodes[], size_t const n)
+{
+    if (n == 0) {
+        return NULL;
+    }
+
+    struct build_frame {
+        size_t lo;
+        size_t hi;
+        bool linked;
+    };
+
+    // Each level of the descent leaves at most two frames behind it.
+    struct build_frame frames[2 * 64 + 1];
+    size_t sp = 0;
+
+    frames[sp++] = (struct build_frame) { .lo = 0, .hi = n, .linked = false };
+
+    while (sp > 0) {
+        struct build_frame const f = frames[--sp];
+        size_t const mid = f.lo + (f.hi - f.lo) / 2;
+        e_avl_node *const node = nodes[mid];
+
+        if (f.linked) {
+            update_height(node);
+            continue;
+        }
+
+        node->lc = (mid > f.lo) ? nodes[f.lo + (mid - f.lo) / 2] : NULL;
+        node->rc = (f.hi > mid + 1) ? nodes[mid + 1 + (f.hi - mid - 1) / 2] : NULL;
+
+        frames[sp++] = (struct build_frame) { .lo = f.lo, .hi = f.hi, .linked = true };
+        if (node->lc != NULL) {
+            frames[sp++] = (struct build_frame) { .lo = f.lo, .hi = mid, .linked = false };
+        }
+        if (node->rc != NULL) {
+            frames[sp++] = (struct build_frame) { .lo = mid + 1, .hi = f.hi, .linked = false };
+        }
+    }
+
+    return nodes[n / 2];
+}
+
+// Replace the contents of `tree` with `n` nodes that are already sorted in
+// ascending order with no duplicates. This is O(n) and never calls a
+// comparator. Nodes previously in `tree` are dropped, not modified.
+static inline void
+avl_base_build_sorted(avl_tree_t *const tree, e_avl_node *const nodes[], size_t const n)
+{
+    tree->m_top = build_balanced(nodes, n);
+    tree->m_size = n;
+    gen_bump(tree);
+}
+
 // Gets the pointer associated with a key.
 __attribute__((pure))
 static inline e_avl_node *
@@ -436,30 +632,173 @@ avl_base_get(avl_tree_t const*const tree, void const*const key, avlkeycmp_t cons
     }
 }
 
+/*
+ * Batched lookups.
+ *
+ * Once a tree is much bigger than the cache, every level of `avl_base_get` is
+ * a miss to DRAM that the core just waits on. A batch keeps
+ * AVL_BATCH_LANES independent searches in flight and advances them round
+ * robin, prefetching each search's next node as it steps, so by the time a
+ * lane comes around again its node has (hopefully) arrived. A lane that
+ * finishes immediately starts on the next key, so the lanes stay full.
+ */
+#ifndef AVL_BATCH_LANES
+#define AVL_BATCH_LANES 16
+#endif
+
+// Looks up `n` keys, laid out `key_stride` bytes apart starting at `keys`,
+// writing the matching node for each (or NULL) to `out`.
+static inline void
+avl_base_get_batch(
+    avl_tree_t const*const tree,
+    void const*const keys,
+    size_t const key_stride,
+    size_t const n,
+    e_avl_node *out[],
+    avlkeycmp_t const cmpfunc)
+{
+    e_avl_node *const top = tree->m_top;
+    if (top == NULL) {
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = NULL;
+        }
+        return;
+    }
+
+    e_avl_node *lane_node[AVL_BATCH_LANES];
+    size_t lane_idx[AVL_BATCH_LANES];
+
+    size_t next = 0;
+    size_t n_lanes = 0;
+    while (n_lanes < AVL_BATCH_LANES && next < n) {
+        lane_node[n_lanes] = top;
+        lane_idx[n_lanes] = next++;
+        ++n_lanes;
+    }
+
+    size_t live = n_lanes;
+    while (live > 0) {
+        for (size_t l = 0; l < n_lanes; ++l) {
+            e_avl_node *const node = lane_node[l];
+            if (node == NULL) {
+                continue;
+            }
+
+            void const*const key = (unsigned char const*)keys + lane_idx[l] * key_stride;
+            int const lcmp = cmpfunc(key, node);
+            e_avl_node *const child = (lcmp < 0) ? node->lc : node->rc;
+
+            if (lcmp == 0 || child == NULL) {
+                out[lane_idx[l]] = (lcmp == 0) ? node : NULL;
+
+                if (next < n) {
+                    // The top of the tree is always hot, no need to prefetch
+                    lane_node[l] = top;
+                    lane_idx[l] = next++;
+                } else {
+                    lane_node[l] = NULL;
+                    --live;
+                }
+            } else {
+                __builtin_prefetch(child);
+                lane_node[l] = child;
+            }
+        }
+    }
+}
+
+/*
+ * Bound queries. Like `avl_base_get` these descend without a stack, keeping
+ * the best candidate seen on the way down.
+ */
+
+// Returns the first node whose key is not less than `key`, or NULL.
+__attribute__((pure))
 static inline e_avl_node *
-avl_base_rem(
-    avl_tree_t *const tree,
-    void const*const key,
-    avlkeycmp_t const cmpfunc,
-    void *const stack_buffer)
+avl_base_lower_bound(avl_tree_t const*const tree, void const*const key, avlkeycmp_t const cmpfunc)
 {
-    if (tree->m_size == 0) {
-        return NULL;
+    e_avl_node *node = tree->m_top;
+    e_avl_node *best = NULL;
+
+    while (node != NULL) {
+        int const lcmp = cmpfunc(key, node);
+        if (lcmp < 0) {
+            best = node;
+            node = node->lc;
+        } else if (lcmp > 0) {
+            node = node->rc;
+        } else {
+            return node;
+        }
     }
 
-    astack_t l_stack = stack_init(stack_buffer);
-    astack_t *const stack = &l_stack;
+    return best;
+}
 
+// Returns the first node whose key is greater than `key`, or NULL.
+__attribute__((pure))
+static inline e_avl_node *
+avl_base_upper_bound(avl_tree_t const*const tree, void const*const key, avlkeycmp_t const cmpfunc)
+{
     e_avl_node *node = tree->m_top;
-    int const dive_rc = divek(node, key, cmpfunc, stack);
-    if (dive_rc != DFOUND) {
-        return NULL;
+    e_avl_node *best = NULL;
+
+    while (node != NULL) {
+        int const lcmp = cmpfunc(key, node);
+        if (lcmp < 0) {
+            best = node;
+            node = node->lc;
+        } else {
+            node = node->rc;
+        }
     }
 
-    // At this point, the stack contains an element with key
-    // equal to `key`
-    e_avl_node *const to_remove = stack_pop(stack);
-    e_avl_node *const rem_parent = stack_peek(stack);
+    return best;
+}
+
+// Returns the last node whose key is not greater than `key`, or NULL.
+__attribute__((pure))
+static inline e_avl_node *
+avl_base_floor(avl_tree_t const*const tree, void const*const key, avlkeycmp_t const cmpfunc)
+{
+    e_avl_node *node = tree->m_top;
+    e_avl_node *best = NULL;
+
+    while (node != NULL) {
+        int const lcmp = cmpfunc(key, node);
+        if (lcmp < 0) {
+            node = node->lc;
+        } else if (lcmp > 0) {
+            best = node;
+            node = node->rc;
+        } else {
+            return node;
+        }
+    }
+
+    return best;
+}
+
+// Returns the first node whose key is not less than `key`, or NULL. The same
+// as `avl_base_lower_bound`, for symmetry with `avl_base_floor`.
+__attribute__((pure))
+static inline e_avl_node *
+avl_base_ceil(avl_tree_t const*const tree, void const*const key, avlkeycmp_t const cmpfunc)
+{
+    return avl_base_lower_bound(tree, key, cmpfunc);
+}
+
+/* Unlink the node on top of `stack`, which holds the path to it from the top
+ * of the tree, leaving on `stack` the path that needs rebalancing. The buffer
+ * under `stack` must have room for the whole height of the tree, since the
+ * path is extended down to the node that takes the removed one's place. */
+static inline e_avl_node *
+unlink_path(avl_tree_t *const tree, astack_t *const stack)
+{
+    e_avl_node *node;
+
+    e_avl_node *const to_remove = (e_avl_node *)stack_pop(stack);
+    e_avl_node *const rem_parent = (e_avl_node *)stack_peek(stack);
 
     if (to_remove->lc == NULL && to_remove->rc == NULL) {
         /* The node we are removing is a leaf node. Remove references to it */
@@ -517,8 +856,8 @@ avl_base_rem(
         /* At this point, we have found the node to replace the node that we're deleting.
          * We have placed every node along that path onto our stack */
 
-        e_avl_node *const replacement = stack_pop(stack);
-        e_avl_node *const replace_parent = stack_peek(stack);
+        e_avl_node *const replacement = (e_avl_node *)stack_pop(stack);
+        e_avl_node *const replace_parent = (e_avl_node *)stack_peek(stack);
 
         /* make sure to keep children of replace_candidate */
         if (replace_case == DLEFT) {
@@ -555,9 +894,12 @@ avl_base_rem(
             replace_parent->rc = replacement->rc;
         }
 
-        /* swap out the node we are removing with the replacement candidate */
+        /* swap out the node we are removing with the replacement candidate.
+         * It takes over the old height too, so the retrace can tell whether
+         * the subtree in this position has changed. */
         replacement->rc = to_remove->rc;
         replacement->lc = to_remove->lc;
+        replacement->height = to_remove->height;
         if (rem_parent == NULL) {
             tree->m_top = replacement;
         } else {
@@ -576,13 +918,1268 @@ avl_base_rem(
     to_remove->lc = NULL;
     to_remove->rc = NULL;
     to_remove->height = 0;
+#ifdef AVL_SUBTREE_COUNT
+    to_remove->count = 0;
+#endif
+
+    return to_remove;
+}
+
+/* Unlink the node on top of `stack` as `unlink_path` does, and rebalance */
+static inline e_avl_node *
+remove_path(avl_tree_t *const tree, astack_t *const stack)
+{
+    e_avl_node *const to_remove = unlink_path(tree, stack);
 
     rebalance(tree, stack);
 
-    tree->m_size--;
-    tree->m_gen++;
+    size_shrink(tree, 1);
+    gen_bump(tree);
 
     return to_remove;
 }
 
+static inline e_avl_node *
+avl_base_rem(
+    avl_tree_t *const tree,
+    void const*const key,
+    avlkeycmp_t const cmpfunc,
+    void *const stack_buffer)
+{
+    if (tree->m_top == NULL) {
+        return NULL;
+    }
+
+    astack_t l_stack = stack_init(stack_buffer);
+    astack_t *const stack = &l_stack;
+
+    int const dive_rc = divek(tree->m_top, key, cmpfunc, stack);
+    if (dive_rc != DFOUND) {
+        return NULL;
+    }
+
+    // At this point, the stack contains an element with key
+    // equal to `key`
+    return remove_path(tree, stack);
+}
+
+#ifdef AVL_SUBTREE_COUNT
+/*
+ * Order statistics, available when nodes keep their subtree sizes.
+ */
+
+// Returns the node with `k` nodes before it in key order (counting from zero),
+// or NULL if the tree has `k` or fewer nodes. O(log n).
+__attribute__((pure))
+static inline e_avl_node *
+avl_base_select(avl_tree_t const*const tree, size_t k)
+{
+    e_avl_node *node = tree->m_top;
+
+    while (node != NULL) {
+        size_t const n_left = avl_node_count(node->lc);
+        if (k < n_left) {
+            node = node->lc;
+        } else if (k > n_left) {
+            k -= n_left + 1;
+            node = node->rc;
+        } else {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+// Returns the number of nodes whose key is less than `key`. O(log n).
+__attribute__((pure))
+static inline size_t
+avl_base_rank(avl_tree_t const*const tree, void const*const key, avlkeycmp_t const cmpfunc)
+{
+    e_avl_node *node = tree->m_top;
+    size_t rank = 0;
+
+    while (node != NULL) {
+        int const lcmp = cmpfunc(key, node);
+        if (lcmp < 0) {
+            node = node->lc;
+        } else if (lcmp > 0) {
+            rank += avl_node_count(node->lc) + 1;
+            node = node->rc;
+        } else {
+            return rank + avl_node_count(node->lc);
+        }
+    }
+
+    return rank;
+}
+#endif
+
+/*
+ * Range decomposition, for answering aggregate queries over a key range.
+ *
+ * The nodes with `lo <= key < hi` are covered by O(log n) pieces: whole
+ * subtrees, whose aggregate can be read straight off their top node, and
+ * single nodes, which contribute only themselves. `visit` is called once for
+ * each piece, with `whole` set for a subtree. Pieces are not visited in key
+ * order, so this suits commutative aggregates.
+ */
+typedef void (*avlvisit_t)(e_avl_node *node, bool whole, void *arg);
+
+static inline void
+avl_base_range_visit(
+    avl_tree_t const*const tree,
+    void const*const lo,
+    void const*const hi,
+    avlkeycmp_t const cmpfunc,
+    avlvisit_t const visit,
+    void *const arg)
+{
+    e_avl_node *node = tree->m_top;
+
+    // Find the topmost node in the range, where the paths to the two ends
+    // of the range part.
+    for (;;) {
+        if (node == NULL) {
+            return;
+        }
+
+        if (cmpfunc(hi, node) <= 0) {
+            node = node->lc;
+        } else if (cmpfunc(lo, node) > 0) {
+            node = node->rc;
+        } else {
+            break;
+        }
+    }
+
+    visit(node, false, arg);
+
+    // Walk towards `lo`. Everything right of a node in range is in range.
+    e_avl_node *left = node->lc;
+    while (left != NULL) {
+        if (cmpfunc(lo, left) <= 0) {
+            visit(left, false, arg);
+            if (left->rc != NULL) {
+                visit(left->rc, true, arg);
+            }
+            left = left->lc;
+        } else {
+            left = left->rc;
+        }
+    }
+
+    // Walk towards `hi`. Everything left of a node in range is in range.
+    e_avl_node *right = node->rc;
+    while (right != NULL) {
+        if (cmpfunc(hi, right) > 0) {
+            visit(right, false, arg);
+            if (right->lc != NULL) {
+                visit(right->lc, true, arg);
+            }
+            right = right->rc;
+        } else {
+            right = right->lc;
+        }
+    }
+}
+
+/*
+ * Join and split.
+ *
+ * These work on bare subtrees, borrowing `rebalance` by wrapping the subtree
+ * being modified in a temporary `avl_tree_t`. Their stack buffers only need
+ * room for the part of the tree they walk.
+ */
+
+/* Join `l`, `k` and `r` into one subtree, where every key in `l` is less than
+ * `k` and every key in `r` is greater. Walks down the taller side until it
+ * finds a subtree at most one taller than the shorter side, hangs both of
+ * them off `k` there, and rebalances back up. O(|height(l) - height(r)|). */
+static inline e_avl_node *
+join_node(
+    e_avl_node *const l,
+    e_avl_node *const k,
+    e_avl_node *const r,
+    void *const stack_buffer)
+{
+    int const lh = avl_node_height(l);
+    int const rh = avl_node_height(r);
+
+    if (lh > rh + 1) {
+        avl_tree_t sub = { .m_top = l };
+        astack_t l_stack = stack_init(stack_buffer);
+
+        e_avl_node *node = l;
+        do {
+            (void)stack_push(&l_stack, node);
+            node = node->rc;
+        } while (avl_node_height(node) > rh + 1);
+
+        k->lc = node;
+        k->rc = r;
+        update_height(k);
+        ((e_avl_node *)stack_peek(&l_stack))->rc = k;
+
+        rebalance(&sub, &l_stack);
+        return sub.m_top;
+    } else if (rh > lh + 1) {
+        avl_tree_t sub = { .m_top = r };
+        astack_t l_stack = stack_init(stack_buffer);
+
+        e_avl_node *node = r;
+        do {
+            (void)stack_push(&l_stack, node);
+            node = node->lc;
+        } while (avl_node_height(node) > lh + 1);
+
+        k->lc = l;
+        k->rc = node;
+        update_height(k);
+        ((e_avl_node *)stack_peek(&l_stack))->lc = k;
+
+        rebalance(&sub, &l_stack);
+        return sub.m_top;
+    } else {
+        k->lc = l;
+        k->rc = r;
+        update_height(k);
+        return k;
+    }
+}
+
+/* Unlink and return the smallest node of the non-empty subtree `sub`. */
+static inline e_avl_node *
+detach_min(avl_tree_t *const sub, void *const stack_buffer)
+{
+    astack_t l_stack = stack_init(stack_buffer);
+
+    e_avl_node *node = sub->m_top;
+    while (node->lc != NULL) {
+        (void)stack_push(&l_stack, node);
+        node = node->lc;
+    }
+
+    e_avl_node *const parent = (e_avl_node *)stack_peek(&l_stack);
+    if (parent == NULL) {
+        sub->m_top = node->rc;
+    } else {
+        parent->lc = node->rc;
+    }
+    node->rc = NULL;
+
+    rebalance(sub, &l_stack);
+    return node;
+}
+
+/* Join two subtrees where every key in `l` is less than every key in `r`. */
+static inline e_avl_node *
+join_two(e_avl_node *const l, e_avl_node *const r, void *const stack_buffer)
+{
+    if (l == NULL) {
+        return r;
+    } else if (r == NULL) {
+        return l;
+    }
+
+    avl_tree_t sub = { .m_top = r };
+    e_avl_node *const k = detach_min(&sub, stack_buffer);
+    return join_node(l, k, sub.m_top, stack_buffer);
+}
+
+/* Given the path left in `p_stack` by `dive`/`divek` and its return code,
+ * take the tree apart into the nodes less than the key and the nodes greater
+ * than it. A node matching the key is returned and belongs to neither side.
+ * Each node on the path is joined onto whichever side it belongs to on the
+ * way back up, and the joins telescope to O(log n) in total. The unused part
+ * of the stack buffer is the scratch space for the joins. */
+static inline e_avl_node *
+split_path(
+    astack_t *const p_stack,
+    int const dive_rc,
+    e_avl_node **const p_left,
+    e_avl_node **const p_right)
+{
+    e_avl_node *child = (e_avl_node *)stack_pop(p_stack);
+    e_avl_node *match = NULL;
+
+    e_avl_node *l = NULL;
+    e_avl_node *r = NULL;
+    if (dive_rc == DFOUND) {
+        match = child;
+        l = child->lc;
+        r = child->rc;
+    } else if (dive_rc == DLEFT) {
+        r = join_node(NULL, child, child->rc, &p_stack->data[p_stack->sz]);
+    } else {
+        l = join_node(child->lc, child, NULL, &p_stack->data[p_stack->sz]);
+    }
+
+    for (;;) {
+        e_avl_node *const parent = (e_avl_node *)stack_pop(p_stack);
+        if (parent == NULL) {
+            break;
+        }
+
+        void *const scratch = &p_stack->data[p_stack->sz];
+        if (parent->lc == child) {
+            r = join_node(r, parent, parent->rc, scratch);
+        } else {
+            l = join_node(parent->lc, parent, l, scratch);
+        }
+        child = parent;
+    }
+
+    *p_left = l;
+    *p_right = r;
+    return match;
+}
+
+// Cut `tree` at `key`. Nodes less than `key` stay in `tree` and the rest,
+// including any node matching `key`, move to `right`, whose previous contents
+// are dropped. O(log n). Unless nodes record their subtree sizes
+// (AVL_SUBTREE_COUNT), the sizes of two non-empty halves aren't known, and
+// are left to `avl_size` to count if asked for.
+// `stack_buffer` needs one more entry than the tree's height.
+static inline void
+avl_base_split(
+    avl_tree_t *const tree,
+    void const*const key,
+    avlkeycmp_t const cmpfunc,
+    void *const stack_buffer,
+    avl_tree_t *const right)
+{
+    size_t const total = tree->m_size;
+    e_avl_node *l = NULL;
+    e_avl_node *r = NULL;
+
+    if (tree->m_top != NULL) {
+        astack_t l_stack = stack_init(stack_buffer);
+        int const dive_rc = divek(tree->m_top, key, cmpfunc, &l_stack);
+        e_avl_node *const match = split_path(&l_stack, dive_rc, &l, &r);
+        if (match != NULL) {
+            r = join_node(NULL, match, r, stack_buffer);
+        }
+    }
+
+    size_t n_left;
+    size_t n_right;
+    if (l == NULL || r == NULL) {
+        n_left = (l == NULL) ? 0 : total;
+        n_right = (r == NULL) ? 0 : total;
+    } else {
+#ifdef AVL_SUBTREE_COUNT
+        n_left = avl_node_count(l);
+        n_right = avl_node_count(r);
+#else
+        n_left = AVL_SIZE_UNKNOWN;
+        n_right = AVL_SIZE_UNKNOWN;
+#endif
+    }
+
+    tree->m_top = l;
+    tree->m_size = n_left;
+    gen_bump(tree);
+
+    right->m_top = r;
+    right->m_size = n_right;
+    gen_bump(right);
+}
+
+// Move every node of `right` into `left`, leaving `right` empty. Every key in
+// `left` must be less than every key in `right`. O(log n).
+static inline void
+avl_base_join(avl_tree_t *const left, avl_tree_t *const right, void *const stack_buffer)
+{
+    if (right->m_top == NULL) {
+        return;
+    }
+
+    if (right->m_size == AVL_SIZE_UNKNOWN || left->m_top == NULL) {
+        left->m_size = right->m_size;
+    } else {
+        size_grow(left, right->m_size);
+    }
+    left->m_top = join_two(left->m_top, right->m_top, stack_buffer);
+    gen_bump(left);
+
+    right->m_top = NULL;
+    right->m_size = 0;
+    gen_bump(right);
+}
+
+/*
+ * Sorted batch insertion.
+ *
+ * Keys that arrive in order mostly land next to each other, so the path to
+ * one insertion point is nearly the path to the next. A batch keeps its path
+ * between inserts: every run of keys that falls into the same gap between
+ * existing nodes is linked into a balanced subtree with `build_balanced` and
+ * hung into that gap with one retrace, and the next run's search resumes from
+ * the deepest node on the path that can still hold it.
+ */
+
+/* Trim the path in `p_stack` back to the deepest node whose subtree could
+ * hold `lhs` and return that node, leaving it off the stack so a `dive` from
+ * it pushes it again. A subtree spans the keys between its nearest ancestors
+ * on either side, which the path gives us with pointer compares, so each
+ * level climbed costs at most two key comparisons. The stack must not be
+ * empty. */
+static inline e_avl_node *
+climb_path(astack_t *const p_stack, e_avl_node const*const lhs, avlcmp_t const cmpfunc)
+{
+    e_avl_node **const data = (e_avl_node **)p_stack->data;
+    size_t i = p_stack->sz - 1;
+
+    for (;;) {
+        /* Nearest ancestors of `data[i]` we went left and right at */
+        size_t hi = i;
+        size_t lo = i;
+        for (size_t j = i; j > 0 && (hi == i || lo == i); --j) {
+            if (((e_avl_node *)data[j - 1])->lc == data[j]) {
+                if (hi == i) {
+                    hi = j - 1;
+                }
+            } else if (lo == i) {
+                lo = j - 1;
+            }
+        }
+
+        if (hi != i && cmpfunc(lhs, data[hi]) >= 0) {
+            i = hi;
+        } else if (lo != i && cmpfunc(lhs, data[lo]) <= 0) {
+            i = lo;
+        } else {
+            break;
+        }
+    }
+
+    p_stack->sz = i;
+    return data[i];
+}
+
+/* Hang the subtree `sub` into the empty child of the node on top of
+ * `p_stack` that `dive_rc` points at, and retrace towards the root, joining
+ * each ancestor back onto its newly grown child. Each join costs O(1) plus
+ * the height it absorbs.
+ *
+ * Without counts or augmentation nothing above a node can tell that its
+ * contents changed, so the retrace stops at the first ancestor that keeps its
+ * place and its height, and the path down to it is left in `p_stack`.
+ * Otherwise the retrace goes all the way up and leaves `p_stack` empty. */
+static inline void
+hang_subtree(avl_tree_t *const tree, astack_t *const p_stack, int const dive_rc, e_avl_node *sub)
+{
+    e_avl_node *child = NULL;
+
+    for (;;) {
+        e_avl_node *const parent = (e_avl_node *)stack_pop(p_stack);
+        if (parent == NULL) {
+            tree->m_top = sub;
+            return;
+        }
+
+        bool const left = (child == NULL) ? (dive_rc == DLEFT) : (parent->lc == child);
+#ifdef AVL_HEIGHT_ONLY
+        int const old_height = parent->height;
+#endif
+        void *const scratch = &p_stack->data[p_stack->sz];
+        e_avl_node *const joined = left
+            ? join_node(sub, parent, parent->rc, scratch)
+            : join_node(parent->lc, parent, sub, scratch);
+
+#ifdef AVL_HEIGHT_ONLY
+        if (joined == parent && parent->height == old_height) {
+            (void)stack_push(p_stack, parent);
+            return;
+        }
+#endif
+
+        child = parent;
+        sub = joined;
+    }
+}
+
+// Adds `n` nodes, sorted in strictly ascending order, to `tree`. Nodes whose
+// key is already in the tree are skipped and left untouched. Returns the
+// number of nodes added.
+//
+// Each run of nodes falling between the same two existing keys costs one
+// search, O(run) to link, and a retrace that usually stops early, instead of
+// a full descent and rebalance per node. `stack_buffer` needs room for twice
+// the height of the resulting tree.
+static inline size_t
+avl_base_add_sorted_batch(
+    avl_tree_t *const tree,
+    e_avl_node *const nodes[],
+    size_t const n,
+    avlcmp_t const cmpfunc,
+    void *const stack_buffer)
+{
+    astack_t l_stack = stack_init(stack_buffer);
+    astack_t *const stack = &l_stack;
+    size_t added = 0;
+    size_t i = 0;
+
+    while (i < n) {
+        e_avl_node *from;
+        if (stack->sz != 0) {
+            from = climb_path(stack, nodes[i], cmpfunc);
+        } else if (tree->m_top != NULL) {
+            from = tree->m_top;
+        } else {
+            tree->m_top = build_balanced(nodes + i, n - i);
+            added += n - i;
+            break;
+        }
+
+        int const rc = dive(from, nodes[i], cmpfunc, stack);
+        if (rc == DFOUND) {
+            ++i;
+            continue;
+        }
+
+        /* The gap is bounded above by the deepest node we went left at */
+        e_avl_node *bound = NULL;
+        if (rc == DLEFT) {
+            bound = (e_avl_node *)stack_peek(stack);
+        } else {
+            for (size_t j = stack->sz - 1; j > 0; --j) {
+                if (((e_avl_node *)stack->data[j - 1])->lc == stack->data[j]) {
+                    bound = (e_avl_node *)stack->data[j - 1];
+                    break;
+                }
+            }
+        }
+
+        size_t end = i + 1;
+        while (end < n && (bound == NULL || cmpfunc(nodes[end], bound) < 0)) {
+            ++end;
+        }
+
+        hang_subtree(tree, stack, rc, build_balanced(nodes + i, end - i));
+        added += end - i;
+        i = end;
+    }
+
+    if (added != 0) {
+        size_grow(tree, added);
+        gen_bump(tree);
+    }
+
+    return added;
+}
+
+/*
+ * In-order iterator.
+ *
+ * The iterator keeps the path from the root to the current node in a
+ * caller-supplied buffer (the same convention as `avl_base_add`), so a full
+ * scan costs amortized O(1) per step instead of a fresh descent per key.
+ *
+ * Every add/rem bumps `m_gen`. An iterator remembers the generation it was
+ * positioned at, and once the tree has been mutated every stepping function
+ * returns NULL until the iterator is repositioned with first/last/seek.
+ */
+typedef struct avl_iter avl_iter_t;
+
+struct avl_iter {
+    avl_tree_t const *tree;
+    astack_t stack;
+    unsigned gen;
+};
+
+static inline avl_iter_t
+avl_iter_init(avl_tree_t const*const tree, void *const stack_buffer)
+{
+    return (avl_iter_t) {
+        .tree = tree,
+        .stack = stack_init(stack_buffer),
+        .gen = tree->m_gen,
+    };
+}
+
+__attribute__((pure))
+static inline bool
+avl_iter_valid(avl_iter_t const*const iter)
+{
+    return iter->gen == iter->tree->m_gen;
+}
+
+// Returns the node the iterator is positioned at, or NULL if the iterator
+// has run off either end of the tree or has been invalidated.
+__attribute__((pure))
+static inline e_avl_node *
+avl_iter_cur(avl_iter_t const*const iter)
+{
+    if (!avl_iter_valid(iter)) {
+        return NULL;
+    }
+
+    return (e_avl_node *)stack_peek(&iter->stack);
+}
+
+static inline e_avl_node *
+avl_iter_first(avl_iter_t *const iter)
+{
+    iter->stack.sz = 0;
+    iter->gen = iter->tree->m_gen;
+
+    e_avl_node *node = iter->tree->m_top;
+    while (node != NULL) {
+        (void)stack_push(&iter->stack, node);
+        node = node->lc;
+    }
+
+    return (e_avl_node *)stack_peek(&iter->stack);
+}
+
+static inline e_avl_node *
+avl_iter_last(avl_iter_t *const iter)
+{
+    iter->stack.sz = 0;
+    iter->gen = iter->tree->m_gen;
+
+    e_avl_node *node = iter->tree->m_top;
+    while (node != NULL) {
+        (void)stack_push(&iter->stack, node);
+        node = node->rc;
+    }
+
+    return (e_avl_node *)stack_peek(&iter->stack);
+}
+
+static inline e_avl_node *
+avl_iter_next(avl_iter_t *const iter)
+{
+    if (!avl_iter_valid(iter)) {
+        return NULL;
+    }
+
+    astack_t *const stack = &iter->stack;
+    e_avl_node *node = (e_avl_node *)stack_peek(stack);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    if (node->rc != NULL) {
+        /* The successor is the smallest node in the right subtree */
+        node = node->rc;
+        for (;;) {
+            (void)stack_push(stack, node);
+            if (node->lc == NULL) {
+                return node;
+            }
+            node = node->lc;
+        }
+    }
+
+    /* Otherwise climb until we come up out of a left subtree. The parent we
+     * arrive at is the successor. */
+    e_avl_node *child = (e_avl_node *)stack_pop(stack);
+    for (;;) {
+        e_avl_node *const parent = (e_avl_node *)stack_peek(stack);
+        if (parent == NULL || parent->lc == child) {
+            return parent;
+        }
+        child = (e_avl_node *)stack_pop(stack);
+    }
+}
+
+static inline e_avl_node *
+avl_iter_prev(avl_iter_t *const iter)
+{
+    if (!avl_iter_valid(iter)) {
+        return NULL;
+    }
+
+    astack_t *const stack = &iter->stack;
+    e_avl_node *node = (e_avl_node *)stack_peek(stack);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    if (node->lc != NULL) {
+        /* The predecessor is the largest node in the left subtree */
+        node = node->lc;
+        for (;;) {
+            (void)stack_push(stack, node);
+            if (node->rc == NULL) {
+                return node;
+            }
+            node = node->rc;
+        }
+    }
+
+    e_avl_node *child = (e_avl_node *)stack_pop(stack);
+    for (;;) {
+        e_avl_node *const parent = (e_avl_node *)stack_peek(stack);
+        if (parent == NULL || parent->rc == child) {
+            return parent;
+        }
+        child = (e_avl_node *)stack_pop(stack);
+    }
+}
+
+/* Descend from `node` towards `key`, pushing the path onto the iterator's
+ * stack, and leave the iterator at the first node not less than `key`.
+ * `candidate` is the depth to fall back to if everything below `node` is
+ * less than `key`. */
+static inline e_avl_node *
+seek_from(
+    avl_iter_t *const iter,
+    e_avl_node *node,
+    size_t candidate,
+    void const*const key,
+    avlkeycmp_t const cmpfunc)
+{
+    astack_t *const stack = &iter->stack;
+
+    /* `candidate` tracks the depth of the deepest node we branched left at.
+     * That node is the smallest one greater than `key` seen so far. */
+    while (node != NULL) {
+        (void)stack_push(stack, node);
+
+        int const lcmp = cmpfunc(key, node);
+        if (lcmp < 0) {
+            candidate = stack->sz;
+            node = node->lc;
+        } else if (lcmp > 0) {
+            node = node->rc;
+        } else {
+            return node;
+        }
+    }
+
+    /* Trim the path back to the candidate */
+    stack->sz = candidate;
+    return (e_avl_node *)stack_peek(stack);
+}
+
+// Positions the iterator at the first node that is not less than `key` and
+// returns it, or returns NULL if every node in the tree is less than `key`.
+static inline e_avl_node *
+avl_iter_seek(avl_iter_t *const iter, void const*const key, avlkeycmp_t const cmpfunc)
+{
+    iter->stack.sz = 0;
+    iter->gen = iter->tree->m_gen;
+
+    return seek_from(iter, iter->tree->m_top, 0, key, cmpfunc);
+}
+
+// Returns the number of nodes with `lo <= key < hi`. With AVL_SUBTREE_COUNT
+// this is two ranks, O(log n), and `stack_buffer` is unused. Otherwise the
+// nodes in the range are stepped over with an iterator, O(log n + k).
+static inline size_t
+avl_base_range_count(
+    avl_tree_t const*const tree,
+    void const*const lo,
+    void const*const hi,
+    avlkeycmp_t const cmpfunc,
+    void *const stack_buffer)
+{
+#ifdef AVL_SUBTREE_COUNT
+    (void)stack_buffer;
+    size_t const r_lo = avl_base_rank(tree, lo, cmpfunc);
+    size_t const r_hi = avl_base_rank(tree, hi, cmpfunc);
+    return (r_hi > r_lo) ? r_hi - r_lo : 0;
+#else
+    avl_iter_t iter = avl_iter_init(tree, stack_buffer);
+    size_t count = 0;
+
+    for (e_avl_node *node = avl_iter_seek(&iter, lo, cmpfunc);
+            node != NULL && cmpfunc(hi, node) > 0;
+            node = avl_iter_next(&iter)) {
+        ++count;
+    }
+
+    return count;
+#endif
+}
+
+/*
+ * Finger search.
+ *
+ * A positioned iterator is a finger into its tree: its path says where every
+ * subtree along it begins and ends. Searching or inserting from a finger
+ * climbs the path only as far as the smallest subtree that can hold the key
+ * and descends from there, so it costs O(h) comparisons, where h is the
+ * height of that subtree. For most fingers a key d positions away is found
+ * in O(log d), but not for all: when a high ancestor separates the finger
+ * from the key, even a neighbour costs O(log n). A bound of O(log d) for
+ * every finger would take links between the nodes of each level, which
+ * these nodes don't have. Appending past the last node, the finger's own
+ * position, costs O(1) comparisons.
+ */
+
+/* `climb_path` for a bare key. Also reports the depth `avl_iter_seek` would
+ * trim back to if everything in the returned subtree is less than `key`,
+ * which is just below the nearest ancestor we went left at. */
+static inline e_avl_node *
+climb_pathk(
+    astack_t *const p_stack,
+    void const*const key,
+    avlkeycmp_t const cmpfunc,
+    size_t *const p_candidate)
+{
+    e_avl_node **const data = (e_avl_node **)p_stack->data;
+    size_t i = p_stack->sz - 1;
+
+    for (;;) {
+        size_t hi = i;
+        size_t lo = i;
+        for (size_t j = i; j > 0 && (hi == i || lo == i); --j) {
+            if (((e_avl_node *)data[j - 1])->lc == data[j]) {
+                if (hi == i) {
+                    hi = j - 1;
+                }
+            } else if (lo == i) {
+                lo = j - 1;
+            }
+        }
+
+        if (hi != i && cmpfunc(key, data[hi]) >= 0) {
+            i = hi;
+        } else if (lo != i && cmpfunc(key, data[lo]) <= 0) {
+            i = lo;
+        } else {
+            *p_candidate = (hi != i) ? hi + 1 : 0;
+            break;
+        }
+    }
+
+    p_stack->sz = i;
+    return data[i];
+}
+
+/* After a rotation at depth `i` of a path that ends at a freshly inserted
+ * node, `top` has taken the rotated node's place. An insertion's rotations
+ * only rearrange the path's nodes at depths i to i+2, so the path rejoins
+ * its old tail at the node that was at depth i+3 (or at its last node) with
+ * at most one node in between. */
+static inline void
+relink_path(astack_t *const p_stack, size_t const i, e_avl_node *const top)
+{
+    e_avl_node **const data = (e_avl_node **)p_stack->data;
+    size_t const sz = p_stack->sz;
+    size_t const tail = (sz > i + 3) ? i + 3 : sz - 1;
+    e_avl_node *const last = data[tail];
+
+    size_t w = i;
+    data[w++] = top;
+    if (top != last) {
+        if (top->lc != last && top->rc != last) {
+            e_avl_node *const lc = top->lc;
+            data[w++] = (lc != NULL && (lc->lc == last || lc->rc == last)) ? lc : top->rc;
+        }
+        for (size_t j = tail; j < sz; ++j) {
+            data[w++] = data[j];
+        }
+    }
+    p_stack->sz = w;
+}
+
+/* `rebalance` for a path that ends at a freshly inserted leaf, except that
+ * the path is kept and relinked around any rotation, so that it still leads
+ * to the new leaf afterwards.
+ *
+ * Without counts or augmentation the retrace can stop as soon as a subtree's
+ * height comes out unchanged, which includes right after a rotation, since
+ * an insertion's rotation restores the height the subtree had before. That
+ * makes it amortized O(1). */
+static inline void
+retrace_path(avl_tree_t *const tree, astack_t *const p_stack)
+{
+    e_avl_node **const data = (e_avl_node **)p_stack->data;
+
+    for (size_t i = p_stack->sz - 1; i-- > 0;) {
+        e_avl_node *const node = data[i];
+
+#ifdef AVL_HEIGHT_ONLY
+        int const old_height = node->height;
+#endif
+        update_height(node);
+        unsigned const rot = find_case(node);
+        if (rot == ROT_BALANCED) {
+#ifdef AVL_HEIGHT_ONLY
+            if (node->height == old_height) {
+                break;
+            }
+#endif
+            continue;
+        }
+
+        e_avl_node **branch;
+        if (i == 0) {
+            branch = &tree->m_top;
+        } else {
+            e_avl_node *const parent = data[i - 1];
+            branch = (node == parent->lc) ? &parent->lc : &parent->rc;
+        }
+
+        if ((rot & ROT_FMASK) == ROT_FIRST_L) {
+            if (rot & ROT_SECND_R) {
+                rotate_left(&node->lc);
+            }
+            rotate_right(branch);
+        } else {
+            if (rot & ROT_SECND_L) {
+                rotate_right(&node->rc);
+            }
+            rotate_left(branch);
+        }
+
+        relink_path(p_stack, i, *branch);
+#ifdef AVL_HEIGHT_ONLY
+        break;
+#endif
+    }
+}
+
+// Like `avl_iter_seek`, but searches from where the iterator is positioned
+// instead of from the top. Falls back to `avl_iter_seek` if the iterator
+// isn't positioned on a node.
+static inline e_avl_node *
+avl_iter_seek_near(avl_iter_t *const iter, void const*const key, avlkeycmp_t const cmpfunc)
+{
+    if (!avl_iter_valid(iter) || iter->stack.sz == 0) {
+        return avl_iter_seek(iter, key, cmpfunc);
+    }
+
+    size_t candidate;
+    e_avl_node *const from = climb_pathk(&iter->stack, key, cmpfunc, &candidate);
+    return seek_from(iter, from, candidate, key, cmpfunc);
+}
+
+// Adds `node` to `tree`, searching from where `finger`, an iterator over
+// `tree`, is positioned. If a node with the same key is already in the tree,
+// that one is returned instead. Either way `finger` is left positioned at the
+// returned node and stays valid, so a run of nearby inserts can keep reusing
+// it. Other iterators over `tree` are invalidated as usual.
+static inline e_avl_node *
+avl_base_add_near(
+    avl_tree_t *const tree,
+    avl_iter_t *const finger,
+    e_avl_node *const node,
+    avlcmp_t const cmpfunc)
+{
+    astack_t *const stack = &finger->stack;
+
+    leaf_init(node);
+
+    e_avl_node *from;
+    if (avl_iter_valid(finger) && stack->sz != 0) {
+        from = climb_path(stack, node, cmpfunc);
+    } else {
+        stack->sz = 0;
+        from = tree->m_top;
+    }
+
+    if (from == NULL) {
+        tree->m_top = node;
+        (void)stack_push(stack, node);
+    } else {
+        int const rc = dive(from, node, cmpfunc, stack);
+
+        e_avl_node *const parent = (e_avl_node *)stack_peek(stack);
+        if (rc == DLEFT) {
+            parent->lc = node;
+        } else if (rc == DRIGHT) {
+            parent->rc = node;
+        } else {
+            finger->gen = tree->m_gen;
+            return parent;
+        }
+
+        (void)stack_push(stack, node);
+        retrace_path(tree, stack);
+    }
+
+    size_grow(tree, 1);
+    gen_bump(tree);
+    finger->gen = tree->m_gen;
+
+    return node;
+}
+
+/*
+ * Relayout.
+ *
+ * Moves every object of a tree into a caller-supplied region, in breadth
+ * first order of their nodes: the top at slot 0, its children at slots 1 and
+ * 2, and so on. The first levels of every search then share a few cache
+ * lines, and the rest of a path is in one region instead of wherever the
+ * objects were allocated.
+ *
+ * This is Cheney's copying scheme, with the region doubling as the queue. The
+ * objects in slots [scan, next) have been moved but their children haven't.
+ * Each step moves the children of the object at `scan` to the end of the
+ * queue and points it at their new copies. No other memory is needed, and
+ * the tree is whole between steps, so the work can be split into slices of
+ * any size with lookups in between. Every slice invalidates iterators.
+ * Adding or removing nodes before it's done invalidates the relayout, which
+ * then stops; the tree is left whole, partly moved.
+ */
+
+#define AVL_RELAYOUT_DONE  0
+#define AVL_RELAYOUT_MORE  1
+#define AVL_RELAYOUT_STALE 2
+
+// Moves the object at `src` to `dst`, which is `stride` bytes of unused
+// memory, fixing up any pointers to it from outside the tree.
+typedef void (*avlmove_t)(void *dst, void *src, void *arg);
+
+typedef struct avl_relayout avl_relayout_t;
+
+struct avl_relayout {
+    avl_tree_t *tree;
+    unsigned char *region;
+    size_t stride;   /* bytes from one object to the next in `region` */
+    size_t offset;   /* of the `e_avl_node` in each object */
+    avlmove_t move;
+    void *arg;
+    size_t scan;     /* next object whose children are to be moved */
+    size_t next;     /* next free slot */
+    unsigned gen;
+};
+
+// Prepares to move the objects of `tree` into `region`, which must have room
+// for `avl_size(tree)` objects of `stride` bytes with their nodes `offset`
+// bytes in, and must not overlap the objects where they are now. With `move`
+// NULL the objects are moved with memcpy.
+static inline avl_relayout_t
+avl_relayout_init(
+    avl_tree_t *const tree,
+    void *const region,
+    size_t const stride,
+    size_t const offset,
+    avlmove_t const move,
+    void *const arg)
+{
+    return (avl_relayout_t) {
+        .tree = tree,
+        .region = (unsigned char *)region,
+        .stride = stride,
+        .offset = offset,
+        .move = move,
+        .arg = arg,
+        .scan = 0,
+        .next = 0,
+        .gen = tree->m_gen,
+    };
+}
+
+__attribute__((pure))
+static inline e_avl_node *
+relayout_slot(avl_relayout_t const*const rl, size_t const i)
+{
+    return (e_avl_node *)(rl->region + i * rl->stride + rl->offset);
+}
+
+/* Whether `node` has been moved already */
+__attribute__((pure))
+static inline bool
+relayout_moved(avl_relayout_t const*const rl, e_avl_node const*const node)
+{
+    uintptr_t const p = (uintptr_t)node;
+    uintptr_t const base = (uintptr_t)rl->region;
+    return p >= base && p < base + rl->next * rl->stride;
+}
+
+/* Move the object of `node` to the next free slot and return its new node */
+static inline e_avl_node *
+relayout_move(avl_relayout_t *const rl, e_avl_node *const node)
+{
+    e_avl_node *const to = relayout_slot(rl, rl->next++);
+    unsigned char *const dst = (unsigned char *)to - rl->offset;
+    unsigned char *const src = (unsigned char *)node - rl->offset;
+
+    if (rl->move != NULL) {
+        rl->move(dst, src, rl->arg);
+    } else {
+        memcpy(dst, src, rl->stride);
+    }
+
+    return to;
+}
+
+// Moves up to `budget` more objects. Returns AVL_RELAYOUT_DONE once every
+// object is in the region, AVL_RELAYOUT_MORE if there's more to do, or
+// AVL_RELAYOUT_STALE if the tree has been changed since the relayout began.
+static inline int
+avl_base_relayout(avl_relayout_t *const rl, size_t budget)
+{
+    avl_tree_t *const tree = rl->tree;
+
+    if (tree->m_gen != rl->gen) {
+        return AVL_RELAYOUT_STALE;
+    }
+
+    size_t const before = rl->next;
+    int rc = AVL_RELAYOUT_DONE;
+
+    if (rl->next == 0 && tree->m_top != NULL) {
+        if (budget == 0) {
+            return AVL_RELAYOUT_MORE;
+        }
+        tree->m_top = relayout_move(rl, tree->m_top);
+        --budget;
+    }
+
+    while (rl->scan < rl->next) {
+        e_avl_node *const node = relayout_slot(rl, rl->scan);
+
+        /* A slice may have ended between the two children */
+        if (node->lc != NULL && !relayout_moved(rl, node->lc)) {
+            if (budget == 0) {
+                rc = AVL_RELAYOUT_MORE;
+                break;
+            }
+            node->lc = relayout_move(rl, node->lc);
+            --budget;
+        }
+        if (node->rc != NULL && !relayout_moved(rl, node->rc)) {
+            if (budget == 0) {
+                rc = AVL_RELAYOUT_MORE;
+                break;
+            }
+            node->rc = relayout_move(rl, node->rc);
+            --budget;
+        }
+
+        ++rl->scan;
+    }
+
+    if (rl->next != before) {
+        rl->gen = gen_bump(tree);
+    }
+
+    return rc;
+}
+
+/*
+ * Optimistic readers.
+ *
+ * `m_gen` doubles as a sequence counter, so that lookups can run alongside
+ * one writer without taking a lock. A writer brackets each change, or batch
+ * of changes, with `avl_seq_write_begin` and `avl_seq_write_end`, which make
+ * the generation odd for the duration; writers still need to exclude each
+ * other. A reader takes `avl_seq_read_begin`, looks, and keeps what it found
+ * only if `avl_seq_read_retry` says nothing changed meanwhile.
+ *
+ * A reader may see the tree halfway through a rotation: links that skip a
+ * node, a node reached twice, a node already removed. `avl_seq_try_get` reads
+ * every link once into a local, checks it for NULL, and gives up after
+ * AVL_SEQ_MAX_STEPS steps, so such a view costs a retry and nothing worse,
+ * provided that
+ *
+ *  - objects are type stable: once an object has been in the tree its memory
+ *    stays mapped and its links hold only NULL or the addresses of other such
+ *    objects, as with objects from an `avl_pool_t` that outlives the readers
+ *    and that begin with their node (the pool links free objects through
+ *    their first word, and fresh slabs are zero), and
+ *  - whatever the comparator reads is not changed while the object is in the
+ *    tree, and is safe to read after it has been removed.
+ *
+ * The reader's loads race with the writer's stores by design; the validation
+ * is what makes the result trustworthy, as with any seqlock.
+ */
+
+/* Longer than any real path, which is at most about 1.44 log2(n) nodes */
+#ifndef AVL_SEQ_MAX_STEPS
+#define AVL_SEQ_MAX_STEPS 96
+#endif
+
+static inline void
+avl_seq_write_begin(avl_tree_t *const tree)
+{
+    __atomic_store_n(&tree->m_gen, tree->m_gen + 1, __ATOMIC_RELAXED);
+    /* No store of the change may become visible before the odd count */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+avl_seq_write_end(avl_tree_t *const tree)
+{
+    __atomic_store_n(&tree->m_gen, tree->m_gen + 1, __ATOMIC_RELEASE);
+}
+
+/* Pauses spent waiting out a change before giving the processor away, in
+ * case the writer was preempted in the middle of it */
+#ifndef AVL_SEQ_SPINS
+#define AVL_SEQ_SPINS 256
+#endif
+
+// Waits until no change is in progress and returns the count to validate
+// against.
+static inline unsigned
+avl_seq_read_begin(avl_tree_t const*const tree)
+{
+    unsigned seq;
+    unsigned spins = 0;
+    while ((seq = __atomic_load_n(&tree->m_gen, __ATOMIC_ACQUIRE)) & 1) {
+        if (++spins % AVL_SEQ_SPINS == 0) {
+            sched_yield();
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    return seq;
+}
+
+// Whether the tree changed since `avl_seq_read_begin` returned `seq`, in
+// which case whatever was read since must be thrown away.
+static inline bool
+avl_seq_read_retry(avl_tree_t const*const tree, unsigned const seq)
+{
+    /* The reads being validated must complete before the count is read */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&tree->m_gen, __ATOMIC_RELAXED) != seq;
+}
+
+// One optimistic lookup. Returns false if the tree changed while looking;
+// otherwise sets `*found` to the node matching `key`, or NULL, and returns
+// true.
+static inline bool
+avl_seq_try_get(
+    avl_tree_t const*const tree,
+    void const*const key,
+    avlkeycmp_t const cmp,
+    e_avl_node **const found)
+{
+    unsigned const seq = avl_seq_read_begin(tree);
+    e_avl_node *node = __atomic_load_n(&tree->m_top, __ATOMIC_RELAXED);
+    e_avl_node *hit = NULL;
+
+    for (unsigned steps = 0; node != NULL; ++steps) {
+        if (steps == AVL_SEQ_MAX_STEPS) {
+            return false;
+        }
+        int const c = cmp(key, node);
+        if (c == 0) {
+            hit = node;
+            break;
+        }
+        node = __atomic_load_n((c < 0) ? &node->lc : &node->rc, __ATOMIC_RELAXED);
+    }
+
+    if (avl_seq_read_retry(tree, seq)) {
+        return false;
+    }
+    *found = hit;
+    return true;
+}
+
+// Returns the node matching `key`, or NULL, retrying until a lookup runs
+// without a change in between.
+static inline e_avl_node *
+avl_seq_get(avl_tree_t const*const tree, void const*const key, avlkeycmp_t const cmp)
+{
+    e_avl_node *found;
+    while (!avl_seq_try_get(tree, key, cmp, &found)) {
+    }
+    return found;
+}
+
 #endif /* INLINE_AVL_H */
@@ -0,0 +1,543 @@
+
+#ifndef INLINE_AVL_HPP
+#define INLINE_AVL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#include "inline_avl.h"
+
+/*
+ * C++ interface.
+ *
+ * avl::tree<T, &T::node, Compare> is an intrusive ordered set of `T`s linked
+ * through their `e_avl_node` member `node`, shaped like std::set. `Compare`
+ * is a strict weak ordering as for std::set (std::less<T> by default). It is
+ * a template argument and every descent is written here in terms of it, so
+ * it's inlined instead of being called through an `avlcmp_t`. A transparent
+ * `Compare` (one with `is_transparent`, like std::less<>) enables lookups by
+ * any key it can compare with a `T`.
+ *
+ * The tree never allocates and never throws. Like the C interface it keeps
+ * no parent pointers: an iterator carries the path from the top of the tree
+ * to its node, sized by `Capacity`, the most objects the tree will hold.
+ * Adding or removing objects invalidates every iterator except the one
+ * returned, and stepping an invalidated iterator makes it equal to end().
+ */
+
+namespace avl {
+
+// The greatest height of an AVL tree of `n` nodes
+constexpr int
+max_height(unsigned long long const n)
+{
+    // Sparsest trees of heights h and h + 1
+    unsigned long long sparse = 0;
+    unsigned long long next = 1;
+    int h = 0;
+    while (next <= n) {
+        ++h;
+        if (n - next < sparse + 1) {
+            break;
+        }
+        unsigned long long const after = next + sparse + 1;
+        sparse = next;
+        next = after;
+    }
+    return h;
+}
+
+static_assert(max_height(0) == 0, "");
+static_assert(max_height(1) == 1, "");
+static_assert(max_height(4) == 3, "");
+static_assert(max_height(UINT32_MAX) == 45, "");
+static_assert(max_height(UINT64_MAX) == 91, "");
+
+template <
+    class T,
+    e_avl_node T::*Node,
+    class Compare = std::less<T>,
+    std::size_t Capacity = UINT32_MAX>
+class tree {
+public:
+    using value_type = T;
+    using reference = T &;
+    using const_reference = T const &;
+    using pointer = T *;
+    using const_pointer = T const *;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using key_compare = Compare;
+    using value_compare = Compare;
+
+    // Entries in the path buffer of an iterator
+    static constexpr std::size_t stack_size = max_height(Capacity) + 1;
+
+private:
+    // With GCC and Clang (the Itanium C++ ABI) a pointer to a data member is
+    // represented as the member's offset.
+    static std::ptrdiff_t
+    node_offset() noexcept
+    {
+        static_assert(sizeof(Node) == sizeof(std::ptrdiff_t), "unsupported ABI");
+        e_avl_node T::*const member = Node;
+        std::ptrdiff_t offset;
+        std::memcpy(&offset, &member, sizeof(offset));
+        return offset;
+    }
+
+    static T *
+    obj(e_avl_node const *const nd) noexcept
+    {
+        return reinterpret_cast<T *>(
+                reinterpret_cast<unsigned char *>(const_cast<e_avl_node *>(nd)) - node_offset());
+    }
+
+public:
+    template <bool Const>
+    class basic_iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = typename std::conditional<Const, T const *, T *>::type;
+        using reference = typename std::conditional<Const, T const &, T &>::type;
+
+        basic_iterator() noexcept
+            : m_it(avl_iter_t{})
+        {
+            m_it.stack = stack_init(m_path);
+        }
+
+        basic_iterator(basic_iterator const &other) noexcept
+        {
+            assign(other.m_it);
+        }
+
+        // An iterator converts to a const_iterator
+        template <bool C, class = typename std::enable_if<Const && !C>::type>
+        basic_iterator(basic_iterator<C> const &other) noexcept
+        {
+            assign(other.m_it);
+        }
+
+        basic_iterator &
+        operator=(basic_iterator const &other) noexcept
+        {
+            assign(other.m_it);
+            return *this;
+        }
+
+        reference
+        operator*() const noexcept
+        {
+            return *obj(cur());
+        }
+
+        pointer
+        operator->() const noexcept
+        {
+            return obj(cur());
+        }
+
+        basic_iterator &
+        operator++() noexcept
+        {
+            if (avl_iter_next(&m_it) == NULL) {
+                m_it.stack.sz = 0;
+            }
+            return *this;
+        }
+
+        // Decrementing end() gives the last object
+        basic_iterator &
+        operator--() noexcept
+        {
+            if (m_it.stack.sz == 0) {
+                (void)avl_iter_last(&m_it);
+            } else if (avl_iter_prev(&m_it) == NULL) {
+                m_it.stack.sz = 0;
+            }
+            return *this;
+        }
+
+        basic_iterator
+        operator++(int) noexcept
+        {
+            basic_iterator const o(*this);
+            ++*this;
+            return o;
+        }
+
+        basic_iterator
+        operator--(int) noexcept
+        {
+            basic_iterator const o(*this);
+            --*this;
+            return o;
+        }
+
+        template <bool C>
+        bool
+        operator==(basic_iterator<C> const &other) const noexcept
+        {
+            return cur() == other.cur();
+        }
+
+        template <bool C>
+        bool
+        operator!=(basic_iterator<C> const &other) const noexcept
+        {
+            return cur() != other.cur();
+        }
+
+    private:
+        friend class tree;
+        template <bool> friend class basic_iterator;
+
+        // Positioned at end() of `t`
+        explicit basic_iterator(avl_tree_t const *const t) noexcept
+            : m_it(avl_iter_init(t, m_path))
+        {
+        }
+
+        void
+        assign(avl_iter_t const &it) noexcept
+        {
+            m_it = it;
+            m_it.stack.data = m_path;
+            std::memcpy(m_path, it.stack.data, it.stack.sz * sizeof(m_path[0]));
+        }
+
+        e_avl_node *
+        cur() const noexcept
+        {
+            return (m_it.stack.sz == 0)
+                ? nullptr
+                : static_cast<e_avl_node *>(m_it.stack.data[m_it.stack.sz - 1]);
+        }
+
+        avl_iter_t m_it;
+        void *m_path[stack_size];
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    tree() noexcept
+        : m_tree(avl_tree_init()), m_cmp()
+    {
+    }
+
+    explicit tree(Compare const &cmp) noexcept
+        : m_tree(avl_tree_init()), m_cmp(cmp)
+    {
+    }
+
+    // The tree doesn't own its objects, so it can't be copied
+    tree(tree const &) = delete;
+    tree &operator=(tree const &) = delete;
+
+    tree(tree &&other) noexcept
+        : m_tree(other.m_tree), m_cmp(std::move(other.m_cmp))
+    {
+        other.clear();
+    }
+
+    tree &
+    operator=(tree &&other) noexcept
+    {
+        m_tree = other.m_tree;
+        m_cmp = std::move(other.m_cmp);
+        other.clear();
+        gen_bump(&m_tree);
+        return *this;
+    }
+
+    void
+    swap(tree &other) noexcept
+    {
+        using std::swap;
+        swap(m_tree, other.m_tree);
+        swap(m_cmp, other.m_cmp);
+        gen_bump(&m_tree);
+        gen_bump(&other.m_tree);
+    }
+
+    size_type size() const noexcept { return avl_size(&m_tree); }
+    bool empty() const noexcept { return avl_size(&m_tree) == 0; }
+    int height() const noexcept { return avl_height(&m_tree); }
+    key_compare key_comp() const { return m_cmp; }
+    value_compare value_comp() const { return m_cmp; }
+
+    // The underlying C tree, for use with the avl_base_ functions
+    avl_tree_t *c_tree() noexcept { return &m_tree; }
+    avl_tree_t const *c_tree() const noexcept { return &m_tree; }
+
+    iterator begin() noexcept { return first<iterator>(); }
+    const_iterator begin() const noexcept { return first<const_iterator>(); }
+    const_iterator cbegin() const noexcept { return first<const_iterator>(); }
+    iterator end() noexcept { return iterator(&m_tree); }
+    const_iterator end() const noexcept { return const_iterator(&m_tree); }
+    const_iterator cend() const noexcept { return const_iterator(&m_tree); }
+    reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+    const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+    reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+    const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
+
+    // Links `value` into the tree. If an equivalent object is already in the
+    // tree, returns that one and false instead.
+    std::pair<iterator, bool>
+    insert(T &value)
+    {
+        std::pair<iterator, bool> o(iterator(&m_tree), true);
+        astack_t *const stack = &o.first.m_it.stack;
+
+        /* Descend with one comparison per level, remembering the last node
+         * not greater than `value`, which is equal to it if anything is. */
+        e_avl_node *node = m_tree.m_top;
+        e_avl_node *le = nullptr;
+        size_t le_depth = 0;
+        bool left = false;
+        while (node != nullptr) {
+            (void)stack_push(stack, node);
+            left = m_cmp(value, *obj(node));
+            if (left) {
+                node = node->lc;
+            } else {
+                le = node;
+                le_depth = stack->sz;
+                node = node->rc;
+            }
+        }
+
+        if (le != nullptr && !m_cmp(*obj(le), value)) {
+            stack->sz = le_depth;
+            o.second = false;
+            return o;
+        }
+
+        node = &(value.*Node);
+        leaf_init(node);
+        e_avl_node *const parent = static_cast<e_avl_node *>(stack_peek(stack));
+        if (parent == nullptr) {
+            m_tree.m_top = node;
+        } else if (left) {
+            parent->lc = node;
+        } else {
+            parent->rc = node;
+        }
+        (void)stack_push(stack, node);
+        retrace_path(&m_tree, stack);
+
+        size_grow(&m_tree, 1);
+        o.first.m_it.gen = gen_bump(&m_tree);
+        return o;
+    }
+
+    // Unlinks the object at `pos` and returns an iterator to the one after it
+    iterator
+    erase(const_iterator const pos)
+    {
+        const_iterator next(pos);
+        ++next;
+
+        const_iterator victim(pos);
+        (void)remove_path(&m_tree, &victim.m_it.stack);
+
+        if (next.m_it.stack.sz == 0) {
+            return end();
+        }
+        return lower_bound(*obj(next.cur()));
+    }
+
+    void
+    erase(const_iterator first, const_iterator const last)
+    {
+        while (first != last) {
+            first = erase(first);
+        }
+    }
+
+    size_type erase(T const &key) { return erase_key(key); }
+
+    template <class K, class C = Compare, class = typename C::is_transparent,
+        class = typename std::enable_if<!std::is_convertible<K, const_iterator>::value>::type>
+    size_type erase(K const &key) { return erase_key(key); }
+
+    // Forgets every object at once, without touching them
+    void
+    clear() noexcept
+    {
+        m_tree.m_top = nullptr;
+        m_tree.m_size = 0;
+        gen_bump(&m_tree);
+    }
+
+    iterator find(T const &key) { return find_key<iterator>(key); }
+    const_iterator find(T const &key) const { return find_key<const_iterator>(key); }
+
+    template <class K, class C = Compare, class = typename C::is_transparent>
+    iterator find(K const &key) { return find_key<iterator>(key); }
+
+    template <class K, class C = Compare, class = typename C::is_transparent>
+    const_iterator find(K const &key) const { return find_key<const_iterator>(key); }
+
+    bool contains(T const &key) const { return get_key(key) != nullptr; }
+
+    template <class K, class C = Compare, class = typename C::is_transparent>
+    bool contains(K const &key) const { return get_key(key) != nullptr; }
+
+    size_type count(T const &key) const { return contains(key); }
+
+    template <class K, class C = Compare, class = typename C::is_transparent>
+    size_type count(K const &key) const { return contains(key); }
+
+    iterator lower_bound(T const &key) { return seek_lower<iterator>(key); }
+    const_iterator lower_bound(T const &key) const { return seek_lower<const_iterator>(key); }
+
+    template <class K, class C = Compare, class = typename C::is_transparent>
+    iterator lower_bound(K const &key) { return seek_lower<iterator>(key); }
+
+    template <class K, class C = Compare, class = typename C::is_transparent>
+    const_iterator lower_bound(K const &key) const { return seek_lower<const_iterator>(key); }
+
+    iterator upper_bound(T const &key) { return seek_upper<iterator>(key); }
+    const_iterator upper_bound(T const &key) const { return seek_upper<const_iterator>(key); }
+
+    template <class K, class C = Compare, class = typename C::is_transparent>
+    iterator upper_bound(K const &key) { return seek_upper<iterator>(key); }
+
+    template <class K, class C = Compare, class = typename C::is_transparent>
+    const_iterator upper_bound(K const &key) const { return seek_upper<const_iterator>(key); }
+
+    std::pair<iterator, iterator>
+    equal_range(T const &key)
+    {
+        return { lower_bound(key), upper_bound(key) };
+    }
+
+    std::pair<const_iterator, const_iterator>
+    equal_range(T const &key) const
+    {
+        return { lower_bound(key), upper_bound(key) };
+    }
+
+    template <class K, class C = Compare, class = typename C::is_transparent>
+    std::pair<iterator, iterator>
+    equal_range(K const &key)
+    {
+        return { lower_bound(key), upper_bound(key) };
+    }
+
+    template <class K, class C = Compare, class = typename C::is_transparent>
+    std::pair<const_iterator, const_iterator>
+    equal_range(K const &key) const
+    {
+        return { lower_bound(key), upper_bound(key) };
+    }
+
+private:
+    template <class It>
+    It
+    first() const noexcept
+    {
+        It it(&m_tree);
+        (void)avl_iter_first(&it.m_it);
+        return it;
+    }
+
+    /* Leave `it` at the first node that `goes_left` holds for, where every
+     * node it holds for comes after every node it doesn't. */
+    template <class It, class GoesLeft>
+    It
+    seek(GoesLeft const goes_left) const
+    {
+        It it(&m_tree);
+        astack_t *const stack = &it.m_it.stack;
+
+        size_t candidate = 0;
+        e_avl_node *node = m_tree.m_top;
+        while (node != nullptr) {
+            (void)stack_push(stack, node);
+            if (goes_left(node)) {
+                candidate = stack->sz;
+                node = node->lc;
+            } else {
+                node = node->rc;
+            }
+        }
+
+        stack->sz = candidate;
+        return it;
+    }
+
+    template <class It, class K>
+    It
+    seek_lower(K const &key) const
+    {
+        return seek<It>([&](e_avl_node const *const nd) { return !m_cmp(*obj(nd), key); });
+    }
+
+    template <class It, class K>
+    It
+    seek_upper(K const &key) const
+    {
+        return seek<It>([&](e_avl_node const *const nd) { return m_cmp(key, *obj(nd)); });
+    }
+
+    template <class It, class K>
+    It
+    find_key(K const &key) const
+    {
+        It it = seek_lower<It>(key);
+        if (it.m_it.stack.sz != 0 && m_cmp(key, *obj(it.cur()))) {
+            it.m_it.stack.sz = 0;
+        }
+        return it;
+    }
+
+    // Stackless lookup
+    template <class K>
+    e_avl_node *
+    get_key(K const &key) const
+    {
+        e_avl_node *node = m_tree.m_top;
+        e_avl_node *ge = nullptr;
+        while (node != nullptr) {
+            if (!m_cmp(*obj(node), key)) {
+                ge = node;
+                node = node->lc;
+            } else {
+                node = node->rc;
+            }
+        }
+        return (ge != nullptr && !m_cmp(key, *obj(ge))) ? ge : nullptr;
+    }
+
+    template <class K>
+    size_type
+    erase_key(K const &key)
+    {
+        const_iterator it = find_key<const_iterator>(key);
+        if (it.m_it.stack.sz == 0) {
+            return 0;
+        }
+        (void)remove_path(&m_tree, &it.m_it.stack);
+        return 1;
+    }
+
+    avl_tree_t m_tree;
+    [[no_unique_address]] Compare m_cmp;
+};
+
+} // namespace avl
+
+#endif /* INLINE_AVL_HPP */
@@ -0,0 +1,247 @@
+#ifndef INLINE_AVL_CLONE_H
+#define INLINE_AVL_CLONE_H
+
+#include <pthread.h>
+
+#include "inline_avl.h"
+
+/*
+ * Deep copies of a tree.
+ *
+ * `avl_base_clone` copies the structure of a tree as it is, links and
+ * heights, so it calls no comparator and never rotates. The copies are laid
+ * out in one block of memory, in pre-order: the caller's `alloc` callback is
+ * asked once for room for the whole tree, and `copy` then fills slot `i` of
+ * it for every node, so a parent comes just before its left subtree and the
+ * top of the copy is slot 0.
+ *
+ * To share the work, the top few levels of the tree are cut into subtrees,
+ * a few per thread. Their sizes fix where each one's slots start: with
+ * AVL_SUBTREE_COUNT they're read off the nodes, otherwise the subtrees are
+ * counted first, in parallel. The calling thread copies the levels above
+ * them, and then it and up to `threads` more threads copy the subtrees,
+ * taking the next one as they finish. `copy` may be called from any of them.
+ */
+
+/* Copy the object holding `src` into slot `i`, returning its node. Links,
+ * heights and counts in the node are filled in afterwards. */
+typedef e_avl_node *(*avlclonecopy_t)(e_avl_node const *src, size_t i, void *arg);
+
+/* Subtrees cut per thread, so that one that finishes early finds more */
+#define AVL_CLONE_TASKS_PER_THREAD 4
+
+/* Deepest the cut goes, so the task list stays small */
+#define AVL_CLONE_MAX_DEPTH 10
+
+typedef struct clone_task clone_task_t;
+
+struct clone_task {
+    e_avl_node const *src;
+    e_avl_node *dst;      /* the copy of `src`, made while cutting */
+    size_t size;
+    size_t first;         /* slot of `src` */
+};
+
+typedef struct clone_job clone_job_t;
+
+struct clone_job {
+    avlclonecopy_t copy;
+    void *arg;
+    clone_task_t *tasks;
+    size_t n_tasks;
+    size_t next;          /* the next task to take */
+    bool counting;        /* counting the tasks rather than copying them */
+};
+
+static inline size_t
+clone_count(e_avl_node const*const node)
+{
+    if (node == NULL) {
+        return 0;
+    }
+    return 1 + clone_count(node->lc) + clone_count(node->rc);
+}
+
+static inline void
+clone_fill(e_avl_node *const dst, e_avl_node const*const src)
+{
+    dst->height = src->height;
+#ifdef AVL_SUBTREE_COUNT
+    dst->count = src->count;
+#endif
+#ifdef AVL_PERSISTENT
+    dst->refs = 1;
+#endif
+}
+
+/* Copy the subtree under `src` into the slots from `*slot` on, in pre-order */
+static inline e_avl_node *
+clone_copy(clone_job_t const*const job, e_avl_node const*const src, size_t *const slot)
+{
+    if (src == NULL) {
+        return NULL;
+    }
+
+    /* Start on the right child while the left subtree is copied, which at
+     * the bottom levels is a node or two */
+    if (src->rc != NULL) {
+        __builtin_prefetch(src->rc);
+    }
+    e_avl_node *const dst = job->copy(src, (*slot)++, job->arg);
+    clone_fill(dst, src);
+    dst->lc = clone_copy(job, src->lc, slot);
+    dst->rc = clone_copy(job, src->rc, slot);
+    return dst;
+}
+
+static inline void *
+clone_worker(void *const arg)
+{
+    clone_job_t *const job = arg;
+
+    for (;;) {
+        size_t const i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->n_tasks) {
+            return NULL;
+        }
+
+        clone_task_t *const task = &job->tasks[i];
+        if (job->counting) {
+            task->size = clone_count(task->src);
+        } else {
+            size_t slot = task->first + 1;
+            task->dst->lc = clone_copy(job, task->src->lc, &slot);
+            task->dst->rc = clone_copy(job, task->src->rc, &slot);
+        }
+    }
+}
+
+/* Run every task of `job` on the calling thread and up to `threads` more */
+static inline void
+clone_run(clone_job_t *const job, unsigned const threads)
+{
+    pthread_t workers[threads > 0 ? threads : 1];
+    unsigned started = 0;
+
+    job->next = 0;
+    while (started < threads && started + 1 < job->n_tasks
+            && pthread_create(&workers[started], NULL, clone_worker, job) == 0) {
+        ++started;
+    }
+    (void)clone_worker(job);
+    for (unsigned i = 0; i < started; ++i) {
+        (void)pthread_join(workers[i], NULL);
+    }
+}
+
+/* Gather the subtrees `depth` levels below `src` into the task list, in
+ * pre-order */
+static inline void
+clone_cut(clone_job_t *const job, e_avl_node const*const src, int const depth)
+{
+    if (src == NULL) {
+        return;
+    }
+    if (depth == 0) {
+        job->tasks[job->n_tasks++] = (clone_task_t) { .src = src };
+        return;
+    }
+    clone_cut(job, src->lc, depth - 1);
+    clone_cut(job, src->rc, depth - 1);
+}
+
+/* Copy the levels above the cut, handing out slots in pre-order from `*slot`
+ * and `*task` onwards; each task's top is copied here and its slots are
+ * skipped for the workers. */
+static inline e_avl_node *
+clone_top(clone_job_t *const job, e_avl_node const*const src, int const depth,
+        size_t *const slot, size_t *const task)
+{
+    if (src == NULL) {
+        return NULL;
+    }
+
+    e_avl_node *const dst = job->copy(src, *slot, job->arg);
+    clone_fill(dst, src);
+    if (depth == 0) {
+        clone_task_t *const t = &job->tasks[(*task)++];
+        t->dst = dst;
+        t->first = *slot;
+        *slot += t->size;
+        return dst;
+    }
+
+    ++*slot;
+    dst->lc = clone_top(job, src->lc, depth - 1, slot, task);
+    dst->rc = clone_top(job, src->rc, depth - 1, slot, task);
+    return dst;
+}
+
+// Replace the contents of `dst` with a copy of `src`, made with `alloc` and
+// `copy` and shared among the calling thread and up to `threads` others.
+// Returns false, leaving `dst` alone, if `alloc` fails. Nodes previously in
+// `dst` are dropped, not modified.
+static inline bool
+avl_base_clone(
+    avl_tree_t *const dst,
+    avl_tree_t const*const src,
+    avlalloc_t const alloc,
+    avlclonecopy_t const copy,
+    void *const arg,
+    unsigned const threads)
+{
+    size_t const n = avl_size(src);
+    if (n > 0 && !alloc(n, arg)) {
+        return false;
+    }
+
+    /* Deep enough for a few subtrees per thread */
+    int depth = 0;
+    while (depth < AVL_CLONE_MAX_DEPTH && threads > 0
+            && ((size_t)1 << depth) < (size_t)(threads + 1) * AVL_CLONE_TASKS_PER_THREAD) {
+        ++depth;
+    }
+    if (depth >= avl_height(src)) {
+        depth = 0;
+    }
+
+    clone_task_t l_tasks[(size_t)1 << AVL_CLONE_MAX_DEPTH];
+    clone_job_t job = {
+        .copy = copy,
+        .arg = arg,
+        .tasks = l_tasks,
+        .n_tasks = 0,
+    };
+
+    e_avl_node *top = NULL;
+    if (n > 0) {
+        size_t slot = 0;
+        size_t task = 0;
+
+        clone_cut(&job, src->m_top, depth);
+        if (depth == 0) {
+            job.tasks[0].size = n;
+        } else {
+#ifdef AVL_SUBTREE_COUNT
+            for (size_t i = 0; i < job.n_tasks; ++i) {
+                job.tasks[i].size = avl_node_count(job.tasks[i].src);
+            }
+#else
+            job.counting = true;
+            clone_run(&job, threads);
+#endif
+        }
+
+        top = clone_top(&job, src->m_top, depth, &slot, &task);
+        assert(slot == n && task == job.n_tasks);
+        job.counting = false;
+        clone_run(&job, threads);
+    }
+
+    dst->m_top = top;
+    dst->m_size = n;
+    gen_bump(dst);
+    return true;
+}
+
+#endif /* INLINE_AVL_CLONE_H */
@@ -0,0 +1,375 @@
+
+#ifndef INLINE_AVL_COMPACT_H
+#define INLINE_AVL_COMPACT_H
+
+#include "inline_avl.h"
+
+/*
+ * Compact AVL tree.
+ *
+ * A 16-byte node (on 64-bit) for trees of small objects. Instead of a height
+ * each node keeps a balance factor of -1, 0 or +1 in the low bits of its two
+ * child pointers, which are always clear since nodes are at least pointer
+ * aligned: the bit in `lc` is set when the left subtree is the taller one, and
+ * the bit in `rc` when the right one is.
+ *
+ * Balance factors are enough to rebalance, and a retrace stops as soon as a
+ * subtree's height is unchanged, so an add or a rem does amortized O(1)
+ * rebalancing work after its O(log n) descent.
+ *
+ * This is a separate tree type; nodes and trees can't be mixed with the
+ * height-based ones. It takes the same stack buffers as `avl_base_add`.
+ */
+
+/* embedded compact avl node */
+typedef struct avl_cnode e_avl_cnode;
+
+struct avl_cnode {
+    uintptr_t lc; /* left child, low bit set if the left side is taller */
+    uintptr_t rc; /* right child, low bit set if the right side is taller */
+};
+
+typedef struct avl_ctree avl_ctree_t;
+
+struct avl_ctree {
+    e_avl_cnode *m_top;
+    size_t m_size;
+    unsigned m_gen;
+};
+
+typedef int (*avlccmp_t)(e_avl_cnode const*, e_avl_cnode const*);
+typedef int (*avlckeycmp_t)(void const*, e_avl_cnode const*);
+
+#define CNODE_TALLER ((uintptr_t)1)
+
+static inline avl_ctree_t
+avl_ctree_init(void)
+{
+    return (avl_ctree_t) {
+        .m_top = NULL,
+        .m_size = 0,
+        .m_gen = 0,
+    };
+}
+
+__attribute__((pure))
+static inline size_t
+avl_csize(avl_ctree_t const*const p_tree)
+{
+    return p_tree->m_size;
+}
+
+__attribute__((pure))
+static inline e_avl_cnode *
+avl_cnode_lc(e_avl_cnode const*const node)
+{
+    return (e_avl_cnode *)(node->lc & ~CNODE_TALLER);
+}
+
+__attribute__((pure))
+static inline e_avl_cnode *
+avl_cnode_rc(e_avl_cnode const*const node)
+{
+    return (e_avl_cnode *)(node->rc & ~CNODE_TALLER);
+}
+
+// Height of the right subtree minus height of the left one
+__attribute__((pure))
+static inline int
+avl_cnode_balance(e_avl_cnode const*const node)
+{
+    return (int)(node->rc & CNODE_TALLER) - (int)(node->lc & CNODE_TALLER);
+}
+
+static inline void
+cnode_set_lc(e_avl_cnode *const node, e_avl_cnode *const child)
+{
+    node->lc = (uintptr_t)child | (node->lc & CNODE_TALLER);
+}
+
+static inline void
+cnode_set_rc(e_avl_cnode *const node, e_avl_cnode *const child)
+{
+    node->rc = (uintptr_t)child | (node->rc & CNODE_TALLER);
+}
+
+static inline void
+cnode_set_balance(e_avl_cnode *const node, int const balance)
+{
+    node->lc = (node->lc & ~CNODE_TALLER) | (balance < 0);
+    node->rc = (node->rc & ~CNODE_TALLER) | (balance > 0);
+}
+
+/* Point whatever pointed at `old` (the child of `parent`, or the top of the
+ * tree) at `new` instead. */
+static inline void
+cnode_replace(
+    avl_ctree_t *const tree,
+    e_avl_cnode *const parent,
+    e_avl_cnode const*const old,
+    e_avl_cnode *const new)
+{
+    if (parent == NULL) {
+        tree->m_top = new;
+    } else if (avl_cnode_lc(parent) == old) {
+        cnode_set_lc(parent, new);
+    } else {
+        cnode_set_rc(parent, new);
+    }
+}
+
+/*
+ * Rebalance `a`, whose left side is two taller than its right, and return
+ * the new top of its subtree. `*p_same` is set if the subtree is as tall as
+ * it was before `a` went out of balance, which is always the case after an
+ * insertion and only sometimes after a removal.
+ *
+ *        a              b                 a                c
+ *       / \            / \               / \             /   \
+ *      b   z    ->    x   a             b   z    ->     b     a
+ *     / \                / \           / \             / \   / \
+ *    x   y              y   z         x   c           x   p q   z
+ *                                        / \
+ *                                       p   q
+ */
+static inline e_avl_cnode *
+cnode_rotate_right(e_avl_cnode *const a, bool *const p_same)
+{
+    e_avl_cnode *const b = avl_cnode_lc(a);
+    int const bb = avl_cnode_balance(b);
+
+    if (bb <= 0) {
+        cnode_set_lc(a, avl_cnode_rc(b));
+        cnode_set_rc(b, a);
+        cnode_set_balance(a, (bb == 0) ? -1 : 0);
+        cnode_set_balance(b, (bb == 0) ? 1 : 0);
+        *p_same = (bb == 0);
+        return b;
+    }
+
+    e_avl_cnode *const c = avl_cnode_rc(b);
+    int const cb = avl_cnode_balance(c);
+    cnode_set_rc(b, avl_cnode_lc(c));
+    cnode_set_lc(a, avl_cnode_rc(c));
+    cnode_set_lc(c, b);
+    cnode_set_rc(c, a);
+    cnode_set_balance(b, (cb > 0) ? -1 : 0);
+    cnode_set_balance(a, (cb < 0) ? 1 : 0);
+    cnode_set_balance(c, 0);
+    *p_same = false;
+    return c;
+}
+
+/* The mirror image of `cnode_rotate_right` */
+static inline e_avl_cnode *
+cnode_rotate_left(e_avl_cnode *const a, bool *const p_same)
+{
+    e_avl_cnode *const b = avl_cnode_rc(a);
+    int const bb = avl_cnode_balance(b);
+
+    if (bb >= 0) {
+        cnode_set_rc(a, avl_cnode_lc(b));
+        cnode_set_lc(b, a);
+        cnode_set_balance(a, (bb == 0) ? 1 : 0);
+        cnode_set_balance(b, (bb == 0) ? -1 : 0);
+        *p_same = (bb == 0);
+        return b;
+    }
+
+    e_avl_cnode *const c = avl_cnode_lc(b);
+    int const cb = avl_cnode_balance(c);
+    cnode_set_lc(b, avl_cnode_rc(c));
+    cnode_set_rc(a, avl_cnode_lc(c));
+    cnode_set_rc(c, b);
+    cnode_set_lc(c, a);
+    cnode_set_balance(b, (cb < 0) ? 1 : 0);
+    cnode_set_balance(a, (cb > 0) ? -1 : 0);
+    cnode_set_balance(c, 0);
+    *p_same = false;
+    return c;
+}
+
+// Adds `node` to `tree`. If a node with the same key is already in the tree,
+// that one is returned instead.
+static inline e_avl_cnode *
+avl_compact_add(
+    avl_ctree_t *const tree,
+    e_avl_cnode *const node,
+    avlccmp_t const cmpfunc,
+    void *const stack_buffer)
+{
+    node->lc = 0;
+    node->rc = 0;
+
+    if (tree->m_top == NULL) {
+        tree->m_top = node;
+    } else {
+        astack_t l_stack = stack_init(stack_buffer);
+        astack_t *const stack = &l_stack;
+
+        e_avl_cnode *parent = tree->m_top;
+        for (;;) {
+            (void)stack_push(stack, parent);
+
+            int const lcmp = cmpfunc(node, parent);
+            e_avl_cnode *const next = (lcmp < 0) ? avl_cnode_lc(parent) : avl_cnode_rc(parent);
+            if (lcmp == 0) {
+                return parent;
+            } else if (next != NULL) {
+                parent = next;
+            } else if (lcmp < 0) {
+                cnode_set_lc(parent, node);
+                break;
+            } else {
+                cnode_set_rc(parent, node);
+                break;
+            }
+        }
+
+        /* Each ancestor's side towards `node` just grew by one. Stop at the
+         * first one that doesn't get taller itself. */
+        e_avl_cnode *child = node;
+        while ((parent = stack_pop(stack)) != NULL) {
+            int const balance = avl_cnode_balance(parent) + ((avl_cnode_lc(parent) == child) ? -1 : 1);
+            if (balance == 0) {
+                cnode_set_balance(parent, 0);
+                break;
+            } else if (balance == -1 || balance == 1) {
+                cnode_set_balance(parent, balance);
+                child = parent;
+            } else {
+                bool same;
+                e_avl_cnode *const top = (balance < 0)
+                    ? cnode_rotate_right(parent, &same)
+                    : cnode_rotate_left(parent, &same);
+                cnode_replace(tree, stack_peek(stack), parent, top);
+                break;
+            }
+        }
+    }
+
+    ++tree->m_size;
+    ++tree->m_gen;
+
+    return node;
+}
+
+// Gets the node associated with a key.
+__attribute__((pure))
+static inline e_avl_cnode *
+avl_compact_get(avl_ctree_t const*const tree, void const*const key, avlckeycmp_t const cmpfunc)
+{
+    e_avl_cnode *node = tree->m_top;
+
+    while (node != NULL) {
+        int const lcmp = cmpfunc(key, node);
+        if (lcmp < 0) {
+            node = avl_cnode_lc(node);
+        } else if (lcmp > 0) {
+            node = avl_cnode_rc(node);
+        } else {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+// Removes and returns the node matching `key`, or NULL if there is none.
+static inline e_avl_cnode *
+avl_compact_rem(
+    avl_ctree_t *const tree,
+    void const*const key,
+    avlckeycmp_t const cmpfunc,
+    void *const stack_buffer)
+{
+    astack_t l_stack = stack_init(stack_buffer);
+    astack_t *const stack = &l_stack;
+
+    e_avl_cnode *to_remove = tree->m_top;
+    for (;;) {
+        if (to_remove == NULL) {
+            return NULL;
+        }
+
+        int const lcmp = cmpfunc(key, to_remove);
+        if (lcmp == 0) {
+            break;
+        }
+        (void)stack_push(stack, to_remove);
+        to_remove = (lcmp < 0) ? avl_cnode_lc(to_remove) : avl_cnode_rc(to_remove);
+    }
+
+    e_avl_cnode *const rem_parent = stack_peek(stack);
+    e_avl_cnode *const lc = avl_cnode_lc(to_remove);
+    e_avl_cnode *const rc = avl_cnode_rc(to_remove);
+
+    /* Which side of the node on top of the stack got shorter */
+    bool left;
+
+    if (lc == NULL || rc == NULL) {
+        left = (rem_parent != NULL && avl_cnode_lc(rem_parent) == to_remove);
+        cnode_replace(tree, rem_parent, to_remove, (lc != NULL) ? lc : rc);
+    } else {
+        /* Replace it with the largest node of its left subtree, which has no
+         * right child. The replacement takes over its place on the path. */
+        void **const rem_stack_ptr = stack_push(stack, to_remove);
+
+        e_avl_cnode *replacement = lc;
+        while (avl_cnode_rc(replacement) != NULL) {
+            (void)stack_push(stack, replacement);
+            replacement = avl_cnode_rc(replacement);
+        }
+
+        e_avl_cnode *const replace_parent = stack_peek(stack);
+        if (replace_parent == to_remove) {
+            left = true;
+        } else {
+            left = false;
+            cnode_set_rc(replace_parent, avl_cnode_lc(replacement));
+            replacement->lc = to_remove->lc;
+        }
+        replacement->rc = to_remove->rc;
+        cnode_set_balance(replacement, avl_cnode_balance(to_remove));
+        cnode_replace(tree, rem_parent, to_remove, replacement);
+
+        *rem_stack_ptr = replacement;
+    }
+
+    to_remove->lc = 0;
+    to_remove->rc = 0;
+
+    /* Each ancestor's `left` side just shrank by one. Stop at the first one
+     * that doesn't get shorter itself. */
+    e_avl_cnode *parent;
+    while ((parent = stack_pop(stack)) != NULL) {
+        e_avl_cnode *const grand = stack_peek(stack);
+        int const balance = avl_cnode_balance(parent) + (left ? 1 : -1);
+
+        e_avl_cnode *top = parent;
+        if (balance == -1 || balance == 1) {
+            cnode_set_balance(parent, balance);
+            break;
+        } else if (balance == 0) {
+            cnode_set_balance(parent, 0);
+        } else {
+            bool same;
+            top = (balance < 0)
+                ? cnode_rotate_right(parent, &same)
+                : cnode_rotate_left(parent, &same);
+            cnode_replace(tree, grand, parent, top);
+            if (same) {
+                break;
+            }
+        }
+
+        left = (grand != NULL && avl_cnode_lc(grand) == top);
+    }
+
+    --tree->m_size;
+    ++tree->m_gen;
+
+    return to_remove;
+}
+
+#endif /* INLINE_AVL_COMPACT_H */
@@ -0,0 +1,909 @@
+#ifndef INLINE_AVL_CONCURRENT_H
+#define INLINE_AVL_CONCURRENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+/*
+ * Concurrent AVL tree.
+ *
+ * A map from 64-bit unsigned keys to non-NULL values that any number of
+ * threads can read and change at once, after Bronson, Casper, Chafi and
+ * Olukotun, "A Practical Concurrent Binary Search Tree" (PPoPP 2010).
+ *
+ * Lookups take no locks. Each node has a version word that a rotation bumps
+ * while moving the node down ("shrinking" it), and a search going from a node
+ * to its child reads the child, then checks that the node's version hasn't
+ * changed, hand over hand; if it has, the search backs up one level and tries
+ * again from there. Changes lock only the nodes they touch: an insert locks
+ * the new leaf's parent, an unlink the node and its parent, and a rotation
+ * the nodes it moves, always top down.
+ *
+ * Balance is relaxed. Heights are repaired on the way back up, a node at a
+ * time, and a node with two children that is removed stays in place as a
+ * routing node, with no value, until it has a child to spare and can be
+ * unlinked. Used from one thread the tree stays an AVL tree apart from
+ * routing nodes; repairs that race can leave a few nodes a level or two out
+ * of balance until a later change passes through them.
+ *
+ * The tree allocates its own nodes, since a routing node outlives the removal
+ * of its value, and frees unlinked ones through epoch-based reclamation: a
+ * thread marks the global epoch it is in for the length of each operation,
+ * the epoch moves on once every thread inside has seen it, and a node
+ * unlinked in epoch e is freed once the epoch reaches e + 2, when no
+ * operation that could have seen it is still running. Threads take part
+ * through an `avl_conc_thread_t` each, from `avl_conc_thread_enter`. The
+ * tree never touches values, whose lifetimes are up to the caller.
+ */
+
+#ifndef AVL_CONC_MAX_THREADS
+#define AVL_CONC_MAX_THREADS 64
+#endif
+
+/* Spins waiting on a lock or a rotation before giving up the processor */
+#ifndef AVL_CONC_SPINS
+#define AVL_CONC_SPINS 128
+#endif
+
+/* Nodes a thread retires between attempts to move the epoch on */
+#ifndef AVL_CONC_ADVANCE
+#define AVL_CONC_ADVANCE 64
+#endif
+
+#define AVL_CONC_CACHE_LINE 64
+
+/* Version words: unlinked for good, mid-rotation, and a count of rotations */
+#define CONC_UNLINKED    UINT64_C(1)
+#define CONC_SHRINKING   UINT64_C(2)
+#define CONC_SHRINK_STEP UINT64_C(4)
+
+/* Results of the steps of an operation */
+#define CONC_DONE  0
+#define CONC_RETRY 1
+
+/* What a node needs after a change below it, else the height it should have */
+#define CONC_NOTHING   (-1)
+#define CONC_UNLINK    (-2)
+#define CONC_REBALANCE (-3)
+
+typedef struct avl_conc_node avl_conc_node_t;
+
+struct avl_conc_node {
+    uint64_t key;
+    void *value;             /* NULL for a routing node */
+    avl_conc_node_t *parent;
+    avl_conc_node_t *child[2];
+    uint64_t version;
+    int height;
+    uint32_t lock;
+    avl_conc_node_t *next_retired;
+};
+
+typedef struct avl_conc_tree avl_conc_tree_t;
+
+typedef struct avl_conc_thread avl_conc_thread_t;
+
+struct avl_conc_thread {
+    avl_conc_tree_t *tree;
+    uint64_t epoch;                  /* 2e + 1 while inside in epoch e, else 0 */
+    uint32_t in_use;
+    unsigned retired;                /* since the last attempt to advance */
+    avl_conc_node_t *limbo[3];       /* nodes retired in each of three epochs */
+    uint64_t limbo_epoch[3];
+} __attribute__((aligned(AVL_CONC_CACHE_LINE)));
+
+// Over-aligned: declare one statically or allocate it with aligned_alloc.
+struct avl_conc_tree {
+    avl_conc_node_t m_holder;        /* its right child is the top of the tree */
+    uint64_t m_epoch __attribute__((aligned(AVL_CONC_CACHE_LINE)));
+    unsigned m_threads_hw;           /* slots ever used */
+    avl_conc_thread_t m_threads[AVL_CONC_MAX_THREADS];
+};
+
+static inline void
+avl_conc_init(avl_conc_tree_t *const tree)
+{
+    memset(tree, 0, sizeof(*tree));
+}
+
+/* Shared fields are only accessed atomically */
+
+static inline avl_conc_node_t *
+conc_child(avl_conc_node_t const*const node, int const dir)
+{
+    return __atomic_load_n(&node->child[dir], __ATOMIC_ACQUIRE);
+}
+
+static inline void
+conc_set_child(avl_conc_node_t *const node, int const dir, avl_conc_node_t *const child)
+{
+    __atomic_store_n(&node->child[dir], child, __ATOMIC_RELEASE);
+}
+
+static inline avl_conc_node_t *
+conc_parent(avl_conc_node_t const*const node)
+{
+    return __atomic_load_n(&node->parent, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+conc_set_parent(avl_conc_node_t *const node, avl_conc_node_t *const parent)
+{
+    __atomic_store_n(&node->parent, parent, __ATOMIC_RELEASE);
+}
+
+static inline void *
+conc_value(avl_conc_node_t const*const node)
+{
+    return __atomic_load_n(&node->value, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+conc_set_value(avl_conc_node_t *const node, void *const value)
+{
+    __atomic_store_n(&node->value, value, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t
+conc_version(avl_conc_node_t const*const node)
+{
+    return __atomic_load_n(&node->version, __ATOMIC_ACQUIRE);
+}
+
+static inline int
+conc_height(avl_conc_node_t const*const node)
+{
+    return (node == NULL) ? 0 : __atomic_load_n(&node->height, __ATOMIC_RELAXED);
+}
+
+static inline void
+conc_set_height(avl_conc_node_t *const node, int const height)
+{
+    __atomic_store_n(&node->height, height, __ATOMIC_RELAXED);
+}
+
+static inline void
+conc_spin(unsigned *const spins)
+{
+    if (++*spins % AVL_CONC_SPINS == 0) {
+        sched_yield();
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static inline void
+conc_lock(avl_conc_node_t *const node)
+{
+    unsigned spins = 0;
+    while (__atomic_exchange_n(&node->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&node->lock, __ATOMIC_RELAXED)) {
+            conc_spin(&spins);
+        }
+    }
+}
+
+static inline void
+conc_unlock(avl_conc_node_t *const node)
+{
+    __atomic_store_n(&node->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Marks a locked node as moving down. Searches that passed through it will
+ * fail their next check and back up. */
+static inline uint64_t
+conc_begin_shrink(avl_conc_node_t *const node)
+{
+    uint64_t const version = node->version;
+    __atomic_store_n(&node->version, version | CONC_SHRINKING, __ATOMIC_RELAXED);
+    /* None of the rotation's stores may be seen before the mark */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return version;
+}
+
+static inline void
+conc_end_shrink(avl_conc_node_t *const node, uint64_t const version)
+{
+    __atomic_store_n(&node->version, version + CONC_SHRINK_STEP, __ATOMIC_RELEASE);
+}
+
+/* Waits out a rotation of `node`, if one is running */
+static inline void
+conc_wait_shrink(avl_conc_node_t *const node)
+{
+    uint64_t const version = conc_version(node);
+    if (!(version & CONC_SHRINKING)) {
+        return;
+    }
+    unsigned spins = 0;
+    while (conc_version(node) == version) {
+        if (++spins == AVL_CONC_SPINS) {
+            /* Rotations hold the lock, so this blocks until it's over */
+            conc_lock(node);
+            conc_unlock(node);
+            return;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+/* Epochs */
+
+static inline void
+conc_free_list(avl_conc_node_t *node)
+{
+    while (node != NULL) {
+        avl_conc_node_t *const next = node->next_retired;
+        free(node);
+        node = next;
+    }
+}
+
+static inline void
+conc_pin(avl_conc_thread_t *const th)
+{
+    uint64_t const epoch = __atomic_load_n(&th->tree->m_epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&th->epoch, 2 * epoch + 1, __ATOMIC_RELAXED);
+    /* The mark must be seen before any node is read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (int b = 0; b < 3; ++b) {
+        if (th->limbo[b] != NULL && th->limbo_epoch[b] + 2 <= epoch) {
+            conc_free_list(th->limbo[b]);
+            th->limbo[b] = NULL;
+        }
+    }
+}
+
+static inline void
+conc_unpin(avl_conc_thread_t *const th)
+{
+    __atomic_store_n(&th->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* Moves the epoch on if every thread inside an operation is in this one */
+static inline void
+conc_try_advance(avl_conc_tree_t *const tree)
+{
+    uint64_t epoch = __atomic_load_n(&tree->m_epoch, __ATOMIC_SEQ_CST);
+    unsigned const hw = __atomic_load_n(&tree->m_threads_hw, __ATOMIC_ACQUIRE);
+
+    for (unsigned i = 0; i < hw; ++i) {
+        uint64_t const e = __atomic_load_n(&tree->m_threads[i].epoch, __ATOMIC_SEQ_CST);
+        if ((e & 1) && (e >> 1) != epoch) {
+            return;
+        }
+    }
+    (void)__atomic_compare_exchange_n(&tree->m_epoch, &epoch, epoch + 1, false,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+/* Hands an unlinked node over to be freed once no one can be looking at it */
+static inline void
+conc_retire(avl_conc_thread_t *const th, avl_conc_node_t *const node)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64_t const epoch = __atomic_load_n(&th->tree->m_epoch, __ATOMIC_SEQ_CST);
+    int const b = epoch % 3;
+
+    /* A list from another epoch in the same slot is from three or more ago */
+    if (th->limbo_epoch[b] != epoch) {
+        conc_free_list(th->limbo[b]);
+        th->limbo[b] = NULL;
+        th->limbo_epoch[b] = epoch;
+    }
+    node->next_retired = th->limbo[b];
+    th->limbo[b] = node;
+
+    if (++th->retired >= AVL_CONC_ADVANCE) {
+        th->retired = 0;
+        conc_try_advance(th->tree);
+    }
+}
+
+// Takes a free thread slot, or returns NULL if all AVL_CONC_MAX_THREADS are
+// taken. A thread uses its slot for every operation on the tree.
+static inline avl_conc_thread_t *
+avl_conc_thread_enter(avl_conc_tree_t *const tree)
+{
+    for (unsigned i = 0; i < AVL_CONC_MAX_THREADS; ++i) {
+        avl_conc_thread_t *const th = &tree->m_threads[i];
+        uint32_t expected = 0;
+        if (__atomic_compare_exchange_n(&th->in_use, &expected, 1, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            th->tree = tree;
+            th->retired = 0;
+            unsigned hw = __atomic_load_n(&tree->m_threads_hw, __ATOMIC_RELAXED);
+            while (hw < i + 1 && !__atomic_compare_exchange_n(&tree->m_threads_hw, &hw,
+                        i + 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            }
+            return th;
+        }
+    }
+    return NULL;
+}
+
+// Gives the slot back. Nodes it retired are freed by its next user, or by
+// `avl_conc_destroy`.
+static inline void
+avl_conc_thread_leave(avl_conc_thread_t *const th)
+{
+    __atomic_store_n(&th->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/* Repairs */
+
+static inline int
+conc_condition(avl_conc_node_t const*const node)
+{
+    avl_conc_node_t const*const l = conc_child(node, 0);
+    avl_conc_node_t const*const r = conc_child(node, 1);
+    if ((l == NULL || r == NULL) && conc_value(node) == NULL) {
+        return CONC_UNLINK;
+    }
+
+    int const hl = conc_height(l);
+    int const hr = conc_height(r);
+    int const want = 1 + ((hl > hr) ? hl : hr);
+    if (hl - hr < -1 || hl - hr > 1) {
+        return CONC_REBALANCE;
+    }
+    return (conc_height(node) != want) ? want : CONC_NOTHING;
+}
+
+/* Fixes the height of a locked node and returns the next node needing
+ * attention: this one again if it needs more than a height, else the parent
+ * if the height changed, else NULL */
+static inline avl_conc_node_t *
+conc_fix_height_nl(avl_conc_node_t *const node)
+{
+    int const c = conc_condition(node);
+    switch (c) {
+    case CONC_REBALANCE:
+    case CONC_UNLINK:
+        return node;
+    case CONC_NOTHING:
+        return NULL;
+    default:
+        conc_set_height(node, c);
+        return conc_parent(node);
+    }
+}
+
+/* Unlinks a locked node with at most one child from its locked parent */
+static inline bool
+conc_unlink_nl(avl_conc_node_t *const parent, avl_conc_node_t *const node)
+{
+    avl_conc_node_t *const pl = conc_child(parent, 0);
+    avl_conc_node_t *const pr = conc_child(parent, 1);
+    if (pl != node && pr != node) {
+        return false;
+    }
+
+    avl_conc_node_t *const l = conc_child(node, 0);
+    avl_conc_node_t *const r = conc_child(node, 1);
+    if (l != NULL && r != NULL) {
+        return false;
+    }
+
+    avl_conc_node_t *const splice = (l != NULL) ? l : r;
+    conc_set_child(parent, (pl == node) ? 0 : 1, splice);
+    if (splice != NULL) {
+        conc_set_parent(splice, parent);
+    }
+
+    __atomic_store_n(&node->version, node->version | CONC_UNLINKED, __ATOMIC_RELEASE);
+    conc_set_value(node, NULL);
+    return true;
+}
+
+/*
+ * The rotations are written for a node `n` whose side `d` is too tall: `h` is
+ * the child on that side, `hi` its inner child (toward the other side) and
+ * `ho` its outer one. With d = 0 a single rotation is a right rotation, and a
+ * double one a right rotation over a left-rotated child. The caller holds
+ * the locks of the parent `p`, `n`, `h` and, for a double rotation, `hi`.
+ */
+
+static inline avl_conc_node_t *
+conc_rotate_nl(
+    avl_conc_node_t *const p,
+    avl_conc_node_t *const n,
+    avl_conc_node_t *const h,
+    int const h_light,
+    int const h_ho,
+    avl_conc_node_t *const hi,
+    int const h_hi,
+    int const d)
+{
+    uint64_t const n_version = conc_begin_shrink(n);
+    avl_conc_node_t *const pl = conc_child(p, 0);
+
+    conc_set_child(n, d, hi);
+    if (hi != NULL) {
+        conc_set_parent(hi, n);
+    }
+    conc_set_child(h, !d, n);
+    conc_set_parent(n, h);
+    conc_set_child(p, (pl == n) ? 0 : 1, h);
+    conc_set_parent(h, p);
+
+    int const h_n = 1 + ((h_hi > h_light) ? h_hi : h_light);
+    conc_set_height(n, h_n);
+    conc_set_height(h, 1 + ((h_ho > h_n) ? h_ho : h_n));
+
+    conc_end_shrink(n, n_version);
+
+    /* Whichever of the two moved nodes still needs work comes back */
+    if (h_hi - h_light < -1 || h_hi - h_light > 1) {
+        return n;
+    }
+    if ((hi == NULL || h_light == 0) && conc_value(n) == NULL) {
+        return n;
+    }
+    if (h_ho - h_n < -1 || h_ho - h_n > 1) {
+        return h;
+    }
+    if (h_ho == 0 && conc_value(h) == NULL) {
+        return h;
+    }
+    return conc_fix_height_nl(p);
+}
+
+static inline avl_conc_node_t *
+conc_rotate_double_nl(
+    avl_conc_node_t *const p,
+    avl_conc_node_t *const n,
+    avl_conc_node_t *const h,
+    int const h_light,
+    int const h_ho,
+    avl_conc_node_t *const hi,
+    int const h_hio,
+    int const d)
+{
+    uint64_t const n_version = conc_begin_shrink(n);
+    uint64_t const h_version = conc_begin_shrink(h);
+    avl_conc_node_t *const pl = conc_child(p, 0);
+    avl_conc_node_t *const hio = conc_child(hi, d);
+    avl_conc_node_t *const hii = conc_child(hi, !d);
+    int const h_hii = conc_height(hii);
+
+    conc_set_child(n, d, hii);
+    if (hii != NULL) {
+        conc_set_parent(hii, n);
+    }
+    conc_set_child(h, !d, hio);
+    if (hio != NULL) {
+        conc_set_parent(hio, h);
+    }
+    conc_set_child(hi, d, h);
+    conc_set_parent(h, hi);
+    conc_set_child(hi, !d, n);
+    conc_set_parent(n, hi);
+    conc_set_child(p, (pl == n) ? 0 : 1, hi);
+    conc_set_parent(hi, p);
+
+    int const h_n = 1 + ((h_hii > h_light) ? h_hii : h_light);
+    conc_set_height(n, h_n);
+    int const h_h = 1 + ((h_ho > h_hio) ? h_ho : h_hio);
+    conc_set_height(h, h_h);
+    conc_set_height(hi, 1 + ((h_h > h_n) ? h_h : h_n));
+
+    conc_end_shrink(n, n_version);
+    conc_end_shrink(h, h_version);
+
+    if (h_hii - h_light < -1 || h_hii - h_light > 1) {
+        return n;
+    }
+    if ((hii == NULL || h_light == 0) && conc_value(n) == NULL) {
+        return n;
+    }
+    if (h_h - h_n < -1 || h_h - h_n > 1) {
+        return hi;
+    }
+    return conc_fix_height_nl(p);
+}
+
+/* Rebalances a locked `n`, under locked `p`, whose side `d` is too tall */
+static inline avl_conc_node_t *
+conc_rebalance_side_nl(
+    avl_conc_node_t *const p,
+    avl_conc_node_t *const n,
+    avl_conc_node_t *const h,
+    int const h_light,
+    int const d)
+{
+    avl_conc_node_t *ret;
+
+    conc_lock(h);
+    if (conc_height(h) - h_light <= 1) {
+        /* Changed since the caller looked, so look again */
+        ret = n;
+        goto out;
+    }
+
+    avl_conc_node_t *const hi = conc_child(h, !d);
+    int const h_ho = conc_height(conc_child(h, d));
+    int const h_hi0 = conc_height(hi);
+    if (h_ho >= h_hi0) {
+        ret = conc_rotate_nl(p, n, h, h_light, h_ho, hi, h_hi0, d);
+        goto out;
+    }
+
+    conc_lock(hi);
+    int const h_hi = conc_height(hi);
+    if (h_ho >= h_hi) {
+        ret = conc_rotate_nl(p, n, h, h_light, h_ho, hi, h_hi, d);
+        conc_unlock(hi);
+        goto out;
+    }
+    int const h_hio = conc_height(conc_child(hi, d));
+    int const b = h_ho - h_hio;
+    if (b >= -1 && b <= 1 && !((h_ho == 0 || h_hio == 0) && conc_value(h) == NULL)) {
+        ret = conc_rotate_double_nl(p, n, h, h_light, h_ho, hi, h_hio, d);
+        conc_unlock(hi);
+        goto out;
+    }
+    conc_unlock(hi);
+
+    /* The double rotation would leave `h` unbalanced, so first rotate `hi`
+     * up over `h`, which is then the one to come back to */
+    ret = conc_rebalance_side_nl(n, h, hi, h_ho, !d);
+
+out:
+    conc_unlock(h);
+    return ret;
+}
+
+/* Unlinks, rotates or fixes the height of a locked `n` under locked `p` */
+static inline avl_conc_node_t *
+conc_rebalance_nl(avl_conc_thread_t *const th, avl_conc_node_t *const p, avl_conc_node_t *const n)
+{
+    avl_conc_node_t *const l = conc_child(n, 0);
+    avl_conc_node_t *const r = conc_child(n, 1);
+    if ((l == NULL || r == NULL) && conc_value(n) == NULL) {
+        if (conc_unlink_nl(p, n)) {
+            conc_retire(th, n);
+            return conc_fix_height_nl(p);
+        }
+        return n;
+    }
+
+    int const hl = conc_height(l);
+    int const hr = conc_height(r);
+    int const want = 1 + ((hl > hr) ? hl : hr);
+    if (hl - hr > 1) {
+        return conc_rebalance_side_nl(p, n, l, hr, 0);
+    }
+    if (hl - hr < -1) {
+        return conc_rebalance_side_nl(p, n, r, hl, 1);
+    }
+    if (conc_height(n) != want) {
+        conc_set_height(n, want);
+        return conc_fix_height_nl(p);
+    }
+    return NULL;
+}
+
+/* Walks up from `node` repairing heights and balance, a node at a time */
+static inline void
+conc_fix_up(avl_conc_thread_t *const th, avl_conc_node_t *node)
+{
+    while (node != NULL && conc_parent(node) != NULL) {
+        int const c = conc_condition(node);
+        if (c == CONC_NOTHING || (conc_version(node) & CONC_UNLINKED)) {
+            return;
+        }
+
+        if (c != CONC_UNLINK && c != CONC_REBALANCE) {
+            avl_conc_node_t *const n = node;
+            conc_lock(n);
+            node = conc_fix_height_nl(n);
+            conc_unlock(n);
+        } else {
+            avl_conc_node_t *const p = conc_parent(node);
+            conc_lock(p);
+            if (!(conc_version(p) & CONC_UNLINKED) && conc_parent(node) == p) {
+                avl_conc_node_t *const n = node;
+                conc_lock(n);
+                node = conc_rebalance_nl(th, p, n);
+                conc_unlock(n);
+            }
+            conc_unlock(p);
+        }
+    }
+}
+
+/* Operations. Each attempt carries on below `node`, on its side `dir`, as long
+ * as `node` is still at version `node_version`; otherwise it returns
+ * CONC_RETRY and the level above tries again. */
+
+static inline int
+conc_attempt_get(
+    uint64_t const key,
+    avl_conc_node_t *const node,
+    int const dir,
+    uint64_t const node_version,
+    void **const out)
+{
+    for (;;) {
+        avl_conc_node_t *const child = conc_child(node, dir);
+        if (conc_version(node) != node_version) {
+            return CONC_RETRY;
+        }
+        if (child == NULL) {
+            *out = NULL;
+            return CONC_DONE;
+        }
+        if (child->key == key) {
+            *out = conc_value(child);
+            return CONC_DONE;
+        }
+
+        uint64_t const child_version = conc_version(child);
+        if (child_version & CONC_SHRINKING) {
+            conc_wait_shrink(child);
+        } else if (!(child_version & CONC_UNLINKED) && child == conc_child(node, dir)) {
+            if (conc_version(node) != node_version) {
+                return CONC_RETRY;
+            }
+            if (conc_attempt_get(key, child, key > child->key, child_version, out) == CONC_DONE) {
+                return CONC_DONE;
+            }
+        }
+    }
+}
+
+// Returns the value mapped to `key`, or NULL.
+static inline void *
+avl_conc_get(avl_conc_thread_t *const th, uint64_t const key)
+{
+    void *value;
+    conc_pin(th);
+    while (conc_attempt_get(key, &th->tree->m_holder, 1, 0, &value) != CONC_DONE) {
+    }
+    conc_unpin(th);
+    return value;
+}
+
+static inline int
+conc_attempt_add(
+    avl_conc_thread_t *const th,
+    uint64_t const key,
+    void *const value,
+    avl_conc_node_t *const node,
+    int const dir,
+    uint64_t const node_version,
+    avl_conc_node_t **const leaf,
+    void **const out)
+{
+    for (;;) {
+        avl_conc_node_t *const child = conc_child(node, dir);
+        if (conc_version(node) != node_version) {
+            return CONC_RETRY;
+        }
+
+        if (child == NULL) {
+            if (*leaf == NULL) {
+                *leaf = malloc(sizeof(**leaf));
+                if (*leaf == NULL) {
+                    *out = NULL;
+                    return CONC_DONE;
+                }
+            }
+            **leaf = (avl_conc_node_t) {
+                .key = key,
+                .value = value,
+                .parent = node,
+                .height = 1,
+            };
+
+            conc_lock(node);
+            if (conc_version(node) != node_version) {
+                conc_unlock(node);
+                return CONC_RETRY;
+            }
+            if (conc_child(node, dir) != NULL) {
+                /* Someone else got there first */
+                conc_unlock(node);
+                continue;
+            }
+            conc_set_child(node, dir, *leaf);
+            conc_unlock(node);
+
+            *leaf = NULL;
+            conc_fix_up(th, node);
+            *out = value;
+            return CONC_DONE;
+        }
+
+        if (child->key == key) {
+            conc_lock(child);
+            if (conc_version(child) & CONC_UNLINKED) {
+                conc_unlock(child);
+                continue;
+            }
+            void *const prev = conc_value(child);
+            if (prev == NULL) {
+                /* A routing node takes the value back */
+                conc_set_value(child, value);
+            }
+            conc_unlock(child);
+            *out = (prev != NULL) ? prev : value;
+            return CONC_DONE;
+        }
+
+        uint64_t const child_version = conc_version(child);
+        if (child_version & CONC_SHRINKING) {
+            conc_wait_shrink(child);
+        } else if (!(child_version & CONC_UNLINKED) && child == conc_child(node, dir)) {
+            if (conc_version(node) != node_version) {
+                return CONC_RETRY;
+            }
+            if (conc_attempt_add(th, key, value, child, key > child->key, child_version,
+                        leaf, out) == CONC_DONE) {
+                return CONC_DONE;
+            }
+        }
+    }
+}
+
+// Maps `key` to `value` (not NULL) unless it is mapped already. Returns the
+// value `key` is now mapped to: `value` if it was added, else the one that
+// was there. Returns NULL if a node can't be allocated.
+static inline void *
+avl_conc_add(avl_conc_thread_t *const th, uint64_t const key, void *const value)
+{
+    avl_conc_node_t *leaf = NULL;
+    void *out;
+    conc_pin(th);
+    while (conc_attempt_add(th, key, value, &th->tree->m_holder, 1, 0, &leaf, &out) != CONC_DONE) {
+    }
+    conc_unpin(th);
+    /* Allocated for a race that was lost; no one else saw it */
+    free(leaf);
+    return out;
+}
+
+/* Removes the value of `n`, found below `parent`: a node with a child to
+ * spare is unlinked, any other is left as a routing node */
+static inline int
+conc_attempt_rem_node(
+    avl_conc_thread_t *const th,
+    avl_conc_node_t *const parent,
+    avl_conc_node_t *const n,
+    void **const out)
+{
+    if (conc_value(n) == NULL) {
+        *out = NULL;
+        return CONC_DONE;
+    }
+
+    if (conc_child(n, 0) == NULL || conc_child(n, 1) == NULL) {
+        conc_lock(parent);
+        if ((conc_version(parent) & CONC_UNLINKED) || conc_parent(n) != parent) {
+            conc_unlock(parent);
+            return CONC_RETRY;
+        }
+        conc_lock(n);
+        void *const prev = conc_value(n);
+        if (prev == NULL) {
+            conc_unlock(n);
+            conc_unlock(parent);
+            *out = NULL;
+            return CONC_DONE;
+        }
+        if (!conc_unlink_nl(parent, n)) {
+            conc_unlock(n);
+            conc_unlock(parent);
+            return CONC_RETRY;
+        }
+        conc_unlock(n);
+        conc_unlock(parent);
+
+        conc_retire(th, n);
+        conc_fix_up(th, parent);
+        *out = prev;
+        return CONC_DONE;
+    }
+
+    conc_lock(n);
+    if (conc_version(n) & CONC_UNLINKED) {
+        conc_unlock(n);
+        return CONC_RETRY;
+    }
+    void *const prev = conc_value(n);
+    if (prev != NULL && (conc_child(n, 0) == NULL || conc_child(n, 1) == NULL)) {
+        /* Lost a child meanwhile, so it can be unlinked after all */
+        conc_unlock(n);
+        return CONC_RETRY;
+    }
+    conc_set_value(n, NULL);
+    conc_unlock(n);
+    *out = prev;
+    return CONC_DONE;
+}
+
+static inline int
+conc_attempt_rem(
+    avl_conc_thread_t *const th,
+    uint64_t const key,
+    avl_conc_node_t *const node,
+    int const dir,
+    uint64_t const node_version,
+    void **const out)
+{
+    for (;;) {
+        avl_conc_node_t *const child = conc_child(node, dir);
+        if (conc_version(node) != node_version) {
+            return CONC_RETRY;
+        }
+        if (child == NULL) {
+            *out = NULL;
+            return CONC_DONE;
+        }
+        if (child->key == key) {
+            if (conc_attempt_rem_node(th, node, child, out) == CONC_DONE) {
+                return CONC_DONE;
+            }
+            continue;
+        }
+
+        uint64_t const child_version = conc_version(child);
+        if (child_version & CONC_SHRINKING) {
+            conc_wait_shrink(child);
+        } else if (!(child_version & CONC_UNLINKED) && child == conc_child(node, dir)) {
+            if (conc_version(node) != node_version) {
+                return CONC_RETRY;
+            }
+            if (conc_attempt_rem(th, key, child, key > child->key, child_version, out) == CONC_DONE) {
+                return CONC_DONE;
+            }
+        }
+    }
+}
+
+// Removes `key` and returns the value it was mapped to, or NULL if it wasn't.
+static inline void *
+avl_conc_rem(avl_conc_thread_t *const th, uint64_t const key)
+{
+    void *value;
+    conc_pin(th);
+    while (conc_attempt_rem(th, key, &th->tree->m_holder, 1, 0, &value) != CONC_DONE) {
+    }
+    conc_unpin(th);
+    return value;
+}
+
+static inline void
+conc_free_subtree(avl_conc_node_t *const node)
+{
+    if (node != NULL) {
+        conc_free_subtree(node->child[0]);
+        conc_free_subtree(node->child[1]);
+        free(node);
+    }
+}
+
+// Frees every node, once no thread is using the tree any more.
+static inline void
+avl_conc_destroy(avl_conc_tree_t *const tree)
+{
+    conc_free_subtree(tree->m_holder.child[1]);
+    tree->m_holder.child[1] = NULL;
+    for (unsigned i = 0; i < AVL_CONC_MAX_THREADS; ++i) {
+        for (int b = 0; b < 3; ++b) {
+            conc_free_list(tree->m_threads[i].limbo[b]);
+            tree->m_threads[i].limbo[b] = NULL;
+        }
+    }
+}
+
+#endif /* INLINE_AVL_CONCURRENT_H */
@@ -0,0 +1,174 @@
+
+#ifndef INLINE_AVL_DEFINE_H
+#define INLINE_AVL_DEFINE_H
+
+#include "inline_avl.h"
+
+/*
+ * Typed instantiations.
+ *
+ * AVL_DEFINE(prefix, type, node_member, key_member, cmp) writes the wrappers
+ * that avlhelper.c writes by hand for `my_t`, for any `type` with an
+ * `e_avl_node` member `node_member` and a key member `key_member`. `cmp` is a
+ * function or macro taking two pointers to keys and returning <0, 0 or >0.
+ * Keys are passed by value, so `key_member` can't be an array.
+ *
+ * Since the comparator is named at the point of definition, every generated
+ * function is flattened with it, and no node visit goes through an
+ * `avlcmp_t` pointer. Path buffers are sized from the capacity given to
+ * AVL_DEFINE_CAP (AVL_DEFINE assumes fewer than 2^32 objects), so they live
+ * on the stack inside the wrappers. With `prefix` = foo this defines:
+ *
+ *   type *foo_add(avl_tree_t *tree, type *obj);
+ *   type *foo_get(avl_tree_t const *tree, key_type key);
+ *   type *foo_rem(avl_tree_t *tree, key_type key);
+ *
+ *   foo_iter_t, an iterator that carries its own path buffer, and
+ *   void foo_iter_init(foo_iter_t *iter, avl_tree_t const *tree);
+ *   type *foo_first(foo_iter_t *iter);   type *foo_last(foo_iter_t *iter);
+ *   type *foo_next(foo_iter_t *iter);    type *foo_prev(foo_iter_t *iter);
+ *   type *foo_seek(foo_iter_t *iter, key_type key);
+ *
+ * The generated functions are static, so AVL_DEFINE goes wherever they are
+ * used, once per translation unit.
+ */
+
+/* The greatest height of an AVL tree of `c` nodes: the number of heights h
+ * whose sparsest tree, with F(h+2) - 1 nodes, has no more than `c`. */
+#define AVL_MAX_HEIGHT(c) ( \
+    ((c) >= 1ull) + ((c) >= 2ull) + ((c) >= 4ull) + \
+    ((c) >= 7ull) + ((c) >= 12ull) + ((c) >= 20ull) + \
+    ((c) >= 33ull) + ((c) >= 54ull) + ((c) >= 88ull) + \
+    ((c) >= 143ull) + ((c) >= 232ull) + ((c) >= 376ull) + \
+    ((c) >= 609ull) + ((c) >= 986ull) + ((c) >= 1596ull) + \
+    ((c) >= 2583ull) + ((c) >= 4180ull) + ((c) >= 6764ull) + \
+    ((c) >= 10945ull) + ((c) >= 17710ull) + ((c) >= 28656ull) + \
+    ((c) >= 46367ull) + ((c) >= 75024ull) + ((c) >= 121392ull) + \
+    ((c) >= 196417ull) + ((c) >= 317810ull) + ((c) >= 514228ull) + \
+    ((c) >= 832039ull) + ((c) >= 1346268ull) + ((c) >= 2178308ull) + \
+    ((c) >= 3524577ull) + ((c) >= 5702886ull) + ((c) >= 9227464ull) + \
+    ((c) >= 14930351ull) + ((c) >= 24157816ull) + ((c) >= 39088168ull) + \
+    ((c) >= 63245985ull) + ((c) >= 102334154ull) + ((c) >= 165580140ull) + \
+    ((c) >= 267914295ull) + ((c) >= 433494436ull) + ((c) >= 701408732ull) + \
+    ((c) >= 1134903169ull) + ((c) >= 1836311902ull) + ((c) >= 2971215072ull) + \
+    ((c) >= 4807526975ull) + ((c) >= 7778742048ull) + ((c) >= 12586269024ull) + \
+    ((c) >= 20365011073ull) + ((c) >= 32951280098ull) + ((c) >= 53316291172ull) + \
+    ((c) >= 86267571271ull) + ((c) >= 139583862444ull) + ((c) >= 225851433716ull) + \
+    ((c) >= 365435296161ull) + ((c) >= 591286729878ull) + ((c) >= 956722026040ull) + \
+    ((c) >= 1548008755919ull) + ((c) >= 2504730781960ull) + ((c) >= 4052739537880ull) + \
+    ((c) >= 6557470319841ull) + ((c) >= 10610209857722ull) + ((c) >= 17167680177564ull) + \
+    ((c) >= 27777890035287ull) + ((c) >= 44945570212852ull) + ((c) >= 72723460248140ull) + \
+    ((c) >= 117669030460993ull) + ((c) >= 190392490709134ull) + ((c) >= 308061521170128ull) + \
+    ((c) >= 498454011879263ull) + ((c) >= 806515533049392ull) + ((c) >= 1304969544928656ull) + \
+    ((c) >= 2111485077978049ull) + ((c) >= 3416454622906706ull) + ((c) >= 5527939700884756ull) + \
+    ((c) >= 8944394323791463ull) + ((c) >= 14472334024676220ull) + ((c) >= 23416728348467684ull) + \
+    ((c) >= 37889062373143905ull) + ((c) >= 61305790721611590ull) + ((c) >= 99194853094755496ull) + \
+    ((c) >= 160500643816367087ull) + ((c) >= 259695496911122584ull) + ((c) >= 420196140727489672ull) + \
+    ((c) >= 679891637638612257ull) + ((c) >= 1100087778366101930ull) + ((c) >= 1779979416004714188ull) + \
+    ((c) >= 2880067194370816119ull) + ((c) >= 4660046610375530308ull) + ((c) >= 7540113804746346428ull) + \
+    ((c) >= 12200160415121876737ull) )
+
+#define AVL_DEFINE(prefix, type, node_member, key_member, cmp) \
+    AVL_DEFINE_CAP(prefix, type, node_member, key_member, cmp, UINT32_MAX)
+
+#define AVL_DEFINE_CAP(prefix, type, node_member, key_member, cmp, capacity) \
+    \
+    typedef __typeof__(((type *)0)->key_member) prefix##_key_t; \
+    \
+    enum { prefix##_STACK = AVL_MAX_HEIGHT(capacity) + 1 }; \
+    \
+    typedef struct { \
+        avl_iter_t iter; \
+        void *stack[prefix##_STACK]; \
+    } prefix##_iter_t; \
+    \
+    __attribute__((pure, unused)) \
+    static inline type * \
+    prefix##_obj(e_avl_node const*const nd) \
+    { \
+        if (nd == NULL) { \
+            return NULL; \
+        } \
+        return (type *)((unsigned char *)nd - offsetof(type, node_member)); \
+    } \
+    \
+    __attribute__((pure, unused)) \
+    static inline int \
+    prefix##_nodecmp(e_avl_node const*const ln, e_avl_node const*const rn) \
+    { \
+        return cmp(&prefix##_obj(ln)->key_member, &prefix##_obj(rn)->key_member); \
+    } \
+    \
+    __attribute__((pure, unused)) \
+    static inline int \
+    prefix##_keycmp(void const*const key, e_avl_node const*const rn) \
+    { \
+        return cmp((prefix##_key_t const *)key, &prefix##_obj(rn)->key_member); \
+    } \
+    \
+    __attribute__((flatten, unused)) \
+    static inline type * \
+    prefix##_add(avl_tree_t *const tree, type *const obj) \
+    { \
+        void *stack[prefix##_STACK]; \
+        return prefix##_obj(avl_base_add(tree, &obj->node_member, prefix##_nodecmp, stack)); \
+    } \
+    \
+    __attribute__((flatten, unused)) \
+    static inline type * \
+    prefix##_get(avl_tree_t const*const tree, prefix##_key_t const key) \
+    { \
+        return prefix##_obj(avl_base_get(tree, &key, prefix##_keycmp)); \
+    } \
+    \
+    __attribute__((flatten, unused)) \
+    static inline type * \
+    prefix##_rem(avl_tree_t *const tree, prefix##_key_t const key) \
+    { \
+        void *stack[prefix##_STACK]; \
+        return prefix##_obj(avl_base_rem(tree, &key, prefix##_keycmp, stack)); \
+    } \
+    \
+    __attribute__((unused)) \
+    static inline void \
+    prefix##_iter_init(prefix##_iter_t *const it, avl_tree_t const*const tree) \
+    { \
+        it->iter = avl_iter_init(tree, it->stack); \
+    } \
+    \
+    __attribute__((flatten, unused)) \
+    static inline type * \
+    prefix##_first(prefix##_iter_t *const it) \
+    { \
+        return prefix##_obj(avl_iter_first(&it->iter)); \
+    } \
+    \
+    __attribute__((flatten, unused)) \
+    static inline type * \
+    prefix##_last(prefix##_iter_t *const it) \
+    { \
+        return prefix##_obj(avl_iter_last(&it->iter)); \
+    } \
+    \
+    __attribute__((flatten, unused)) \
+    static inline type * \
+    prefix##_next(prefix##_iter_t *const it) \
+    { \
+        return prefix##_obj(avl_iter_next(&it->iter)); \
+    } \
+    \
+    __attribute__((flatten, unused)) \
+    static inline type * \
+    prefix##_prev(prefix##_iter_t *const it) \
+    { \
+        return prefix##_obj(avl_iter_prev(&it->iter)); \
+    } \
+    \
+    __attribute__((flatten, unused)) \
+    static inline type * \
+    prefix##_seek(prefix##_iter_t *const it, prefix##_key_t const key) \
+    { \
+        return prefix##_obj(avl_iter_seek(&it->iter, &key, prefix##_keycmp)); \
+    }
+
+#endif /* INLINE_AVL_DEFINE_H */
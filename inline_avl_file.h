@@ -0,0 +1,276 @@
+#ifndef INLINE_AVL_FILE_H
+#define INLINE_AVL_FILE_H
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "inline_avl.h"
+
+/*
+ * Trees on disk.
+ *
+ * A tree is saved as its objects in key order, one fixed-size record each,
+ * after a header giving the format version, the record size and the count.
+ * What goes in a record is up to the caller, through callbacks. A writer
+ * streams records out through a buffer, so that a tree or any other source
+ * of sorted records can be saved without holding a second copy; the header
+ * is only completed once every record is out, so a file whose writing was
+ * cut short is never taken for a whole one.
+ *
+ * Loading maps the file, then decodes the records in order into one block
+ * of objects and links them with `avl_base_build_sorted`: O(n), with no
+ * comparisons or rotations, reading the file front to back. The records are
+ * also usable in place, sorted, through `avl_file_record`.
+ *
+ * Numbers are in the byte order of the machine that wrote them, so a file
+ * from the other order fails the version check. Records start 32 bytes into
+ * the file and are packed, so they're only as aligned as their size makes
+ * them. The loader trusts that the records are sorted and distinct.
+ */
+
+#define AVL_FILE_MAGIC "INLAVL\r\n"
+#define AVL_FILE_VERSION 1u
+
+/* How much a writer collects before writing */
+#ifndef AVL_FILE_BUFFER
+#define AVL_FILE_BUFFER (1 << 16)
+#endif
+
+typedef struct avl_file_header avl_file_header_t;
+
+struct avl_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+    uint64_t reserved;
+};
+
+/* Write the record for `node` to `record` */
+typedef void (*avlencode_t)(e_avl_node const *node, void *record, void *arg);
+
+/* Fill slot `i` from `record`, returning the slot's node */
+typedef e_avl_node *(*avldecode_t)(void const *record, size_t i, void *arg);
+
+typedef struct avl_file_writer avl_file_writer_t;
+
+struct avl_file_writer {
+    int m_fd;
+    uint32_t m_record_size;
+    uint64_t m_count;
+    unsigned char *m_buf;
+    size_t m_fill;
+    bool m_ok;            /* false once a write has failed */
+};
+
+/* Write all of `len` bytes, carrying on after short writes */
+static inline bool
+file_write_all(int const fd, void const*const buf, size_t const len, off_t const offset)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t const w = pwrite(fd, (unsigned char const*)buf + done, len - done, offset + done);
+        if (w <= 0) {
+            return false;
+        }
+        done += w;
+    }
+    return true;
+}
+
+// Starts a file of `record_size` byte records at the start of `fd`, which
+// should be empty. Returns false if the buffer can't be allocated.
+static inline bool
+avl_file_write_begin(avl_file_writer_t *const w, int const fd, uint32_t const record_size)
+{
+    if (record_size == 0 || record_size > AVL_FILE_BUFFER) {
+        return false;
+    }
+    *w = (avl_file_writer_t) {
+        .m_fd = fd,
+        .m_record_size = record_size,
+        .m_count = 0,
+        .m_buf = malloc(AVL_FILE_BUFFER),
+        .m_fill = sizeof(avl_file_header_t),
+        .m_ok = true,
+    };
+    if (w->m_buf == NULL) {
+        return false;
+    }
+
+    /* A zeroed header until the end, so the file isn't valid before then */
+    memset(w->m_buf, 0, sizeof(avl_file_header_t));
+    return true;
+}
+
+static inline void
+file_flush(avl_file_writer_t *const w)
+{
+    off_t const written = sizeof(avl_file_header_t) + (off_t)w->m_count * w->m_record_size
+        - (off_t)w->m_fill;
+    if (w->m_ok && !file_write_all(w->m_fd, w->m_buf, w->m_fill, written)) {
+        w->m_ok = false;
+    }
+    w->m_fill = 0;
+}
+
+// Returns room for the next record, which must sort after the last. It is
+// written out as the buffer fills up.
+static inline void *
+avl_file_write_next(avl_file_writer_t *const w)
+{
+    if (w->m_fill + w->m_record_size > AVL_FILE_BUFFER) {
+        file_flush(w);
+    }
+    void *const record = w->m_buf + w->m_fill;
+    w->m_fill += w->m_record_size;
+    ++w->m_count;
+    return record;
+}
+
+// Writes out the rest of the records and then the header, and frees the
+// buffer. Returns whether every write succeeded.
+static inline bool
+avl_file_write_end(avl_file_writer_t *const w)
+{
+    file_flush(w);
+
+    avl_file_header_t header = {
+        .version = AVL_FILE_VERSION,
+        .record_size = w->m_record_size,
+        .count = w->m_count,
+        .reserved = 0,
+    };
+    memcpy(header.magic, AVL_FILE_MAGIC, sizeof(header.magic));
+    bool const ok = w->m_ok && file_write_all(w->m_fd, &header, sizeof(header), 0);
+
+    free(w->m_buf);
+    w->m_buf = NULL;
+    return ok;
+}
+
+// Writes every node of `tree` to `fd`, in key order, through `encode`.
+static inline bool
+avl_file_write_tree(
+    int const fd,
+    avl_tree_t const*const tree,
+    uint32_t const record_size,
+    avlencode_t const encode,
+    void *const arg)
+{
+    avl_file_writer_t w;
+    if (!avl_file_write_begin(&w, fd, record_size)) {
+        return false;
+    }
+
+    void *stack[64];
+    avl_iter_t iter = avl_iter_init(tree, stack);
+    for (e_avl_node *nd = avl_iter_first(&iter); nd != NULL; nd = avl_iter_next(&iter)) {
+        encode(nd, avl_file_write_next(&w), arg);
+    }
+    return avl_file_write_end(&w);
+}
+
+typedef struct avl_file avl_file_t;
+
+struct avl_file {
+    void *m_base;
+    size_t m_len;
+    uint64_t m_count;
+    uint32_t m_record_size;
+};
+
+// Maps the file open at `fd`, which must hold `record_size` byte records.
+// Returns false if it can't be mapped, or isn't a whole file in this format
+// and version with records of that size.
+static inline bool
+avl_file_map(avl_file_t *const f, int const fd, uint32_t const record_size)
+{
+    struct stat st;
+    if (record_size == 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(avl_file_header_t)) {
+        return false;
+    }
+
+    size_t const len = st.st_size;
+    void *const base = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    avl_file_header_t header;
+    memcpy(&header, base, sizeof(header));
+    uint64_t const room = (len - sizeof(header)) / record_size;
+    if (memcmp(header.magic, AVL_FILE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != AVL_FILE_VERSION
+            || header.record_size != record_size
+            || header.count > room) {
+        (void)munmap(base, len);
+        return false;
+    }
+
+    *f = (avl_file_t) {
+        .m_base = base,
+        .m_len = len,
+        .m_count = header.count,
+        .m_record_size = record_size,
+    };
+    return true;
+}
+
+static inline void
+avl_file_unmap(avl_file_t *const f)
+{
+    (void)munmap(f->m_base, f->m_len);
+    f->m_base = NULL;
+    f->m_len = 0;
+}
+
+__attribute__((pure))
+static inline size_t
+avl_file_size(avl_file_t const*const f)
+{
+    return f->m_count;
+}
+
+// Returns the `i`-th record in key order, in place in the mapping.
+__attribute__((pure))
+static inline void const *
+avl_file_record(avl_file_t const*const f, size_t const i)
+{
+    return (unsigned char const*)f->m_base + sizeof(avl_file_header_t) + i * f->m_record_size;
+}
+
+// Replaces the contents of `tree` with the records of `f`, decoded into
+// objects made with `alloc` and `decode` and linked in O(n). Returns false,
+// leaving `tree` alone, if memory runs out. Nodes previously in `tree` are
+// dropped, not modified.
+static inline bool
+avl_file_load(
+    avl_tree_t *const tree,
+    avl_file_t const*const f,
+    avlalloc_t const alloc,
+    avldecode_t const decode,
+    void *const arg)
+{
+    size_t const n = f->m_count;
+    e_avl_node **const nodes = malloc(sizeof(*nodes) * (n > 0 ? n : 1));
+    if (nodes == NULL) {
+        return false;
+    }
+    if (n > 0 && !alloc(n, arg)) {
+        free(nodes);
+        return false;
+    }
+
+    (void)madvise(f->m_base, f->m_len, MADV_SEQUENTIAL);
+    for (size_t i = 0; i < n; ++i) {
+        nodes[i] = decode(avl_file_record(f, i), i, arg);
+    }
+
+    avl_base_build_sorted(tree, nodes, n);
+    free(nodes);
+    return true;
+}
+
+#endif /* INLINE_AVL_FILE_H */
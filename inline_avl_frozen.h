@@ -0,0 +1,253 @@
+
+#ifndef INLINE_AVL_FROZEN_H
+#define INLINE_AVL_FROZEN_H
+
+#include "inline_avl.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AVL_FROZEN_X86
+#endif
+
+/*
+ * Frozen snapshots.
+ *
+ * `avl_freeze` copies the integer keys of a tree that is no longer changing,
+ * with a pointer to each node, into two arrays in Eytzinger order: the order
+ * of a complete binary tree laid out level by level, the children of slot k
+ * being slots 2k and 2k + 1. A search is then index arithmetic on one array
+ * rather than pointer chasing, every level's loads can be prefetched four
+ * levels ahead (the 16 descendants of slot k are slots 16k to 16k + 15, two
+ * cache lines), and no level needs a branch.
+ *
+ * The arrays are padded to a complete tree with UINT64_MAX keys and NULL
+ * nodes, so every search takes the same number of steps. That is also what
+ * lets `avl_frozen_get_batch` run four searches at a time in AVX2 registers,
+ * which it does where the processor supports it.
+ *
+ * A snapshot doesn't own the nodes it points to. It records the tree's
+ * generation, and `avl_frozen_valid` is false once the tree has been changed
+ * since, after which its nodes may be gone.
+ */
+
+typedef uint64_t (*avlkeyof_t)(e_avl_node const*);
+
+typedef struct avl_frozen avl_frozen_t;
+
+struct avl_frozen {
+    uint64_t *keys;      /* keys[1..m] in Eytzinger order */
+    e_avl_node **nodes;  /* the node for each key, NULL for padding */
+    size_t m;            /* slots, 2^levels - 1 */
+    unsigned levels;
+    avl_tree_t const *tree;
+    unsigned gen;
+};
+
+#define AVL_FROZEN_ALIGN 64
+
+// Makes a snapshot of `tree`, whose nodes are keyed by `keyof` in the same
+// order as the tree's comparator. Returns false if it can't be allocated.
+// O(n). `stack_buffer` is as for `avl_iter_init`.
+static inline bool
+avl_freeze(
+    avl_tree_t const*const tree,
+    avlkeyof_t const keyof,
+    void *const stack_buffer,
+    avl_frozen_t *const frozen)
+{
+    size_t const n = avl_size(tree);
+    unsigned levels = 0;
+    while (levels < 63 && ((size_t)1 << levels) - 1 < n) {
+        ++levels;
+    }
+    size_t const m = ((size_t)1 << levels) - 1;
+
+    /* Slot 0 is unused; round up so that both arrays can be aligned */
+    size_t const len = ((m + 1) * sizeof(uint64_t) + AVL_FROZEN_ALIGN - 1)
+        / AVL_FROZEN_ALIGN * AVL_FROZEN_ALIGN;
+    uint64_t *const keys = aligned_alloc(AVL_FROZEN_ALIGN, len);
+    e_avl_node **const nodes = aligned_alloc(AVL_FROZEN_ALIGN, len);
+    if (keys == NULL || nodes == NULL) {
+        free(keys);
+        free(nodes);
+        return false;
+    }
+
+    /* Visit the slots in order, filling them from an in-order walk */
+    avl_iter_t iter = avl_iter_init(tree, stack_buffer);
+    e_avl_node *node = avl_iter_first(&iter);
+
+    size_t k = (m == 0) ? 0 : 1;
+    while (k != 0 && 2 * k <= m) {
+        k *= 2;
+    }
+    for (size_t i = 0; i < m; ++i) {
+        if (node != NULL) {
+            keys[k] = keyof(node);
+            nodes[k] = node;
+            node = avl_iter_next(&iter);
+        } else {
+            keys[k] = UINT64_MAX;
+            nodes[k] = NULL;
+        }
+
+        /* The next slot in order */
+        if (2 * k + 1 <= m) {
+            k = 2 * k + 1;
+            while (2 * k <= m) {
+                k *= 2;
+            }
+        } else {
+            while (k & 1) {
+                k >>= 1;
+            }
+            k >>= 1;
+        }
+    }
+    keys[0] = 0;
+    nodes[0] = NULL;
+
+    *frozen = (avl_frozen_t) {
+        .keys = keys,
+        .nodes = nodes,
+        .m = m,
+        .levels = levels,
+        .tree = tree,
+        .gen = tree->m_gen,
+    };
+    return true;
+}
+
+static inline void
+avl_frozen_free(avl_frozen_t *const frozen)
+{
+    free(frozen->keys);
+    free(frozen->nodes);
+    frozen->keys = NULL;
+    frozen->nodes = NULL;
+    frozen->m = 0;
+    frozen->levels = 0;
+}
+
+// Whether the tree is unchanged since the snapshot was taken
+__attribute__((pure))
+static inline bool
+avl_frozen_valid(avl_frozen_t const*const frozen)
+{
+    return frozen->gen == frozen->tree->m_gen;
+}
+
+/* The slot of the first key not less than `key`. Padding makes it exist. */
+__attribute__((pure))
+static inline size_t
+frozen_lower_bound(avl_frozen_t const*const frozen, uint64_t const key)
+{
+    uint64_t const*const keys = frozen->keys;
+    size_t k = 1;
+
+    for (unsigned l = 0; l < frozen->levels; ++l) {
+        __builtin_prefetch(&keys[16 * k]);
+        __builtin_prefetch(&keys[16 * k + 8]);
+        k = 2 * k + (keys[k] < key);
+    }
+
+    /* Climb back out of the right turns taken at the bottom */
+    return k >> __builtin_ffsll(~(long long)k);
+}
+
+// Returns the node keyed `key`, or NULL.
+__attribute__((pure))
+static inline e_avl_node *
+avl_frozen_get(avl_frozen_t const*const frozen, uint64_t const key)
+{
+    if (frozen->m == 0) {
+        return NULL;
+    }
+    size_t const k = frozen_lower_bound(frozen, key);
+    return (frozen->keys[k] == key) ? frozen->nodes[k] : NULL;
+}
+
+// Returns the node with the smallest key not less than `key`, or NULL.
+__attribute__((pure))
+static inline e_avl_node *
+avl_frozen_lower_bound(avl_frozen_t const*const frozen, uint64_t const key)
+{
+    if (frozen->m == 0) {
+        return NULL;
+    }
+    return frozen->nodes[frozen_lower_bound(frozen, key)];
+}
+
+#ifdef AVL_FROZEN_X86
+/* Eight searches at a time, in two vectors of four lanes. AVX2 has only a
+ * signed 64-bit comparison, so both sides have their top bit flipped. */
+__attribute__((target("avx2")))
+static inline size_t
+frozen_get_batch_avx2(
+    avl_frozen_t const*const frozen,
+    uint64_t const keys[],
+    size_t const n,
+    e_avl_node *out[])
+{
+    long long const*const base = (long long const*)frozen->keys;
+    __m256i const flip = _mm256_set1_epi64x((long long)(UINT64_C(1) << 63));
+    __m256i const one = _mm256_set1_epi64x(1);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i const x0 = _mm256_xor_si256(_mm256_loadu_si256((__m256i const*)&keys[i]), flip);
+        __m256i const x1 = _mm256_xor_si256(_mm256_loadu_si256((__m256i const*)&keys[i + 4]), flip);
+        __m256i k0 = one;
+        __m256i k1 = one;
+
+        for (unsigned l = 0; l < frozen->levels; ++l) {
+            __m256i const p0 = _mm256_xor_si256(_mm256_i64gather_epi64(base, k0, 8), flip);
+            __m256i const p1 = _mm256_xor_si256(_mm256_i64gather_epi64(base, k1, 8), flip);
+            /* k = 2k + (probe < x), the mask being -1 where it is */
+            k0 = _mm256_sub_epi64(_mm256_add_epi64(k0, k0), _mm256_cmpgt_epi64(x0, p0));
+            k1 = _mm256_sub_epi64(_mm256_add_epi64(k1, k1), _mm256_cmpgt_epi64(x1, p1));
+        }
+
+        uint64_t slots[8];
+        _mm256_storeu_si256((__m256i *)&slots[0], k0);
+        _mm256_storeu_si256((__m256i *)&slots[4], k1);
+        for (int j = 0; j < 8; ++j) {
+            size_t const k = slots[j] >> __builtin_ffsll(~(long long)slots[j]);
+            out[i + j] = (frozen->keys[k] == keys[i + j]) ? frozen->nodes[k] : NULL;
+        }
+    }
+
+    return i;
+}
+#endif
+
+// Looks up `n` keys, writing the node for each (or NULL) to `out`. With
+// AVX2 this runs eight searches side by side.
+static inline void
+avl_frozen_get_batch(
+    avl_frozen_t const*const frozen,
+    uint64_t const keys[],
+    size_t const n,
+    e_avl_node *out[])
+{
+    size_t i = 0;
+
+    if (frozen->m == 0) {
+        for (; i < n; ++i) {
+            out[i] = NULL;
+        }
+        return;
+    }
+
+#ifdef AVL_FROZEN_X86
+    if (__builtin_cpu_supports("avx2")) {
+        i = frozen_get_batch_avx2(frozen, keys, n, out);
+    }
+#endif
+
+    for (; i < n; ++i) {
+        out[i] = avl_frozen_get(frozen, keys[i]);
+    }
+}
+
+#endif /* INLINE_AVL_FROZEN_H */
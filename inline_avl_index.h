@@ -0,0 +1,397 @@
+
+#ifndef INLINE_AVL_INDEX_H
+#define INLINE_AVL_INDEX_H
+
+#include "inline_avl.h"
+
+/*
+ * Index-based AVL tree.
+ *
+ * Nodes name their children by 32-bit index into a caller-owned pool instead
+ * of by pointer, which makes a node 12 bytes instead of 24. A tree can hold
+ * up to 2^32 - 1 elements, and since nothing in it is an address, the whole
+ * pool can be moved (`avl_index_relocate`) or written out and read back in
+ * as it is.
+ *
+ * The pool is an array of caller elements, `m_stride` bytes apart, with an
+ * `e_avl_xnode` embedded `m_offset` bytes into each. Elements are named by
+ * their position in the pool, and AVL_INDEX_NONE stands for no element.
+ *
+ * Paths are kept as indices too, in a caller-supplied `uint32_t` buffer that
+ * needs one more entry than the height of the tree; 48 covers any tree.
+ */
+
+#define AVL_INDEX_NONE UINT32_MAX
+
+/* embedded index avl node */
+typedef struct avl_xnode e_avl_xnode;
+
+struct avl_xnode {
+    uint32_t lc;
+    uint32_t rc;
+    int32_t height;
+};
+
+typedef struct avl_xtree avl_xtree_t;
+
+struct avl_xtree {
+    unsigned char *m_pool; /* first element of the pool */
+    size_t m_stride;       /* bytes between elements */
+    size_t m_offset;       /* bytes from an element to its node */
+    uint32_t m_top;
+    size_t m_size;
+    unsigned m_gen;
+};
+
+typedef int (*avlxcmp_t)(e_avl_xnode const*, e_avl_xnode const*);
+typedef int (*avlxkeycmp_t)(void const*, e_avl_xnode const*);
+
+static inline avl_xtree_t
+avl_xtree_init(void *const pool, size_t const stride, size_t const offset)
+{
+    return (avl_xtree_t) {
+        .m_pool = pool,
+        .m_stride = stride,
+        .m_offset = offset,
+        .m_top = AVL_INDEX_NONE,
+        .m_size = 0,
+        .m_gen = 0,
+    };
+}
+
+// Point `tree` at a pool that has been moved or copied to `pool`.
+static inline void
+avl_index_relocate(avl_xtree_t *const tree, void *const pool)
+{
+    tree->m_pool = pool;
+}
+
+__attribute__((pure))
+static inline size_t
+avl_xsize(avl_xtree_t const*const tree)
+{
+    return tree->m_size;
+}
+
+// The node of element `i`
+__attribute__((pure))
+static inline e_avl_xnode *
+avl_xnode(avl_xtree_t const*const tree, uint32_t const i)
+{
+    return (e_avl_xnode *)(tree->m_pool + (size_t)i * tree->m_stride + tree->m_offset);
+}
+
+__attribute__((pure))
+static inline int
+xnode_height(avl_xtree_t const*const tree, uint32_t const i)
+{
+    if (i == AVL_INDEX_NONE) {
+        return 0;
+    }
+
+    return avl_xnode(tree, i)->height;
+}
+
+__attribute__((pure))
+static inline int
+avl_xheight(avl_xtree_t const*const tree)
+{
+    return xnode_height(tree, tree->m_top);
+}
+
+static inline void
+xupdate_height(avl_xtree_t const*const tree, e_avl_xnode *const node)
+{
+    int const height_lc = xnode_height(tree, node->lc);
+    int const height_rc = xnode_height(tree, node->rc);
+    node->height = 1 + ((height_rc > height_lc) ? height_rc : height_lc);
+}
+
+/* `rotate_right` on indices. `branch` is the slot holding the pivot. */
+static inline void
+xrotate_right(avl_xtree_t const*const tree, uint32_t *const branch)
+{
+    uint32_t const a = *branch;
+    e_avl_xnode *const nd_a = avl_xnode(tree, a);
+    uint32_t const b = nd_a->lc;
+    e_avl_xnode *const nd_b = avl_xnode(tree, b);
+
+    *branch = b;
+    nd_a->lc = nd_b->rc;
+    nd_b->rc = a;
+
+    xupdate_height(tree, nd_a);
+    xupdate_height(tree, nd_b);
+}
+
+/* `rotate_left` on indices */
+static inline void
+xrotate_left(avl_xtree_t const*const tree, uint32_t *const branch)
+{
+    uint32_t const a = *branch;
+    e_avl_xnode *const nd_a = avl_xnode(tree, a);
+    uint32_t const c = nd_a->rc;
+    e_avl_xnode *const nd_c = avl_xnode(tree, c);
+
+    *branch = c;
+    nd_a->rc = nd_c->lc;
+    nd_c->lc = a;
+
+    xupdate_height(tree, nd_a);
+    xupdate_height(tree, nd_c);
+}
+
+/* `find_case` on indices */
+__attribute__((pure))
+static inline unsigned
+xfind_case(avl_xtree_t const*const tree, e_avl_xnode const*const node)
+{
+    int const height_rc = xnode_height(tree, node->rc);
+    int const height_lc = xnode_height(tree, node->lc);
+
+    if (height_lc > height_rc + 1) {
+        e_avl_xnode const*const child = avl_xnode(tree, node->lc);
+        return ROT_FIRST_L
+            | ((xnode_height(tree, child->lc) < xnode_height(tree, child->rc)) ? ROT_SECND_R : 0);
+    } else if (height_rc > height_lc + 1) {
+        e_avl_xnode const*const child = avl_xnode(tree, node->rc);
+        return ROT_FIRST_R
+            | ((xnode_height(tree, child->lc) > xnode_height(tree, child->rc)) ? ROT_SECND_L : 0);
+    } else {
+        return ROT_BALANCED;
+    }
+}
+
+/* `rebalance` on indices: retrace up the first `depth` entries of `path`,
+ * stopping at the first subtree whose height is unchanged. */
+static inline void
+xrebalance(avl_xtree_t *const tree, uint32_t const path[], size_t depth)
+{
+    while (depth-- > 0) {
+        uint32_t const i = path[depth];
+        e_avl_xnode *const node = avl_xnode(tree, i);
+
+        int const old_height = node->height;
+        xupdate_height(tree, node);
+        unsigned const rot = xfind_case(tree, node);
+
+        uint32_t *branch;
+        if (depth == 0) {
+            branch = &tree->m_top;
+        } else {
+            e_avl_xnode *const parent = avl_xnode(tree, path[depth - 1]);
+            branch = (parent->lc == i) ? &parent->lc : &parent->rc;
+        }
+
+        if ((rot & ROT_FMASK) == ROT_FIRST_L) {
+            if (rot & ROT_SECND_R) {
+                xrotate_left(tree, &node->lc);
+            }
+            xrotate_right(tree, branch);
+        } else if ((rot & ROT_FMASK) == ROT_FIRST_R) {
+            if (rot & ROT_SECND_L) {
+                xrotate_right(tree, &node->rc);
+            }
+            xrotate_left(tree, branch);
+        }
+
+        if (avl_xnode(tree, *branch)->height == old_height) {
+            break;
+        }
+    }
+}
+
+/* `dive` on indices. Records the path in `path`, sets `*p_depth` to its
+ * length, and returns DFOUND, DLEFT or DRIGHT for the last entry. */
+static inline int
+xdive(
+    avl_xtree_t const*const tree,
+    e_avl_xnode const*const lhs,
+    avlxcmp_t const cmpfunc,
+    uint32_t path[],
+    size_t *const p_depth)
+{
+    size_t depth = 0;
+    uint32_t i = tree->m_top;
+
+    for (;;) {
+        path[depth++] = i;
+        e_avl_xnode const*const node = avl_xnode(tree, i);
+
+        int const lcmp = cmpfunc(lhs, node);
+        uint32_t const next = (lcmp < 0) ? node->lc : node->rc;
+        if (lcmp == 0 || next == AVL_INDEX_NONE) {
+            *p_depth = depth;
+            return (lcmp == 0) ? DFOUND : (lcmp < 0) ? DLEFT : DRIGHT;
+        }
+        i = next;
+    }
+}
+
+/* `divek` on indices */
+static inline int
+xdivek(
+    avl_xtree_t const*const tree,
+    void const*const key,
+    avlxkeycmp_t const cmpfunc,
+    uint32_t path[],
+    size_t *const p_depth)
+{
+    size_t depth = 0;
+    uint32_t i = tree->m_top;
+
+    for (;;) {
+        path[depth++] = i;
+        e_avl_xnode const*const node = avl_xnode(tree, i);
+
+        int const lcmp = cmpfunc(key, node);
+        uint32_t const next = (lcmp < 0) ? node->lc : node->rc;
+        if (lcmp == 0 || next == AVL_INDEX_NONE) {
+            *p_depth = depth;
+            return (lcmp == 0) ? DFOUND : (lcmp < 0) ? DLEFT : DRIGHT;
+        }
+        i = next;
+    }
+}
+
+// Adds element `i` of the pool. If an element with the same key is already
+// in the tree, its index is returned instead.
+static inline uint32_t
+avl_index_add(
+    avl_xtree_t *const tree,
+    uint32_t const i,
+    avlxcmp_t const cmpfunc,
+    uint32_t path_buffer[])
+{
+    e_avl_xnode *const node = avl_xnode(tree, i);
+    node->lc = AVL_INDEX_NONE;
+    node->rc = AVL_INDEX_NONE;
+    node->height = 1;
+
+    if (tree->m_top == AVL_INDEX_NONE) {
+        tree->m_top = i;
+    } else {
+        size_t depth;
+        int const rc = xdive(tree, node, cmpfunc, path_buffer, &depth);
+
+        uint32_t const p = path_buffer[depth - 1];
+        if (rc == DLEFT) {
+            avl_xnode(tree, p)->lc = i;
+        } else if (rc == DRIGHT) {
+            avl_xnode(tree, p)->rc = i;
+        } else {
+            return p;
+        }
+
+        xrebalance(tree, path_buffer, depth);
+    }
+
+    ++tree->m_size;
+    ++tree->m_gen;
+
+    return i;
+}
+
+// Gets the index of the element matching `key`, or AVL_INDEX_NONE.
+__attribute__((pure))
+static inline uint32_t
+avl_index_get(avl_xtree_t const*const tree, void const*const key, avlxkeycmp_t const cmpfunc)
+{
+    uint32_t i = tree->m_top;
+
+    while (i != AVL_INDEX_NONE) {
+        e_avl_xnode const*const node = avl_xnode(tree, i);
+        int const lcmp = cmpfunc(key, node);
+        if (lcmp < 0) {
+            i = node->lc;
+        } else if (lcmp > 0) {
+            i = node->rc;
+        } else {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/* Point the slot of `parent` (or the top) that held `old` at `new` */
+static inline void
+xreplace(avl_xtree_t *const tree, size_t const depth, uint32_t const path[], uint32_t const old, uint32_t const new)
+{
+    if (depth == 0) {
+        tree->m_top = new;
+    } else {
+        e_avl_xnode *const parent = avl_xnode(tree, path[depth - 1]);
+        if (parent->lc == old) {
+            parent->lc = new;
+        } else {
+            parent->rc = new;
+        }
+    }
+}
+
+// Removes the element matching `key` and returns its index, or returns
+// AVL_INDEX_NONE if there is none.
+static inline uint32_t
+avl_index_rem(
+    avl_xtree_t *const tree,
+    void const*const key,
+    avlxkeycmp_t const cmpfunc,
+    uint32_t path_buffer[])
+{
+    if (tree->m_top == AVL_INDEX_NONE) {
+        return AVL_INDEX_NONE;
+    }
+
+    uint32_t *const path = path_buffer;
+    size_t depth;
+    if (xdivek(tree, key, cmpfunc, path, &depth) != DFOUND) {
+        return AVL_INDEX_NONE;
+    }
+
+    size_t const rem_depth = --depth;
+    uint32_t const r = path[rem_depth];
+    e_avl_xnode *const to_remove = avl_xnode(tree, r);
+
+    if (to_remove->lc == AVL_INDEX_NONE || to_remove->rc == AVL_INDEX_NONE) {
+        uint32_t const child = (to_remove->lc != AVL_INDEX_NONE) ? to_remove->lc : to_remove->rc;
+        xreplace(tree, rem_depth, path, r, child);
+    } else {
+        /* Replace it with the largest element of its left subtree, which
+         * takes over its place, height included, on the path */
+        path[depth++] = r;
+
+        uint32_t s = to_remove->lc;
+        e_avl_xnode *replacement = avl_xnode(tree, s);
+        while (replacement->rc != AVL_INDEX_NONE) {
+            path[depth++] = s;
+            s = replacement->rc;
+            replacement = avl_xnode(tree, s);
+        }
+
+        if (path[depth - 1] == r) {
+            to_remove->lc = replacement->lc;
+        } else {
+            avl_xnode(tree, path[depth - 1])->rc = replacement->lc;
+        }
+
+        replacement->lc = to_remove->lc;
+        replacement->rc = to_remove->rc;
+        replacement->height = to_remove->height;
+        xreplace(tree, rem_depth, path, r, s);
+        path[rem_depth] = s;
+    }
+
+    to_remove->lc = AVL_INDEX_NONE;
+    to_remove->rc = AVL_INDEX_NONE;
+    to_remove->height = 0;
+
+    xrebalance(tree, path, depth);
+
+    --tree->m_size;
+    ++tree->m_gen;
+
+    return r;
+}
+
+#endif /* INLINE_AVL_INDEX_H */
@@ -0,0 +1,120 @@
+
+#ifndef INLINE_AVL_INT_H
+#define INLINE_AVL_INT_H
+
+#include "inline_avl.h"
+
+/*
+ * Integer keys stored in the node.
+ *
+ * An `e_avl_knode` is an `e_avl_node` followed by a 64-bit unsigned key, so a
+ * descent reads the key from the same cache line as the links instead of
+ * chasing into the containing object, and compares it inline rather than
+ * through an `avlkeycmp_t`. Lookups don't stop early on a match: they walk
+ * to the bottom keeping the last node not less than the key, loading the
+ * child by index and picking the candidate with a conditional move, so the
+ * only branch left per level is the loop's own, which is predictable. An
+ * early exit saves less than a mispredicted branch per level costs once the
+ * path is deeper than a few levels.
+ *
+ * Knode trees are plain `avl_tree_t`s and work with every `avl_base_`
+ * function that takes a comparator, `avl_knode_cmp` and `avl_knode_keycmp`
+ * (whose key is a `uint64_t const *`). Signed keys keep their order if
+ * stored as `(uint64_t)k ^ (UINT64_C(1) << 63)`.
+ */
+
+/* embedded avl node with an integer key */
+typedef struct avl_knode e_avl_knode;
+
+struct avl_knode {
+    e_avl_node node;
+    uint64_t key;
+};
+
+__attribute__((pure))
+static inline e_avl_knode *
+nd2knode(e_avl_node const*const nd)
+{
+    return (e_avl_knode *)nd;
+}
+
+__attribute__((pure))
+static inline int
+avl_knode_cmp(e_avl_node const*const ln, e_avl_node const*const rn)
+{
+    uint64_t const l = nd2knode(ln)->key;
+    uint64_t const r = nd2knode(rn)->key;
+    return (l > r) - (l < r);
+}
+
+__attribute__((pure))
+static inline int
+avl_knode_keycmp(void const*const key, e_avl_node const*const rn)
+{
+    uint64_t const l = *(uint64_t const*)key;
+    uint64_t const r = nd2knode(rn)->key;
+    return (l > r) - (l < r);
+}
+
+// Adds `kn`, keyed by `kn->key`. If a node with the same key is already in
+// the tree, that one is returned instead.
+__attribute__((flatten))
+static inline e_avl_knode *
+avl_int_add(avl_tree_t *const tree, e_avl_knode *const kn, void *const stack_buffer)
+{
+    return nd2knode(avl_base_add(tree, &kn->node, avl_knode_cmp, stack_buffer));
+}
+
+#ifdef __cplusplus
+static_assert(offsetof(e_avl_node, rc) == offsetof(e_avl_node, lc) + sizeof(e_avl_node *),
+        "the children of a node are adjacent");
+#else
+_Static_assert(offsetof(e_avl_node, rc) == offsetof(e_avl_node, lc) + sizeof(e_avl_node *),
+        "the children of a node are adjacent");
+#endif
+
+/* The right child if `right` is set, else the left, without a branch */
+__attribute__((pure, always_inline))
+static inline e_avl_node *
+knode_child(e_avl_node const*const node, bool const right)
+{
+    unsigned char const*const lc = (unsigned char const*)node + offsetof(e_avl_node, lc);
+    return *(e_avl_node *const*)(lc + right * sizeof(e_avl_node *));
+}
+
+// Returns the node with the smallest key not less than `key`, or NULL.
+__attribute__((pure))
+static inline e_avl_knode *
+avl_int_lower_bound(avl_tree_t const*const tree, uint64_t const key)
+{
+    e_avl_node *node = tree->m_top;
+    e_avl_node *best = NULL;
+
+    while (node != NULL) {
+        bool const lt = nd2knode(node)->key < key;
+        /* Either way is equally likely, so ask for a conditional move */
+        best = __builtin_expect_with_probability(lt, 1, 0.5) ? best : node;
+        node = knode_child(node, lt);
+    }
+
+    return nd2knode(best);
+}
+
+// Returns the node keyed `key`, or NULL.
+__attribute__((pure))
+static inline e_avl_knode *
+avl_int_get(avl_tree_t const*const tree, uint64_t const key)
+{
+    e_avl_knode *const kn = avl_int_lower_bound(tree, key);
+    return (kn != NULL && kn->key == key) ? kn : NULL;
+}
+
+// Removes and returns the node keyed `key`, or NULL if there is none.
+__attribute__((flatten))
+static inline e_avl_knode *
+avl_int_rem(avl_tree_t *const tree, uint64_t const key, void *const stack_buffer)
+{
+    return nd2knode(avl_base_rem(tree, &key, avl_knode_keycmp, stack_buffer));
+}
+
+#endif /* INLINE_AVL_INT_H */
@@ -0,0 +1,185 @@
+
+#ifndef INLINE_AVL_INTERVAL_H
+#define INLINE_AVL_INTERVAL_H
+
+/*
+ * Interval tree built on the intrusive AVL core.
+ *
+ * Nodes hold half-open intervals [start, end), ordered by start and then by
+ * end, and every node tracks the greatest `end` in its subtree through the
+ * AVL_AUGMENT hook. A subtree whose greatest end is at or before the query's
+ * start can't overlap it and is skipped whole, so an overlap query only
+ * visits the paths down to the intervals it reports: O(log n + k log(n/k))
+ * nodes for k of them. That's O(log n + k) when they're close together in
+ * order of start, but when they're scattered among ones that don't overlap,
+ * each can cost up to O(log n); a bound of O(log n + k) regardless would
+ * take another kind of interval tree.
+ *
+ * Since the hook is shared by every tree in a translation unit, this header
+ * has to be included before inline_avl.h, and every tree in that translation
+ * unit must be made of `e_avl_inode`s.
+ */
+
+#ifdef INLINE_AVL_H
+#error "inline_avl_interval.h must be included before inline_avl.h"
+#endif
+
+#ifdef AVL_AUGMENT
+#error "inline_avl_interval.h needs AVL_AUGMENT for itself"
+#endif
+
+struct avl_node;
+static inline void avl_interval_augment(struct avl_node *node);
+#define AVL_AUGMENT(node) avl_interval_augment(node)
+
+#include "inline_avl.h"
+
+/* embedded interval node */
+typedef struct avl_inode e_avl_inode;
+
+struct avl_inode {
+    e_avl_node node;
+    uint64_t start;
+    uint64_t end;
+    uint64_t max_end; /* greatest `end` in this subtree */
+};
+
+typedef bool (*avlivisit_t)(e_avl_inode *, void *);
+
+__attribute__((pure))
+static inline e_avl_inode *
+nd2inode(e_avl_node const*const nd)
+{
+    return (void *)((unsigned char *)nd - offsetof(e_avl_inode, node));
+}
+
+static inline void
+avl_interval_augment(struct avl_node *const node)
+{
+    e_avl_inode *const in = nd2inode(node);
+    uint64_t max_end = in->end;
+    if (node->lc != NULL && nd2inode(node->lc)->max_end > max_end) {
+        max_end = nd2inode(node->lc)->max_end;
+    }
+    if (node->rc != NULL && nd2inode(node->rc)->max_end > max_end) {
+        max_end = nd2inode(node->rc)->max_end;
+    }
+    in->max_end = max_end;
+}
+
+__attribute__((pure))
+static inline int
+avl_interval_cmp(e_avl_node const*const ln, e_avl_node const*const rn)
+{
+    e_avl_inode const*const l = nd2inode(ln);
+    e_avl_inode const*const r = nd2inode(rn);
+    if (l->start != r->start) {
+        return (l->start < r->start) ? -1 : 1;
+    } else if (l->end != r->end) {
+        return (l->end < r->end) ? -1 : 1;
+    } else {
+        return 0;
+    }
+}
+
+__attribute__((pure))
+static inline int
+avl_interval_keycmp(void const*const key, e_avl_node const*const rn)
+{
+    return avl_interval_cmp(&((e_avl_inode const*)key)->node, rn);
+}
+
+// Adds [in->start, in->end). If an identical interval is already in the tree,
+// that one is returned instead.
+__attribute__((flatten))
+static inline e_avl_inode *
+avl_interval_add(avl_tree_t *const tree, e_avl_inode *const in, void *const stack_buffer)
+{
+    e_avl_node *const o = avl_base_add(tree, &in->node, avl_interval_cmp, stack_buffer);
+    return nd2inode(o);
+}
+
+// Removes and returns the node holding exactly [start, end), if there is one.
+__attribute__((flatten))
+static inline e_avl_inode *
+avl_interval_rem(avl_tree_t *const tree, uint64_t const start, uint64_t const end, void *const stack_buffer)
+{
+    e_avl_inode const k = {
+        .start = start,
+        .end = end,
+    };
+    e_avl_node *const o = avl_base_rem(tree, &k, avl_interval_keycmp, stack_buffer);
+    if (o == NULL) {
+        return NULL;
+    } else {
+        return nd2inode(o);
+    }
+}
+
+// Calls `visit` on every interval overlapping [lo, hi), in order of start,
+// until `visit` returns false. Returns the number of intervals visited.
+static inline size_t
+avl_interval_overlap(
+    avl_tree_t const*const tree,
+    uint64_t const lo,
+    uint64_t const hi,
+    avlivisit_t const visit,
+    void *const arg,
+    void *const stack_buffer)
+{
+    astack_t l_stack = stack_init(stack_buffer);
+    astack_t *const stack = &l_stack;
+    size_t visited = 0;
+
+    if (lo >= hi) {
+        return 0;
+    }
+
+    e_avl_node *node = tree->m_top;
+    for (;;) {
+        /* Go left as far as anything could still end after `lo` */
+        while (node != NULL && nd2inode(node)->max_end > lo) {
+            (void)stack_push(stack, node);
+            node = node->lc;
+        }
+
+        node = stack_pop(stack);
+        if (node == NULL) {
+            break;
+        }
+
+        e_avl_inode *const in = nd2inode(node);
+        if (in->start >= hi) {
+            /* Everything from here on starts too late */
+            break;
+        }
+
+        if (in->end > lo) {
+            ++visited;
+            if (!visit(in, arg)) {
+                break;
+            }
+        }
+
+        node = node->rc;
+    }
+
+    return visited;
+}
+
+// Calls `visit` on every interval containing `point`.
+static inline size_t
+avl_interval_stab(
+    avl_tree_t const*const tree,
+    uint64_t const point,
+    avlivisit_t const visit,
+    void *const arg,
+    void *const stack_buffer)
+{
+    if (point == UINT64_MAX) {
+        return 0;
+    }
+    return avl_interval_overlap(tree, point, point + 1, visit, arg, stack_buffer);
+}
+
+#endif /* INLINE_AVL_INTERVAL_H */
@@ -0,0 +1,305 @@
+#ifndef INLINE_AVL_PERSIST_H
+#define INLINE_AVL_PERSIST_H
+
+/*
+ * Persistent trees.
+ *
+ * An `avl_persist_t` is a tree whose past versions stay readable. Taking a
+ * snapshot costs O(1): it hands out a plain `avl_tree_t` sharing the current
+ * top, which every read-only `avl_base_` function and the iterators accept.
+ * Changes afterwards copy the nodes they would modify instead, which is the
+ * path that `dive` and the retrace walk plus the siblings that rotations
+ * touch, so O(log n) nodes per change; everything else stays shared.
+ *
+ * Sharing is tracked with a reference count in every node (AVL_PERSISTENT
+ * adds it to `struct avl_node`): one for each parent or version pointing at
+ * it. A node whose count is one, reached from a top whose count is one,
+ * belongs to the current version alone and is changed in place, so with no
+ * snapshots outstanding nothing is copied at all. Releasing a version drops
+ * the nodes only it held, handing each to the `drop` callback.
+ *
+ * Objects are copied by the `copy` callback, which must return the node of
+ * a new object holding the same key and payload; it may not fail. It should
+ * leave the embedded node alone, since another thread may be changing its
+ * count; links, heights and counts are filled in afterwards. Changes and
+ * snapshots come from one writer at a time. Versions may be read and
+ * released from any thread while it works, so `drop` may be called from any
+ * of them.
+ *
+ * Since the reference count is part of the node, this header has to be
+ * included before inline_avl.h, and every tree in that translation unit
+ * carries it.
+ */
+
+#ifdef INLINE_AVL_H
+#error "inline_avl_persist.h must be included before inline_avl.h"
+#endif
+
+#define AVL_PERSISTENT
+
+#include "inline_avl.h"
+
+typedef e_avl_node *(*avlcopy_t)(e_avl_node const*, void *);
+
+typedef struct avl_persist avl_persist_t;
+
+struct avl_persist {
+    avl_tree_t m_tree;    /* the current version, which holds its top */
+    avlcopy_t m_copy;
+    avldrop_t m_drop;
+    void *m_arg;
+    size_t m_copies;      /* nodes copied so far */
+};
+
+static inline avl_persist_t
+avl_persist_init(avlcopy_t const copy, avldrop_t const drop, void *const arg)
+{
+    return (avl_persist_t) {
+        .m_tree = avl_tree_init(),
+        .m_copy = copy,
+        .m_drop = drop,
+        .m_arg = arg,
+        .m_copies = 0,
+    };
+}
+
+static inline void
+persist_ref(e_avl_node *const node)
+{
+    if (node != NULL) {
+        __atomic_add_fetch(&node->refs, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Let go of one reference to `node`, dropping it and whatever only it held
+ * if that was the last. The recursion is no deeper than the tree. */
+static inline void
+persist_unref(avl_persist_t const*const p, e_avl_node *node)
+{
+    while (node != NULL && __atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        e_avl_node *const lc = node->lc;
+        e_avl_node *const rc = node->rc;
+        p->m_drop(node, p->m_arg);
+        persist_unref(p, lc);
+        node = rc;
+    }
+}
+
+// Returns a read-only version of the tree as it is now, which stays the same
+// until it is released with `avl_persist_release`. O(1).
+static inline avl_tree_t
+avl_persist_snapshot(avl_persist_t *const p)
+{
+    persist_ref(p->m_tree.m_top);
+    return p->m_tree;
+}
+
+// Releases a snapshot, dropping the nodes no other version holds. It may be
+// called from any thread, while the writer goes on changing the tree.
+static inline void
+avl_persist_release(avl_persist_t const*const p, avl_tree_t *const snapshot)
+{
+    persist_unref(p, snapshot->m_top);
+    *snapshot = avl_tree_init();
+}
+
+// Releases the current version, leaving the tree empty. Snapshots stay valid.
+static inline void
+avl_persist_destroy(avl_persist_t *const p)
+{
+    avl_persist_release(p, &p->m_tree);
+}
+
+/* Make the node at `*link`, whose parent (or version) belongs to the current
+ * version alone, belong to it alone too, copying it if anything else holds
+ * it. Returns the node now at `*link`. */
+static inline e_avl_node *
+persist_own(avl_persist_t *const p, e_avl_node **const link)
+{
+    e_avl_node *const node = *link;
+    if (__atomic_load_n(&node->refs, __ATOMIC_ACQUIRE) == 1) {
+        return node;
+    }
+
+    e_avl_node *const copy = p->m_copy(node, p->m_arg);
+    assert(copy != NULL);
+    copy->lc = node->lc;
+    copy->rc = node->rc;
+    copy->height = node->height;
+#ifdef AVL_SUBTREE_COUNT
+    copy->count = node->count;
+#endif
+    copy->refs = 1;
+    persist_ref(copy->lc);
+    persist_ref(copy->rc);
+    ++p->m_copies;
+
+    *link = copy;
+    persist_unref(p, node);
+    return copy;
+}
+
+/* Make every node on `stack`, a path from the top, belong to the current
+ * version alone, replacing the entries with the copies */
+static inline void
+persist_own_path(avl_persist_t *const p, astack_t *const stack)
+{
+    e_avl_node **link = &p->m_tree.m_top;
+
+    for (size_t i = 0; i < stack->sz; ++i) {
+        e_avl_node *const node = persist_own(p, link);
+        stack->data[i] = node;
+        if (i + 1 < stack->sz) {
+            link = (node->lc == stack->data[i + 1]) ? &node->lc : &node->rc;
+        }
+    }
+}
+
+/* `rebalance`, over a path that belongs to the current version, owning the
+ * children that rotations move before moving them */
+static inline void
+persist_rebalance(avl_persist_t *const p, astack_t *const stack)
+{
+    e_avl_node *node = (e_avl_node *)stack_pop(stack);
+
+    while (node != NULL) {
+
+#ifdef AVL_HEIGHT_ONLY
+        int const old_height = node->height;
+#endif
+        update_height(node);
+        unsigned const rot = find_case(node);
+        e_avl_node *const parent = (e_avl_node *)stack_peek(stack);
+
+        struct avl_node **branch = NULL;
+        if (parent == NULL) {
+            branch = &p->m_tree.m_top;
+        } else {
+            branch = (node == parent->lc) ? &parent->lc : &parent->rc;
+        }
+
+        if (rot != ROT_BALANCED) {
+            if ((rot & ROT_FMASK) == ROT_FIRST_L) {
+                e_avl_node *const child = persist_own(p, &node->lc);
+                if (rot & ROT_SECND_R) {
+                    (void)persist_own(p, &child->rc);
+                    rotate_left(&node->lc);
+                }
+                rotate_right(branch);
+            } else {
+                e_avl_node *const child = persist_own(p, &node->rc);
+                if (rot & ROT_SECND_L) {
+                    (void)persist_own(p, &child->lc);
+                    rotate_right(&node->rc);
+                }
+                rotate_left(branch);
+            }
+        }
+
+#ifdef AVL_HEIGHT_ONLY
+        if ((*branch)->height == old_height) {
+            break;
+        }
+#endif
+
+        node = (e_avl_node *)stack_pop(stack);
+    }
+}
+
+// Adds `node` to the current version, copying the path to it where that is
+// shared with a snapshot. If a node with the same key is already there, that
+// one is returned instead and nothing is copied.
+static inline e_avl_node *
+avl_persist_add(
+    avl_persist_t *const p,
+    e_avl_node *const node,
+    avlcmp_t const cmpfunc,
+    void *const stack_buffer)
+{
+    avl_tree_t *const tree = &p->m_tree;
+
+    leaf_init(node);
+    node->refs = 1;
+
+    if (tree->m_size == 0) {
+        tree->m_top = node;
+    } else {
+        astack_t l_stack = stack_init(stack_buffer);
+        astack_t *const stack = &l_stack;
+
+        int const rc = dive(tree->m_top, node, cmpfunc, stack);
+        if (rc == DFOUND) {
+            return (e_avl_node *)stack_peek(stack);
+        }
+
+        persist_own_path(p, stack);
+        e_avl_node *const parent = (e_avl_node *)stack_peek(stack);
+        if (rc == DLEFT) {
+            parent->lc = node;
+        } else {
+            parent->rc = node;
+        }
+
+        persist_rebalance(p, stack);
+    }
+
+    ++tree->m_size;
+    gen_bump(tree);
+
+    return node;
+}
+
+// Removes the node matching `key` from the current version, and returns
+// whether there was one. The node is dropped once no snapshot holds it
+// either, so unlike `avl_base_rem` it isn't handed back. The buffer needs
+// room for the whole height of the tree.
+static inline bool
+avl_persist_rem(
+    avl_persist_t *const p,
+    void const*const key,
+    avlkeycmp_t const cmpfunc,
+    void *const stack_buffer)
+{
+    avl_tree_t *const tree = &p->m_tree;
+
+    if (tree->m_size == 0) {
+        return false;
+    }
+
+    astack_t l_stack = stack_init(stack_buffer);
+    astack_t *const stack = &l_stack;
+
+    if (divek(tree->m_top, key, cmpfunc, stack) != DFOUND) {
+        return false;
+    }
+
+    /* Own the path down to the node taking the removed one's place too, the
+     * same way `unlink_path` will walk it. The removed node is owned like the
+     * rest, so that its links can be handed over; if it had to be copied for
+     * that, it's the copy that gets dropped below. */
+    size_t const depth = stack->sz;
+    e_avl_node *const found = (e_avl_node *)stack_peek(stack);
+    if (found->lc != NULL) {
+        for (e_avl_node *nd = found->lc; nd != NULL; nd = nd->rc) {
+            (void)stack_push(stack, nd);
+        }
+    } else if (found->rc != NULL) {
+        (void)stack_push(stack, found->rc);
+    }
+    persist_own_path(p, stack);
+    stack->sz = depth;
+
+    e_avl_node *const to_remove = unlink_path(tree, stack);
+    assert(to_remove->refs == 1);
+    __atomic_store_n(&to_remove->refs, 0, __ATOMIC_RELAXED);
+    p->m_drop(to_remove, p->m_arg);
+
+    persist_rebalance(p, stack);
+
+    tree->m_size--;
+    gen_bump(tree);
+
+    return true;
+}
+
+#endif /* INLINE_AVL_PERSIST_H */
@@ -0,0 +1,253 @@
+
+#ifndef INLINE_AVL_POOL_H
+#define INLINE_AVL_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+ * Slab allocator for the objects of owning trees.
+ *
+ * A pool reserves one contiguous range of address space up front and carves
+ * it into slabs, each serving one size class (multiples of AVL_POOL_GRAIN up
+ * to AVL_POOL_MAX_SIZE). Threads allocate through their own
+ * `avl_pool_cache_t`, which bumps through a private slab and keeps a private
+ * free list, so the common path takes no lock and objects allocated in a row
+ * by one thread sit next to each other in memory. Freed objects go back to
+ * the cache that frees them; a cache that collects too many hands its whole
+ * list to the pool in O(1), where any cache can pick it up again.
+ *
+ * Everything lives in the one reservation, so dropping a whole tree of
+ * objects is a single `avl_pool_release`, O(1) no matter how many there are.
+ * Pages are only committed as they are first touched, and with
+ * AVL_POOL_HUGE the range is 2 MiB aligned and advised for transparent huge
+ * pages.
+ */
+
+#ifndef AVL_POOL_GRAIN
+#define AVL_POOL_GRAIN 16
+#endif
+
+#ifndef AVL_POOL_CLASSES
+#define AVL_POOL_CLASSES 16
+#endif
+
+#define AVL_POOL_MAX_SIZE (AVL_POOL_GRAIN * AVL_POOL_CLASSES)
+
+/* Bytes a cache takes from the pool at a time */
+#ifndef AVL_POOL_SLAB
+#define AVL_POOL_SLAB (64 * 1024)
+#endif
+
+/* Objects a cache keeps freed before returning them to the pool */
+#ifndef AVL_POOL_CACHE_MAX
+#define AVL_POOL_CACHE_MAX 4096
+#endif
+
+#define AVL_POOL_HUGE 0x1u
+
+#define AVL_POOL_HUGE_PAGE ((size_t)2 << 20)
+
+/* A list of free objects, linked through their first words */
+typedef struct avl_pool_list avl_pool_list_t;
+
+struct avl_pool_list {
+    void *head;
+    void *tail;
+    size_t n;
+};
+
+typedef struct avl_pool avl_pool_t;
+
+struct avl_pool {
+    void *m_map;           /* the whole mapping, for munmap */
+    size_t m_map_len;
+    unsigned char *m_base; /* first usable byte */
+    size_t m_capacity;
+    size_t m_used;         /* bytes handed out as slabs */
+    pthread_mutex_t m_lock;
+    avl_pool_list_t m_free[AVL_POOL_CLASSES]; /* objects returned by caches */
+};
+
+typedef struct avl_pool_cache avl_pool_cache_t;
+
+struct avl_pool_cache {
+    avl_pool_t *pool;
+    struct {
+        avl_pool_list_t free;
+        unsigned char *bump;  /* unused part of the current slab */
+        unsigned char *end;
+    } cls[AVL_POOL_CLASSES];
+};
+
+// Reserves `capacity` bytes of address space for `pool`. Returns false if the
+// reservation fails.
+static inline bool
+avl_pool_init(avl_pool_t *const pool, size_t const capacity, unsigned const flags)
+{
+    size_t const align = (flags & AVL_POOL_HUGE) ? AVL_POOL_HUGE_PAGE : AVL_POOL_SLAB;
+    size_t const usable = (capacity + AVL_POOL_SLAB - 1) / AVL_POOL_SLAB * AVL_POOL_SLAB;
+    size_t const map_len = usable + align;
+
+    void *const map = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    uintptr_t const base = ((uintptr_t)map + align - 1) & ~(uintptr_t)(align - 1);
+#ifdef MADV_HUGEPAGE
+    if (flags & AVL_POOL_HUGE) {
+        (void)madvise((void *)base, usable, MADV_HUGEPAGE);
+    }
+#endif
+
+    *pool = (avl_pool_t) {
+        .m_map = map,
+        .m_map_len = map_len,
+        .m_base = (unsigned char *)base,
+        .m_capacity = usable,
+        .m_used = 0,
+    };
+    pthread_mutex_init(&pool->m_lock, NULL);
+    return true;
+}
+
+// Gives every object of `pool` back to the system at once. Trees of objects
+// from it must be forgotten, and its caches not used again.
+static inline void
+avl_pool_release(avl_pool_t *const pool)
+{
+    (void)munmap(pool->m_map, pool->m_map_len);
+    pthread_mutex_destroy(&pool->m_lock);
+    pool->m_map = NULL;
+    pool->m_base = NULL;
+    pool->m_capacity = 0;
+}
+
+// A cache for one thread to allocate from `pool` with.
+static inline avl_pool_cache_t
+avl_pool_cache(avl_pool_t *const pool)
+{
+    avl_pool_cache_t cache = { .pool = pool };
+    return cache;
+}
+
+/* Move all of `from` onto the front of `to`, in O(1) */
+static inline void
+pool_list_splice(avl_pool_list_t *const to, avl_pool_list_t *const from)
+{
+    if (from->head == NULL) {
+        return;
+    }
+    if (to->head == NULL) {
+        to->tail = from->tail;
+    }
+    *(void **)from->tail = to->head;
+    to->head = from->head;
+    to->n += from->n;
+    *from = (avl_pool_list_t) { .head = NULL };
+}
+
+// Returns a cache's free objects to its pool, so that other caches can reuse
+// them. Call it before a thread that allocated stops using its cache.
+static inline void
+avl_pool_cache_flush(avl_pool_cache_t *const cache)
+{
+    avl_pool_t *const pool = cache->pool;
+
+    pthread_mutex_lock(&pool->m_lock);
+    for (size_t c = 0; c < AVL_POOL_CLASSES; ++c) {
+        pool_list_splice(&pool->m_free[c], &cache->cls[c].free);
+    }
+    pthread_mutex_unlock(&pool->m_lock);
+}
+
+/* Refill class `c` of `cache` from the pool, taking everything on the pool's
+ * free list if there is anything there and a fresh slab otherwise. */
+static inline bool
+pool_refill(avl_pool_cache_t *const cache, size_t const c)
+{
+    avl_pool_t *const pool = cache->pool;
+
+    pthread_mutex_lock(&pool->m_lock);
+    pool_list_splice(&cache->cls[c].free, &pool->m_free[c]);
+    pthread_mutex_unlock(&pool->m_lock);
+
+    if (cache->cls[c].free.head != NULL) {
+        return true;
+    }
+
+    /* Only claim the slab if it fits, so that an exhausted pool still
+     * reports what it handed out */
+    size_t used = __atomic_load_n(&pool->m_used, __ATOMIC_RELAXED);
+    do {
+        if (used + AVL_POOL_SLAB > pool->m_capacity) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&pool->m_used, &used, used + AVL_POOL_SLAB,
+                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    cache->cls[c].bump = pool->m_base + used;
+    cache->cls[c].end = pool->m_base + used + AVL_POOL_SLAB;
+    return true;
+}
+
+// Allocates `size` bytes, aligned to AVL_POOL_GRAIN, or returns NULL if the
+// size is 0 or over AVL_POOL_MAX_SIZE or the pool is exhausted.
+static inline void *
+avl_pool_alloc(avl_pool_cache_t *const cache, size_t const size)
+{
+    if (size == 0 || size > AVL_POOL_MAX_SIZE) {
+        return NULL;
+    }
+
+    size_t const c = (size - 1) / AVL_POOL_GRAIN;
+    size_t const bytes = (c + 1) * AVL_POOL_GRAIN;
+
+    for (;;) {
+        avl_pool_list_t *const list = &cache->cls[c].free;
+        void *const o = list->head;
+        if (o != NULL) {
+            list->head = *(void **)o;
+            --list->n;
+            return o;
+        }
+
+        unsigned char *const bump = cache->cls[c].bump;
+        if (bump != NULL && (size_t)(cache->cls[c].end - bump) >= bytes) {
+            cache->cls[c].bump = bump + bytes;
+            return bump;
+        }
+
+        if (!pool_refill(cache, c)) {
+            return NULL;
+        }
+    }
+}
+
+// Frees an object of `size` bytes that came from the same pool as `cache`.
+static inline void
+avl_pool_free(avl_pool_cache_t *const cache, void *const o, size_t const size)
+{
+    size_t const c = (size - 1) / AVL_POOL_GRAIN;
+    avl_pool_list_t *const list = &cache->cls[c].free;
+
+    if (list->head == NULL) {
+        list->tail = o;
+    }
+    *(void **)o = list->head;
+    list->head = o;
+
+    if (++list->n >= AVL_POOL_CACHE_MAX) {
+        avl_pool_t *const pool = cache->pool;
+        pthread_mutex_lock(&pool->m_lock);
+        pool_list_splice(&pool->m_free[c], list);
+        pthread_mutex_unlock(&pool->m_lock);
+    }
+}
+
+#endif /* INLINE_AVL_POOL_H */
@@ -0,0 +1,283 @@
+
+#ifndef INLINE_AVL_SETOPS_H
+#define INLINE_AVL_SETOPS_H
+
+#include <pthread.h>
+
+#include "inline_avl.h"
+
+/*
+ * Set algebra between two trees of the same node type.
+ *
+ * Each operation is the divide-and-conquer join/split algorithm: split the
+ * first tree around the top of the second, solve the two halves independently
+ * and join the results back together around the top. That is
+ * O(m log(n/m + 1)) work for trees of sizes m <= n, and the two halves can be
+ * solved in parallel.
+ *
+ * Forked halves run on their own pthread. `threads` bounds how many extra
+ * threads may be running at once, and halves shorter than `fork_height`
+ * are always solved inline since they're too small to pay for a thread.
+ *
+ * Nodes that end up in neither tree are handed to `drop` (if it isn't NULL),
+ * which may be called from several threads at once.
+ */
+
+typedef struct avl_setop avl_setop_t;
+
+struct avl_setop {
+    avlcmp_t cmpfunc;
+    avldrop_t drop;
+    void *drop_arg;
+    unsigned threads;
+    int fork_height;
+};
+
+// Enough stack for one split or join of a tree of 2^32 nodes
+#define AVL_SETOP_STACK 48
+
+#define SETOP_UNION         0
+#define SETOP_INTERSECTION  1
+#define SETOP_DIFFERENCE    2
+
+typedef struct setop_task setop_task_t;
+
+struct setop_task {
+    avl_setop_t const *op;
+    int *threads_left;
+    int kind;
+    e_avl_node *t1;
+    e_avl_node const *t2;
+    e_avl_node *out;
+    size_t count;
+};
+
+static inline void setop_run(setop_task_t *task);
+
+static inline void *
+setop_thread(void *const arg)
+{
+    setop_run(arg);
+    return NULL;
+}
+
+/* Unlink a node that is leaving the trees and hand it to the drop callback */
+static inline void
+setop_drop(avl_setop_t const*const op, e_avl_node *const node)
+{
+    node->lc = NULL;
+    node->rc = NULL;
+    node->height = 0;
+#ifdef AVL_SUBTREE_COUNT
+    node->count = 0;
+#endif
+    if (op->drop != NULL) {
+        op->drop(node, op->drop_arg);
+    }
+}
+
+/* Drop every node of a subtree */
+static inline void
+setop_drop_all(avl_setop_t const*const op, e_avl_node *const top)
+{
+    if (op->drop == NULL || top == NULL) {
+        return;
+    }
+
+    void *stack[AVL_SETOP_STACK];
+    astack_t l_stack = stack_init(stack);
+    (void)stack_push(&l_stack, top);
+
+    e_avl_node *node;
+    while ((node = stack_pop(&l_stack)) != NULL) {
+        if (node->rc != NULL) {
+            (void)stack_push(&l_stack, node->rc);
+        }
+        if (node->lc != NULL) {
+            (void)stack_push(&l_stack, node->lc);
+        }
+        setop_drop(op, node);
+    }
+}
+
+/* Try to reserve a thread to solve a half of the size given by `height` */
+static inline bool
+setop_claim_thread(setop_task_t const*const task, int const height)
+{
+    if (height < task->op->fork_height) {
+        return false;
+    }
+
+    int left = __atomic_load_n(task->threads_left, __ATOMIC_RELAXED);
+    while (left > 0) {
+        if (__atomic_compare_exchange_n(task->threads_left, &left, left - 1,
+                    true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Solve `task`, leaving the resulting subtree in `out` and a count in
+ * `count`. The count is the number of duplicates dropped for a union, the
+ * number of nodes kept for an intersection, and the number of nodes removed
+ * for a difference, which is all that's needed to keep `m_size` up to date.
+ *
+ * `t1` is consumed. `t2` is consumed for a union and only read otherwise.
+ */
+static inline void
+setop_run(setop_task_t *const task)
+{
+    avl_setop_t const*const op = task->op;
+    e_avl_node *const t1 = task->t1;
+    e_avl_node *const t2 = (e_avl_node *)task->t2;
+
+    if (t1 == NULL || t2 == NULL) {
+        task->count = 0;
+        if (task->kind == SETOP_UNION) {
+            task->out = (t1 == NULL) ? t2 : t1;
+        } else if (task->kind == SETOP_INTERSECTION) {
+            setop_drop_all(op, t1);
+            task->out = NULL;
+        } else {
+            task->out = t1;
+        }
+        return;
+    }
+
+    /* The halves of `t2` have to be read before a union relinks its top */
+    e_avl_node *const l2 = t2->lc;
+    e_avl_node *const r2 = t2->rc;
+
+    void *stack[AVL_SETOP_STACK];
+    astack_t l_stack = stack_init(stack);
+    int const dive_rc = dive(t1, t2, op->cmpfunc, &l_stack);
+
+    e_avl_node *l1;
+    e_avl_node *r1;
+    e_avl_node *const match = split_path(&l_stack, dive_rc, &l1, &r1);
+
+    setop_task_t lo = {
+        .op = op,
+        .threads_left = task->threads_left,
+        .kind = task->kind,
+        .t1 = l1,
+        .t2 = l2,
+    };
+    setop_task_t hi = {
+        .op = op,
+        .threads_left = task->threads_left,
+        .kind = task->kind,
+        .t1 = r1,
+        .t2 = r2,
+    };
+
+    int const lh = avl_node_height(l1) > avl_node_height(l2) ? avl_node_height(l1) : avl_node_height(l2);
+    pthread_t thread;
+    bool const forked = setop_claim_thread(task, lh)
+        && pthread_create(&thread, NULL, setop_thread, &lo) == 0;
+
+    if (!forked) {
+        setop_run(&lo);
+    }
+    setop_run(&hi);
+    if (forked) {
+        (void)pthread_join(thread, NULL);
+        __atomic_fetch_add(task->threads_left, 1, __ATOMIC_RELAXED);
+    }
+
+    if (task->kind == SETOP_UNION) {
+        /* Keep the node already in the destination when both have the key */
+        e_avl_node *k = t2;
+        task->count = lo.count + hi.count;
+        if (match != NULL) {
+            k = match;
+            ++task->count;
+            setop_drop(op, t2);
+        }
+        task->out = join_node(lo.out, k, hi.out, stack);
+    } else if (task->kind == SETOP_INTERSECTION) {
+        task->count = lo.count + hi.count;
+        if (match != NULL) {
+            ++task->count;
+            task->out = join_node(lo.out, match, hi.out, stack);
+        } else {
+            task->out = join_two(lo.out, hi.out, stack);
+        }
+    } else {
+        task->count = lo.count + hi.count;
+        if (match != NULL) {
+            ++task->count;
+            setop_drop(op, match);
+        }
+        task->out = join_two(lo.out, hi.out, stack);
+    }
+}
+
+static inline setop_task_t
+setop_solve(avl_setop_t const*const op, int const kind, e_avl_node *const t1, e_avl_node const*const t2)
+{
+    int threads_left = (int)op->threads;
+    setop_task_t task = {
+        .op = op,
+        .threads_left = &threads_left,
+        .kind = kind,
+        .t1 = t1,
+        .t2 = t2,
+    };
+    setop_run(&task);
+    return task;
+}
+
+// Move every node of `src` into `dst`, leaving `src` empty. Where both trees
+// hold the same key the node in `dst` is kept and the one from `src` dropped.
+static inline void
+avl_base_union(avl_tree_t *const dst, avl_tree_t *const src, avl_setop_t const*const op)
+{
+    if (src->m_top == NULL) {
+        return;
+    }
+
+    setop_task_t const task = setop_solve(op, SETOP_UNION, dst->m_top, src->m_top);
+
+    dst->m_top = task.out;
+    if (dst->m_size == AVL_SIZE_UNKNOWN || src->m_size == AVL_SIZE_UNKNOWN) {
+        dst->m_size = AVL_SIZE_UNKNOWN;
+    } else {
+        dst->m_size = dst->m_size + src->m_size - task.count;
+    }
+    gen_bump(dst);
+
+    src->m_top = NULL;
+    src->m_size = 0;
+    gen_bump(src);
+}
+
+// Drop every node of `dst` whose key is not also in `src`. `src` is unchanged.
+static inline void
+avl_base_intersection(avl_tree_t *const dst, avl_tree_t const*const src, avl_setop_t const*const op)
+{
+    setop_task_t const task = setop_solve(op, SETOP_INTERSECTION, dst->m_top, src->m_top);
+
+    dst->m_top = task.out;
+    dst->m_size = task.count;
+    gen_bump(dst);
+}
+
+// Drop every node of `dst` whose key is also in `src`. `src` is unchanged.
+static inline void
+avl_base_difference(avl_tree_t *const dst, avl_tree_t const*const src, avl_setop_t const*const op)
+{
+    if (src->m_top == NULL) {
+        return;
+    }
+
+    setop_task_t const task = setop_solve(op, SETOP_DIFFERENCE, dst->m_top, src->m_top);
+
+    dst->m_top = task.out;
+    size_shrink(dst, task.count);
+    gen_bump(dst);
+}
+
+#endif /* INLINE_AVL_SETOPS_H */
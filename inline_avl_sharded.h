@@ -0,0 +1,384 @@
+
+#ifndef INLINE_AVL_SHARDED_H
+#define INLINE_AVL_SHARDED_H
+
+#include <pthread.h>
+
+#include "inline_avl_int.h"
+
+/*
+ * Range-sharded trees.
+ *
+ * An `avl_sharded_t` splits the key space of a knode tree (inline_avl_int.h)
+ * into ranges, one `avl_tree_t` each with its own lock, so that threads
+ * working on different ranges don't contend. Shards are padded to cache
+ * lines so that their locks don't share one. A point operation finds its
+ * shard from an array of fences, the first key of each shard, read without a
+ * lock; once the shard is locked it checks the range it actually covers,
+ * and steps to the neighbour if a boundary moved meanwhile.
+ *
+ * With AVL_SUBTREE_COUNT, boundaries move on their own. Every
+ * AVL_SHARDED_CHECK operations a shard compares itself with its neighbours,
+ * and hands keys across to the lighter one if it is hot (more than twice the
+ * neighbour's operations since they last compared) or oversized (more than
+ * twice its keys). The keys go as a whole: the new fence is found with
+ * `avl_base_select`, the shard is split there and the piece joined onto the
+ * neighbour, so a move is O(log n). Without counts, finding the fence would
+ * mean walking the keys that move with both shards locked, so boundaries
+ * stay where `avl_sharded_init` put them.
+ *
+ * A node returned by `avl_sharded_get` may be removed by another thread as
+ * soon as its shard is unlocked again; callers that remove concurrently must
+ * arrange for that themselves, as with any tree under a lock.
+ */
+
+/* Operations on a shard between comparisons with its neighbours */
+#ifndef AVL_SHARDED_CHECK
+#define AVL_SHARDED_CHECK 4096
+#endif
+
+/* Shards smaller than this aren't oversized, whatever their neighbours */
+#ifndef AVL_SHARDED_MIN
+#define AVL_SHARDED_MIN 64
+#endif
+
+/* Enough for any tree of 2^32 nodes, plus one */
+#define AVL_SHARDED_STACK 48
+
+#define AVL_SHARDED_CACHE_LINE 64
+
+typedef struct avl_shard avl_shard_t;
+
+struct avl_shard {
+    pthread_mutex_t lock;
+    avl_tree_t tree;
+    uint64_t lo;       /* the keys of the shard are lo to hi - 1 */
+    uint64_t hi;       /* UINT64_MAX for the last, which also has that key */
+    uint64_t ops;      /* since the last comparison with the neighbours */
+} __attribute__((aligned(AVL_SHARDED_CACHE_LINE)));
+
+typedef struct avl_sharded avl_sharded_t;
+
+struct avl_sharded {
+    avl_shard_t *m_shards;
+    uint64_t *m_fences;   /* each shard's lo, for finding it without a lock */
+    unsigned m_n;
+    uint64_t m_moves;     /* boundary moves so far */
+};
+
+// Sets up `n` empty shards whose boundaries start evenly spread over keys
+// `min` to `max`; keys outside that go to the first or last shard until
+// boundaries move. Returns false if the shards can't be allocated.
+static inline bool
+avl_sharded_init(avl_sharded_t *const sh, unsigned const n, uint64_t const min, uint64_t const max)
+{
+    if (n == 0 || max < min) {
+        return false;
+    }
+
+    size_t const len = (n * sizeof(avl_shard_t) + AVL_SHARDED_CACHE_LINE - 1)
+        / AVL_SHARDED_CACHE_LINE * AVL_SHARDED_CACHE_LINE;
+    avl_shard_t *const shards = aligned_alloc(AVL_SHARDED_CACHE_LINE, len);
+    uint64_t *const fences = malloc(n * sizeof(*fences));
+    if (shards == NULL || fences == NULL) {
+        free(shards);
+        free(fences);
+        return false;
+    }
+
+    /* With fewer keys than shards, widen the range so that the fences still
+     * rise, without going past the largest key */
+    uint64_t lo = min;
+    uint64_t hi = max;
+    if (hi - lo < n) {
+        if (lo <= UINT64_MAX - n) {
+            hi = lo + n;
+        } else {
+            hi = UINT64_MAX;
+            lo = hi - n;
+        }
+    }
+
+    /* Spread the remainder over the first shards rather than multiplying a
+     * rounded-up step, which can run past `hi` and wrap */
+    uint64_t const q = (hi - lo) / n;
+    uint64_t const r = (hi - lo) % n;
+    for (unsigned i = 0; i < n; ++i) {
+        fences[i] = (i == 0) ? 0 : lo + q * i + (i < r ? i : r);
+    }
+    for (unsigned i = 0; i < n; ++i) {
+        shards[i] = (avl_shard_t) {
+            .tree = avl_tree_init(),
+            .lo = fences[i],
+            .hi = (i + 1 < n) ? fences[i + 1] : UINT64_MAX,
+            .ops = 0,
+        };
+        pthread_mutex_init(&shards[i].lock, NULL);
+    }
+
+    *sh = (avl_sharded_t) {
+        .m_shards = shards,
+        .m_fences = fences,
+        .m_n = n,
+        .m_moves = 0,
+    };
+    return true;
+}
+
+// Frees the shards. The nodes still in them are the caller's.
+static inline void
+avl_sharded_destroy(avl_sharded_t *const sh)
+{
+    for (unsigned i = 0; i < sh->m_n; ++i) {
+        pthread_mutex_destroy(&sh->m_shards[i].lock);
+    }
+    free(sh->m_shards);
+    free(sh->m_fences);
+    sh->m_shards = NULL;
+    sh->m_fences = NULL;
+    sh->m_n = 0;
+}
+
+/* The last shard whose fence isn't above `key`. Fences may be moving, so
+ * this is a guess for `sharded_lock` to check. */
+static inline unsigned
+sharded_guess(avl_sharded_t const*const sh, uint64_t const key)
+{
+    unsigned lo = 0;
+    unsigned hi = sh->m_n;
+    while (hi - lo > 1) {
+        unsigned const mid = lo + (hi - lo) / 2;
+        if (__atomic_load_n(&sh->m_fences[mid], __ATOMIC_RELAXED) <= key) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static inline bool
+shard_has(avl_sharded_t const*const sh, unsigned const i, uint64_t const key)
+{
+    avl_shard_t const*const s = &sh->m_shards[i];
+    return key >= s->lo && (key < s->hi || i + 1 == sh->m_n);
+}
+
+/* Locks and returns the index of the shard that holds `key` */
+static inline unsigned
+sharded_lock(avl_sharded_t *const sh, uint64_t const key)
+{
+    unsigned i = sharded_guess(sh, key);
+    for (;;) {
+        avl_shard_t *const s = &sh->m_shards[i];
+        pthread_mutex_lock(&s->lock);
+        if (shard_has(sh, i, key)) {
+            return i;
+        }
+        bool const below = key < s->lo;
+        pthread_mutex_unlock(&s->lock);
+        i = below ? i - 1 : i + 1;
+    }
+}
+
+#ifdef AVL_SUBTREE_COUNT
+/* Moves the `k` keys of shard `from` nearest to its neighbour `to`. Both are
+ * locked, and `from` has more than `k` keys. */
+static inline void
+sharded_move(avl_sharded_t *const sh, unsigned const from, unsigned const to, size_t const k)
+{
+    void *stack[AVL_SHARDED_STACK];
+    avl_shard_t *const src = &sh->m_shards[from];
+    avl_shard_t *const dst = &sh->m_shards[to];
+
+    /* The new fence is the first key that ends up on the right */
+    size_t const size = avl_size(&src->tree);
+    e_avl_node *const node = avl_base_select(&src->tree, (to > from) ? size - k : k);
+    uint64_t const fence = nd2knode(node)->key;
+
+    avl_tree_t right = avl_tree_init();
+    avl_base_split(&src->tree, &fence, avl_knode_keycmp, stack, &right);
+    if (to > from) {
+        avl_base_join(&right, &dst->tree, stack);
+        dst->tree = right;
+        src->hi = fence;
+        dst->lo = fence;
+        __atomic_store_n(&sh->m_fences[to], fence, __ATOMIC_RELAXED);
+    } else {
+        avl_base_join(&dst->tree, &src->tree, stack);
+        src->tree = right;
+        dst->hi = fence;
+        src->lo = fence;
+        __atomic_store_n(&sh->m_fences[from], fence, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&sh->m_moves, 1, __ATOMIC_RELAXED);
+}
+
+/* Compares shard `i` with its neighbours and moves keys to the lighter one if
+ * `i` is hot or oversized */
+static inline void
+sharded_balance(avl_sharded_t *const sh, unsigned const i)
+{
+    unsigned const first = (i > 0) ? i - 1 : i;
+    unsigned const last = (i + 1 < sh->m_n) ? i + 1 : i;
+    if (first == last) {
+        return;
+    }
+    for (unsigned j = first; j <= last; ++j) {
+        pthread_mutex_lock(&sh->m_shards[j].lock);
+    }
+
+    /* The lighter neighbour, by operations and then by keys */
+    avl_shard_t *const s = &sh->m_shards[i];
+    unsigned to;
+    if (i == first) {
+        to = last;
+    } else if (i == last) {
+        to = first;
+    } else {
+        avl_shard_t const*const l = &sh->m_shards[first];
+        avl_shard_t const*const r = &sh->m_shards[last];
+        bool const right = (r->ops != l->ops) ? r->ops < l->ops
+            : avl_size(&r->tree) < avl_size(&l->tree);
+        to = right ? last : first;
+    }
+    avl_shard_t *const t = &sh->m_shards[to];
+
+    size_t const size = avl_size(&s->tree);
+    size_t const t_size = avl_size(&t->tree);
+    size_t k = 0;
+
+    if (s->ops > 2 * t->ops && size > 1) {
+        /* Hot: even out the operations, assuming they are spread evenly over
+         * the shard's keys, without making the neighbour oversized */
+        k = (size_t)((double)size * (s->ops - t->ops) / (2.0 * s->ops));
+        size_t const cap = (2 * size + AVL_SHARDED_MIN > t_size)
+            ? (2 * size + AVL_SHARDED_MIN - t_size) / 3 : 0;
+        if (k > cap) {
+            k = cap;
+        }
+    }
+    if (k == 0 && size > 2 * t_size + AVL_SHARDED_MIN && s->ops * 2 >= t->ops) {
+        /* Oversized, and not by moving keys onto a hotter shard */
+        k = (size - t_size) / 2;
+    }
+    if (size > 0 && k >= size) {
+        k = size - 1;
+    }
+    if (k > 0) {
+        sharded_move(sh, i, to, k);
+    }
+
+    for (unsigned j = first; j <= last; ++j) {
+        sh->m_shards[j].ops = 0;
+        pthread_mutex_unlock(&sh->m_shards[j].lock);
+    }
+}
+#endif
+
+/* Unlocks shard `i` after an operation, balancing it if it's time */
+static inline void
+sharded_unlock(avl_sharded_t *const sh, unsigned const i)
+{
+    avl_shard_t *const s = &sh->m_shards[i];
+#ifdef AVL_SUBTREE_COUNT
+    bool const check = ++s->ops >= AVL_SHARDED_CHECK;
+    pthread_mutex_unlock(&s->lock);
+    if (check) {
+        sharded_balance(sh, i);
+    }
+#else
+    pthread_mutex_unlock(&s->lock);
+#endif
+}
+
+// Adds `kn`, keyed by `kn->key`. If a node with the same key is already
+// there, that one is returned instead.
+static inline e_avl_knode *
+avl_sharded_add(avl_sharded_t *const sh, e_avl_knode *const kn)
+{
+    void *stack[AVL_SHARDED_STACK];
+    unsigned const i = sharded_lock(sh, kn->key);
+    e_avl_knode *const got = avl_int_add(&sh->m_shards[i].tree, kn, stack);
+    sharded_unlock(sh, i);
+    return got;
+}
+
+// Returns the node keyed `key`, or NULL.
+static inline e_avl_knode *
+avl_sharded_get(avl_sharded_t *const sh, uint64_t const key)
+{
+    unsigned const i = sharded_lock(sh, key);
+    e_avl_knode *const kn = avl_int_get(&sh->m_shards[i].tree, key);
+    sharded_unlock(sh, i);
+    return kn;
+}
+
+// Removes and returns the node keyed `key`, or NULL if there is none.
+static inline e_avl_knode *
+avl_sharded_rem(avl_sharded_t *const sh, uint64_t const key)
+{
+    void *stack[AVL_SHARDED_STACK];
+    unsigned const i = sharded_lock(sh, key);
+    e_avl_knode *const kn = avl_int_rem(&sh->m_shards[i].tree, key, stack);
+    sharded_unlock(sh, i);
+    return kn;
+}
+
+// The number of nodes, adding up the shards one at a time.
+static inline size_t
+avl_sharded_size(avl_sharded_t *const sh)
+{
+    size_t n = 0;
+    for (unsigned i = 0; i < sh->m_n; ++i) {
+        pthread_mutex_lock(&sh->m_shards[i].lock);
+        n += avl_size(&sh->m_shards[i].tree);
+        pthread_mutex_unlock(&sh->m_shards[i].lock);
+    }
+    return n;
+}
+
+typedef bool (*avlscan_t)(e_avl_knode *, void *);
+
+// Calls `fn` on the nodes keyed `lo` to `hi` inclusive, in order, until it
+// returns false. Shards are visited one at a time, each locked while `fn`
+// runs on its nodes, so `fn` must not call back into `sh`. Each shard is seen
+// as it was at some moment; a boundary moving between two visits neither
+// skips nor repeats keys.
+static inline void
+avl_sharded_scan(
+    avl_sharded_t *const sh,
+    uint64_t const lo,
+    uint64_t const hi,
+    avlscan_t const fn,
+    void *const arg)
+{
+    void *stack[AVL_SHARDED_STACK];
+    uint64_t key = lo;
+
+    while (key <= hi) {
+        unsigned const i = sharded_lock(sh, key);
+        avl_shard_t *const s = &sh->m_shards[i];
+
+        avl_iter_t iter = avl_iter_init(&s->tree, stack);
+        bool more = true;
+        for (e_avl_node *nd = avl_iter_seek(&iter, &key, avl_knode_keycmp);
+                nd != NULL && nd2knode(nd)->key <= hi;
+                nd = avl_iter_next(&iter)) {
+            if (!fn(nd2knode(nd), arg)) {
+                more = false;
+                break;
+            }
+        }
+
+        /* Carry on from where this shard's range ended */
+        bool const last = (i + 1 == sh->m_n);
+        key = s->hi;
+        pthread_mutex_unlock(&s->lock);
+        if (!more || last) {
+            break;
+        }
+    }
+}
+
+#endif /* INLINE_AVL_SHARDED_H */